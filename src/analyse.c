@@ -0,0 +1,488 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+    fster-analyse loads a FSter configuration and, for each node of the hierarchy, prints the
+    query issued to list his contents and an estimate of the queries required by the most
+    common filesystem operations. Nodes listed with a query for each item of their parent
+    (N+1 patterns) are reported, and make the program exit with a non-zero status.
+    Optionally the filesystem is crawled with the configured metadata backend, so to compare
+    the estimates with the queries effectively issued
+*/
+
+#include "hierarchy.h"
+#include "metadata-backend.h"
+#include "query-stats.h"
+#include "utils.h"
+
+#define DEFAULT_CONFIG_FILE         "/etc/fster/fster.xml"
+#define DEFAULT_CRAWL_DEPTH         4
+
+/*
+    Counters collected for each node while crawling the filesystem
+*/
+typedef struct {
+    guint           items;
+    guint           listings;
+    guint           queries;
+} NodeMeasure;
+
+/*
+    First folder found at each depth while crawling, used as sample for readdir() and lookups
+*/
+typedef struct {
+    gchar           *path;
+    guint           readdir_queries;
+} DepthSample;
+
+static gchar                *ConfFile       = NULL;
+static gchar                *Backend        = NULL;
+static gchar                **UserParams    = NULL;
+static gboolean             Measure         = FALSE;
+static gint                 CrawlDepth      = DEFAULT_CRAWL_DEPTH;
+
+static GList                *CrawlTerms     = NULL;
+static guint                CrawlConstant   = 0;
+static guint                NPlusOne        = 0;
+static GHashTable           *Measures       = NULL;
+
+static GOptionEntry Entries [] = {
+    { "config", 'c', 0, G_OPTION_ARG_FILENAME, &ConfFile, "Configuration file (default " DEFAULT_CONFIG_FILE ")", "FILE" },
+    { "backend", 'b', 0, G_OPTION_ARG_STRING, &Backend, "Metadata backend, as accepted by fster", "BACKEND" },
+    { "param", 'p', 0, G_OPTION_ARG_STRING_ARRAY, &UserParams, "Value for a user parameter found in configuration", "NAME=VALUE" },
+    { "measure", 'm', 0, G_OPTION_ARG_NONE, &Measure, "Crawl the filesystem and count the queries effectively issued", NULL },
+    { "depth", 'd', 0, G_OPTION_ARG_INT, &CrawlDepth, "Max depth of the measured crawl (default 4)", "N" },
+    { NULL }
+};
+
+static const gchar* node_tag (HierarchyNode *node)
+{
+    switch (hierarchy_node_get_format (node)) {
+        case ITEM_IS_ROOT:
+            return "root";
+        case ITEM_IS_VIRTUAL_ITEM:
+            return "file";
+        case ITEM_IS_VIRTUAL_FOLDER:
+            return "folder";
+        case ITEM_IS_MIRROR_ITEM:
+        case ITEM_IS_MIRROR_FOLDER:
+            return "mirror_content";
+        case ITEM_IS_STATIC_ITEM:
+        case ITEM_IS_STATIC_FOLDER:
+            return "static_folder";
+        case ITEM_IS_SET_FOLDER:
+            return "set_folder";
+        default:
+            return "unknown";
+    }
+}
+
+/*
+    Queries issued to list items of @node for a single parent item
+*/
+static guint listing_cost (HierarchyNode *node)
+{
+    switch (hierarchy_node_get_format (node)) {
+        case ITEM_IS_VIRTUAL_ITEM:
+        case ITEM_IS_VIRTUAL_FOLDER:
+        case ITEM_IS_SET_FOLDER:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+    Items of @node are fetched for all the items of @parent with a single query, issued when
+    the parent items are listed (cfr. hierarchy_node_prefetch_children())
+*/
+static gboolean is_batched (HierarchyNode *parent, HierarchyNode *node)
+{
+    return (hierarchy_node_prefetches_children (parent) == TRUE && hierarchy_node_is_joinable (node) == TRUE);
+}
+
+/*
+    Queries issued by a lookup to resolve one path component below an item of @node: all
+    the nodes inside @node are listed to search the name
+*/
+static guint lookup_step_cost (HierarchyNode *node)
+{
+    guint ret;
+    GList *iter;
+
+    ret = 0;
+
+    for (iter = hierarchy_node_get_child_nodes (node); iter; iter = g_list_next (iter))
+        ret += listing_cost ((HierarchyNode*) iter->data);
+
+    return ret;
+}
+
+/*
+    Queries issued by readdir() on an item of @node: the contents of the item, plus the
+    contents prefetched for each listed item with "prefetch_children" (assuming less than
+    PREFETCH_CHUNK_SIZE items are listed)
+*/
+static guint readdir_cost (HierarchyNode *node)
+{
+    guint ret;
+    GList *iter;
+    GList *subiter;
+    HierarchyNode *child;
+
+    ret = 0;
+
+    for (iter = hierarchy_node_get_child_nodes (node); iter; iter = g_list_next (iter)) {
+        child = (HierarchyNode*) iter->data;
+
+        if (is_batched (node, child) == FALSE)
+            ret += listing_cost (child);
+
+        if (hierarchy_node_prefetches_children (child) == TRUE)
+            for (subiter = hierarchy_node_get_child_nodes (child); subiter; subiter = g_list_next (subiter))
+                if (hierarchy_node_is_joinable ((HierarchyNode*) subiter->data) == TRUE)
+                    ret++;
+    }
+
+    return ret;
+}
+
+static void add_crawl_term (const gchar *instances, gboolean batched)
+{
+    if (strcmp (instances, "1") == 0)
+        CrawlConstant++;
+    else if (batched == TRUE)
+        CrawlTerms = g_list_append (CrawlTerms, g_strdup_printf ("%s/%d", instances, PREFETCH_CHUNK_SIZE));
+    else
+        CrawlTerms = g_list_append (CrawlTerms, g_strdup (instances));
+}
+
+/*
+    @instances is the number of items of @parent in the whole filesystem, expressed in terms
+    of n(label) (the number of items of the node with the given label) or "1"
+*/
+static void analyse_node (HierarchyNode *node, HierarchyNode *parent, int depth, const gchar *instances, guint lookup)
+{
+    gboolean batched;
+    gchar *query;
+    gchar *own_instances;
+    GList *iter;
+
+    printf ("%*s%s <%s>, depth %d\n", depth * 2, "", hierarchy_node_get_label (node), node_tag (node), depth);
+
+    if (listing_cost (node) != 0) {
+        query = hierarchy_node_describe_query (node);
+
+        if (query != NULL) {
+            printf ("%*s    query: %s\n", depth * 2, "", query);
+            g_free (query);
+        }
+        else {
+            printf ("%*s    query: composed at runtime with values computed from the parent\n", depth * 2, "");
+        }
+
+        batched = (parent != NULL && is_batched (parent, node));
+        add_crawl_term (instances, batched);
+
+        if (batched == TRUE) {
+            printf ("%*s    fetched together with the items of %s\n", depth * 2, "", hierarchy_node_get_label (parent));
+        }
+        else if (strcmp (instances, "1") != 0) {
+            NPlusOne++;
+            printf ("%*s    N+1: listed with a query for each of the %s items of %s", depth * 2, "", instances, hierarchy_node_get_label (parent));
+
+            if (hierarchy_node_is_joinable (node) == TRUE)
+                printf (", set prefetch_children=\"yes\" on it to fetch them in a single query\n");
+            else
+                printf (", and cannot be batched as conditions depend on values computed from the parent\n");
+        }
+    }
+
+    if (hierarchy_node_get_format (node) == ITEM_IS_MIRROR_FOLDER || hierarchy_node_get_format (node) == ITEM_IS_MIRROR_ITEM)
+        return;
+
+    if (parent != NULL)
+        printf ("%*s    lookup of an item: %u queries\n", depth * 2, "", lookup);
+
+    if (hierarchy_node_get_child_nodes (node) != NULL)
+        printf ("%*s    readdir of an item: %u queries\n", depth * 2, "", readdir_cost (node));
+
+    if (listing_cost (node) != 0)
+        own_instances = g_strdup_printf ("n(%s)", hierarchy_node_get_label (node));
+    else
+        own_instances = g_strdup (instances);
+
+    for (iter = hierarchy_node_get_child_nodes (node); iter; iter = g_list_next (iter))
+        analyse_node ((HierarchyNode*) iter->data, node, depth + 1, own_instances, lookup + lookup_step_cost (node));
+
+    g_free (own_instances);
+}
+
+static void analyse_tree (HierarchyNode *tree)
+{
+    gchar *terms;
+
+    analyse_node (tree, NULL, 0, "1", 0);
+
+    printf ("\nrecursive crawl: %u", CrawlConstant);
+
+    if (CrawlTerms != NULL) {
+        terms = from_glist_to_string (CrawlTerms, " + ", FALSE);
+        printf (" + %s", terms);
+        g_free (terms);
+        easy_list_free (CrawlTerms);
+        CrawlTerms = NULL;
+    }
+
+    printf (" queries\n");
+    printf ("N+1 patterns: %u\n", NPlusOne);
+}
+
+static NodeMeasure* measure_for_node (HierarchyNode *node)
+{
+    NodeMeasure *ret;
+
+    ret = g_hash_table_lookup (Measures, node);
+
+    if (ret == NULL) {
+        ret = g_new0 (NodeMeasure, 1);
+        g_hash_table_insert (Measures, node, ret);
+    }
+
+    return ret;
+}
+
+static void crawl (ItemHandler *item, const gchar *path, int depth, GPtrArray *samples)
+{
+    guint before;
+    gchar *child_path;
+    const gchar *name;
+    struct stat st;
+    GList *children;
+    GList *iter;
+    NodeMeasure *measure;
+    DepthSample *sample;
+    ItemHandler *child;
+
+    /*
+        The same steps of ifs_readdir()
+    */
+    before = query_stats_count ();
+    children = item_handler_get_children (item);
+    hierarchy_node_prefetch_children (children);
+
+    for (iter = children; iter; iter = g_list_next (iter)) {
+        child = (ItemHandler*) iter->data;
+        if (item_handler_exposed_name (child) != NULL)
+            item_handler_stat (child, &st);
+        measure_for_node (item_handler_get_logic_node (child))->items++;
+    }
+
+    measure = measure_for_node (item_handler_get_logic_node (item));
+    measure->listings++;
+    measure->queries += query_stats_count () - before;
+
+    if (samples->len == depth) {
+        sample = g_new0 (DepthSample, 1);
+        sample->path = g_strdup (path);
+        sample->readdir_queries = query_stats_count () - before;
+        g_ptr_array_add (samples, sample);
+    }
+
+    if (depth < CrawlDepth) {
+        for (iter = children; iter; iter = g_list_next (iter)) {
+            child = (ItemHandler*) iter->data;
+
+            if (item_handler_is_folder (child) == FALSE || item_handler_get_format (child) == ITEM_IS_MIRROR_FOLDER)
+                continue;
+
+            name = item_handler_exposed_name (child);
+            if (name == NULL)
+                continue;
+
+            child_path = g_build_filename (path, name, NULL);
+            crawl (child, child_path, depth + 1, samples);
+            g_free (child_path);
+        }
+    }
+
+    g_list_free (children);
+}
+
+static void print_measures (HierarchyNode *node, int depth)
+{
+    GList *iter;
+    NodeMeasure *measure;
+
+    measure = g_hash_table_lookup (Measures, node);
+
+    if (measure != NULL)
+        printf ("%*s%s: %u items, %u listings, %u queries\n", depth * 2, "", hierarchy_node_get_label (node),
+                measure->items, measure->listings, measure->queries);
+    else
+        printf ("%*s%s: not reached\n", depth * 2, "", hierarchy_node_get_label (node));
+
+    for (iter = hierarchy_node_get_child_nodes (node); iter; iter = g_list_next (iter))
+        print_measures ((HierarchyNode*) iter->data, depth + 1);
+}
+
+static void free_sample (DepthSample *sample)
+{
+    g_free (sample->path);
+    g_free (sample);
+}
+
+static void measure_tree (HierarchyNode *tree)
+{
+    register int i;
+    guint before;
+    guint total;
+    GPtrArray *samples;
+    DepthSample *sample;
+
+    Measures = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+    samples = g_ptr_array_new_with_free_func ((GDestroyNotify) free_sample);
+
+    before = query_stats_count ();
+    crawl (verify_exposed_path ("/"), "/", 0, samples);
+    total = query_stats_count () - before;
+
+    printf ("\nmeasured crawl (max depth %d): %u queries\n", CrawlDepth, total);
+    print_measures (tree, 1);
+
+    printf ("\n");
+
+    for (i = 0; i < samples->len; i++) {
+        sample = (DepthSample*) g_ptr_array_index (samples, i);
+        printf ("depth %d, %s\n", i, sample->path);
+        printf ("    readdir: %u queries\n", sample->readdir_queries);
+
+        if (i == 0)
+            continue;
+
+        /*
+            Lookups are measured with no cached results, but items may still hold contents
+            prefetched during the crawl
+        */
+        if (get_query_cache_reference () != NULL)
+            query_cache_invalidate_all (get_query_cache_reference ());
+
+        before = query_stats_count ();
+        verify_exposed_path (sample->path);
+        printf ("    lookup: %u queries\n", query_stats_count () - before);
+    }
+
+    g_ptr_array_unref (samples);
+    g_hash_table_destroy (Measures);
+    Measures = NULL;
+}
+
+static gboolean set_user_params ()
+{
+    register int i;
+    gchar *separator;
+
+    if (UserParams == NULL)
+        return TRUE;
+
+    for (i = 0; UserParams [i] != NULL; i++) {
+        separator = strchr (UserParams [i], '=');
+        if (separator == NULL) {
+            g_warning ("Malformed parameter, should be name=value");
+            return FALSE;
+        }
+
+        set_user_param (g_strndup (UserParams [i], separator - UserParams [i]), g_strdup (separator + 1));
+    }
+
+    return TRUE;
+}
+
+int main (int argc, char *argv [])
+{
+    int ret;
+    xmlDocPtr doc;
+    GError *error;
+    GOptionContext *context;
+    MetadataBackend *backend;
+    HierarchyNode *tree;
+
+    error = NULL;
+    context = g_option_context_new ("- analyse queries generated by a FSter configuration");
+    g_option_context_add_main_entries (context, Entries, NULL);
+
+    if (g_option_context_parse (context, &argc, &argv, &error) == FALSE) {
+        g_warning ("%s", error->message);
+        g_error_free (error);
+        g_option_context_free (context);
+        return 1;
+    }
+
+    g_option_context_free (context);
+
+    if (ConfFile == NULL)
+        ConfFile = g_strdup (DEFAULT_CONFIG_FILE);
+
+    if (set_user_params () == FALSE)
+        return 1;
+
+    /*
+        The backend is required anyway, as properties are validated against the ontology: to
+        analyse a configuration with no running Tracker, use a "memory:" backend
+    */
+    backend = metadata_backend_new (Backend, &error);
+    if (backend == NULL) {
+        g_warning ("Unable to init metadata backend: %s", error->message);
+        g_error_free (error);
+        return 1;
+    }
+
+    metadata_backend_set_default (backend);
+    g_object_unref (backend);
+    query_stats_init ();
+
+    doc = read_configuration_file (ConfFile);
+    if (doc == NULL)
+        return 1;
+
+    build_hierarchy_tree_from_xml (doc);
+    xmlFreeDoc (doc);
+    set_user_param (NULL, NULL);
+
+    tree = get_exposing_tree_reference ();
+    if (tree == NULL) {
+        g_warning ("Unable to build hierarchy from %s", ConfFile);
+        return 1;
+    }
+
+    analyse_tree (tree);
+    ret = (NPlusOne == 0) ? 0 : 2;
+
+    if (Measure == TRUE)
+        measure_tree (tree);
+
+    destroy_hierarchy_tree ();
+    query_stats_finish ();
+    metadata_backend_set_default (NULL);
+
+    g_free (ConfFile);
+    g_free (Backend);
+    g_strfreev (UserParams);
+    return ret;
+}
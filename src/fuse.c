@@ -20,6 +20,13 @@
 #include "core.h"
 #include "hierarchy.h"
 #include "gfuse-loop.h"
+#include "metadata-journal.h"
+#include "metadata-backend.h"
+#include "operation.h"
+#include "query-stats.h"
+
+#include <signal.h>
+#include <glib-unix.h>
 
 /**
     TODO    Better path for configuration file, based on prefix and sysconfdir
@@ -68,7 +75,10 @@ enum {
     KEY_HELP,
     KEY_CONFIGFILE,
     KEY_VERSION,
-    KEY_USER_PARAMETER
+    KEY_USER_PARAMETER,
+    KEY_BACKEND,
+    KEY_SLOW_QUERIES,
+    KEY_QUERY_STATS
 };
 
 static struct fuse_opt fster_opts [] = {
@@ -78,6 +88,9 @@ static struct fuse_opt fster_opts [] = {
     FUSE_OPT_KEY ("-V",         KEY_VERSION),
     FUSE_OPT_KEY ("--version",  KEY_VERSION),
     FUSE_OPT_KEY ("-p ",        KEY_USER_PARAMETER),
+    FUSE_OPT_KEY ("-b ",        KEY_BACKEND),
+    FUSE_OPT_KEY ("-t ",        KEY_SLOW_QUERIES),
+    FUSE_OPT_KEY ("-q ",        KEY_QUERY_STATS),
     FUSE_OPT_END
 };
 
@@ -92,6 +105,8 @@ typedef struct {
 
 struct {
     gchar               *conf_file;
+    gchar               *backend;
+    gchar               *stats_file;
 } Config;
 
 /**
@@ -131,6 +146,10 @@ static void free_conf ()
 {
     if (Config.conf_file != NULL)
         g_free (Config.conf_file);
+    if (Config.backend != NULL)
+        g_free (Config.backend);
+    if (Config.stats_file != NULL)
+        g_free (Config.stats_file);
 
     set_user_param (NULL, NULL);
 }
@@ -196,6 +215,12 @@ static int create_item_by_path (const gchar *path, NODE_TYPE type, ItemHandler *
     if (item == NULL)
         return -EACCES;
 
+    /*
+        Metadata for the new item are saved asynchronously, and it may still not be found
+        querying Tracker: it is explicitely registered in the cache
+    */
+    nodes_cache_set_by_path (get_cache_reference (), item, g_strdup (path));
+
     if (target != NULL)
         *target = item;
 
@@ -215,8 +240,9 @@ static int ifs_getattr (const char *path, struct stat *stbuf)
     ItemHandler *target;
 
     set_permissions ();
+    operation_begin ();
     target = verify_exposed_path (path);
-    return item_handler_stat (target, stbuf);
+    return operation_end (item_handler_stat (target, stbuf));
 }
 
 /**
@@ -232,8 +258,9 @@ static int ifs_access (const char *path, int mask)
     ItemHandler *target;
 
     set_permissions ();
+    operation_begin ();
     target = verify_exposed_path (path);
-    return item_handler_access (target, mask);
+    return operation_end (item_handler_access (target, mask));
 }
 
 /**
@@ -251,8 +278,9 @@ static int ifs_readlink (const char *path, char *buf, size_t size)
     ItemHandler *target;
 
     set_permissions ();
+    operation_begin ();
     target = verify_exposed_path (path);
-    return item_handler_readlink (target, buf, size);
+    return operation_end (item_handler_readlink (target, buf, size));
 }
 
 /**
@@ -266,21 +294,80 @@ static int ifs_readlink (const char *path, char *buf, size_t size)
 
     @return                 0 if successfull, or a negative value
 */
+typedef struct {
+    const gchar         *path;
+    void                *buf;
+    fuse_fill_dir_t     filler;
+    NodesCache          *cache;
+    GList               *items;
+    GList               *mirrored;
+    GList               *listings;
+} ReaddirData;
+
+/*
+    Items are saved in the cache, as most clients access them just after the listing. Plain
+    files are passed without item, which is built from the rows of the listing once looked up.
+    The kernel uses only the type of the entries, so nothing is stat()ed here
+*/
+static gboolean fill_directory (const gchar *name, ItemHandler *item, gpointer user_data)
+{
+    CONTENT_TYPE type;
+    struct stat st;
+    ReaddirData *data;
+
+    data = (ReaddirData*) user_data;
+
+    memset (&st, 0, sizeof (st));
+    st.st_mode = S_IFREG;
+
+    if (item != NULL) {
+        nodes_cache_set_by_path (data->cache, item, g_build_filename (data->path, name, NULL));
+        data->items = g_list_prepend (data->items, item);
+
+        type = item_handler_get_format (item);
+        if (type == ITEM_IS_MIRROR_ITEM || type == ITEM_IS_MIRROR_FOLDER)
+            data->mirrored = g_list_prepend (data->mirrored, item);
+
+        if (item_handler_is_folder (item))
+            st.st_mode = S_IFDIR;
+    }
+
+    return (data->filler (data->buf, name, &st, 0) != 0);
+}
+
+/*
+    Attributes of mirrored files are kept in the mirror cache, where they are found by the
+    getattr() requests usually following the listing: here they are fetched in parallel, so
+    that slow storages do not pay the latency of each file in sequence
+*/
+static void stat_mirrored_items (ReaddirData *data)
+{
+    int *results;
+    guint len;
+    struct stat *sbufs;
+
+    len = g_list_length (data->mirrored);
+    if (len == 0)
+        return;
+
+    sbufs = g_new (struct stat, len);
+    results = g_new (int, len);
+    item_handler_stat_batch (data->mirrored, sbufs, results);
+    g_free (sbufs);
+    g_free (results);
+}
+
 static int ifs_readdir (const char *path, void *buf, fuse_fill_dir_t filler,
                         off_t offset, struct fuse_file_info *fi)
 {
     int ret;
-    const gchar *name;
-    gchar *file_path;
-    struct stat st;
-    struct stat *ptr_st;
-    GList *items;
-    GList *iter;
     ItemHandler *target;
-    ItemHandler *child;
-    NodesCache *cache;
+    ReaddirData data;
+    GError *error;
 
     set_permissions ();
+    operation_begin ();
+
     target = verify_exposed_path (path);
 
     if (target == NULL) {
@@ -291,37 +378,43 @@ static int ifs_readdir (const char *path, void *buf, fuse_fill_dir_t filler,
             ret = -ENOTDIR;
         }
         else {
-            cache = get_cache_reference ();
-            items = item_handler_get_children (target);
-
-            for (iter = items; iter; iter = g_list_next (iter)) {
-                child = (ItemHandler*) iter->data;
-
-                if (item_handler_get_hidden (child) == TRUE)
-                    continue;
-
-                name = item_handler_exposed_name (child);
-                if (name == NULL)
-                    continue;
-
-                if (item_handler_stat (child, &st) == 0)
-                    ptr_st = &st;
-                else
-                    ptr_st = NULL;
+            data.path = path;
+            data.buf = buf;
+            data.filler = filler;
+            data.cache = get_cache_reference ();
+            data.items = NULL;
+            data.mirrored = NULL;
+            data.listings = NULL;
+
+            hierarchy_node_stream_subchildren (item_handler_get_logic_node (target), target, fill_directory, &data, &data.listings);
+
+            /*
+                If the listing has been aborted, entries passed to the kernel are incomplete
+                and prefetching for them would only extend the operation further
+            */
+            error = NULL;
+
+            if (operation_check (&error) == FALSE) {
+                ret = (error->code == G_IO_ERROR_CANCELLED) ? -EINTR : -ETIMEDOUT;
+                g_error_free (error);
+                g_list_free_full (data.listings, (GDestroyNotify) hierarchy_node_listing_free);
+            }
+            else {
+                nodes_cache_set_listings_by_path (data.cache, data.listings, g_strdup (path));
 
-                file_path = g_build_filename (path, name, NULL);
-                nodes_cache_set_by_path (cache, child, file_path);
+                data.items = g_list_reverse (data.items);
+                stat_mirrored_items (&data);
 
-                if (filler (buf, name, ptr_st, 0))
-                    break;
+                hierarchy_node_prefetch_children (data.items);
+                ret = 0;
             }
 
-            g_list_free (items);
-            ret = 0;
+            g_list_free (data.items);
+            g_list_free (data.mirrored);
         }
     }
 
-    return ret;
+    return operation_end (ret);
 }
 
 /**
@@ -352,7 +445,8 @@ static int ifs_mknod (const char *path, mode_t mode, dev_t rdev)
 static int ifs_mkdir (const char *path, mode_t mode)
 {
     set_permissions ();
-    return create_item_by_path (path, NODE_IS_FOLDER, NULL);
+    operation_begin ();
+    return operation_end (create_item_by_path (path, NODE_IS_FOLDER, NULL));
 }
 
 /**
@@ -369,6 +463,7 @@ static int ifs_unlink (const char *path)
     ItemHandler *target;
 
     set_permissions ();
+    operation_begin ();
     target = verify_exposed_path (path);
 
     if (target != NULL) {
@@ -385,7 +480,7 @@ static int ifs_unlink (const char *path)
         ret = -ENOENT;
     }
 
-    return ret;
+    return operation_end (ret);
 }
 
 /**
@@ -402,6 +497,7 @@ static int ifs_rmdir (const char *path)
     ItemHandler *target;
 
     set_permissions ();
+    operation_begin ();
     target = verify_exposed_path (path);
 
     if (target != NULL && item_handler_is_folder (target)) {
@@ -413,7 +509,7 @@ static int ifs_rmdir (const char *path)
         ret = -ENOTDIR;
     }
 
-    return ret;
+    return operation_end (ret);
 }
 
 /**
@@ -454,6 +550,7 @@ static int ifs_rename (const char *from, const char *to)
     HierarchyNode *target_level;
 
     set_permissions ();
+    operation_begin ();
 
     /*
         Into the effective hierarchy, an existing item can only be moved as another valid
@@ -462,7 +559,7 @@ static int ifs_rename (const char *from, const char *to)
     */
     start = verify_exposed_path (from);
     if (start == NULL)
-        return -ENOENT;
+        return operation_end (-ENOENT);
 
     /*
         If both paths, origin and destination, refer to something into a mirror folder, so are
@@ -481,7 +578,7 @@ static int ifs_rename (const char *from, const char *to)
             if (target_level == item_handler_get_logic_node (start)) {
                 res = rename (from, to);
                 if (res != 0)
-                    return -errno;
+                    return operation_end (-errno);
             }
         }
     }
@@ -491,15 +588,15 @@ static int ifs_rename (const char *from, const char *to)
     if (target == NULL) {
         res = create_item_by_path (to, item_handler_is_folder (start) ? NODE_IS_FOLDER : NODE_IS_FILE, &target);
         if (res != 0)
-            return res;
+            return operation_end (res);
     }
 
     res = replace_hierarchy_node (start, target);
     if (res != 0)
-        return res;
+        return operation_end (res);
 
     nodes_cache_remove_by_path (get_cache_reference (), from);
-    return 0;
+    return operation_end (0);
 }
 
 /**
@@ -535,8 +632,9 @@ static int ifs_chmod (const char *path, mode_t mode)
     ItemHandler *target;
 
     set_permissions ();
+    operation_begin ();
     target = verify_exposed_path (path);
-    return item_handler_chmod (target, mode);
+    return operation_end (item_handler_chmod (target, mode));
 }
 
 /**
@@ -554,8 +652,9 @@ static int ifs_chown (const char *path, uid_t uid, gid_t gid)
     ItemHandler *target;
 
     set_permissions ();
+    operation_begin ();
     target = verify_exposed_path (path);
-    return item_handler_chown (target, uid, gid);
+    return operation_end (item_handler_chown (target, uid, gid));
 }
 
 /**
@@ -571,8 +670,9 @@ static int ifs_truncate (const char *path, off_t size)
     ItemHandler *target;
 
     set_permissions ();
+    operation_begin ();
     target = verify_exposed_path (path);
-    return item_handler_truncate (target, size);
+    return operation_end (item_handler_truncate (target, size));
 }
 
 /**
@@ -625,8 +725,9 @@ static int ifs_utimens (const char *path, const struct timespec ts[2])
     tv [1].tv_usec = ts [1].tv_nsec / 1000;
 
     set_permissions ();
+    operation_begin ();
     target = verify_exposed_path (path);
-    return item_handler_utimes (target, tv);
+    return operation_end (item_handler_utimes (target, tv));
 }
 
 /**
@@ -645,14 +746,15 @@ static int ifs_open (const char *path, struct fuse_file_info *fi)
     OpenedItem *item;
 
     set_permissions ();
+    operation_begin ();
 
     target = verify_exposed_path (path);
     if (target == NULL)
-        return -ENOENT;
+        return operation_end (-ENOENT);
 
     res = item_handler_open (target, fi->flags);
     if (res < 0)
-        return res;
+        return operation_end (res);
 
     item = allocate_opened_item (target, res);
     if (item == NULL) {
@@ -660,11 +762,11 @@ static int ifs_open (const char *path, struct fuse_file_info *fi)
             In absence of a more specific error, here return the one which is fault by design :-P
             cfr. man 2 open
         */
-        return -ENODEV;
+        return operation_end (-ENODEV);
     }
 
     OPENED_ITEM_TO_FI (item, fi);
-    return 0;
+    return operation_end (0);
 }
 
 /**
@@ -684,20 +786,21 @@ static int ifs_create (const char *path, mode_t mask, struct fuse_file_info *fi)
     OpenedItem *item;
 
     set_permissions ();
+    operation_begin ();
     res = create_item_by_path (path, NODE_IS_FILE, &target);
     if (res != 0)
-        return res;
+        return operation_end (res);
 
     res = item_handler_open (target, fi->flags & ~O_CREAT);
     if (res < 0)
-        return res;
+        return operation_end (res);
 
     item = allocate_opened_item (target, res);
     if (item == NULL)
-        return -ENODEV;
+        return operation_end (-ENODEV);
 
     OPENED_ITEM_TO_FI (item, fi);
-    return 0;
+    return operation_end (0);
 }
 
 /**
@@ -861,53 +964,45 @@ static int ifs_fsync (const char *path, int isdatasync, struct fuse_file_info *f
         return -EBADF;
 
     set_permissions ();
+    metadata_journal_barrier ();
     return fsync (item->fd);
 }
 
-static gchar* read_configuration (int *fsize)
-{
-    gchar *offset;
-    gchar *string;
-    gchar *comment_start;
-    gchar *comment_end;
-    FILE *f;
-
-    f = fopen (Config.conf_file, "rb");
-    fseek (f, 0, SEEK_END);
-
-    *fsize = (int) ftell (f);
-    if (*fsize == 0) {
-        g_warning ("Empty configuration file");
-        return NULL;
-    }
-
-    fseek (f, 0, SEEK_SET);
-
-    string = g_malloc (*fsize + 1);
-    fread (string, *fsize, 1, f);
-    fclose (f);
+/**
+    Validates the metadata backend specified on command line. The backend itself is inited
+    only once the filesystem is mounted, but paths have to be made absolute before FUSE moves
+    the process in the root folder
 
-    string [*fsize] = 0;
-    offset = string;
+    @return                 TRUE if the backend may be used, FALSE otherwise
+*/
+static gboolean check_backend ()
+{
+    gchar *cwd;
+    gchar *path;
 
-    while (TRUE) {
-        comment_start = strstr (offset, "<!--");
-        if (comment_start == NULL)
-            break;
+    if (Config.backend == NULL || strcmp (Config.backend, "tracker") == 0 || strcmp (Config.backend, "tracker:preload") == 0)
+        return TRUE;
 
-        comment_end = strstr (comment_start, "-->");
-        if (comment_end == NULL)
-            break;
+    if (strncmp (Config.backend, "memory:", 7) != 0) {
+        g_warning ("Unknown metadata backend %s", Config.backend);
+        return FALSE;
+    }
 
-        while (comment_start != comment_end + 3) {
-            *comment_start = ' ';
-            comment_start++;
-        }
+    if (g_path_is_absolute (Config.backend + 7) == FALSE) {
+        cwd = g_get_current_dir ();
+        path = g_build_filename (cwd, Config.backend + 7, NULL);
+        g_free (Config.backend);
+        Config.backend = g_strdup_printf ("memory:%s", path);
+        g_free (path);
+        g_free (cwd);
+    }
 
-        offset = comment_start;
+    if (access (Config.backend + 7, F_OK | R_OK) != 0) {
+        g_warning ("Unable to find metadata dump in %s", Config.backend + 7);
+        return FALSE;
     }
 
-    return string;
+    return TRUE;
 }
 
 /**
@@ -915,12 +1010,23 @@ static gchar* read_configuration (int *fsize)
 */
 static void check_configuration ()
 {
-    int fsize;
-    gchar *file;
     xmlDocPtr doc;
+    GError *error;
+    MetadataBackend *backend;
+
+    error = NULL;
+    backend = metadata_backend_new (Config.backend, &error);
+
+    if (backend == NULL) {
+        g_warning ("Unable to init metadata backend: %s", error->message);
+        g_error_free (error);
+        return;
+    }
 
-    file = read_configuration (&fsize);
-    doc = xmlReadMemory (file, fsize, NULL, NULL, XML_PARSE_NOBLANKS);
+    metadata_backend_set_default (backend);
+    g_object_unref (backend);
+
+    doc = read_configuration_file (Config.conf_file);
 
     if (doc == NULL) {
         g_warning ("Unable to read configuration");
@@ -929,8 +1035,6 @@ static void check_configuration ()
         build_hierarchy_tree_from_xml (doc);
         xmlFreeDoc (doc);
     }
-
-    g_free (file);
 }
 
 /**
@@ -941,6 +1045,7 @@ static void check_configuration ()
 static void* ifs_init (struct fuse_conn_info *conn)
 {
     check_configuration ();
+    set_mountpoint_reference (gfuse_loop_get_mountpoint (gfuse_loop_get_current ()));
 
     /*
         User parameters are directly embedded in the hierarchy tree (cfr.
@@ -952,6 +1057,28 @@ static void* ifs_init (struct fuse_conn_info *conn)
     return NULL;
 }
 
+/**
+    Writes the statistics about queries collected so far in the file specified with the -q
+    option, if any
+*/
+static gboolean write_query_stats ()
+{
+    FILE *output;
+
+    if (Config.stats_file == NULL)
+        return TRUE;
+
+    output = fopen (Config.stats_file, "w");
+    if (output == NULL) {
+        g_warning ("Unable to write query statistics in %s: %s", Config.stats_file, strerror (errno));
+        return TRUE;
+    }
+
+    query_stats_dump (output);
+    fclose (output);
+    return TRUE;
+}
+
 /**
     Uninit the filesystem, destroying local tree of contents got from Item Manager
 
@@ -960,7 +1087,10 @@ static void* ifs_init (struct fuse_conn_info *conn)
 static void ifs_destroy (void *conn)
 {
     g_main_loop_quit (g_main_loop_new (NULL, FALSE));
+    write_query_stats ();
+    query_stats_finish ();
     destroy_hierarchy_tree ();
+    metadata_backend_set_default (NULL);
     free_conf ();
 }
 
@@ -1013,6 +1143,13 @@ static void usage ()
 "FSter options:\n"
 "   -c FILE                 specify a configuration file (default " DEFAULT_CONFIG_FILE ")\n"
 "   -p NAME=VALUE           specify value for a user parameter found in configuration file\n"
+"   -b BACKEND              metadata backend: \"tracker\" (default), \"tracker:preload\" to keep\n"
+"                           in memory the metadata involved in the configuration, or\n"
+"                           \"memory:FILE\" to load metadata from a Turtle dump and keep\n"
+"                           it in memory\n"
+"   -t MSEC                 log queries taking more than MSEC milliseconds\n"
+"   -q FILE                 write statistics about queries in FILE when unmounting, or\n"
+"                           when receiving SIGUSR2\n"
 "\n");
 }
 
@@ -1053,6 +1190,18 @@ static int fster_opt_proc (void *data, const char *arg, int key, struct fuse_arg
             set_user_param (param_name, param_value);
             break;
 
+        case KEY_BACKEND:
+            Config.backend = g_strdup (arg + 2);
+            break;
+
+        case KEY_SLOW_QUERIES:
+            query_stats_set_slow_threshold (strtoul (arg + 2, NULL, 10));
+            break;
+
+        case KEY_QUERY_STATS:
+            Config.stats_file = g_strdup (arg + 2);
+            break;
+
         default:
             return 1;
             break;
@@ -1074,6 +1223,7 @@ int main (int argc, char *argv [])
     g_log_set_always_fatal (G_LOG_LEVEL_CRITICAL);
 
     memset (&Config, 0, sizeof (Config));
+    query_stats_init ();
 
     if (fuse_opt_parse (&args, &Config, fster_opts, fster_opt_proc) == -1) {
         free_conf ();
@@ -1089,11 +1239,24 @@ int main (int argc, char *argv [])
         exit (1);
     }
 
+    if (check_backend () == FALSE) {
+        free_conf ();
+        exit (1);
+    }
+
+    /*
+        Without "intr" libfuse ignores FUSE_INTERRUPT requests from the kernel, and a process
+        blocked on a slow listing cannot be killed until the query completes
+    */
+    fuse_opt_add_arg (&args, "-ointr");
+
     loop = gfuse_loop_new ();
     gfuse_loop_set_operations (loop, &ifs_oper);
     gfuse_loop_set_config (loop, args.argc, args.argv);
     gfuse_loop_run (loop);
 
+    g_unix_signal_add (SIGUSR2, (GSourceFunc) write_query_stats, NULL);
+
     gloop = g_main_loop_new (NULL, FALSE);
     g_main_loop_run (gloop);
 
@@ -22,6 +22,11 @@
 
 #define GFUSE_LOOP_GET_PRIVATE(obj)       (G_TYPE_INSTANCE_GET_PRIVATE ((obj), GFUSE_LOOP_TYPE, GFuseLoopPrivate))
 
+/*
+    Opcode of FUSE_INTERRUPT requests, as defined in linux/fuse.h
+*/
+#define FUSE_INTERRUPT_OPCODE       36
+
 typedef struct {
     GFuseLoop       *loop;
     void            *user;
@@ -32,6 +37,20 @@ typedef struct {
     int             res;
 } ThreadsData;
 
+/*
+    Head of each request coming from the kernel, as defined in linux/fuse.h
+*/
+typedef struct {
+    guint32         len;
+    guint32         opcode;
+    guint64         unique;
+    guint64         nodeid;
+    guint32         uid;
+    guint32         gid;
+    guint32         pid;
+    guint32         padding;
+} RequestHeader;
+
 struct _GFuseLoopPrivate {
     int                     startup_argc;
     gchar                   **startup_argv;
@@ -42,11 +61,29 @@ struct _GFuseLoopPrivate {
     gchar                   *mountpoint;
     gboolean                threads;
 
+    struct fuse             *fuse;
     GIOChannel              *fuse_fd;
+    GQueue                  deferred;
 };
 
 G_DEFINE_TYPE (GFuseLoop, gfuse_loop, G_TYPE_OBJECT);
 
+static inline ThreadsData* do_threads_data (char *buf, int res)
+{
+    ThreadsData *info;
+
+    info = g_new0 (ThreadsData, 1);
+    info->buf = buf;
+    info->res = res;
+    return info;
+}
+
+static inline void free_threads_data (ThreadsData *info)
+{
+    free (info->buf);
+    g_free (info);
+}
+
 static void gfuse_loop_finalize (GObject *item)
 {
     GFuseLoop *loop;
@@ -59,6 +96,9 @@ static void gfuse_loop_finalize (GObject *item)
     if (loop->priv->fuse_fd != NULL)
         g_io_channel_unref (loop->priv->fuse_fd);
 
+    while (g_queue_is_empty (&(loop->priv->deferred)) == FALSE)
+        free_threads_data (g_queue_pop_head (&(loop->priv->deferred)));
+
     if (loop->priv->shadow_ops != NULL)
         g_free (loop->priv->shadow_ops);
 
@@ -149,22 +189,6 @@ void gfuse_loop_set_config (GFuseLoop *loop, int argc, gchar **argv)
     loop->priv->startup_argv = dup_argv;
 }
 
-static inline ThreadsData* do_threads_data (char *buf, int res)
-{
-    ThreadsData *info;
-
-    info = g_new0 (ThreadsData, 1);
-    info->buf = buf;
-    info->res = res;
-    return info;
-}
-
-static inline void free_threads_data (ThreadsData *info)
-{
-    free (info->buf);
-    g_free (info);
-}
-
 #if 0
 
 static void manage_request (gpointer data, gpointer user)
@@ -240,18 +264,37 @@ static gboolean manage_fuse_mt (GIOChannel *source, GIOCondition condition, gpoi
 
 #endif
 
+/*
+    Requests read while another one is being served are executed here, once the callbacks
+    are no longer running
+*/
+static void process_deferred (GFuseLoop *loop)
+{
+    struct fuse_session *se;
+    struct fuse_chan *ch;
+    ThreadsData *info;
+
+    se = fuse_get_session (loop->priv->fuse);
+    ch = fuse_session_next_chan (se, NULL);
+
+    while ((info = g_queue_pop_head (&(loop->priv->deferred))) != NULL) {
+        fuse_session_process (se, info->buf, info->res, ch);
+        free_threads_data (info);
+    }
+}
+
 static gboolean manage_fuse_st (GIOChannel *source, GIOCondition condition, gpointer data)
 {
     int res;
     char *buf;
     gboolean ret;
     size_t bufsize;
-    struct fuse *fuse;
     struct fuse_session *se;
     struct fuse_chan *ch;
+    GFuseLoop *loop;
 
-    fuse = (struct fuse*) data;
-    se = fuse_get_session (fuse);
+    loop = (GFuseLoop*) data;
+    se = fuse_get_session (loop->priv->fuse);
     ch = fuse_session_next_chan (se, NULL);
     bufsize = fuse_chan_bufsize (ch);
     buf = alloca (bufsize);
@@ -266,9 +309,51 @@ static gboolean manage_fuse_st (GIOChannel *source, GIOCondition condition, gpoi
     else
         fuse_session_process (se, buf, res, ch);
 
+    process_deferred (loop);
     return ret;
 }
 
+/*
+    Executed while a callback waits for something else: interruptions are passed to libfuse
+    immediately, so that fuse_interrupted() reports them to the waiting callback, while all
+    other requests are deferred as callbacks are not reentrant
+*/
+static gboolean manage_fuse_interrupts (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    int res;
+    char *buf;
+    size_t bufsize;
+    struct fuse_session *se;
+    struct fuse_chan *ch;
+    GFuseLoop *loop;
+    RequestHeader *header;
+
+    loop = (GFuseLoop*) data;
+    se = fuse_get_session (loop->priv->fuse);
+    ch = fuse_session_next_chan (se, NULL);
+    bufsize = fuse_chan_bufsize (ch);
+    buf = (char*) malloc (bufsize);
+
+    res = fuse_chan_recv (&ch, buf, bufsize);
+
+    if (res <= 0) {
+        free (buf);
+        return (res == -EINTR);
+    }
+
+    header = (RequestHeader*) buf;
+
+    if ((size_t) res >= sizeof (RequestHeader) && header->opcode == FUSE_INTERRUPT_OPCODE) {
+        fuse_session_process (se, buf, res, ch);
+        free (buf);
+    }
+    else {
+        g_queue_push_tail (&(loop->priv->deferred), do_threads_data (buf, res));
+    }
+
+    return TRUE;
+}
+
 static void* internal_init_wrapper (struct fuse_conn_info *conn)
 {
     struct fuse_context *con;
@@ -315,6 +400,7 @@ void gfuse_loop_run (GFuseLoop *loop)
                                &loop->priv->mountpoint, &thread, loop->priv->runtime_data);
 
     loop->priv->threads = (thread != 0);
+    loop->priv->fuse = fuse_session;
     se = fuse_get_session (fuse_session);
     ch = fuse_session_next_chan (se, NULL);
     loop->priv->fuse_fd = g_io_channel_unix_new (fuse_chan_fd (ch));
@@ -330,7 +416,27 @@ void gfuse_loop_run (GFuseLoop *loop)
         g_io_add_watch (loop->priv->fuse_fd, G_IO_IN, manage_fuse_st, fuse_session);
     */
 
-    g_io_add_watch (loop->priv->fuse_fd, G_IO_IN, manage_fuse_st, fuse_session);
+    g_io_add_watch (loop->priv->fuse_fd, G_IO_IN, manage_fuse_st, loop);
+}
+
+/**
+ * gfuse_loop_interrupts_source:
+ * @loop: a running #GFuseLoop
+ *
+ * To be used by callbacks waiting in a private #GMainContext: the returned
+ * source polls the FUSE channel and dispatches only interruptions, which
+ * are then notified by fuse_interrupted(). Other requests read meanwhile
+ * are executed once the current callback returns
+ *
+ * Return value: a new #GSource, to be attached to the waiting context
+ */
+GSource* gfuse_loop_interrupts_source (GFuseLoop *loop)
+{
+    GSource *ret;
+
+    ret = g_io_create_watch (loop->priv->fuse_fd, G_IO_IN);
+    g_source_set_callback (ret, (GSourceFunc) manage_fuse_interrupts, loop, NULL);
+    return ret;
 }
 
 /**
@@ -56,6 +56,7 @@ GFuseLoop*      gfuse_loop_new              ();
 void            gfuse_loop_set_operations   (GFuseLoop *loop, struct fuse_operations *operations);
 void            gfuse_loop_set_config       (GFuseLoop *loop, int argc, gchar **argv);
 void            gfuse_loop_run              (GFuseLoop *loop);
+GSource*        gfuse_loop_interrupts_source (GFuseLoop *loop);
 
 GFuseLoop*      gfuse_loop_get_current      ();
 const gchar*    gfuse_loop_get_mountpoint   (GFuseLoop *loop);
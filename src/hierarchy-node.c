@@ -23,17 +23,41 @@
 #include "contents-plugin.h"
 #include "hierarchy.h"
 #include "nodes-cache.h"
-#include "gfuse-loop.h"
+#include "set-index.h"
+#include "operation.h"
+#include "query-stats.h"
 #include "utils.h"
+#include "mirror-cache.h"
 #include <wordexp.h>
 
 #define HIERARCHY_NODE_GET_PRIVATE(obj)     (G_TYPE_INSTANCE_GET_PRIVATE ((obj), HIERARCHY_NODE_TYPE, HierarchyNodePrivate))
 
+/*
+    Listings of contents of sibling items separated by less than this time (in microseconds)
+    are considered part of a burst, and following siblings are fetched in advance in batches
+    of BATCH_SIZE items
+*/
+#define BATCH_WINDOW                        (250 * 1000)
+#define BATCH_SIZE                          32
+
+/*
+    Max number of items remembered from the last listing, to look for following siblings
+*/
+#define LAST_LISTING_SIZE                   4096
+
+/*
+    Max number of values indexes kept for each node (one for each parent, when conditions
+    depend on it): least recently used are dropped first
+*/
+#define SET_INDEXES_SIZE                    64
+
 typedef struct _ExposePolicy            ExposePolicy;
 typedef int (*ContentCallback)          (ExposePolicy *policy, ItemHandler *item, int flags);
 
 gchar       *SavingPath                 = NULL;
 
+G_LOCK_DEFINE_STATIC (SetIndexes);
+
 typedef enum {
     METADATA_OPERATOR_IS_EQUAL,
     METADATA_OPERATOR_IS_NOT_EQUAL,
@@ -96,17 +120,27 @@ typedef struct {
 struct _HierarchyNodePrivate {
     CONTENT_TYPE        type;
     gchar               *name;
+    gchar               *label;                     // identifies the node in query statistics
     HierarchyNode       *node;
 
     gchar               *additional_option;
     gchar               *mountpoint;
     gboolean            hide_contents;
+    gboolean            prefetch_children;
+    gboolean            stat_from_metadata;
     EditPolicy          save_policy;
     ExposePolicy        expose_policy;
     ConditionPolicy     self_policy;
     ConditionPolicy     child_policy;
 
     GList               *children;
+    GList               *prefetch;                  // list of Property
+    GPtrArray           *last_listing;              // of GWeakRef, to ItemHandler
+    GHashTable          *listing_index;             // ItemHandler -> position in last_listing + 1
+    gint64              last_request;
+    GHashTable          *set_indexes;               // conditions -> SetIndex
+    GQueue              set_indexes_lru;            // conditions, most recent first
+    guint               deadline;                   // in milliseconds, 0 to use the default
 };
 
 enum {
@@ -128,6 +162,22 @@ struct {
     { NULL,               0 }
 };
 
+/*
+    Time (in milliseconds) granted to operations involving each type of node, when not
+    specified with the "deadline" attribute. Sets are built scanning all the items, and may
+    take longer
+*/
+static guint DefaultDeadlines [] = {
+    5000,           // ITEM_IS_ROOT
+    10000,          // ITEM_IS_VIRTUAL_ITEM
+    10000,          // ITEM_IS_VIRTUAL_FOLDER
+    5000,           // ITEM_IS_MIRROR_ITEM
+    5000,           // ITEM_IS_MIRROR_FOLDER
+    5000,           // ITEM_IS_STATIC_ITEM
+    5000,           // ITEM_IS_STATIC_FOLDER
+    20000,          // ITEM_IS_SET_FOLDER
+};
+
 G_DEFINE_TYPE (HierarchyNode, hierarchy_node, G_TYPE_OBJECT);
 
 static void free_metadata_reference (ValuedMetadataReference *ref)
@@ -181,6 +231,9 @@ static void hierarchy_node_finalize (GObject *obj)
     if (node->priv->additional_option != NULL)
         g_free (node->priv->additional_option);
 
+    if (node->priv->label != NULL)
+        g_free (node->priv->label);
+
     free_expose_policy (&(node->priv->expose_policy));
     free_condition_policy (&(node->priv->self_policy));
     free_condition_policy (&(node->priv->child_policy));
@@ -188,6 +241,19 @@ static void hierarchy_node_finalize (GObject *obj)
 
     for (iter = node->priv->children; iter; iter = g_list_next (iter))
         g_object_unref ((HierarchyNode*) iter->data);
+
+    if (node->priv->prefetch != NULL)
+        g_list_free (node->priv->prefetch);
+
+    if (node->priv->set_indexes != NULL) {
+        g_queue_clear (&(node->priv->set_indexes_lru));
+        g_hash_table_destroy (node->priv->set_indexes);
+    }
+
+    if (node->priv->last_listing != NULL) {
+        g_ptr_array_unref (node->priv->last_listing);
+        g_hash_table_destroy (node->priv->listing_index);
+    }
 }
 
 static void hierarchy_node_set_property (GObject *object, guint property_id, const GValue *value, GParamSpec *pspec)
@@ -754,6 +820,51 @@ static void add_hide_property (HierarchyNode *this, xmlNode *root)
     }
 }
 
+static void add_prefetch_property (HierarchyNode *this, xmlNode *root)
+{
+    gchar *str;
+
+    str = (gchar*) xmlGetProp (root, (xmlChar*) "prefetch_children");
+    if (str != NULL) {
+        if (strcmp (str, "yes") == 0) {
+            if (this->priv->type == ITEM_IS_VIRTUAL_FOLDER)
+                this->priv->prefetch_children = TRUE;
+            else
+                g_warning ("Attribute prefetch_children is valid only for folder nodes");
+        }
+
+        free (str);
+    }
+}
+
+static void add_stat_property (HierarchyNode *this, xmlNode *root)
+{
+    gchar *str;
+
+    str = (gchar*) xmlGetProp (root, (xmlChar*) "stat_from_metadata");
+    if (str != NULL) {
+        if (strcmp (str, "yes") == 0) {
+            if (this->priv->type == ITEM_IS_VIRTUAL_FOLDER || this->priv->type == ITEM_IS_VIRTUAL_ITEM)
+                this->priv->stat_from_metadata = TRUE;
+            else
+                g_warning ("Attribute stat_from_metadata is valid only for folder and file nodes");
+        }
+
+        free (str);
+    }
+}
+
+static void add_deadline_property (HierarchyNode *this, xmlNode *root)
+{
+    gchar *str;
+
+    str = (gchar*) xmlGetProp (root, (xmlChar*) "deadline");
+    if (str != NULL) {
+        this->priv->deadline = strtoul (str, NULL, 10);
+        xmlFree (str);
+    }
+}
+
 static gchar* remove_trailing_slash (gchar *path)
 {
     int len;
@@ -799,6 +910,9 @@ static gboolean parse_exposing_nodes (HierarchyNode *this, xmlNode *root)
             }
 
             add_hide_property (this, root);
+            add_prefetch_property (this, root);
+            add_stat_property (this, root);
+            add_deadline_property (this, root);
             ret = TRUE;
             break;
         }
@@ -815,6 +929,16 @@ static gboolean parse_exposing_nodes (HierarchyNode *this, xmlNode *root)
         if (str != NULL)
             this->priv->name = str;
 
+        /*
+            Nodes without ID are labelled with their path in the configuration
+        */
+        if (this->priv->name != NULL)
+            this->priv->label = g_strdup (this->priv->name);
+        else if (this->priv->node != NULL)
+            this->priv->label = g_strdup_printf ("%s/%s", this->priv->node->priv->label, (gchar*) root->name);
+        else
+            this->priv->label = g_strdup ((gchar*) root->name);
+
         str = (gchar*) xmlGetProp (root, (xmlChar*) "mountpoint");
         if (str != NULL) {
             /*
@@ -843,6 +967,145 @@ static gboolean parse_exposing_nodes (HierarchyNode *this, xmlNode *root)
     return ret;
 }
 
+static void plan_add_property (GList **list, Property *prop)
+{
+    if (prop != NULL && g_list_find (*list, prop) == NULL)
+        *list = g_list_append (*list, prop);
+}
+
+static void plan_metadata_desc_list (GList **list, GList *components)
+{
+    GList *iter;
+    MetadataDesc *component;
+
+    for (iter = components; iter; iter = g_list_next (iter)) {
+        component = (MetadataDesc*) iter->data;
+        if (component->from == METADATA_HOLDER_PARENT && component->means_subject == FALSE)
+            plan_add_property (list, component->metadata);
+    }
+}
+
+static void plan_metadata_references (GList **list, GList *references)
+{
+    GList *iter;
+
+    for (iter = references; iter; iter = g_list_next (iter))
+        plan_metadata_desc_list (list, ((ValuedMetadataReference*) iter->data)->involved);
+}
+
+static void plan_children_requirements (HierarchyNode *node, GList **list)
+{
+    gboolean inheriting;
+    GList *iter;
+    HierarchyNode *child;
+    HierarchyNode *ancestor;
+
+    inheriting = FALSE;
+
+    for (iter = node->priv->children; iter; iter = g_list_next (iter)) {
+        child = (HierarchyNode*) iter->data;
+
+        plan_metadata_references (list, child->priv->self_policy.conditions);
+        plan_metadata_desc_list (list, child->priv->expose_policy.exposed_metadata);
+        plan_metadata_references (list, child->priv->save_policy.inheritable_assignments);
+        plan_metadata_references (list, child->priv->save_policy.extraction_behaviour.assigned_metadata);
+
+        if (child->priv->child_policy.inherit == TRUE)
+            inheriting = TRUE;
+
+        /*
+            Static folders carry no metadata, so while building queries for their contents
+            condition_policy_to_sparql() climbs up to the first item having them: that is, one
+            of the items of this node
+        */
+        if (child->priv->type == ITEM_IS_STATIC_FOLDER)
+            plan_children_requirements (child, list);
+    }
+
+    if (inheriting == TRUE) {
+        for (ancestor = node; ancestor != NULL; ancestor = ancestor->priv->node) {
+            plan_metadata_references (list, ancestor->priv->child_policy.conditions);
+            if (ancestor->priv->child_policy.inherit == FALSE)
+                break;
+        }
+    }
+}
+
+/*
+    Items fetched from Tracker are lazily completed with item_handler_get_metadata(), which
+    issues a query for each missing metadata. Here are collected all the predicates which will
+    be surely required for the items of this node (to retrieve the real file, or to build
+    queries and names for contents of the items), so to fetch them all in the main listing query.
+    Predicates permitting many values are left out, as each of them would multiply the rows
+    returned for the same item.
+    When attributes are synthesized from metadata the real file is not accessed by listings,
+    and his path is fetched only if required
+*/
+static void plan_prefetch (HierarchyNode *node)
+{
+    const gchar *meta;
+    GList *list;
+    GList *iter;
+    GList *next;
+    ContentsPlugin *contents;
+
+    if (node->priv->type != ITEM_IS_VIRTUAL_FOLDER && node->priv->type != ITEM_IS_VIRTUAL_ITEM)
+        return;
+
+    list = NULL;
+    contents = node->priv->expose_policy.contents_callback;
+
+    if (contents != NULL && contents_plugin_get_metadata (contents) != NULL)
+        meta = contents_plugin_get_metadata (contents);
+    else if (node->priv->stat_from_metadata == FALSE)
+        meta = "nie:url";
+    else
+        meta = NULL;
+
+    if (meta != NULL)
+        plan_add_property (&list, properties_pool_get_by_name ((gchar*) meta));
+
+    plan_children_requirements (node, &list);
+
+    /*
+        Attributes of the items are synthesized from those, so they have to be already
+        available when the listing is stat()ed
+    */
+    if (node->priv->stat_from_metadata == TRUE) {
+        plan_add_property (&list, properties_pool_get_by_name ("nie:byteSize"));
+        plan_add_property (&list, properties_pool_get_by_name ("nfo:fileLastModified"));
+        plan_add_property (&list, properties_pool_get_by_name ("nfo:fileLastAccessed"));
+    }
+
+    for (iter = list; iter; iter = next) {
+        next = g_list_next (iter);
+        if (property_is_multiple ((Property*) iter->data))
+            list = g_list_delete_link (list, iter);
+    }
+
+    node->priv->prefetch = list;
+}
+
+static void collect_metadata_desc_list (GList **list, GList *components)
+{
+    GList *iter;
+
+    for (iter = components; iter; iter = g_list_next (iter))
+        plan_add_property (list, ((MetadataDesc*) iter->data)->metadata);
+}
+
+static void collect_metadata_references (GList **list, GList *references)
+{
+    GList *iter;
+    ValuedMetadataReference *ref;
+
+    for (iter = references; iter; iter = g_list_next (iter)) {
+        ref = (ValuedMetadataReference*) iter->data;
+        plan_add_property (list, ref->metadata.metadata);
+        collect_metadata_desc_list (list, ref->involved);
+    }
+}
+
 /**
  * hierarchy_node_new_from_xml:
  * @parent: parent of the new hierarchy node, to wire to the new one so to be
@@ -866,6 +1129,9 @@ HierarchyNode* hierarchy_node_new_from_xml (HierarchyNode *parent, xmlNode *node
         g_object_unref (ret);
         ret = NULL;
     }
+    else {
+        plan_prefetch (ret);
+    }
 
     return ret;
 }
@@ -908,8 +1174,14 @@ static gchar* compose_value_from_many_metadata (ItemHandler *parent, GList *meta
 			met = (MetadataDesc*) metadata->data;
 
 			if (met->from == METADATA_HOLDER_PARENT) {
-				if (met->means_subject == TRUE)
+				if (met->means_subject == TRUE) {
+					if (item_handler_get_subject (parent) == NULL) {
+						g_string_free (str, TRUE);
+						return NULL;
+					}
+
 					g_string_append_printf (str, "<%s>", item_handler_get_subject (parent));
+				}
 				else
 					g_string_append_printf (str, "%s", item_handler_get_metadata (parent, property_get_name (met->metadata)));
 			}
@@ -948,19 +1220,28 @@ static const gchar* common_operator (int name)
     return "";
 }
 
-static GList* condition_policy_to_sparql (ConditionPolicy *policy, ItemHandler *parent, int *offset)
+/*
+    If @joined is TRUE, @parent is ignored and conditions referring to the parent are written
+    against the ?parent variable, so that the same query can match children of many items at
+    once. Only conditions accepted by condition_policy_is_joinable() are correctly translated
+*/
+static GList* condition_policy_to_sparql (ConditionPolicy *policy, ItemHandler *parent, gboolean joined, int *offset, GStringChunk *arena)
 {
     int value_offset;
     int involved_num;
     gchar *stat;
     gchar *val;
     gchar *true_val;
+    const gchar *parent_term;
+    const gchar *parent_literal;
     const gchar *meta_name;
+    const gchar *parent_value;
     const gchar *op;
     GList *iter;
     GList *statements;
     ValuedMetadataReference *meta_ref;
     MetadataDesc *component;
+    PropertyValue decoded;
 
     statements = NULL;
     value_offset = *offset;
@@ -999,7 +1280,7 @@ static GList* condition_policy_to_sparql (ConditionPolicy *policy, ItemHandler *
                                 is the same thing than
                                 self's metadata = /subject
                             */
-                            stat = g_strdup_printf ("?item %s ?item", property_get_name (component->metadata));
+                            stat = arena_printf (arena, "?item %s ?item", property_get_name (component->metadata));
                         }
                     }
                     else if (meta_ref->metadata.means_subject == FALSE) {
@@ -1009,12 +1290,12 @@ static GList* condition_policy_to_sparql (ConditionPolicy *policy, ItemHandler *
                                 is the same thing than
                                 self's metadata = /subject
                             */
-                            stat = g_strdup_printf ("?item %s ?item", property_get_name (meta_ref->metadata.metadata));
+                            stat = arena_printf (arena, "?item %s ?item", property_get_name (meta_ref->metadata.metadata));
                         }
                         else {
-                            stat = g_strdup_printf ("?item %s ?var%d . ?item %s ?var%d",
-                                                    property_get_name (meta_ref->metadata.metadata), value_offset,
-                                                    property_get_name (component->metadata), value_offset);
+                            stat = arena_printf (arena, "?item %s ?var%d . ?item %s ?var%d",
+                                                        property_get_name (meta_ref->metadata.metadata), value_offset,
+                                                        property_get_name (component->metadata), value_offset);
                             value_offset++;
                         }
                     }
@@ -1033,35 +1314,55 @@ static GList* condition_policy_to_sparql (ConditionPolicy *policy, ItemHandler *
                                 himself (impossible). Free the whole collected statements
                                 and return NULL
                             */
-                            easy_list_free (statements);
+                            g_list_free (statements);
                             statements = NULL;
                             break;
                         }
                         else {
-                            stat = g_strdup_printf ("?item %s ?var%d . FILTER ( ?var%d %s ?item )",
-                                                    property_get_name (component->metadata), value_offset, value_offset, op);
+                            stat = arena_printf (arena, "?item %s ?var%d . FILTER ( ?var%d %s ?item )",
+                                                        property_get_name (component->metadata), value_offset, value_offset, op);
                         }
                     }
                     else if (meta_ref->metadata.means_subject == FALSE) {
                         if (component->means_subject == TRUE) {
-                            stat = g_strdup_printf ("?item %s ?var%d . FILTER ( ?var%d %s ?item )",
-                                                    property_get_name (meta_ref->metadata.metadata), value_offset, value_offset, op);
+                            stat = arena_printf (arena, "?item %s ?var%d . FILTER ( ?var%d %s ?item )",
+                                                        property_get_name (meta_ref->metadata.metadata), value_offset, value_offset, op);
                         }
                         else {
-                            stat = g_strdup_printf ("?item %s ?var%d . ?item %s ?var%d . FILTER ( ?var%d %s ?var%d )",
-                                                    property_get_name (meta_ref->metadata.metadata), value_offset,
-                                                    property_get_name (component->metadata), value_offset + 1,
-                                                    value_offset, op, value_offset + 1);
+                            stat = arena_printf (arena, "?item %s ?var%d . ?item %s ?var%d . FILTER ( ?var%d %s ?var%d )",
+                                                        property_get_name (meta_ref->metadata.metadata), value_offset,
+                                                        property_get_name (component->metadata), value_offset + 1,
+                                                        value_offset, op, value_offset + 1);
                             value_offset += 2;
                         }
                     }
                 }
             }
             else if (component->from == METADATA_HOLDER_PARENT) {
-                while (parent != NULL && item_handler_type_has_metadata (parent) == FALSE)
-                    parent = item_handler_get_parent (parent);
+                if (joined == FALSE)
+                    while (parent != NULL && item_handler_type_has_metadata (parent) == FALSE)
+                        parent = item_handler_get_parent (parent);
+
+                if (joined == TRUE || parent != NULL) {
+                    if (joined == TRUE) {
+                        parent_term = "?parent";
+                        parent_literal = "str(?parent)";
+                    }
+                    else {
+                        /*
+                            A parent never saved has no related items: the query
+                            rappresents an empty set
+                        */
+                        if (item_handler_get_subject (parent) == NULL) {
+                            g_list_free (statements);
+                            statements = NULL;
+                            break;
+                        }
+
+                        parent_term = arena_printf (arena, "<%s>", item_handler_get_subject (parent));
+                        parent_literal = arena_printf (arena, "\"%s\"", item_handler_get_subject (parent));
+                    }
 
-                if (parent != NULL) {
                     if (meta_ref->operator == METADATA_OPERATOR_IS_EQUAL) {
                         if (meta_ref->metadata.means_subject == TRUE) {
                             if (component->means_subject == TRUE) {
@@ -1071,30 +1372,36 @@ static GList* condition_policy_to_sparql (ConditionPolicy *policy, ItemHandler *
                                 stat = NULL;
                             }
                             else {
-                                stat = g_strdup_printf ("<%s> %s ?item",
-                                                        item_handler_get_subject (parent),
-                                                        property_get_name (component->metadata));
+                                stat = arena_printf (arena, "%s %s ?item",
+                                                            parent_term,
+                                                            property_get_name (component->metadata));
                             }
                         }
                         else if (meta_ref->metadata.means_subject == FALSE) {
                             if (component->means_subject == TRUE) {
-                                stat = g_strdup_printf ("?item %s <%s>",
-                                                        property_get_name (meta_ref->metadata.metadata),
-                                                        item_handler_get_subject (parent));
+                                stat = arena_printf (arena, "?item %s %s",
+                                                            property_get_name (meta_ref->metadata.metadata),
+                                                            parent_term);
                             }
                             else {
                                 meta_name = property_get_name (component->metadata);
+                                parent_value = NULL;
+
+                                if (joined == FALSE && item_handler_contains_metadata (parent, meta_name))
+                                    parent_value = item_handler_get_metadata (parent, meta_name);
 
-                                if (item_handler_contains_metadata (parent, meta_name)) {
-                                    val = property_format_value (meta_ref->metadata.metadata, item_handler_get_metadata (parent, meta_name));
+                                if (parent_value != NULL) {
+                                    item_handler_get_decoded_metadata (parent, meta_name, &decoded);
+                                    val = property_format_decoded (meta_ref->metadata.metadata, parent_value, &decoded);
 
-                                    stat = g_strdup_printf ("?item %s %s",
-                                                            property_get_name (meta_ref->metadata.metadata), val);
+                                    stat = arena_printf (arena, "?item %s %s",
+                                                                property_get_name (meta_ref->metadata.metadata), val);
+                                    g_free (val);
                                 }
                                 else {
-                                    stat = g_strdup_printf ("?item %s ?var%d . <%s> %s ?var%d",
-                                                            property_get_name (meta_ref->metadata.metadata), value_offset,
-                                                            item_handler_get_subject (parent), meta_name, value_offset);
+                                    stat = arena_printf (arena, "?item %s ?var%d . %s %s ?var%d",
+                                                                property_get_name (meta_ref->metadata.metadata), value_offset,
+                                                                parent_term, meta_name, value_offset);
                                     value_offset++;
                                 }
                             }
@@ -1114,31 +1421,43 @@ static GList* condition_policy_to_sparql (ConditionPolicy *policy, ItemHandler *
                                 stat = NULL;
                             }
                             else {
-                                stat = g_strdup_printf ("?item %s ?var%d . FILTER ( ?var%d %s \"%s\" )",
-                                                        property_get_name (component->metadata), value_offset,
-                                                        value_offset, op, item_handler_get_subject (parent));
+                                stat = arena_printf (arena, "?item %s ?var%d . FILTER ( ?var%d %s %s )",
+                                                            property_get_name (component->metadata), value_offset,
+                                                            value_offset, op, parent_literal);
                             }
                         }
                         else {
                             if (component->means_subject == TRUE) {
-                                stat = g_strdup_printf ("?item %s ?var%d . FILTER ( ?var%d %s \"%s\" )",
-                                                        property_get_name (meta_ref->metadata.metadata), value_offset,
-                                                        value_offset, op, item_handler_get_subject (parent));
+                                stat = arena_printf (arena, "?item %s ?var%d . FILTER ( ?var%d %s %s )",
+                                                            property_get_name (meta_ref->metadata.metadata), value_offset,
+                                                            value_offset, op, parent_literal);
                             }
                             else {
                                 meta_name = property_get_name (component->metadata);
-
-                                if (item_handler_contains_metadata (parent, meta_name)) {
-                                    stat = g_strdup_printf ("?item %s ?var%d . FILTER ( ?var%d %s \"%s\" )",
-                                                            property_get_name (meta_ref->metadata.metadata), value_offset,
-                                                            value_offset, op, item_handler_get_metadata (parent, meta_name));
+                                parent_value = NULL;
+
+                                if (joined == FALSE && item_handler_contains_metadata (parent, meta_name))
+                                    parent_value = item_handler_get_metadata (parent, meta_name);
+
+                                if (parent_value != NULL) {
+                                    /*
+                                        The value is formatted as a literal of his own type, so
+                                        that numbers and dates are not compared as strings
+                                    */
+                                    item_handler_get_decoded_metadata (parent, meta_name, &decoded);
+                                    val = property_format_decoded (meta_ref->metadata.metadata, parent_value, &decoded);
+
+                                    stat = arena_printf (arena, "?item %s ?var%d . FILTER ( ?var%d %s %s )",
+                                                                property_get_name (meta_ref->metadata.metadata), value_offset,
+                                                                value_offset, op, val);
+                                    g_free (val);
                                     value_offset++;
                                 }
                                 else {
-                                    stat = g_strdup_printf ("?item %s ?var%d . <%s> %s ?var%d . FILTER ( ?var%d %s ?var%d )",
-                                                            property_get_name (meta_ref->metadata.metadata), value_offset,
-                                                            item_handler_get_subject (parent), meta_name, value_offset + 1,
-                                                            value_offset, op, value_offset + 1);
+                                    stat = arena_printf (arena, "?item %s ?var%d . %s %s ?var%d . FILTER ( ?var%d %s ?var%d )",
+                                                                property_get_name (meta_ref->metadata.metadata), value_offset,
+                                                                parent_term, meta_name, value_offset + 1,
+                                                                value_offset, op, value_offset + 1);
                                     value_offset += 2;
                                 }
                             }
@@ -1152,7 +1471,14 @@ static GList* condition_policy_to_sparql (ConditionPolicy *policy, ItemHandler *
         }
         else if (meta_ref->query != NULL) {
             val = compose_value_from_many_metadata (parent, meta_ref->involved, meta_ref->query);
-            stat = g_strdup_printf ("?item %s %s", property_get_name (meta_ref->metadata.metadata), val);
+
+            if (val == NULL) {
+                g_list_free (statements);
+                statements = NULL;
+                break;
+            }
+
+            stat = arena_printf (arena, "?item %s %s", property_get_name (meta_ref->metadata.metadata), val);
             g_free (val);
         }
         else {
@@ -1169,10 +1495,10 @@ static GList* condition_policy_to_sparql (ConditionPolicy *policy, ItemHandler *
             if (val != NULL) {
                 if (meta_ref->metadata.means_subject == TRUE) {
                     if (meta_ref->operator == METADATA_OPERATOR_IS_EQUAL) {
-                        stat = g_strdup_printf ("?item a rdfs:Resource FILTER ( ?subject = <%s> )", val);
+                        stat = arena_printf (arena, "?item a rdfs:Resource FILTER ( ?subject = <%s> )", val);
                     }
                     else if (meta_ref->operator == METADATA_OPERATOR_IS_NOT_EQUAL) {
-                        stat = g_strdup_printf ("?item a rdfs:Resource FILTER ( ?subject != <%s> )", val);
+                        stat = arena_printf (arena, "?item a rdfs:Resource FILTER ( ?subject != <%s> )", val);
                     }
 
                     /**
@@ -1185,12 +1511,12 @@ static GList* condition_policy_to_sparql (ConditionPolicy *policy, ItemHandler *
                     val = true_val;
 
                     if (meta_ref->operator == METADATA_OPERATOR_IS_EQUAL) {
-                        stat = g_strdup_printf ("?item %s %s", property_get_name (meta_ref->metadata.metadata), val);
+                        stat = arena_printf (arena, "?item %s %s", property_get_name (meta_ref->metadata.metadata), val);
                     }
                     else {
                         op = common_operator (meta_ref->operator);
-                        stat = g_strdup_printf ("?item %s ?var%d . FILTER ( ?var%d %s %s )",
-                                                property_get_name (meta_ref->metadata.metadata), value_offset, value_offset, op, val);
+                        stat = arena_printf (arena, "?item %s ?var%d . FILTER ( ?var%d %s %s )",
+                                                    property_get_name (meta_ref->metadata.metadata), value_offset, value_offset, op, val);
                         value_offset++;
                     }
                 }
@@ -1235,92 +1561,74 @@ static gchar* build_sparql_query (gchar *selection, gchar to_get, GList *stateme
     return g_string_free (query, FALSE);
 }
 
-static GList* build_items (HierarchyNode *node, ItemHandler *parent, GVariant *data, GList *required)
+static gboolean condition_policy_is_joinable (ConditionPolicy *policy)
 {
-    gchar *str;
-    GList *required_iter;
-    GList *items;
-    GVariantIter *iter;
-    GVariantIter *subiter;
-    ItemHandler *item;
+    GList *iter;
+    GList *involved;
+    ValuedMetadataReference *meta_ref;
 
-    items = NULL;
-    iter = NULL;
-    subiter = NULL;
+    for (iter = policy->conditions; iter; iter = g_list_next (iter)) {
+        meta_ref = (ValuedMetadataReference*) iter->data;
+
+        if (g_list_length (meta_ref->involved) == 1 && strcmp (meta_ref->formula, "\\1") == 0)
+            continue;
 
-    g_variant_get (data, "(aas)", &iter);
+        /*
+            Values composed from metadata of the parent are computed locally, and cannot be
+            expressed in terms of a variable
+        */
+        for (involved = meta_ref->involved; involved; involved = g_list_next (involved))
+            if (((MetadataDesc*) involved->data)->from == METADATA_HOLDER_PARENT)
+                return FALSE;
+    }
 
-    while (g_variant_iter_loop (iter, "as", &subiter)) {
-        str = NULL;
+    return TRUE;
+}
 
-        if (g_variant_iter_loop (subiter, "s", &str)) {
-            item = g_object_new (ITEM_HANDLER_TYPE, "type", node->priv->type, "parent", parent, "node", node, "subject", str, NULL);
+static gboolean conditions_are_joinable (HierarchyNode *node)
+{
+    HierarchyNode *parent_node;
 
-            for (required_iter = required; required_iter && g_variant_iter_loop (subiter, "s", &str); required_iter = g_list_next (required_iter))
-                item_handler_load_metadata (item, (gchar*) required_iter->data, str);
+    if (condition_policy_is_joinable (&(node->priv->self_policy)) == FALSE)
+        return FALSE;
 
-            if (node->priv->expose_policy.contents_callback != NULL)
-                g_object_set (item, "contents_handler", node->priv->expose_policy.contents_callback, NULL);
+    if (node->priv->child_policy.inherit == TRUE) {
+        for (parent_node = node->priv->node; parent_node != NULL; parent_node = parent_node->priv->node) {
+            if (condition_policy_is_joinable (&(parent_node->priv->child_policy)) == FALSE)
+                return FALSE;
 
-            items = g_list_prepend (items, item);
+            if (parent_node->priv->child_policy.inherit == FALSE)
+                break;
         }
     }
 
-    return g_list_reverse (items);
+    return TRUE;
 }
 
-static void create_fetching_query_statement (const gchar *metadata, GList **statements, GList **required, gchar *var)
+static gboolean node_is_joinable (HierarchyNode *node)
 {
-    gchar *statement;
+    if (node->priv->type != ITEM_IS_VIRTUAL_FOLDER && node->priv->type != ITEM_IS_VIRTUAL_ITEM)
+        return FALSE;
 
-    statement = g_strdup_printf ("?item %s ?%c", metadata, *var);
-    *statements = g_list_prepend (*statements, statement);
-    *required = g_list_prepend (*required, (gchar*) metadata);
-    (*var)++;
+    return conditions_are_joinable (node);
 }
 
-static GList* collect_children_from_storage (HierarchyNode *node, ItemHandler *parent)
+/*
+    Collects conditions of the node itself and the ones inherited by his ancestors
+*/
+static GList* node_conditions_to_sparql (HierarchyNode *node, ItemHandler *parent, gboolean joined, int *values_offset, GStringChunk *arena)
 {
-    int values_offset;
-    gchar var;
-    gchar *sparql;
-    GList *iter;
     GList *statements;
     GList *more_statements;
-    GList *items;
-    GList *required;
-    GVariant *response;
-    GError *error;
-    ValuedMetadataReference *meta_ref;
-    MetadataDesc *prop;
     HierarchyNode *parent_node;
 
-    var = 'a';
-    statements = NULL;
-    required = NULL;
-
-    for (iter = node->priv->expose_policy.exposed_metadata; iter; iter = g_list_next (iter)) {
-        prop = (MetadataDesc*) iter->data;
-        if (prop->from == METADATA_HOLDER_SELF && prop->means_subject == FALSE)
-            create_fetching_query_statement (property_get_name (prop->metadata), &statements, &required, &var);
-    }
-
-    for (iter = node->priv->expose_policy.conditional_metadata; iter; iter = g_list_next (iter)) {
-        meta_ref = (ValuedMetadataReference*) iter->data;
-        create_fetching_query_statement (property_get_name (meta_ref->metadata.metadata), &statements, &required, &var);
-    }
-
-    values_offset = 0;
-
-    more_statements = condition_policy_to_sparql (&(node->priv->self_policy), parent, &values_offset);
-    if (more_statements != NULL)
-        statements = g_list_concat (statements, more_statements);
+    statements = condition_policy_to_sparql (&(node->priv->self_policy), parent, joined, values_offset, arena);
 
     if (node->priv->child_policy.inherit == TRUE) {
         parent_node = node->priv->node;
 
         while (parent_node != NULL) {
-            more_statements = condition_policy_to_sparql (&(parent_node->priv->child_policy), parent, &values_offset);
+            more_statements = condition_policy_to_sparql (&(parent_node->priv->child_policy), parent, joined, values_offset, arena);
             if (more_statements != NULL)
                 statements = g_list_concat (statements, more_statements);
 
@@ -1331,79 +1639,572 @@ static GList* collect_children_from_storage (HierarchyNode *node, ItemHandler *p
         }
     }
 
-    sparql = build_sparql_query (NULL, var, statements);
-    error = NULL;
-    items = NULL;
-
-    response = execute_query (sparql, &error);
-    if (response == NULL) {
-        printf ("%s\n", sparql);
-        g_warning ("Unable to fetch items: %s", error->message);
-        g_error_free (error);
-    }
-    else {
-        required = g_list_reverse (required);
-        items = build_items (node, parent, response, required);
-        g_variant_unref (response);
-        g_list_free (required);
-    }
-
-    g_free (sparql);
-    return items;
+    return statements;
 }
 
-static GList* check_mountpoints (HierarchyNode *node, ItemHandler *parent, gchar *path)
+/*
+    Each row is expected to hold the subject of the item, the values for the @required
+    metadata and the values for the @optional ones
+*/
+static ItemHandler* build_item (HierarchyNode *node, ItemHandler *parent, gchar **row, GList *required, GList *optional)
 {
-    GList *iter;
-    HierarchyNode *child;
+    int column;
+    GList *required_iter;
+    ItemHandler *item;
 
-    for (iter = node->priv->children; iter; iter = g_list_next (iter)) {
-        child = iter->data;
+    item = item_handler_new (node->priv->type, node, parent, row [0], NULL, NULL);
+    column = 1;
 
-        if (child->priv->mountpoint != NULL && strncmp (child->priv->mountpoint, path, strlen (child->priv->mountpoint)) == 0)
-            return hierarchy_node_get_subchildren (child, parent);
-    }
+    for (required_iter = required; required_iter && row [column] != NULL; required_iter = g_list_next (required_iter), column++)
+        item_handler_load_metadata (item, (gchar*) required_iter->data, row [column]);
 
-    return NULL;
+    /*
+        Unbound OPTIONAL values are returned as empty strings: those metadata are
+        anyway loaded, with no value, so to not be asked again to Tracker
+    */
+    for (required_iter = optional; required_iter && row [column] != NULL; required_iter = g_list_next (required_iter), column++)
+        item_handler_load_metadata (item, (gchar*) required_iter->data, *(row [column]) != '\0' ? row [column] : NULL);
+
+    if (node->priv->expose_policy.contents_callback != NULL)
+        item_handler_set_contents_handler (item, node->priv->expose_policy.contents_callback);
+
+    return item;
 }
 
-static GList* collect_children_from_filesystem (HierarchyNode *node, ItemHandler *parent)
+static GList* build_items (HierarchyNode *node, ItemHandler *parent, GPtrArray *rows, GList *required, GList *optional)
 {
-    int n;
     register int i;
-    gchar *path;
-    gchar *item_path;
-    GList *ret;
-    struct dirent **namelist;
-    struct stat sbuf;
-    ItemHandler *witem;
-    NodesCache *cache;
-    CONTENT_TYPE type;
-    GFuseLoop *loop;
+    gchar **row;
+    GList *items;
 
-    path = NULL;
+    items = NULL;
 
-    if (parent != NULL) {
-        if (item_handler_get_format (parent) == ITEM_IS_MIRROR_FOLDER)
-            path = strdupa (item_handler_real_path (parent));
+    for (i = 0; i < rows->len; i++) {
+        row = (gchar**) g_ptr_array_index (rows, i);
+        if (row [0] != NULL)
+            items = g_list_prepend (items, build_item (node, parent, row, required, optional));
     }
 
-    if (path == NULL)
-        path = strdupa (node->priv->additional_option);
+    return g_list_reverse (items);
+}
 
-    ret = check_mountpoints (node, parent, path);
-    if (ret != NULL)
-        return ret;
+static void create_fetching_query_statement (const gchar *metadata, GList **statements, GList **required, gchar *var, GStringChunk *arena)
+{
+    gchar *statement;
 
-    ret = NULL;
-    cache = get_cache_reference ();
+    statement = arena_printf (arena, "?item %s ?%c", metadata, *var);
+    *statements = g_list_prepend (*statements, statement);
+    *required = g_list_prepend (*required, (gchar*) metadata);
+    (*var)++;
+}
 
-    check_and_create_folder (path);
-    n = scandir (path, &namelist, NULL, alphasort);
-    loop = gfuse_loop_get_current ();
+static void create_fetching_query_statements (HierarchyNode *node, GList **statements, GList **required, gchar *var, GStringChunk *arena)
+{
+    GList *iter;
+    ValuedMetadataReference *meta_ref;
+    MetadataDesc *prop;
 
-    for (i = 2; i < n; i++) {
-        item_path = g_build_filename (path, namelist [i]->d_name, NULL);
+    for (iter = node->priv->expose_policy.exposed_metadata; iter; iter = g_list_next (iter)) {
+        prop = (MetadataDesc*) iter->data;
+        if (prop->from == METADATA_HOLDER_SELF && prop->means_subject == FALSE)
+            create_fetching_query_statement (property_get_name (prop->metadata), statements, required, var, arena);
+    }
+
+    for (iter = node->priv->expose_policy.conditional_metadata; iter; iter = g_list_next (iter)) {
+        meta_ref = (ValuedMetadataReference*) iter->data;
+        create_fetching_query_statement (property_get_name (meta_ref->metadata.metadata), statements, required, var, arena);
+    }
+}
+
+static void create_prefetch_query_statements (HierarchyNode *node, GList **statements, GList *required, GList **optional, gchar *var, GStringChunk *arena)
+{
+    const gchar *metadata;
+    GList *iter;
+    GList *more_statements;
+
+    more_statements = NULL;
+
+    for (iter = node->priv->prefetch; iter; iter = g_list_next (iter)) {
+        metadata = property_get_name ((Property*) iter->data);
+        if (g_list_find_custom (required, metadata, (GCompareFunc) strcmp) != NULL)
+            continue;
+
+        more_statements = g_list_prepend (more_statements, arena_printf (arena, "OPTIONAL { ?item %s ?%c }", metadata, *var));
+        *optional = g_list_prepend (*optional, (gchar*) metadata);
+        (*var)++;
+    }
+
+    /*
+        OPTIONAL blocks have to follow all other statements, otherwise they would be joined
+        before the conditions selecting the items
+    */
+    if (more_statements != NULL)
+        *statements = g_list_concat (*statements, g_list_reverse (more_statements));
+
+    *optional = g_list_reverse (*optional);
+}
+
+/*
+    Fetches children of @node for all the @parents with a single query, where the parent is
+    bound to the ?parent variable, and attaches to each of them his own rows. Parents without
+    a subject (not saved) are skipped
+*/
+static void prefetch_children_for_node (HierarchyNode *node, GList *parents)
+{
+    register int i;
+    int values_offset;
+    gchar var;
+    gchar **row;
+    gchar *sparql;
+    const gchar *origin;
+    GString *values;
+    GList *iter;
+    GList *saved;
+    GList *statements;
+    GList *required;
+    GList *optional;
+    GPtrArray *rows;
+    GPtrArray *group;
+    GHashTable *groups;
+    GError *error;
+    GStringChunk *arena;
+    ItemHandler *parent;
+
+    saved = NULL;
+
+    for (iter = parents; iter; iter = g_list_next (iter))
+        if (item_handler_get_subject ((ItemHandler*) iter->data) != NULL)
+            saved = g_list_prepend (saved, iter->data);
+
+    if (saved == NULL)
+        return;
+
+    parents = g_list_reverse (saved);
+
+    var = 'a';
+    statements = NULL;
+    required = NULL;
+    optional = NULL;
+    arena = g_string_chunk_new (ARENA_CHUNK_SIZE);
+
+    create_fetching_query_statements (node, &statements, &required, &var, arena);
+
+    values_offset = 0;
+    statements = g_list_concat (statements, node_conditions_to_sparql (node, NULL, TRUE, &values_offset, arena));
+
+    values = g_string_new ("VALUES ?parent {");
+    for (iter = parents; iter; iter = g_list_next (iter))
+        g_string_append_printf (values, " <%s>", item_handler_get_subject ((ItemHandler*) iter->data));
+    g_string_append (values, " }");
+    statements = g_list_append (statements, g_string_chunk_insert_len (arena, values->str, values->len));
+    g_string_free (values, TRUE);
+
+    create_prefetch_query_statements (node, &statements, required, &optional, &var, arena);
+    g_list_free (required);
+    g_list_free (optional);
+
+    sparql = build_sparql_query ("SELECT ?parent ?item", var, statements);
+    g_list_free (statements);
+    g_string_chunk_free (arena);
+    error = NULL;
+
+    origin = query_stats_set_origin (node->priv->label);
+    rows = execute_query_rows (sparql, &error);
+    query_stats_set_origin (origin);
+    g_free (sparql);
+
+    if (rows == NULL) {
+        g_warning ("Unable to prefetch items: %s", error->message);
+        g_error_free (error);
+        g_list_free (parents);
+        return;
+    }
+
+    groups = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) g_ptr_array_unref);
+
+    for (iter = parents; iter; iter = g_list_next (iter)) {
+        group = g_ptr_array_new_with_free_func ((GDestroyNotify) g_strfreev);
+        g_hash_table_insert (groups, (gpointer) item_handler_get_subject ((ItemHandler*) iter->data), group);
+    }
+
+    for (i = 0; i < rows->len; i++) {
+        row = (gchar**) g_ptr_array_index (rows, i);
+        if (row [0] == NULL)
+            continue;
+
+        group = g_hash_table_lookup (groups, row [0]);
+        if (group != NULL)
+            g_ptr_array_add (group, g_strdupv (row + 1));
+    }
+
+    /*
+        Also parents with no rows get their (empty) set, so to know they have no children
+    */
+    for (iter = parents; iter; iter = g_list_next (iter)) {
+        parent = (ItemHandler*) iter->data;
+        group = g_hash_table_lookup (groups, item_handler_get_subject (parent));
+        item_handler_set_prefetched_children (parent, node, group);
+    }
+
+    g_hash_table_destroy (groups);
+    g_ptr_array_unref (rows);
+    g_list_free (parents);
+}
+
+/*
+    When contents of many sibling items are requested in a short time (as many clients do,
+    opening all folders in sequence) children for the following siblings in the last listing
+    are fetched together with the requested ones, in a single query
+*/
+static gboolean batch_sibling_requests (HierarchyNode *node, ItemHandler *parent)
+{
+    register int i;
+    int count;
+    guint pos;
+    gint64 now;
+    gboolean burst;
+    GList *batch;
+    HierarchyNode *parent_node;
+    ItemHandler *sibling;
+
+    parent_node = item_handler_get_logic_node (parent);
+    if (parent_node != node->priv->node)
+        return FALSE;
+
+    now = g_get_monotonic_time ();
+    burst = (now - node->priv->last_request < BATCH_WINDOW);
+    node->priv->last_request = now;
+
+    if (burst == FALSE || node_is_joinable (node) == FALSE)
+        return FALSE;
+
+    if (parent_node->priv->last_listing == NULL)
+        return FALSE;
+
+    pos = GPOINTER_TO_UINT (g_hash_table_lookup (parent_node->priv->listing_index, parent));
+    if (pos == 0)
+        return FALSE;
+
+    /*
+        Once a remembered item is destroyed, his address may be reused by another one
+    */
+    sibling = g_weak_ref_get (g_ptr_array_index (parent_node->priv->last_listing, pos - 1));
+    if (sibling != parent) {
+        if (sibling != NULL)
+            g_object_unref (sibling);
+        return FALSE;
+    }
+
+    batch = g_list_prepend (NULL, sibling);
+
+    for (count = 1, i = pos; i < parent_node->priv->last_listing->len && count < BATCH_SIZE; i++) {
+        sibling = g_weak_ref_get (g_ptr_array_index (parent_node->priv->last_listing, i));
+        if (sibling == NULL)
+            continue;
+
+        if (item_handler_has_prefetched_children (sibling, node) == FALSE) {
+            batch = g_list_prepend (batch, sibling);
+            count++;
+        }
+        else {
+            g_object_unref (sibling);
+        }
+    }
+
+    prefetch_children_for_node (node, batch);
+    g_list_free_full (batch, g_object_unref);
+    return TRUE;
+}
+
+static void free_weak_ref (GWeakRef *ref)
+{
+    g_weak_ref_clear (ref);
+    g_free (ref);
+}
+
+/*
+    Items are referenced weakly, so that the listing does not keep them alive, and indexed
+    to find quickly the siblings following the one requested
+*/
+static void remember_listing (HierarchyNode *node, GList *items)
+{
+    GList *iter;
+    GWeakRef *ref;
+
+    if (node->priv->last_listing != NULL) {
+        g_ptr_array_unref (node->priv->last_listing);
+        g_hash_table_destroy (node->priv->listing_index);
+    }
+
+    node->priv->last_listing = g_ptr_array_new_with_free_func ((GDestroyNotify) free_weak_ref);
+    node->priv->listing_index = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    for (iter = items; iter && node->priv->last_listing->len < LAST_LISTING_SIZE; iter = g_list_next (iter)) {
+        ref = g_new0 (GWeakRef, 1);
+        g_weak_ref_init (ref, iter->data);
+        g_ptr_array_add (node->priv->last_listing, ref);
+        g_hash_table_insert (node->priv->listing_index, iter->data, GUINT_TO_POINTER (node->priv->last_listing->len));
+    }
+}
+
+/*
+    Retrieves the rows describing children of @node for @parent, using the ones already
+    prefetched if available. @required and @optional are filled with the names of the
+    metadata found in each row, in the same order
+*/
+static GPtrArray* fetch_children_rows (HierarchyNode *node, ItemHandler *parent, GList **required, GList **optional)
+{
+    int values_offset;
+    gchar var;
+    gchar *sparql;
+    GList *statements;
+    GPtrArray *rows;
+    GError *error;
+    GStringChunk *arena;
+
+    /*
+        All the statements composing the query are allocated in the arena, and released
+        together once the query has been built
+    */
+    arena = g_string_chunk_new (ARENA_CHUNK_SIZE);
+    statements = NULL;
+    *required = NULL;
+    *optional = NULL;
+    var = 'a';
+
+    if (parent != NULL) {
+        rows = item_handler_steal_prefetched_children (parent, node);
+        if (rows == NULL && batch_sibling_requests (node, parent) == TRUE)
+            rows = item_handler_steal_prefetched_children (parent, node);
+
+        if (rows != NULL) {
+            /*
+                Just to obtain the same columns layout used by the prefetch query
+            */
+            create_fetching_query_statements (node, &statements, required, &var, arena);
+            create_prefetch_query_statements (node, &statements, *required, optional, &var, arena);
+            g_list_free (statements);
+            g_string_chunk_free (arena);
+
+            *required = g_list_reverse (*required);
+            return rows;
+        }
+    }
+
+    create_fetching_query_statements (node, &statements, required, &var, arena);
+
+    values_offset = 0;
+    statements = g_list_concat (statements, node_conditions_to_sparql (node, parent, FALSE, &values_offset, arena));
+
+    create_prefetch_query_statements (node, &statements, *required, optional, &var, arena);
+
+    sparql = build_sparql_query (NULL, var, statements);
+    g_list_free (statements);
+    g_string_chunk_free (arena);
+
+    *required = g_list_reverse (*required);
+    error = NULL;
+
+    rows = execute_query_rows (sparql, &error);
+    if (rows == NULL) {
+        g_warning ("Unable to fetch items for %s: %s\n%s", node->priv->label, error->message, sparql);
+        g_error_free (error);
+        g_list_free (*required);
+        g_list_free (*optional);
+        *required = NULL;
+        *optional = NULL;
+    }
+
+    g_free (sparql);
+    return rows;
+}
+
+static GList* collect_children_from_storage (HierarchyNode *node, ItemHandler *parent)
+{
+    GList *items;
+    GList *required;
+    GList *optional;
+    GPtrArray *rows;
+
+    rows = fetch_children_rows (node, parent, &required, &optional);
+    if (rows == NULL)
+        return NULL;
+
+    items = build_items (node, parent, rows, required, optional);
+
+    if (node->priv->type == ITEM_IS_VIRTUAL_FOLDER && node->priv->children != NULL)
+        remember_listing (node, items);
+
+    g_list_free (required);
+    g_list_free (optional);
+    g_ptr_array_unref (rows);
+    return items;
+}
+
+/**
+ * hierarchy_node_prefetch_children:
+ * @items: list of #ItemHandler just listed
+ *
+ * For items belonging to a node configured with the "prefetch_children"
+ * attribute, fetches in one query the contents of all of them, so that
+ * subsequent listings of each item do not require further queries. To be
+ * used when all (or most) listed items are going to be visited, as in
+ * recursive crawls
+ **/
+void hierarchy_node_prefetch_children (GList *items)
+{
+    int count;
+    GList *iter;
+    GList *child;
+    GList *nodes;
+    GList *parents;
+    GList *chunk;
+    HierarchyNode *node;
+    ItemHandler *item;
+
+    nodes = NULL;
+
+    for (iter = items; iter; iter = g_list_next (iter)) {
+        item = (ItemHandler*) iter->data;
+        node = item_handler_get_logic_node (item);
+
+        if (node != NULL && node->priv->prefetch_children == TRUE && g_list_find (nodes, node) == NULL)
+            nodes = g_list_prepend (nodes, node);
+    }
+
+    for (; nodes; nodes = g_list_delete_link (nodes, nodes)) {
+        node = (HierarchyNode*) nodes->data;
+        parents = NULL;
+
+        for (iter = items; iter; iter = g_list_next (iter)) {
+            item = (ItemHandler*) iter->data;
+            if (item_handler_get_logic_node (item) == node && item_handler_is_folder (item) == TRUE)
+                parents = g_list_prepend (parents, item);
+        }
+
+        /*
+            Queries are splitted in chunks, to not hit limits on the size of messages
+        */
+        while (parents != NULL) {
+            chunk = parents;
+            for (count = 1, iter = parents; iter->next != NULL && count < PREFETCH_CHUNK_SIZE; iter = iter->next, count++);
+
+            parents = iter->next;
+            iter->next = NULL;
+            if (parents != NULL)
+                parents->prev = NULL;
+
+            for (child = node->priv->children; child; child = g_list_next (child))
+                if (node_is_joinable ((HierarchyNode*) child->data) == TRUE)
+                    prefetch_children_for_node ((HierarchyNode*) child->data, chunk);
+
+            g_list_free (chunk);
+        }
+    }
+}
+
+static GList* check_mountpoints (HierarchyNode *node, ItemHandler *parent, gchar *path)
+{
+    GList *iter;
+    HierarchyNode *child;
+
+    for (iter = node->priv->children; iter; iter = g_list_next (iter)) {
+        child = iter->data;
+
+        if (child->priv->mountpoint != NULL && strncmp (child->priv->mountpoint, path, strlen (child->priv->mountpoint)) == 0)
+            return hierarchy_node_get_subchildren (child, parent);
+    }
+
+    return NULL;
+}
+
+/*
+    Files in a folder of the real filesystem, in the order returned by the kernel. Entries
+    are classified by their d_type, and only symbolic links (followed, to know if they point
+    to a folder) and entries on filesystems not reporting the type are stat()ed. Listings
+    are kept in the mirror cache, and the folder is read again only when it changes
+*/
+static GPtrArray* list_real_folder (const gchar *path)
+{
+    unsigned char type;
+    DIR *dir;
+    struct dirent *entry;
+    struct stat sbuf;
+    GPtrArray *ret;
+
+    ret = mirror_cache_get_listing (path);
+    if (ret != NULL)
+        return ret;
+
+    dir = opendir (path);
+    if (dir == NULL)
+        return NULL;
+
+    ret = g_ptr_array_new_with_free_func (g_free);
+
+    while ((entry = readdir (dir)) != NULL) {
+        if (entry->d_name [0] == '.' && (entry->d_name [1] == '\0' || (entry->d_name [1] == '.' && entry->d_name [2] == '\0')))
+            continue;
+
+        type = entry->d_type;
+
+        if (type == DT_UNKNOWN || type == DT_LNK) {
+            if (fstatat (dirfd (dir), entry->d_name, &sbuf, 0) == -1)
+                continue;
+
+            type = (S_ISDIR (sbuf.st_mode) ? DT_DIR : DT_REG);
+        }
+
+        g_ptr_array_add (ret, mirror_entry_new (entry->d_name, type == DT_DIR ? DT_DIR : DT_REG));
+    }
+
+    closedir (dir);
+    mirror_cache_set_listing (path, ret);
+    return ret;
+}
+
+/*
+    Folder of the real filesystem holding the children of @parent in a mirror node
+*/
+static const gchar* mirror_folder_path (HierarchyNode *node, ItemHandler *parent)
+{
+    if (parent != NULL && item_handler_get_format (parent) == ITEM_IS_MIRROR_FOLDER)
+        return item_handler_real_path (parent);
+    else
+        return node->priv->additional_option;
+}
+
+static GList* collect_children_from_filesystem (HierarchyNode *node, ItemHandler *parent)
+{
+    register int i;
+    gchar *path;
+    gchar *item_path;
+    const gchar *mountpoint;
+    GList *ret;
+    GPtrArray *entries;
+    ItemHandler *witem;
+    NodesCache *cache;
+    MirrorEntry *entry;
+
+    path = strdupa (mirror_folder_path (node, parent));
+
+    ret = check_mountpoints (node, parent, path);
+    if (ret != NULL)
+        return ret;
+
+    ret = NULL;
+    cache = get_cache_reference ();
+
+    check_and_create_folder (path);
+    entries = list_real_folder (path);
+    if (entries == NULL)
+        return NULL;
+
+    mountpoint = get_mountpoint_reference ();
+
+    for (i = 0; i < entries->len; i++) {
+        entry = g_ptr_array_index (entries, i);
+        item_path = g_build_filename (path, entry->name, NULL);
         witem = nodes_cache_get_by_path (cache, item_path);
 
         if (witem != NULL) {
@@ -1417,128 +2218,253 @@ static GList* collect_children_from_filesystem (HierarchyNode *node, ItemHandler
                         here we skip all paths matching with the current instance's mountpoint
                         (retrieved on startup)
             */
-            if (strcmp (item_path, gfuse_loop_get_mountpoint (loop)) == 0) {
+            if (mountpoint != NULL && strcmp (item_path, mountpoint) == 0) {
                 g_free (item_path);
                 continue;
             }
 
-            if (stat (item_path, &sbuf) != -1) {
-                if (S_ISDIR (sbuf.st_mode))
-                    type = ITEM_IS_MIRROR_FOLDER;
-                else
-                    type = ITEM_IS_MIRROR_ITEM;
+            witem = item_handler_new (entry->type == DT_DIR ? ITEM_IS_MIRROR_FOLDER : ITEM_IS_MIRROR_ITEM,
+                                      node, parent, NULL, entry->name, item_path);
+            nodes_cache_set_by_path (cache, witem, item_path);
+        }
 
-                witem = g_object_new (ITEM_HANDLER_TYPE,
-                                        "type", type, "parent", parent,
-                                        "node", node, "file_path", item_path,
-                                        "exposed_name", namelist [i]->d_name, NULL);
+        ret = g_list_prepend (ret, witem);
+    }
 
-                nodes_cache_set_by_path (cache, witem, item_path);
-            }
+    g_ptr_array_unref (entries);
+    return g_list_reverse (ret);
+}
+
+static GList* collect_children_static (HierarchyNode *node, ItemHandler *parent)
+{
+    ItemHandler *witem;
+
+    witem = item_handler_new (ITEM_IS_STATIC_FOLDER, node, parent, NULL, node->priv->expose_policy.formula, getenv ("HOME"));
+
+    return g_list_prepend (NULL, witem);
+}
+
+/*
+    Properties involved in the conditions of the node, walked as node_conditions_to_sparql()
+    does
+*/
+static void collect_conditions_properties (HierarchyNode *node, GList **list)
+{
+    HierarchyNode *parent_node;
+
+    collect_metadata_references (list, node->priv->self_policy.conditions);
+
+    if (node->priv->child_policy.inherit == TRUE) {
+        for (parent_node = node->priv->node; parent_node != NULL; parent_node = parent_node->priv->node) {
+            collect_metadata_references (list, parent_node->priv->child_policy.conditions);
+            if (parent_node->priv->child_policy.inherit == FALSE)
+                break;
         }
+    }
+}
 
-        if (witem != NULL)
-            ret = g_list_prepend (ret, witem);
+/*
+    Conditions may depend on the parent item, so a different index is kept for each set of
+    statements, up to SET_INDEXES_SIZE
+*/
+static SetIndex* set_index_for_statements (HierarchyNode *node, const gchar *statements)
+{
+    gchar *key;
+    const gchar *uri;
+    GList *properties;
+    GList *predicates;
+    GList *iter;
+    SetIndex *ret;
 
-        free (namelist [i]);
+    G_LOCK (SetIndexes);
+
+    if (node->priv->set_indexes == NULL)
+        node->priv->set_indexes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+
+    ret = NULL;
+
+    if (g_hash_table_lookup_extended (node->priv->set_indexes, statements, (gpointer*) &key, (gpointer*) &ret) == TRUE) {
+        /*
+            The LRU is short enough to be scanned
+        */
+        iter = g_queue_find (&(node->priv->set_indexes_lru), key);
+        g_queue_unlink (&(node->priv->set_indexes_lru), iter);
+        g_queue_push_head_link (&(node->priv->set_indexes_lru), iter);
     }
+    else {
+        if (g_queue_get_length (&(node->priv->set_indexes_lru)) >= SET_INDEXES_SIZE)
+            g_hash_table_remove (node->priv->set_indexes, g_queue_pop_tail (&(node->priv->set_indexes_lru)));
 
-    free (namelist [0]);
-    free (namelist [1]);
-    free (namelist);
+        properties = NULL;
+        predicates = NULL;
 
-    if (ret != NULL)
-        return g_list_reverse (ret);
-    else
-        return NULL;
+        plan_add_property (&properties, properties_pool_get_by_name (node->priv->additional_option));
+        collect_conditions_properties (node, &properties);
+
+        for (iter = properties; iter; iter = g_list_next (iter)) {
+            uri = property_get_uri ((Property*) iter->data);
+            if (uri != NULL)
+                predicates = g_list_prepend (predicates, (gpointer) uri);
+        }
+
+        ret = set_index_new (statements, predicates);
+        key = g_strdup (statements);
+        g_hash_table_insert (node->priv->set_indexes, key, ret);
+        g_queue_push_head (&(node->priv->set_indexes_lru), key);
+
+        g_list_free (predicates);
+        g_list_free (properties);
+    }
+
+    g_object_ref (ret);
+
+    G_UNLOCK (SetIndexes);
+    return ret;
 }
 
-static GList* collect_children_static (HierarchyNode *node, ItemHandler *parent)
+static GList* collect_distinct_values (const gchar *statements, GError **error)
 {
-    ItemHandler *witem;
+    register int i;
+    gchar *sparql;
+    gchar *value;
+    GList *ret;
+    GPtrArray *rows;
 
-    witem = g_object_new (ITEM_HANDLER_TYPE,
-                          "type", ITEM_IS_STATIC_FOLDER,
-                          "parent", parent,
-                          "node", node,
-                          "file_path", getenv ("HOME"),
-                          "exposed_name", node->priv->expose_policy.formula, NULL);
+    sparql = g_strdup_printf ("SELECT DISTINCT(?a) WHERE { %s }", statements);
+    rows = execute_query_rows (sparql, error);
+    g_free (sparql);
 
-    return g_list_prepend (NULL, witem);
+    if (rows == NULL)
+        return NULL;
+
+    ret = NULL;
+
+    for (i = 0; i < rows->len; i++) {
+        value = ((gchar**) g_ptr_array_index (rows, i)) [0];
+        if (value != NULL)
+            ret = g_list_prepend (ret, g_strdup (value));
+    }
+
+    g_ptr_array_unref (rows);
+    return g_list_reverse (ret);
 }
 
+/*
+    Values are served by the index of the node, maintained incrementally. When it cannot be
+    built (the backend may not know about Tracker identifiers) they are collected with a
+    plain query
+*/
 static GList* collect_children_set (HierarchyNode *node, ItemHandler *parent)
 {
     int values_offset;
-    gchar *sparql;
-    gchar *uri;
+    guint generation;
+    gchar *statements;
+    GList *values;
+    GList *iter;
     GList *items;
-    GList *statements;
-    GList *more_statements;
-    GVariant *response;
-    GVariantIter *iter;
-    GVariantIter *subiter;
+    GList *list;
     GError *error;
+    QueryCache *cache;
+    SetIndex *index;
+    GStringChunk *arena;
     ItemHandler *item;
-    HierarchyNode *parent_node;
 
     values_offset = 1;
-    statements = NULL;
-    statements = g_list_append (statements, g_strdup_printf ("?item %s ?a", node->priv->additional_option));
+    list = NULL;
+    arena = g_string_chunk_new (ARENA_CHUNK_SIZE);
+    list = g_list_append (list, arena_printf (arena, "?item %s ?a", node->priv->additional_option));
+    list = g_list_concat (list, node_conditions_to_sparql (node, parent, FALSE, &values_offset, arena));
+    statements = from_glist_to_string (list, " . ", FALSE);
+    g_list_free (list);
+    g_string_chunk_free (arena);
 
-    more_statements = condition_policy_to_sparql (&(node->priv->self_policy), parent, &values_offset);
-    statements = g_list_concat (statements, more_statements);
+    cache = get_query_cache_reference ();
+    generation = cache != NULL ? query_cache_get_generation (cache) : 0;
 
-    if (node->priv->child_policy.inherit == TRUE) {
-        parent_node = node->priv->node;
+    error = NULL;
+    index = set_index_for_statements (node, statements);
+    values = set_index_get_values (index, generation, &error);
+    g_object_unref (index);
 
-        while (parent_node != NULL) {
-            more_statements = condition_policy_to_sparql (&(parent_node->priv->child_policy), parent, &values_offset);
-            statements = g_list_concat (statements, more_statements);
+    if (error != NULL) {
+        g_error_free (error);
+        error = NULL;
+        values = collect_distinct_values (statements, &error);
 
-            if (parent_node->priv->child_policy.inherit == TRUE)
-                parent_node = parent_node->priv->node;
-            else
-                break;
+        if (error != NULL) {
+            g_warning ("Unable to fetch items: %s", error->message);
+            g_error_free (error);
         }
     }
 
-    sparql = build_sparql_query ("SELECT DISTINCT(?a)", 'a', statements);
-    error = NULL;
+    g_free (statements);
+    items = NULL;
 
-    response = execute_query (sparql, &error);
-    if (response == NULL) {
-        g_warning ("Unable to fetch items: %s", error->message);
-        g_error_free (error);
-        g_free (sparql);
-        return NULL;
+    for (iter = values; iter; iter = g_list_next (iter)) {
+        item = item_handler_new (node->priv->type, node, parent, NULL, (gchar*) iter->data, NULL);
+
+        item_handler_load_metadata (item, node->priv->additional_option, (gchar*) iter->data);
+        items = g_list_prepend (items, item);
     }
 
-    items = NULL;
-    iter = NULL;
-    subiter = NULL;
+    easy_list_free (values);
+    return g_list_reverse (items);
+}
 
-    g_variant_get (response, "(aas)", &iter);
+/**
+ * hierarchy_node_get_label:
+ * @node: a #HierarchyNode
+ *
+ * Retrieves a human readable identifier for @node: the "id" assigned in the
+ * configuration, or the path of tags leading to it
+ *
+ * Return value: label of the node
+ **/
+const gchar* hierarchy_node_get_label (HierarchyNode *node)
+{
+    return (const gchar*) node->priv->label;
+}
 
-    while (g_variant_iter_loop (iter, "as", &subiter)) {
-        uri = NULL;
+/**
+ * hierarchy_node_get_deadline:
+ * @node: a #HierarchyNode
+ *
+ * Retrieves the time granted to filesystem operations fetching contents of
+ * @node
+ *
+ * Return value: a timeout in milliseconds
+ **/
+guint hierarchy_node_get_deadline (HierarchyNode *node)
+{
+    if (node->priv->deadline != 0)
+        return node->priv->deadline;
+    else
+        return DefaultDeadlines [node->priv->type];
+}
 
-        if (g_variant_iter_loop (subiter, "s", &uri)) {
-            item = g_object_new (ITEM_HANDLER_TYPE,
-                                 "type", node->priv->type,
-                                 "parent", parent,
-                                 "node", node,
-                                 "exposed_name", uri, NULL);
+/**
+ * hierarchy_node_set_default_deadline:
+ * @tag: name of the XML tag describing a type of node, as "folder" or
+ * "set_folder"
+ * @deadline: timeout in milliseconds
+ *
+ * Changes the time granted to filesystem operations involving nodes of the
+ * given type, when not specified on the node itself
+ *
+ * Return value: FALSE if @tag is not a valid type of node, TRUE otherwise
+ **/
+gboolean hierarchy_node_set_default_deadline (const gchar *tag, guint deadline)
+{
+    register int i;
 
-            item_handler_load_metadata (item, node->priv->additional_option, uri);
-            items = g_list_prepend (items, item);
+    for (i = 0; HierarchyDescription [i].tag != NULL; i++) {
+        if (strcmp (HierarchyDescription [i].tag, tag) == 0) {
+            DefaultDeadlines [HierarchyDescription [i].type] = deadline;
+            return TRUE;
         }
     }
 
-    g_variant_unref (response);
-    g_free (sparql);
-
-    return g_list_reverse (items);
+    return FALSE;
 }
 
 /**
@@ -1553,8 +2479,12 @@ static GList* collect_children_set (HierarchyNode *node, ItemHandler *parent)
  **/
 GList* hierarchy_node_get_children (HierarchyNode *node, ItemHandler *parent)
 {
+    const gchar *origin;
     GList *ret;
 
+    operation_set_timeout (hierarchy_node_get_deadline (node));
+    origin = query_stats_set_origin (node->priv->label);
+
     if (node->priv->type == ITEM_IS_MIRROR_FOLDER)
         ret = collect_children_from_filesystem (node, parent);
     else if (node->priv->type == ITEM_IS_STATIC_FOLDER)
@@ -1564,9 +2494,81 @@ GList* hierarchy_node_get_children (HierarchyNode *node, ItemHandler *parent)
     else
         ret = collect_children_from_storage (node, parent);
 
+    query_stats_set_origin (origin);
     return ret;
 }
 
+/**
+ * hierarchy_node_get_mirror_child:
+ * @node: a #HierarchyNode
+ * @parent: item whose children are generated by @node
+ * @name: name of the required child
+ * @item: filled with the child found, or NULL
+ *
+ * Looks for a child of @parent directly in the real filesystem, when the
+ * subchildren of @node come from a mirror node, without listing all the
+ * contents of the folder
+ *
+ * Return value: TRUE if the lookup has been resolved (even if no child has
+ * been found), FALSE if @name has to be searched within the children of
+ * @parent
+ **/
+gboolean hierarchy_node_get_mirror_child (HierarchyNode *node, ItemHandler *parent, const gchar *name, ItemHandler **item)
+{
+    gchar *item_path;
+    const gchar *mountpoint;
+    GList *iter;
+    struct stat sbuf;
+    NodesCache *cache;
+    HierarchyNode *mirror;
+
+    *item = NULL;
+
+    /*
+        Same cases of hierarchy_node_get_subchildren(): inside a mirrored folder, or in a
+        node having a mirror node as only child
+    */
+    if (node->priv->type == ITEM_IS_MIRROR_FOLDER && parent != NULL && item_handler_get_format (parent) == ITEM_IS_MIRROR_FOLDER)
+        mirror = node;
+    else if (g_list_length (node->priv->children) == 1 && ((HierarchyNode*) node->priv->children->data)->priv->type == ITEM_IS_MIRROR_FOLDER)
+        mirror = (HierarchyNode*) node->priv->children->data;
+    else
+        return FALSE;
+
+    /*
+        Mountpoints are resolved only by check_mountpoints(), when listing the folder
+    */
+    for (iter = mirror->priv->children; iter; iter = g_list_next (iter))
+        if (((HierarchyNode*) iter->data)->priv->mountpoint != NULL)
+            return FALSE;
+
+    cache = get_cache_reference ();
+    item_path = g_build_filename (mirror_folder_path (mirror, parent), name, NULL);
+
+    *item = nodes_cache_get_by_path (cache, item_path);
+    if (*item != NULL) {
+        g_free (item_path);
+        return TRUE;
+    }
+
+    /*
+        As in collect_children_from_filesystem(), the mountpoint of FSter itself is skipped
+        and symbolic links are followed to know the type of the item
+    */
+    mountpoint = get_mountpoint_reference ();
+
+    if ((mountpoint != NULL && strcmp (item_path, mountpoint) == 0) ||
+            ((mirror_cache_get_stat (item_path, &sbuf) == FALSE || S_ISLNK (sbuf.st_mode)) && stat (item_path, &sbuf) == -1)) {
+        g_free (item_path);
+        return TRUE;
+    }
+
+    *item = item_handler_new (S_ISDIR (sbuf.st_mode) ? ITEM_IS_MIRROR_FOLDER : ITEM_IS_MIRROR_ITEM,
+                              mirror, parent, NULL, name, item_path);
+    nodes_cache_set_by_path (cache, *item, item_path);
+    return TRUE;
+}
+
 /**
  * hierarchy_node_get_subchildren:
  * @node: a #HierarchyNode
@@ -1612,6 +2614,304 @@ GList* hierarchy_node_get_subchildren (HierarchyNode *node, ItemHandler *parent)
     return ret;
 }
 
+/*
+    Rows of a listing, kept for the plain files streamed without building their items. Names
+    are resolved against the rows only when some of them is looked up
+*/
+struct _ListingRows {
+    HierarchyNode   *node;
+    ItemHandler     *parent;
+    GPtrArray       *rows;
+    GList           *required;
+    GList           *optional;
+    GHashTable      *names;         // exposed name -> index in rows + 1, built on first lookup
+};
+
+/*
+    Only plain files are streamed: folders are required as real items, to prefetch their
+    contents and batch the requests of siblings
+*/
+static gboolean node_is_streamable (HierarchyNode *node)
+{
+    return (node->priv->type == ITEM_IS_VIRTUAL_ITEM && node->priv->children == NULL &&
+            node->priv->expose_policy.formula != NULL);
+}
+
+static gboolean node_contents_are_hidden (HierarchyNode *node, ItemHandler *parent)
+{
+    return (node->priv->hide_contents == TRUE && (parent == NULL || node != item_handler_get_logic_node (parent)));
+}
+
+static const gchar* row_value (gchar **row, GList *required, const gchar *metadata)
+{
+    int column;
+    GList *iter;
+
+    for (iter = required, column = 1; iter && row [column] != NULL; iter = g_list_next (iter), column++)
+        if (strcmp ((gchar*) iter->data, metadata) == 0)
+            return row [column];
+
+    return NULL;
+}
+
+/*
+    As hierarchy_node_exposed_name_for_item(), but for an item described by @row and not yet
+    built. Returns NULL if some of the involved values is not in @row
+*/
+static gchar* exposed_name_from_row (HierarchyNode *node, ItemHandler *parent, gchar **row, GList *required)
+{
+    int current_offset;
+    register int i;
+    gchar *formula;
+    gchar *ret;
+    const gchar *metadata_value;
+    GList *components_iter;
+    GString *val;
+    MetadataDesc *component;
+
+    formula = node->priv->expose_policy.formula;
+    current_offset = 1;
+    components_iter = node->priv->expose_policy.exposed_metadata;
+    val = g_string_new ("");
+
+    for (i = 0; formula [i] != '\0'; i++) {
+        if (formula [i] == '\\' && formula [i + 1] - 0x30 == current_offset && components_iter != NULL) {
+            component = (MetadataDesc*) components_iter->data;
+            metadata_value = NULL;
+
+            if (component->from == METADATA_HOLDER_SELF) {
+                if (component->means_subject == TRUE)
+                    metadata_value = row [0];
+                else
+                    metadata_value = row_value (row, required, property_get_name (component->metadata));
+            }
+            else if (component->from == METADATA_HOLDER_PARENT && parent != NULL) {
+                if (component->means_subject == TRUE)
+                    metadata_value = item_handler_get_subject (parent);
+                else
+                    metadata_value = item_handler_get_metadata (parent, property_get_name (component->metadata));
+            }
+
+            if (metadata_value == NULL) {
+                g_string_free (val, TRUE);
+                return NULL;
+            }
+
+            g_string_append (val, metadata_value);
+            components_iter = g_list_next (components_iter);
+            i++;
+            current_offset++;
+        }
+        else {
+            g_string_append_c (val, formula [i]);
+        }
+    }
+
+    ret = item_handler_escape_name (val->str);
+    g_string_free (val, TRUE);
+    return ret;
+}
+
+static gboolean stream_items (GList *items, HierarchyStreamFunc func, gpointer user_data)
+{
+    gboolean stop;
+    const gchar *name;
+    GList *iter;
+    ItemHandler *item;
+
+    stop = FALSE;
+
+    for (iter = items; iter; iter = g_list_next (iter)) {
+        item = (ItemHandler*) iter->data;
+
+        if (stop == TRUE || item_handler_get_hidden (item) == TRUE || (name = item_handler_exposed_name (item)) == NULL) {
+            g_object_unref (item);
+            continue;
+        }
+
+        stop = func (name, item, user_data);
+    }
+
+    g_list_free (items);
+    return stop;
+}
+
+static gboolean stream_children_from_storage (HierarchyNode *node, ItemHandler *parent, HierarchyStreamFunc func,
+                                              gpointer user_data, GList **listings)
+{
+    register int i;
+    gboolean stop;
+    gboolean kept;
+    gchar *name;
+    gchar **row;
+    GList *required;
+    GList *optional;
+    GPtrArray *rows;
+    ListingRows *listing;
+    ItemHandler *item;
+
+    rows = fetch_children_rows (node, parent, &required, &optional);
+    if (rows == NULL)
+        return FALSE;
+
+    stop = FALSE;
+    kept = FALSE;
+
+    for (i = 0; stop == FALSE && i < rows->len; i++) {
+        row = (gchar**) g_ptr_array_index (rows, i);
+        if (row [0] == NULL)
+            continue;
+
+        name = exposed_name_from_row (node, parent, row, required);
+
+        if (name == NULL) {
+            /*
+                The name depends on values not fetched with the listing: the item has to be
+                built to retrieve them
+            */
+            item = build_item (node, parent, row, required, optional);
+            stop = stream_items (g_list_prepend (NULL, item), func, user_data);
+            continue;
+        }
+
+        stop = func (name, NULL, user_data);
+        g_free (name);
+        kept = TRUE;
+    }
+
+    if (kept == FALSE) {
+        g_ptr_array_unref (rows);
+        g_list_free (required);
+        g_list_free (optional);
+        return stop;
+    }
+
+    listing = g_new0 (ListingRows, 1);
+    listing->node = node;
+    listing->parent = parent != NULL ? g_object_ref (parent) : NULL;
+    listing->rows = rows;
+    listing->required = required;
+    listing->optional = optional;
+    *listings = g_list_prepend (*listings, listing);
+
+    return stop;
+}
+
+/**
+ * hierarchy_node_stream_subchildren:
+ * @node: a #HierarchyNode
+ * @parent: item whose contents have to be listed
+ * @func: function invoked for each child
+ * @user_data: data passed to @func
+ * @listings: return location for a list of #ListingRows
+ *
+ * As hierarchy_node_get_subchildren(), but children are passed one by one to
+ * @func, and children not visible in listings are skipped. For plain files
+ * coming from the metadata storage no #ItemHandler is built: @func receives
+ * only their name, and the rows they come from are appended to @listings,
+ * to be looked up with hierarchy_node_listing_lookup() when some of them is
+ * effectively accessed. Ownership of the items is passed to @func, which
+ * returns TRUE to stop the listing
+ *
+ * Return value: TRUE if the listing has been stopped by @func
+ **/
+gboolean hierarchy_node_stream_subchildren (HierarchyNode *node, ItemHandler *parent, HierarchyStreamFunc func,
+                                            gpointer user_data, GList **listings)
+{
+    gboolean stop;
+    const gchar *origin;
+    GList *nodes;
+    HierarchyNode *child;
+
+    if (parent != NULL && item_handler_is_folder (parent) == FALSE)
+        return FALSE;
+
+    if (hierarchy_node_get_format (node) == ITEM_IS_MIRROR_FOLDER &&
+            parent != NULL && item_handler_get_format (parent) == ITEM_IS_MIRROR_FOLDER)
+        return stream_items (hierarchy_node_get_children (node, parent), func, user_data);
+
+    stop = FALSE;
+
+    for (nodes = node->priv->children; stop == FALSE && nodes; nodes = g_list_next (nodes)) {
+        child = (HierarchyNode*) nodes->data;
+
+        if (node_contents_are_hidden (child, parent) == TRUE)
+            continue;
+
+        if (node_is_streamable (child) == TRUE) {
+            operation_set_timeout (hierarchy_node_get_deadline (child));
+            origin = query_stats_set_origin (child->priv->label);
+            stop = stream_children_from_storage (child, parent, func, user_data, listings);
+            query_stats_set_origin (origin);
+        }
+        else {
+            stop = stream_items (hierarchy_node_get_children (child, parent), func, user_data);
+        }
+    }
+
+    return stop;
+}
+
+/**
+ * hierarchy_node_listing_lookup:
+ * @listing: a #ListingRows
+ * @name: exposed name of the required child
+ *
+ * Builds the #ItemHandler named @name, from the row fetched when it has
+ * been listed. The first lookup indexes all the names in @listing
+ *
+ * Return value: a newly allocated #ItemHandler, or NULL if @name is not in
+ * @listing
+ **/
+ItemHandler* hierarchy_node_listing_lookup (ListingRows *listing, const gchar *name)
+{
+    register int i;
+    guint index;
+    gchar *row_name;
+    gchar **row;
+
+    if (listing->names == NULL) {
+        listing->names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+        for (i = 0; i < listing->rows->len; i++) {
+            row = (gchar**) g_ptr_array_index (listing->rows, i);
+            if (row [0] == NULL)
+                continue;
+
+            row_name = exposed_name_from_row (listing->node, listing->parent, row, listing->required);
+            if (row_name != NULL)
+                g_hash_table_replace (listing->names, row_name, GUINT_TO_POINTER (i + 1));
+        }
+    }
+
+    index = GPOINTER_TO_UINT (g_hash_table_lookup (listing->names, name));
+    if (index == 0)
+        return NULL;
+
+    return build_item (listing->node, listing->parent, (gchar**) g_ptr_array_index (listing->rows, index - 1),
+                       listing->required, listing->optional);
+}
+
+/**
+ * hierarchy_node_listing_free:
+ * @listing: a #ListingRows
+ *
+ * Releases @listing, as obtained by hierarchy_node_stream_subchildren()
+ **/
+void hierarchy_node_listing_free (ListingRows *listing)
+{
+    if (listing->parent != NULL)
+        g_object_unref (listing->parent);
+
+    if (listing->names != NULL)
+        g_hash_table_destroy (listing->names);
+
+    g_ptr_array_unref (listing->rows);
+    g_list_free (listing->required);
+    g_list_free (listing->optional);
+    g_free (listing);
+}
+
 /**
  * hierarchy_node_get_mirror_path:
  * @node: a #HierarchyNode
@@ -1653,6 +2953,144 @@ gboolean hierarchy_node_hide_contents (HierarchyNode *node)
     return node->priv->hide_contents;
 }
 
+/**
+ * hierarchy_node_get_child_nodes:
+ * @node: a #HierarchyNode
+ *
+ * Retrieves the nodes defined inside @node in the configuration
+ *
+ * Return value: list of #HierarchyNode, owned by @node
+ **/
+GList* hierarchy_node_get_child_nodes (HierarchyNode *node)
+{
+    return node->priv->children;
+}
+
+/**
+ * hierarchy_node_prefetches_children:
+ * @node: a #HierarchyNode
+ *
+ * Return value: TRUE if the node has been configured with the
+ * "prefetch_children" attribute
+ **/
+gboolean hierarchy_node_prefetches_children (HierarchyNode *node)
+{
+    return node->priv->prefetch_children;
+}
+
+/**
+ * hierarchy_node_stats_from_metadata:
+ * @node: a #HierarchyNode
+ *
+ * Return value: TRUE if the node has been configured with the
+ * "stat_from_metadata" attribute, and attributes of his items have to be
+ * built from their metadata instead of their backing files
+ **/
+gboolean hierarchy_node_stats_from_metadata (HierarchyNode *node)
+{
+    return node->priv->stat_from_metadata;
+}
+
+/**
+ * hierarchy_node_is_joinable:
+ * @node: a #HierarchyNode
+ *
+ * Return value: TRUE if contents of @node may be fetched for many parents
+ * with a single query, as done by hierarchy_node_prefetch_children()
+ **/
+gboolean hierarchy_node_is_joinable (HierarchyNode *node)
+{
+    return node_is_joinable (node);
+}
+
+/**
+ * hierarchy_node_describe_query:
+ * @node: a #HierarchyNode
+ *
+ * Builds the query issued to list contents of @node, with the parent item
+ * represented by the ?parent variable. Nodes whose conditions depend on
+ * values computed from the parent cannot be expressed this way
+ *
+ * Return value: a newly allocated SPARQL query, or NULL if the node does not
+ * query the metadata backend or the query is composed only at runtime
+ **/
+gchar* hierarchy_node_describe_query (HierarchyNode *node)
+{
+    int values_offset;
+    gchar var;
+    gchar *sparql;
+    GList *statements;
+    GList *required;
+    GList *optional;
+    GStringChunk *arena;
+
+    if (conditions_are_joinable (node) == FALSE)
+        return NULL;
+
+    values_offset = 0;
+    var = 'a';
+    statements = NULL;
+    required = NULL;
+    optional = NULL;
+    arena = g_string_chunk_new (ARENA_CHUNK_SIZE);
+
+    switch (node->priv->type) {
+        case ITEM_IS_VIRTUAL_FOLDER:
+        case ITEM_IS_VIRTUAL_ITEM:
+            create_fetching_query_statements (node, &statements, &required, &var, arena);
+            statements = g_list_concat (statements, node_conditions_to_sparql (node, NULL, TRUE, &values_offset, arena));
+            create_prefetch_query_statements (node, &statements, required, &optional, &var, arena);
+            sparql = build_sparql_query (NULL, var, statements);
+            g_list_free (required);
+            g_list_free (optional);
+            break;
+
+        case ITEM_IS_SET_FOLDER:
+            values_offset = 1;
+            statements = g_list_append (statements, arena_printf (arena, "?item %s ?a", node->priv->additional_option));
+            statements = g_list_concat (statements, node_conditions_to_sparql (node, NULL, TRUE, &values_offset, arena));
+            sparql = build_sparql_query ("SELECT DISTINCT", 'b', statements);
+            break;
+
+        default:
+            sparql = NULL;
+            break;
+    }
+
+    g_list_free (statements);
+    g_string_chunk_free (arena);
+    return sparql;
+}
+
+/**
+ * hierarchy_node_collect_properties:
+ * @node: a #HierarchyNode
+ * @list: list to which append the properties
+ *
+ * Collects all the properties which may be involved in queries issued for
+ * @node and all his descendants. Each property is appended only once
+ **/
+void hierarchy_node_collect_properties (HierarchyNode *node, GList **list)
+{
+    GList *iter;
+
+    collect_metadata_references (list, node->priv->self_policy.conditions);
+    collect_metadata_references (list, node->priv->child_policy.conditions);
+    collect_metadata_desc_list (list, node->priv->expose_policy.exposed_metadata);
+    collect_metadata_references (list, node->priv->expose_policy.conditional_metadata);
+    collect_metadata_references (list, node->priv->save_policy.inheritable_assignments);
+    collect_metadata_references (list, node->priv->save_policy.extraction_behaviour.assigned_metadata);
+
+    for (iter = node->priv->prefetch; iter; iter = g_list_next (iter))
+        plan_add_property (list, (Property*) iter->data);
+
+    if (node->priv->type == ITEM_IS_SET_FOLDER && node->priv->additional_option != NULL)
+        plan_add_property (list, properties_pool_get_by_name (node->priv->additional_option));
+
+    for (iter = node->priv->children; iter; iter = g_list_next (iter))
+        hierarchy_node_collect_properties ((HierarchyNode*) iter->data, list);
+}
+
 static gchar* collect_from_metadata_desc_list (gchar *formula, GList *components, ItemHandler *item, ItemHandler *parent)
 {
     int current_offset;
@@ -1698,7 +3136,8 @@ static gchar* collect_from_metadata_desc_list (gchar *formula, GList *components
             else
                 metadata_value = item_handler_get_metadata (reference, property_get_name (component->metadata));
 
-            g_string_append_printf (val, "%s", metadata_value);
+            if (metadata_value != NULL)
+                g_string_append (val, metadata_value);
             components_iter = g_list_next (components_iter);
             i++;
             current_offset++;
@@ -51,6 +51,18 @@ struct _HierarchyNodeClass {
 
 #include "item-handler.h"
 
+/*
+    Children of a listing not yet built as #ItemHandler
+*/
+typedef struct _ListingRows         ListingRows;
+
+typedef gboolean (*HierarchyStreamFunc) (const gchar *name, ItemHandler *item, gpointer user_data);
+
+/*
+    Max number of parents bound in a single prefetch query
+*/
+#define PREFETCH_CHUNK_SIZE                 200
+
 GType           hierarchy_node_get_type                     ();
 
 HierarchyNode*  hierarchy_node_new_from_xml                 (HierarchyNode *parent, xmlNode *node);
@@ -59,9 +71,26 @@ CONTENT_TYPE    hierarchy_node_get_format                   (HierarchyNode *node
 
 GList*          hierarchy_node_get_children                 (HierarchyNode *node, ItemHandler *parent);
 GList*          hierarchy_node_get_subchildren              (HierarchyNode *node, ItemHandler *parent);
+gboolean        hierarchy_node_get_mirror_child             (HierarchyNode *node, ItemHandler *parent, const gchar *name, ItemHandler **item);
+void            hierarchy_node_prefetch_children            (GList *items);
+
+gboolean        hierarchy_node_stream_subchildren           (HierarchyNode *node, ItemHandler *parent, HierarchyStreamFunc func, gpointer user_data, GList **listings);
+ItemHandler*    hierarchy_node_listing_lookup               (ListingRows *listing, const gchar *name);
+void            hierarchy_node_listing_free                 (ListingRows *listing);
 
 const gchar*    hierarchy_node_get_mirror_path              (HierarchyNode *node);
 gboolean        hierarchy_node_hide_contents                (HierarchyNode *node);
+void            hierarchy_node_collect_properties           (HierarchyNode *node, GList **list);
+
+GList*          hierarchy_node_get_child_nodes              (HierarchyNode *node);
+gboolean        hierarchy_node_prefetches_children          (HierarchyNode *node);
+gboolean        hierarchy_node_stats_from_metadata          (HierarchyNode *node);
+gboolean        hierarchy_node_is_joinable                  (HierarchyNode *node);
+gchar*          hierarchy_node_describe_query               (HierarchyNode *node);
+
+const gchar*    hierarchy_node_get_label                    (HierarchyNode *node);
+guint           hierarchy_node_get_deadline                 (HierarchyNode *node);
+gboolean        hierarchy_node_set_default_deadline         (const gchar *tag, guint deadline);
 
 ItemHandler*    hierarchy_node_add_item                     (HierarchyNode *node, NODE_TYPE type, ItemHandler *parent, const gchar *name);
 
@@ -20,13 +20,26 @@
 #include "hierarchy.h"
 #include "property-handler.h"
 #include "utils.h"
+#include "metadata-journal.h"
+#include "mirror-cache.h"
+#include "metadata-backend.h"
+
+#include <sys/ioctl.h>
+
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
 
 #define DEFAULT_SAVE_PATH               "~/.fster_saving"
+#define QUERY_CACHE_SIZE                (4 * 1024 * 1024)
+#define COPY_BUFFER_SIZE                (128 * 1024)
 
 static GList                            *LoadedContentsPlugins      = NULL;
 static HierarchyNode                    *ExposingTree               = NULL;
 static NodesCache                       *Cache                      = NULL;
+static QueryCache                       *Queries                    = NULL;
 static GHashTable                       *Params                     = NULL;
+static gchar                            *Mountpoint                 = NULL;
 
 static int create_dummy_references ()
 {
@@ -84,6 +97,119 @@ static void load_plugins ()
     }
 }
 
+/*
+    The backend is informed about all the predicates involved in the configuration, so that
+    it may arrange to serve them faster
+*/
+static void preload_metadata ()
+{
+    const gchar *uri;
+    GList *properties;
+    GList *predicates;
+    GList *iter;
+    MetadataBackend *backend;
+
+    backend = metadata_backend_get_default ();
+    if (backend == NULL || ExposingTree == NULL)
+        return;
+
+    properties = NULL;
+    predicates = NULL;
+    hierarchy_node_collect_properties (ExposingTree, &properties);
+
+    for (iter = properties; iter; iter = g_list_next (iter)) {
+        uri = property_get_uri ((Property*) iter->data);
+        if (uri != NULL)
+            predicates = g_list_prepend (predicates, (gpointer) uri);
+    }
+
+    metadata_backend_preload (backend, predicates);
+
+    g_list_free (predicates);
+    g_list_free (properties);
+}
+
+/*
+    The "deadlines" tag assigns the default timeout (in milliseconds) to each type of node, using
+    node tags as attributes names. e.g. <deadlines folder="5000" set_folder="30000" />
+*/
+static void parse_deadlines (xmlNode *node)
+{
+    gchar *str;
+    xmlAttr *attr;
+
+    for (attr = node->properties; attr; attr = attr->next) {
+        str = (gchar*) xmlGetProp (node, attr->name);
+        if (str == NULL)
+            continue;
+
+        if (hierarchy_node_set_default_deadline ((gchar*) attr->name, strtoul (str, NULL, 10)) == FALSE)
+            g_warning ("Error: unrecognized node type '%s' in deadlines", (gchar*) attr->name);
+
+        xmlFree (str);
+    }
+}
+
+/*
+    Comments are blanked before parsing, as nodes of the configuration are iterated without
+    care about their type
+*/
+xmlDocPtr read_configuration_file (const gchar *path)
+{
+    int fsize;
+    gchar *offset;
+    gchar *string;
+    gchar *comment_start;
+    gchar *comment_end;
+    FILE *f;
+    xmlDocPtr doc;
+
+    f = fopen (path, "rb");
+    if (f == NULL) {
+        g_warning ("Unable to open configuration file %s", path);
+        return NULL;
+    }
+
+    fseek (f, 0, SEEK_END);
+
+    fsize = (int) ftell (f);
+    if (fsize == 0) {
+        g_warning ("Empty configuration file");
+        fclose (f);
+        return NULL;
+    }
+
+    fseek (f, 0, SEEK_SET);
+
+    string = g_malloc (fsize + 1);
+    fread (string, fsize, 1, f);
+    fclose (f);
+
+    string [fsize] = 0;
+    offset = string;
+
+    while (TRUE) {
+        comment_start = strstr (offset, "<!--");
+        if (comment_start == NULL)
+            break;
+
+        comment_end = strstr (comment_start, "-->");
+        if (comment_end == NULL)
+            break;
+
+        while (comment_start != comment_end + 3) {
+            *comment_start = ' ';
+            comment_start++;
+        }
+
+        offset = comment_start;
+    }
+
+    doc = xmlReadMemory (string, fsize, NULL, NULL, XML_PARSE_NOBLANKS);
+    g_free (string);
+    return doc;
+}
+
 void build_hierarchy_tree_from_xml (xmlDocPtr doc)
 {
     gboolean saving_set;
@@ -103,6 +229,9 @@ void build_hierarchy_tree_from_xml (xmlDocPtr doc)
     }
 
     properties_pool_init ();
+    Queries = query_cache_new (QUERY_CACHE_SIZE);
+    metadata_journal_init ();
+    mirror_cache_init ();
     load_plugins ();
     saving_set = FALSE;
 
@@ -122,6 +251,9 @@ void build_hierarchy_tree_from_xml (xmlDocPtr doc)
                 saving_set = TRUE;
             }
         }
+        else if (strcmp ((gchar*) node->name, "deadlines") == 0) {
+            parse_deadlines (node);
+        }
         else {
             g_warning ("Error: unrecognized tag '%s'", (gchar*) node->name);
         }
@@ -131,11 +263,17 @@ void build_hierarchy_tree_from_xml (xmlDocPtr doc)
         hierarchy_node_set_save_path (DEFAULT_SAVE_PATH);
 
     Cache = nodes_cache_new ();
+
+    preload_metadata ();
 }
 
 void destroy_hierarchy_tree ()
 {
     g_object_unref (Cache);
+    metadata_journal_finish ();
+    mirror_cache_finish ();
+    g_object_unref (Queries);
+    Queries = NULL;
     g_object_unref (ExposingTree);
     hierarchy_node_set_save_path (NULL);
     properties_pool_finish ();
@@ -167,11 +305,7 @@ static ItemHandler* root_item ()
     static ItemHandler *ret     = NULL;
 
     if (ret == NULL) {
-        ret = g_object_new (ITEM_HANDLER_TYPE,
-                            "type", ITEM_IS_STATIC_FOLDER,
-                            "node", ExposingTree,
-                            "file_path", getenv ("HOME"),
-                            "exposed_name", "/", NULL);
+        ret = item_handler_new (ITEM_IS_STATIC_FOLDER, ExposingTree, NULL, NULL, "/", getenv ("HOME"));
     }
 
     return ret;
@@ -200,6 +334,13 @@ ItemHandler* verify_exposed_path_in_folder (HierarchyNode *level, ItemHandler *r
     GList *children;
     ItemHandler *ret;
 
+    /*
+        Inside mirror nodes the real path is computed directly, and the ancestors are built
+        level by level without listing their contents
+    */
+    if (level != NULL && hierarchy_node_get_mirror_child (level, root, path, &ret))
+        return ret;
+
     if (level == NULL)
         children = item_handler_get_children (root);
     else
@@ -240,11 +381,10 @@ ItemHandler* verify_exposed_path (const gchar *path)
         level = ExposingTree;
 
         /*
-            Note: here is not suggested to directly check existing files if the node is a
-            mirror_content, because the complete chain of parents items is required when (for
-            example) creating a new file (to rebuild the complete real path to touch). Perhaps is
-            a good idea to shorthand here access to directly mapped filesystem, but adopt a
-            different strategy in ifs_create()
+            Note: the complete chain of parents items is required when (for example) creating
+            a new file (to rebuild the complete real path to touch), so items are resolved level
+            by level also in mirror_content nodes. There verify_exposed_path_in_folder() builds
+            each of them directly, without listing the folders
         */
 
         for (iter = path_tokens; iter; iter = g_list_next (iter)) {
@@ -304,43 +444,114 @@ HierarchyNode* node_at_path (const gchar *path)
     return level;
 }
 
+/*
+    Contents are copied with the cheapest available mean: the file is cloned if the
+    filesystem supports reflinks, else copied by the kernel, and only as last resort passed
+    through a (bounded) buffer in userspace. Each fallback continues from where the previous
+    attempt stopped
+*/
+static int copy_contents (int from, int to)
+{
+    ssize_t len;
+    ssize_t written;
+    ssize_t done;
+    gchar *buffer;
+
+#ifdef FICLONE
+    if (ioctl (to, FICLONE, from) == 0)
+        return 0;
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+    do {
+        len = copy_file_range (from, NULL, to, NULL, COPY_BUFFER_SIZE * 64, 0);
+    } while (len > 0 || (len == -1 && errno == EINTR));
+
+    if (len == 0)
+        return 0;
+    else if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP)
+        return -errno;
+#endif
+
+    buffer = g_malloc (COPY_BUFFER_SIZE);
+
+    while ((len = read (from, buffer, COPY_BUFFER_SIZE)) != 0) {
+        if (len == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (done = 0; done < len; done += written) {
+            written = write (to, buffer + done, len - done);
+
+            if (written == -1) {
+                if (errno == EINTR) {
+                    written = 0;
+                    continue;
+                }
+
+                len = -1;
+                break;
+            }
+        }
+
+        if (len == -1)
+            break;
+    }
+
+    g_free (buffer);
+    return (len == -1 ? -errno : 0);
+}
+
 int replace_hierarchy_node (ItemHandler *old_item, ItemHandler *new_item)
 {
-    int stat;
     int first;
     int second;
     int error;
-    gchar *buffer;
-    struct stat sbuf;
+    const gchar *old_path;
+    const gchar *new_path;
 
     error = 0;
     first = -1;
     second = -1;
 
-    stat = item_handler_stat (old_item, &sbuf);
-    if (stat != 0)
-        return stat;
+    old_path = item_handler_real_path (old_item);
+    if (old_path == NULL)
+        return -ENOENT;
+
+    /*
+        When both files are on the same filesystem, they are just renamed and nothing is
+        copied. Metadata of the old item are anyway dropped, while the file itself is already
+        gone from his previous location (or is the same of the new item)
+    */
+    new_path = item_handler_real_path (new_item);
+
+    if (new_path != NULL && strcmp (old_path, new_path) == 0) {
+        item_handler_forget_metadata (old_item);
+        return 0;
+    }
+
+    if (new_path != NULL) {
+        if (rename (old_path, new_path) == 0) {
+            item_handler_forget_metadata (old_item);
+            return 0;
+        }
+        else if (errno != EXDEV) {
+            return -errno;
+        }
+    }
 
     first = item_handler_open (old_item, O_RDONLY);
     if (first < 0) {
         error = first;
     }
     else {
-        second = item_handler_open (new_item, O_WRONLY);
-        if (second < 0) {
+        second = item_handler_open (new_item, O_WRONLY | O_TRUNC);
+        if (second < 0)
             error = second;
-        }
-        else {
-            buffer = alloca (sbuf.st_size);
-
-            if (read (first, buffer, sbuf.st_size) == -1) {
-                error = -errno;
-            }
-            else {
-                if (write (second, buffer, sbuf.st_size) == -1)
-                    error = -errno;
-            }
-        }
+        else
+            error = copy_contents (first, second);
     }
 
     if (first >= 0)
@@ -382,6 +593,31 @@ NodesCache* get_cache_reference ()
     return Cache;
 }
 
+QueryCache* get_query_cache_reference ()
+{
+    return Queries;
+}
+
+HierarchyNode* get_exposing_tree_reference ()
+{
+    return ExposingTree;
+}
+
+/*
+    The mountpoint is provided by the FUSE frontend once mounted, and is NULL when the
+    hierarchy is explored without mounting it (as in fster-analyse)
+*/
+void set_mountpoint_reference (const gchar *path)
+{
+    g_free (Mountpoint);
+    Mountpoint = g_strdup (path);
+}
+
+const gchar* get_mountpoint_reference ()
+{
+    return Mountpoint;
+}
+
 void set_user_param (gchar *name, gchar *value)
 {
     if (Params == NULL)
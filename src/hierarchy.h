@@ -25,11 +25,13 @@
 #include "item-handler.h"
 #include "contents-plugin.h"
 #include "nodes-cache.h"
+#include "query-cache.h"
 
 #define DUMMY_FILEPATH                      "/tmp/.fster_dummy_reference"
 #define DUMMY_DIRPATH                       "/tmp/.fster_dummy_folder"
 #define FAKE_SAVING_FOLDER                  "/tmp/.fster_contents"
 
+xmlDocPtr           read_configuration_file                 (const gchar *path);
 void                build_hierarchy_tree_from_xml           (xmlDocPtr doc);
 void                destroy_hierarchy_tree                  ();
 ContentsPlugin*     retrieve_contents_plugin                (gchar *name);
@@ -40,6 +42,10 @@ HierarchyNode*      node_at_path                            (const gchar *path);
 int                 replace_hierarchy_node                  (ItemHandler *old_item, ItemHandler *new_item);
 
 NodesCache*         get_cache_reference                     ();
+QueryCache*         get_query_cache_reference               ();
+HierarchyNode*      get_exposing_tree_reference             ();
+void                set_mountpoint_reference                (const gchar *path);
+const gchar*        get_mountpoint_reference                ();
 
 void                set_user_param                          (gchar *name, gchar *value);
 const gchar*        get_user_param                          (gchar *name);
@@ -21,6 +21,10 @@
 #include "property-handler.h"
 #include "hierarchy.h"
 #include "utils.h"
+#include "metadata-journal.h"
+#include "query-stats.h"
+#include "stat-batch.h"
+#include "mirror-cache.h"
 
 #define ITEM_HANDLER_GET_PRIVATE(obj)       (G_TYPE_INSTANCE_GET_PRIVATE ((obj), ITEM_HANDLER_TYPE, ItemHandlerPrivate))
 
@@ -33,6 +37,31 @@
 
 #define IS_MIRROR(__type)                   (__type == ITEM_IS_MIRROR_ITEM || __type == ITEM_IS_MIRROR_FOLDER)
 
+#define IS_TIMESTAMP(__type)                (__type == PROPERTY_TYPE_DATE || __type == PROPERTY_TYPE_DATETIME)
+
+/*
+    Prefetched children not consumed within this time (in microseconds) are considered stale
+*/
+#define PREFETCH_VALIDITY                   (10 * G_USEC_PER_SEC)
+
+typedef struct {
+    gint64          time;
+    guint           generation;     // of the query cache, when rows have been fetched
+    GPtrArray       *rows;
+} PrefetchedRows;
+
+/*
+    Metadata are kept in an array sorted by property id: items usually carry just a few of
+    them, so a binary search in a contiguous block is cheaper than hashing names, and a single
+    slot holds both the known value and the flag marking it as still to be saved
+*/
+typedef struct {
+    guint           property    : 31;
+    guint           dirty       : 1;
+    gchar           *value;         // NULL if known to be not assigned
+    PropertyValue   decoded;
+} MetadataSlot;
+
 struct _ItemHandlerPrivate {
     CONTENT_TYPE    type;
 
@@ -40,13 +69,15 @@ struct _ItemHandlerPrivate {
     HierarchyNode   *node;
     gchar           *exposed_name;
     gchar           *file_path;
+    guint           opened;         // sessions opened with item_handler_open()
 
     ContentsPlugin  *contents;
 
     gboolean        newly_allocated;
+    guint64         pending;        // journal entry creating the resource, while subject is unknown
     gchar           *subject;
-    GHashTable      *metadata;
-    GHashTable      *tosave;
+    GArray          *metadata;      // of MetadataSlot, allocated on first use
+    GHashTable      *prefetched;    // HierarchyNode -> PrefetchedRows
 };
 
 enum {
@@ -62,125 +93,197 @@ enum {
 
 G_DEFINE_TYPE (ItemHandler, item_handler, G_TYPE_OBJECT);
 
+static void free_prefetched_rows (PrefetchedRows *prefetched)
+{
+    g_ptr_array_unref (prefetched->rows);
+    g_free (prefetched);
+}
+
+static guint query_cache_generation ()
+{
+    QueryCache *cache;
+
+    cache = get_query_cache_reference ();
+    return cache != NULL ? query_cache_get_generation (cache) : 0;
+}
+
 /*
-    This is just a dummy function used to force key/value pair remove from the flushed hash table
+    Rows are stale once expired, or if the storage has been modified by FSter itself
+    (invalidating the whole query cache) after they have been fetched
 */
-static gboolean destroy_value_in_hash (gpointer key, gpointer value, gpointer user_data)
+static gboolean prefetched_rows_valid (PrefetchedRows *prefetched)
 {
-    return TRUE;
+    return (g_get_monotonic_time () - prefetched->time < PREFETCH_VALIDITY &&
+            prefetched->generation == query_cache_generation ());
 }
 
-static void flush_pending_metadata_to_save (ItemHandler *item, ...)
+static MetadataSlot* lookup_metadata_slot (ItemHandler *item, guint property, gboolean create)
 {
-    gboolean to_free;
+    register int first;
+    register int last;
+    register int middle;
+    MetadataSlot *slots;
+    MetadataSlot slot;
+
+    first = 0;
+
+    if (item->priv->metadata != NULL) {
+        slots = (MetadataSlot*) item->priv->metadata->data;
+        last = item->priv->metadata->len - 1;
+
+        while (first <= last) {
+            middle = (first + last) / 2;
+
+            if (slots [middle].property == property)
+                return &slots [middle];
+            else if (slots [middle].property < property)
+                first = middle + 1;
+            else
+                last = middle - 1;
+        }
+    }
+
+    if (create == FALSE)
+        return NULL;
+
+    if (item->priv->metadata == NULL)
+        item->priv->metadata = g_array_sized_new (FALSE, FALSE, sizeof (MetadataSlot), 4);
+
+    memset (&slot, 0, sizeof (MetadataSlot));
+    slot.property = property;
+    g_array_insert_val (item->priv->metadata, first, slot);
+    return &g_array_index (item->priv->metadata, MetadataSlot, first);
+}
+
+static void assign_slot_value (MetadataSlot *slot, Property *metadata, const gchar *value)
+{
+    g_free (slot->value);
+    slot->value = g_strdup (value);
+    property_decode_value (metadata, value, &(slot->decoded));
+}
+
+static void clear_dirty_metadata (ItemHandler *item)
+{
+    register int i;
+    MetadataSlot *slot;
+
+    if (item->priv->metadata == NULL)
+        return;
+
+    for (i = 0; i < item->priv->metadata->len; i++) {
+        slot = &g_array_index (item->priv->metadata, MetadataSlot, i);
+        slot->dirty = FALSE;
+    }
+}
+
+static gboolean has_dirty_metadata (ItemHandler *item)
+{
+    register int i;
+
+    if (item->priv->metadata == NULL)
+        return FALSE;
+
+    for (i = 0; i < item->priv->metadata->len; i++)
+        if (g_array_index (item->priv->metadata, MetadataSlot, i).dirty == TRUE)
+            return TRUE;
+
+    return FALSE;
+}
+
+/*
+    Collects metadata of @item in the form "predicate value ; predicate value". If @only_dirty
+    is TRUE only values not yet saved are included. All values are marked as saved
+*/
+static gchar* collect_pending_statements (ItemHandler *item, gboolean only_dirty)
+{
+    register int i;
     gchar *stats;
-    gchar *query;
-    gchar *useless;
-    gchar *uri;
-    va_list params;
-    gpointer key;
-    gpointer value;
     GList *statements;
-    GHashTable *table;
-    GHashTableIter iter;
-    GVariant *results;
-    GVariant *rows;
-    GVariant *sub_value;
-    GVariant *sub_sub_value;
-    GVariantIter r_iter;
-    GVariantIter sub_iter;
-    GVariantIter sub_sub_iter;
-    GError *error;
+    MetadataSlot *slot;
     Property *prop;
 
+    if (item->priv->metadata == NULL)
+        return NULL;
+
     statements = NULL;
-    va_start (params, item);
-
-    while ((table = va_arg (params, GHashTable*)) != NULL) {
-        to_free = va_arg (params, gboolean);
-        g_hash_table_iter_init (&iter, table);
-
-        while (g_hash_table_iter_next (&iter, &key, &value)) {
-            prop = properties_pool_get_by_name ((gchar*) key);
-
-            switch (property_get_datatype (prop)) {
-                case PROPERTY_TYPE_STRING:
-                    stats = g_strdup_printf ("%s \"%s\"", (gchar*) key, (gchar*) value);
-                    statements = g_list_prepend (statements, stats);
-                    break;
-
-                case PROPERTY_TYPE_RESOURCE:
-                    stats = g_strdup_printf ("%s <%s>", (gchar*) key, (gchar*) value);
-                    statements = g_list_prepend (statements, stats);
-                    break;
-
-                default:
-                    stats = g_strdup_printf ("%s %s", (gchar*) key, (gchar*) value);
-                    statements = g_list_prepend (statements, stats);
-                    break;
-            }
-        }
 
-        if (to_free == TRUE)
-            g_hash_table_foreach_remove (table, destroy_value_in_hash, NULL);
+    for (i = 0; i < item->priv->metadata->len; i++) {
+        slot = &g_array_index (item->priv->metadata, MetadataSlot, i);
+        if (slot->value == NULL || (only_dirty == TRUE && slot->dirty == FALSE))
+            continue;
+
+        prop = properties_pool_get_by_id (slot->property);
+
+        switch (property_get_datatype (prop)) {
+            case PROPERTY_TYPE_STRING:
+                stats = g_strdup_printf ("%s \"%s\"", property_get_name (prop), slot->value);
+                statements = g_list_prepend (statements, stats);
+                break;
+
+            case PROPERTY_TYPE_RESOURCE:
+                stats = g_strdup_printf ("%s <%s>", property_get_name (prop), slot->value);
+                statements = g_list_prepend (statements, stats);
+                break;
+
+            default:
+                stats = g_strdup_printf ("%s %s", property_get_name (prop), slot->value);
+                statements = g_list_prepend (statements, stats);
+                break;
+        }
     }
 
-    va_end (params);
+    clear_dirty_metadata (item);
 
     if (statements == NULL)
-        return;
+        return NULL;
 
-    stats = from_glist_to_string (statements, " ; ", TRUE);
-    query = g_strdup_printf ("INSERT { _:item a nfo:FileDataObject ; a nie:InformationElement ; %s }", stats);
-    g_free (stats);
+    return from_glist_to_string (statements, " ; ", TRUE);
+}
 
-    error = NULL;
-    results = execute_update_blank (query, &error);
+/*
+    Changes are not saved immediately, but passed to the metadata journal. When a new resource
+    is created its subject will be assigned to @owner, if not NULL, once known
+*/
+static void flush_pending_metadata_to_save (ItemHandler *item, GObject *owner)
+{
+    gchar *statements;
 
-    if (error != NULL) {
-        g_warning ("Error while saving metadata: %s", error->message);
-        g_error_free (error);
+    if (item->priv->newly_allocated == TRUE) {
+        statements = collect_pending_statements (item, FALSE);
+        if (statements == NULL)
+            return;
+
+        item->priv->pending = metadata_journal_insert (statements, owner);
+        item->priv->newly_allocated = FALSE;
     }
     else {
-        /*
-            To know how to iter a SparqlUpdateBlank response, cfr.
-            http://mail.gnome.org/archives/commits-list/2011-February/msg05384.html
-        */
-        g_variant_iter_init (&r_iter, results);
-
-        if ((rows = g_variant_iter_next_value (&r_iter))) {
-            g_variant_iter_init (&sub_iter, rows);
-
-            if ((sub_value = g_variant_iter_next_value (&sub_iter))) {
-                g_variant_iter_init (&sub_sub_iter, sub_value);
-
-                if ((sub_sub_value = g_variant_iter_next_value (&sub_sub_iter))) {
-                    useless = NULL;
-                    uri = NULL;
-                    g_variant_get (sub_sub_value, "a{ss}", &useless, &uri);
-                    item->priv->subject = g_strdup (uri);
-                    g_variant_unref (sub_sub_value);
-                }
-
-                g_variant_unref (sub_value);
-            }
+        statements = collect_pending_statements (item, TRUE);
+        if (statements == NULL)
+            return;
 
-            g_variant_unref (rows);
-        }
+        metadata_journal_update (item->priv->pending != 0 ? NULL : item->priv->subject, item->priv->pending, statements);
     }
 
-    g_free (query);
+    g_free (statements);
 }
 
 static void item_handler_finalize (GObject *item)
 {
+    register int i;
     ItemHandler *ret;
 
     ret = ITEM_HANDLER (item);
 
-    item_handler_flush (ret);
-    g_hash_table_destroy (ret->priv->metadata);
-    g_hash_table_destroy (ret->priv->tosave);
+    flush_pending_metadata_to_save (ret, NULL);
+
+    if (ret->priv->metadata != NULL) {
+        for (i = 0; i < ret->priv->metadata->len; i++)
+            g_free (g_array_index (ret->priv->metadata, MetadataSlot, i).value);
+        g_array_free (ret->priv->metadata, TRUE);
+    }
+
+    if (ret->priv->prefetched != NULL)
+        g_hash_table_destroy (ret->priv->prefetched);
 
     if (ret->priv->exposed_name != NULL)
         g_free (ret->priv->exposed_name);
@@ -189,32 +292,6 @@ static void item_handler_finalize (GObject *item)
         g_free (ret->priv->file_path);
 }
 
-static gchar* escape_exposed_name (const gchar *str)
-{
-    register int i;
-    register int e;
-    int len;
-    gchar *final;
-
-    if (str == NULL || *str == '\0')
-        return g_strdup ("");
-
-    len = strlen (str);
-    final = alloca (len);
-
-    for (i = 0, e = 0; i < len; i++, e++) {
-        if (str [i] == '/') {
-            final [e] = '\\';
-        }
-        else {
-            final [e] = str [i];
-        }
-    }
-
-    final [e] = '\0';
-    return g_strdup (final);
-}
-
 static void item_handler_set_property (GObject *object, guint property_id, const GValue *value, GParamSpec *pspec)
 {
     ItemHandler *self = ITEM_HANDLER (object);
@@ -241,13 +318,14 @@ static void item_handler_set_property (GObject *object, guint property_id, const
         case PROP_EXPOSED:
             if (self->priv->exposed_name != NULL)
                 g_free (self->priv->exposed_name);
-            self->priv->exposed_name = escape_exposed_name (g_value_get_string (value));
+            self->priv->exposed_name = item_handler_escape_name (g_value_get_string (value));
             break;
 
         case PROP_SUBJECT:
             if (self->priv->subject != NULL)
                 g_free (self->priv->subject);
             self->priv->subject = g_value_dup_string (value);
+            self->priv->pending = 0;
             break;
 
         case PROP_CONTENTS:
@@ -311,6 +389,10 @@ static void item_handler_class_init (ItemHandlerClass *klass)
     gobject_class->set_property = item_handler_set_property;
     gobject_class->get_property = item_handler_get_property;
 
+    /*
+        Properties are kept for plugins and external users, but internally items are built
+        with item_handler_new(), which assigns the fields directly
+    */
     param_spec = g_param_spec_int ("type",
                                         "Item's type",
                                         "Type of the item",
@@ -367,9 +449,78 @@ static void item_handler_init (ItemHandler *item)
 {
     item->priv = ITEM_HANDLER_GET_PRIVATE (item);
     memset (item->priv, 0, sizeof (ItemHandlerPrivate));
+}
+
+/**
+ * item_handler_escape_name:
+ * @str: name to be exposed on the filesystem
+ *
+ * Replaces characters not permitted in a file name, as done for the names
+ * assigned to items
+ *
+ * Return value: a newly allocated string
+ **/
+gchar* item_handler_escape_name (const gchar *str)
+{
+    register int i;
+    register int e;
+    int len;
+    gchar *final;
+
+    if (str == NULL || *str == '\0')
+        return g_strdup ("");
+
+    len = strlen (str);
+    final = alloca (len + 1);
+
+    for (i = 0, e = 0; i < len; i++, e++) {
+        if (str [i] == '/') {
+            final [e] = '\\';
+        }
+        else {
+            final [e] = str [i];
+        }
+    }
+
+    final [e] = '\0';
+    return g_strdup (final);
+}
+
+/**
+ * item_handler_new:
+ * @type: type of the new #ItemHandler
+ * @node: logical node describing the item in the hierarchy
+ * @parent: direct item of the upper level in the hierarchy, or NULL
+ * @subject: identifier of the item in the metadata storage, or NULL
+ * @exposed_name: name of the item on the filesystem, or NULL
+ * @file_path: path of the effective file for the item, or NULL
+ *
+ * Builds an #ItemHandler initializing his fields directly, without the
+ * overhead of the GObject properties machinery. To be preferred when many
+ * items are created at once, as when listing a folder
+ *
+ * Return value: a newly allocated #ItemHandler
+ **/
+ItemHandler* item_handler_new (CONTENT_TYPE type, HierarchyNode *node, ItemHandler *parent,
+                               const gchar *subject, const gchar *exposed_name, const gchar *file_path)
+{
+    ItemHandler *ret;
+
+    ret = g_object_new (ITEM_HANDLER_TYPE, NULL);
+    ret->priv->type = type;
+
+    if (node != NULL)
+        ret->priv->node = g_object_ref (node);
+    if (parent != NULL)
+        ret->priv->parent = g_object_ref (parent);
+    if (subject != NULL)
+        ret->priv->subject = g_strdup (subject);
+    if (exposed_name != NULL)
+        ret->priv->exposed_name = item_handler_escape_name (exposed_name);
+    if (file_path != NULL)
+        ret->priv->file_path = g_strdup (file_path);
 
-    item->priv->metadata = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
-    item->priv->tosave = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    return ret;
 }
 
 /**
@@ -388,11 +539,25 @@ ItemHandler* item_handler_new_alloc (CONTENT_TYPE type, HierarchyNode *node, Ite
 {
     ItemHandler *ret;
 
-    ret = g_object_new (ITEM_HANDLER_TYPE, "type", type, "node", node, "parent", parent, NULL);
+    ret = item_handler_new (type, node, parent, NULL, NULL, NULL);
     ret->priv->newly_allocated = TRUE;
     return ret;
 }
 
+/**
+ * item_handler_set_contents_handler:
+ * @item: an #ItemHandler
+ * @contents: the #ContentsPlugin managing the contents of @item
+ *
+ * As setting the "contents_handler" property, but without the overhead of
+ * the GObject properties machinery, for items built in bulk. The plugin is
+ * not referenced, as it is owned by the #HierarchyNode of @item
+ **/
+void item_handler_set_contents_handler (ItemHandler *item, ContentsPlugin *contents)
+{
+    item->priv->contents = contents;
+}
+
 /**
  * item_handler_get_format:
  * @item: an #ItemHandler
@@ -505,7 +670,7 @@ const gchar* item_handler_exposed_name (ItemHandler *item)
         }
         else {
             name = hierarchy_node_exposed_name_for_item (item_handler_get_logic_node (item), item);
-            g_object_set (item, "exposed_name", name, NULL);
+            item->priv->exposed_name = item_handler_escape_name (name);
             g_free (name);
         }
     }
@@ -513,38 +678,66 @@ const gchar* item_handler_exposed_name (ItemHandler *item)
     return (const gchar*) item->priv->exposed_name;
 }
 
-static const gchar* fetch_metadata (ItemHandler *item, const gchar *metadata)
+/*
+    Values assigned locally and not yet saved are newer than the ones in the storage, and are
+    not overwritten
+*/
+static void load_metadata_value (ItemHandler *item, Property *metadata, const gchar *value)
+{
+    MetadataSlot *slot;
+
+    slot = lookup_metadata_slot (item, property_get_id (metadata), TRUE);
+
+    if (slot->dirty == FALSE)
+        assign_slot_value (slot, metadata, value);
+}
+
+static const gchar* fetch_metadata (ItemHandler *item, Property *metadata)
 {
     gchar *query;
     gchar *ret;
-    gchar *str;
+    gchar **row;
+    MetadataSlot *slot;
+    const gchar *origin;
+    const gchar *subject;
+    GPtrArray *rows;
     GVariant *response;
-    GVariantIter *iter;
-    GVariantIter *subiter;
     GError *error;
 
+    /*
+        The resource has not been saved (yet, or at all): nothing to fetch
+    */
+    subject = item_handler_get_subject (item);
+    if (subject == NULL)
+        return NULL;
+
     ret = NULL;
     error = NULL;
-    query = g_strdup_printf ("SELECT ?a WHERE { <%s> %s ?a }", item->priv->subject, metadata);
+    query = g_strdup_printf ("SELECT ?a WHERE { <%s> %s ?a }", subject, property_get_name (metadata));
 
+    origin = query_stats_set_origin (hierarchy_node_get_label (item->priv->node));
     response = execute_query (query, &error);
+    query_stats_set_origin (origin);
 
     if (response == NULL) {
         g_warning ("Unable to fetch metadata: %s", error->message);
         g_error_free (error);
     }
     else {
-        iter = NULL;
-        subiter = NULL;
+        rows = query_rows_from_variant (response);
+        g_variant_unref (response);
 
-        g_variant_get (response, "(aas)", &iter);
+        if (rows->len != 0) {
+            row = g_ptr_array_index (rows, 0);
 
-        if (g_variant_iter_loop (iter, "as", &subiter) && (str = NULL, g_variant_iter_loop (subiter, "s", &str))) {
-            ret = g_strdup (str);
-            g_hash_table_insert (item->priv->metadata, g_strdup (metadata), ret);
+            if (row [0] != NULL) {
+                slot = lookup_metadata_slot (item, property_get_id (metadata), TRUE);
+                assign_slot_value (slot, metadata, row [0]);
+                ret = slot->value;
+            }
         }
 
-        g_variant_unref (response);
+        g_ptr_array_unref (rows);
     }
 
     g_free (query);
@@ -556,12 +749,16 @@ static const gchar* fetch_metadata (ItemHandler *item, const gchar *metadata)
  * @item: an #ItemHandler
  *
  * Retrieves the subject for @item in Tracker. May be valid only on items of
- * type ITEM_IS_VIRTUAL_ITEM
+ * type ITEM_IS_VIRTUAL_ITEM. If @item has just been created, waits for Tracker
+ * to assign it
  *
  * Return value: the subject used to identify the @item
  */
 const gchar* item_handler_get_subject (ItemHandler *item)
 {
+    if (item->priv->pending != 0)
+        metadata_journal_barrier ();
+
     return (const gchar*) item->priv->subject;
 }
 
@@ -595,7 +792,13 @@ gboolean item_handler_type_has_metadata (ItemHandler *item)
  **/
 gboolean item_handler_contains_metadata (ItemHandler *item, const gchar *metadata)
 {
-    return g_hash_table_lookup_extended (item->priv->metadata, metadata, NULL, NULL);
+    Property *prop;
+
+    prop = properties_pool_get_by_name ((gchar*) metadata);
+    if (prop == NULL)
+        return FALSE;
+
+    return (lookup_metadata_slot (item, property_get_id (prop), FALSE) != NULL);
 }
 
 /**
@@ -611,7 +814,8 @@ gboolean item_handler_contains_metadata (ItemHandler *item, const gchar *metadat
  **/
 const gchar* item_handler_get_metadata (ItemHandler *item, const gchar *metadata)
 {
-    const gchar *ret;
+    MetadataSlot *slot;
+    Property *prop;
 
     g_assert (item != NULL);
     g_assert (metadata != NULL);
@@ -621,13 +825,46 @@ const gchar* item_handler_get_metadata (ItemHandler *item, const gchar *metadata
         return NULL;
     }
 
-    ret = NULL;
+    prop = properties_pool_get_by_name ((gchar*) metadata);
+    if (prop == NULL)
+        return NULL;
 
-    if (g_hash_table_lookup_extended (item->priv->metadata, metadata, NULL, (gpointer*) &ret) == FALSE)
-        if (g_hash_table_lookup_extended (item->priv->tosave, metadata, NULL, (gpointer*) &ret) == FALSE)
-            ret = fetch_metadata (item, metadata);
+    slot = lookup_metadata_slot (item, property_get_id (prop), FALSE);
+    if (slot != NULL)
+        return (const gchar*) slot->value;
 
-    return ret;
+    return fetch_metadata (item, prop);
+}
+
+/**
+ * item_handler_get_decoded_metadata:
+ * @item: an #ItemHandler
+ * @metadata: the name of the metadata to retrieve
+ * @decoded: structure to fill with the decoded value
+ *
+ * Retrieves @metadata in @item already decoded in his native type. Only the
+ * local structure is checked, as in item_handler_contains_metadata()
+ *
+ * Return value: TRUE if @decoded has been filled with a valid value, FALSE
+ * otherwise
+ **/
+gboolean item_handler_get_decoded_metadata (ItemHandler *item, const gchar *metadata, PropertyValue *decoded)
+{
+    MetadataSlot *slot;
+    Property *prop;
+
+    decoded->valid = FALSE;
+
+    prop = properties_pool_get_by_name ((gchar*) metadata);
+    if (prop == NULL)
+        return FALSE;
+
+    slot = lookup_metadata_slot (item, property_get_id (prop), FALSE);
+    if (slot == NULL)
+        return FALSE;
+
+    *decoded = slot->decoded;
+    return decoded->valid;
 }
 
 /**
@@ -642,43 +879,51 @@ const gchar* item_handler_get_metadata (ItemHandler *item, const gchar *metadata
  **/
 GList* item_handler_get_all_metadata (ItemHandler *item)
 {
+    register int i;
     gchar *query;
-    gchar *predicate;
-    gchar *value;
+    gchar **row;
+    const gchar *origin;
+    const gchar *subject;
     GList *ret;
+    GPtrArray *rows;
     GVariant *response;
-    GVariantIter *iter;
-    GVariantIter *subiter;
     GError *error;
     Property *prop;
 
+    subject = item_handler_get_subject (item);
+    if (subject == NULL)
+        return NULL;
+
     ret = NULL;
     error = NULL;
-    query = g_strdup_printf ("SELECT ?predicate ?value WHERE { <%s> ?predicate ?value }", item_handler_get_subject (item));
+    query = g_strdup_printf ("SELECT ?predicate ?value WHERE { <%s> ?predicate ?value }", subject);
+
+    origin = query_stats_set_origin (hierarchy_node_get_label (item->priv->node));
     response = execute_query (query, &error);
+    query_stats_set_origin (origin);
 
     if (response == NULL) {
         g_warning ("Unable to fetch all metadata: %s", error->message);
         g_error_free (error);
     }
     else {
-        iter = NULL;
-        subiter = NULL;
+        rows = query_rows_from_variant (response);
+        g_variant_unref (response);
 
-        g_variant_get (response, "(aas)", &iter);
+        for (i = 0; i < rows->len; i++) {
+            row = g_ptr_array_index (rows, i);
+            if (row [0] == NULL || row [1] == NULL)
+                continue;
 
-        while (g_variant_iter_loop (iter, "as", &subiter)) {
-            predicate = NULL;
-            value = NULL;
+            prop = properties_pool_get_by_uri (row [0]);
+            if (prop == NULL)
+                continue;
 
-            if (g_variant_iter_loop (subiter, "s", &predicate) && g_variant_iter_loop (subiter, "s", &value)) {
-                prop = properties_pool_get_by_uri (predicate);
-                item_handler_load_metadata (item, property_get_name (prop), value);
-                ret = g_list_prepend (ret, prop);
-            }
+            load_metadata_value (item, prop, row [1]);
+            ret = g_list_prepend (ret, prop);
         }
 
-        g_variant_unref (response);
+        g_ptr_array_unref (rows);
     }
 
     g_free (query);
@@ -697,13 +942,21 @@ GList* item_handler_get_all_metadata (ItemHandler *item)
  **/
 void item_handler_set_metadata (ItemHandler *item, const char *metadata, const gchar *value)
 {
+    MetadataSlot *slot;
+    Property *prop;
+
     if (HAS_NOT_META (item_handler_get_format (item))) {
         g_warning ("Attempt to access metadata in non-semantic hierarchy node");
         return;
     }
 
-    g_hash_table_insert (item->priv->metadata, g_strdup (metadata), g_strdup (value));
-    g_hash_table_insert (item->priv->tosave, g_strdup (metadata), g_strdup (value));
+    prop = properties_pool_get_by_name ((gchar*) metadata);
+    if (prop == NULL)
+        return;
+
+    slot = lookup_metadata_slot (item, property_get_id (prop), TRUE);
+    assign_slot_value (slot, prop, value);
+    slot->dirty = TRUE;
 }
 
 /**
@@ -714,16 +967,103 @@ void item_handler_set_metadata (ItemHandler *item, const char *metadata, const g
  *
  * Sets a metadata named @metadata in @item with provided @value. Different
  * from item_handler_set_metadata() since this is used only to populate the
- * local data structure and has no correlation with permanent storage
+ * local data structure and has no correlation with permanent storage.
+ * @value may be NULL, to mark @metadata as known to be not assigned to @item
+ * and avoid to look for it again in Tracker
  */
 void item_handler_load_metadata (ItemHandler *item, const gchar *metadata, const gchar *value)
 {
+    Property *prop;
+
     if (HAS_NOT_META (item_handler_get_format (item))) {
         g_warning ("Attempt to access metadata in non-semantic hierarchy node");
         return;
     }
 
-    g_hash_table_insert (item->priv->metadata, g_strdup (metadata), g_strdup (value));
+    prop = properties_pool_get_by_name ((gchar*) metadata);
+    if (prop == NULL)
+        return;
+
+    load_metadata_value (item, prop, value);
+}
+
+/**
+ * item_handler_set_prefetched_children:
+ * @item: an #ItemHandler
+ * @node: the #HierarchyNode the rows are related to
+ * @rows: array of rows describing the children of @item for @node, as
+ * retrieved from Tracker
+ *
+ * Attaches to @item the already fetched description of his children for
+ * @node, so that the next listing may avoid to query them again. The array is
+ * referenced by @item
+ **/
+void item_handler_set_prefetched_children (ItemHandler *item, HierarchyNode *node, GPtrArray *rows)
+{
+    PrefetchedRows *prefetched;
+
+    if (item->priv->prefetched == NULL)
+        item->priv->prefetched = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) free_prefetched_rows);
+
+    prefetched = g_new0 (PrefetchedRows, 1);
+    prefetched->time = g_get_monotonic_time ();
+    prefetched->generation = query_cache_generation ();
+    prefetched->rows = g_ptr_array_ref (rows);
+    g_hash_table_insert (item->priv->prefetched, node, prefetched);
+}
+
+/**
+ * item_handler_has_prefetched_children:
+ * @item: an #ItemHandler
+ * @node: the #HierarchyNode for which look for rows
+ *
+ * To know if @item already holds valid prefetched children for @node
+ *
+ * Return value: TRUE if rows for @node are attached to @item and still
+ * valid, FALSE otherwise
+ **/
+gboolean item_handler_has_prefetched_children (ItemHandler *item, HierarchyNode *node)
+{
+    PrefetchedRows *prefetched;
+
+    if (item->priv->prefetched == NULL)
+        return FALSE;
+
+    prefetched = g_hash_table_lookup (item->priv->prefetched, node);
+    return (prefetched != NULL && prefetched_rows_valid (prefetched));
+}
+
+/**
+ * item_handler_steal_prefetched_children:
+ * @item: an #ItemHandler
+ * @node: the #HierarchyNode for which look for rows
+ *
+ * Retrieves the rows previously attached with
+ * item_handler_set_prefetched_children() and detaches them from @item, so
+ * that each prefetch is consumed at most once. Expired rows, or rows fetched
+ * before the last invalidation of the query cache, are dropped
+ *
+ * Return value: an array of rows to be freed with g_ptr_array_unref(), or
+ * NULL if nothing valid has been prefetched for @node
+ **/
+GPtrArray* item_handler_steal_prefetched_children (ItemHandler *item, HierarchyNode *node)
+{
+    GPtrArray *ret;
+    PrefetchedRows *prefetched;
+
+    if (item->priv->prefetched == NULL)
+        return NULL;
+
+    prefetched = g_hash_table_lookup (item->priv->prefetched, node);
+    if (prefetched == NULL)
+        return NULL;
+
+    ret = NULL;
+    if (prefetched_rows_valid (prefetched))
+        ret = g_ptr_array_ref (prefetched->rows);
+
+    g_hash_table_remove (item->priv->prefetched, node);
+    return ret;
 }
 
 static const gchar* get_file_path (ItemHandler *item)
@@ -777,6 +1117,44 @@ static const gchar* get_some_file_path (ItemHandler *item)
         return DUMMY_FILEPATH;
 }
 
+/*
+    Mirror items are accessed with the *at() syscalls, relative to the handle kept for their
+    parent folder in the mirror cache, so that the kernel does not walk again the whole path.
+    For other items, or when no handle is available, AT_FDCWD is returned and @name is the
+    absolute path. The returned descriptor has to be released with release_at()
+*/
+static int resolve_at (ItemHandler *item, const gchar *path, const gchar **name)
+{
+    int len;
+    int fd;
+    ItemHandler *parent;
+
+    *name = path;
+    parent = item->priv->parent;
+
+    if (IS_MIRROR (item_handler_get_format (item)) && parent != NULL &&
+            item_handler_get_format (parent) == ITEM_IS_MIRROR_FOLDER && parent->priv->file_path != NULL) {
+        len = strlen (parent->priv->file_path);
+
+        if (strncmp (path, parent->priv->file_path, len) == 0 && path [len] == '/' && strchr (path + len + 1, '/') == NULL) {
+            fd = mirror_cache_acquire_handle (parent->priv->file_path);
+
+            if (fd != -1) {
+                *name = path + len + 1;
+                return fd;
+            }
+        }
+    }
+
+    return AT_FDCWD;
+}
+
+static void release_at (int dir)
+{
+    if (dir != AT_FDCWD)
+        mirror_cache_release_handle (dir);
+}
+
 /**
  * item_handler_open:
  * @item: an #ItemHandler
@@ -795,14 +1173,21 @@ static const gchar* get_some_file_path (ItemHandler *item)
 int item_handler_open (ItemHandler *item, int flags)
 {
     int ret;
+    int dir;
     const gchar *path;
+    const gchar *name;
 
     path = get_file_path (item);
 
     if (path != NULL) {
-        ret = open (path, flags);
+        dir = resolve_at (item, path, &name);
+        ret = openat (dir, name, flags);
+        release_at (dir);
+
         if (ret == -1)
             ret = -errno;
+        else
+            item->priv->opened++;
     }
     else {
         ret = -ENOENT;
@@ -822,12 +1207,40 @@ int item_handler_open (ItemHandler *item, int flags)
  **/
 void item_handler_close (ItemHandler *item, int fd)
 {
-    if (fd >= 0)
+    if (fd >= 0) {
         close (fd);
+        item->priv->opened--;
+    }
 
     g_object_unref (item);
 }
 
+/**
+ * item_handler_forget_metadata:
+ * @item: an #ItemHandler
+ *
+ * Removes all metadata related to the @item from Tracker, leaving untouched
+ * the real file it wraps. To be used when the file has already been moved
+ * elsewhere.
+ * Attention: this function do not update the running nodes cache, please
+ * provide elsewhere
+ */
+void item_handler_forget_metadata (ItemHandler *item)
+{
+    if (IS_VIRTUAL (item_handler_get_format (item)) == FALSE)
+        return;
+
+    /*
+        Metadata not yet saved are just dropped
+    */
+    clear_dirty_metadata (item);
+
+    if (item->priv->newly_allocated == TRUE)
+        item->priv->newly_allocated = FALSE;
+    else
+        metadata_journal_delete (item->priv->pending != 0 ? NULL : item->priv->subject, item->priv->pending);
+}
+
 /**
  * item_handler_remove:
  * @item: an #ItemHandler
@@ -843,22 +1256,8 @@ void item_handler_close (ItemHandler *item, int fd)
 int item_handler_remove (ItemHandler *item)
 {
     const gchar *id;
-    gchar *query;
-    GError *error;
 
-    if (IS_VIRTUAL (item_handler_get_format (item))) {
-        error = NULL;
-        id = item_handler_get_subject (item);
-        query = g_strdup_printf ("DELETE { <%s> ?predicate ?value } WHERE { <%s> ?predicate ?value }", id, id);
-        execute_update (query, &error);
-        g_free (query);
-
-        if (error != NULL) {
-            g_warning ("Error while removing item: %s", error->message);
-            g_error_free (error);
-            return -ENOENT;
-        }
-    }
+    item_handler_forget_metadata (item);
 
     id = get_file_path (item);
     if (id != NULL)
@@ -868,6 +1267,77 @@ int item_handler_remove (ItemHandler *item)
     return 0;
 }
 
+/*
+    Attributes are built only with metadata already loaded in the item (usually fetched
+    with the listing query), so to not access the backing file nor issue more queries.
+    Missing times are left to the epoch
+*/
+static void stat_from_metadata (ItemHandler *item, struct stat *sbuf)
+{
+    PropertyValue value;
+
+    memset (sbuf, 0, sizeof (struct stat));
+    sbuf->st_uid = getuid ();
+    sbuf->st_gid = getgid ();
+    sbuf->st_blksize = 4096;
+
+    if (item_handler_is_folder (item)) {
+        sbuf->st_mode = S_IFDIR | 0755;
+        sbuf->st_nlink = 2;
+    }
+    else {
+        sbuf->st_mode = S_IFREG | 0644;
+        sbuf->st_nlink = 1;
+
+        if (item_handler_get_decoded_metadata (item, "nie:byteSize", &value) && value.type == PROPERTY_TYPE_INTEGER)
+            sbuf->st_size = value.v.integer;
+
+        sbuf->st_blocks = (sbuf->st_size + 511) / 512;
+    }
+
+    if (item_handler_get_decoded_metadata (item, "nfo:fileLastModified", &value) && IS_TIMESTAMP (value.type))
+        sbuf->st_mtime = value.v.timestamp;
+
+    if (item_handler_get_decoded_metadata (item, "nfo:fileLastAccessed", &value) && IS_TIMESTAMP (value.type))
+        sbuf->st_atime = value.v.timestamp;
+    else
+        sbuf->st_atime = sbuf->st_mtime;
+
+    sbuf->st_ctime = sbuf->st_mtime;
+}
+
+/*
+    This is to force items listed under a <folder> node to appear as browseable folders.
+    For "mirror" items, we just get the original stat() result
+*/
+static void fix_folder_mode (ItemHandler *item, struct stat *sbuf)
+{
+    if (IS_MIRROR (item_handler_get_format (item)) == FALSE && item_handler_is_folder (item)) {
+        sbuf->st_mode &= ~S_IFREG;
+        sbuf->st_mode |= S_IFDIR;
+    }
+}
+
+/*
+    Attributes saved in metadata are trusted only while the file is not opened nor has
+    changes still to be saved, as they may be outdated, and if the size is known at all
+*/
+static gboolean synthesizes_stat (ItemHandler *item)
+{
+    PropertyValue value;
+
+    if (IS_VIRTUAL (item_handler_get_format (item)) == FALSE || hierarchy_node_stats_from_metadata (item->priv->node) == FALSE)
+        return FALSE;
+
+    if (item->priv->opened != 0 || has_dirty_metadata (item) == TRUE)
+        return FALSE;
+
+    if (item_handler_is_folder (item))
+        return TRUE;
+
+    return (item_handler_get_decoded_metadata (item, "nie:byteSize", &value) && value.type == PROPERTY_TYPE_INTEGER);
+}
+
 /**
  * item_handler_stat:
  * @item: an #ItemHandler
@@ -882,29 +1352,111 @@ int item_handler_remove (ItemHandler *item)
 int item_handler_stat (ItemHandler *item, struct stat *sbuf)
 {
     int res;
+    int dir;
     const gchar *path;
+    const gchar *name;
 
     if (item == NULL)
         return -ENOENT;
 
+    if (synthesizes_stat (item)) {
+        stat_from_metadata (item, sbuf);
+        return 0;
+    }
+
     path = get_some_file_path (item);
-    res = lstat (path, sbuf);
 
-    /*
-        This is to force items listed under a <folder> node to appear as browseable folders.
-        For "mirror" items, we just get the original stat() result
-    */
-    if (IS_MIRROR (item_handler_get_format (item)) == FALSE && item_handler_is_folder (item)) {
-        sbuf->st_mode &= ~S_IFREG;
-        sbuf->st_mode |= S_IFDIR;
+    if (IS_MIRROR (item_handler_get_format (item)) && mirror_cache_get_stat (path, sbuf))
+        return 0;
+
+    dir = resolve_at (item, path, &name);
+    res = fstatat (dir, name, sbuf, AT_SYMLINK_NOFOLLOW);
+    release_at (dir);
+
+    if (IS_MIRROR (item_handler_get_format (item))) {
+        if (res == -1)
+            return -errno;
+
+        mirror_cache_set_stat (path, sbuf);
+        return 0;
     }
 
+    fix_folder_mode (item, sbuf);
+
     if (res == -1)
         return -errno;
     else
         return 0;
 }
 
+/**
+ * item_handler_stat_batch:
+ * @items: list of #ItemHandler
+ * @sbufs: array of stat structs to be filled, as long as @items
+ * @results: array filled with the results for each item, as long as @items
+ *
+ * As item_handler_stat(), but for many items at once: the files wrapped by
+ * @items are stat()ed in parallel, so that listings of slow storages do not
+ * pay the latency of each file in sequence. Each element of @results is 0 if
+ * the relative struct in @sbufs has been filled correctly, or a negative
+ * value holding the relative errno
+ **/
+void item_handler_stat_batch (GList *items, struct stat *sbufs, int *results)
+{
+    register int i;
+    guint n;
+    guint len;
+    guint *slots;
+    GList *iter;
+    ItemHandler *item;
+    ItemHandler **targets;
+    StatRequest *requests;
+
+    len = g_list_length (items);
+    requests = g_new0 (StatRequest, len);
+    slots = g_new (guint, len);
+    targets = g_new (ItemHandler*, len);
+    n = 0;
+
+    /*
+        Paths are resolved here, as they may require a query to be issued in the current
+        operation
+    */
+    for (i = 0, iter = items; iter; i++, iter = g_list_next (iter)) {
+        item = (ItemHandler*) iter->data;
+
+        if (synthesizes_stat (item)) {
+            stat_from_metadata (item, &(sbufs [i]));
+            results [i] = 0;
+        }
+        else if (IS_MIRROR (item_handler_get_format (item)) && mirror_cache_get_stat (get_some_file_path (item), &(sbufs [i]))) {
+            results [i] = 0;
+        }
+        else {
+            requests [n].path = get_some_file_path (item);
+            requests [n].follow_links = FALSE;
+            slots [n] = i;
+            targets [n] = item;
+            n++;
+        }
+    }
+
+    stat_batch_run (requests, n);
+
+    for (i = 0; i < n; i++) {
+        sbufs [slots [i]] = requests [i].sbuf;
+        results [slots [i]] = requests [i].result;
+        fix_folder_mode (targets [i], &(sbufs [slots [i]]));
+
+        if (IS_MIRROR (item_handler_get_format (targets [i])) && requests [i].result == 0)
+            mirror_cache_set_stat (requests [i].path, &(requests [i].sbuf));
+    }
+
+    g_free (requests);
+    g_free (slots);
+    g_free (targets);
+}
+
 /**
  * item_handler_access:
  * @item: an #ItemHandler
@@ -918,13 +1470,17 @@ int item_handler_stat (ItemHandler *item, struct stat *sbuf)
 int item_handler_access (ItemHandler *item, int mask)
 {
     int res;
+    int dir;
     const gchar *path;
+    const gchar *name;
 
     if (item == NULL)
         return -ENOENT;
 
     path = get_some_file_path (item);
-    res = access (path, mask);
+    dir = resolve_at (item, path, &name);
+    res = faccessat (dir, name, mask, 0);
+    release_at (dir);
 
     if (res == -1)
         return -errno;
@@ -945,13 +1501,17 @@ int item_handler_access (ItemHandler *item, int mask)
 int item_handler_chmod (ItemHandler *item, mode_t mode)
 {
     int res;
+    int dir;
     const gchar *path;
+    const gchar *name;
 
     if (item == NULL)
         return -ENOENT;
 
     path = get_some_file_path (item);
-    res = chmod (path, mode);
+    dir = resolve_at (item, path, &name);
+    res = fchmodat (dir, name, mode, 0);
+    release_at (dir);
 
     if (res == -1)
         return -errno;
@@ -974,13 +1534,17 @@ int item_handler_chmod (ItemHandler *item, mode_t mode)
 int item_handler_chown (ItemHandler *item, uid_t uid, gid_t gid)
 {
     int res;
+    int dir;
     const gchar *path;
+    const gchar *name;
 
     if (item == NULL)
         return -ENOENT;
 
     path = get_some_file_path (item);
-    res = chown (path, uid, gid);
+    dir = resolve_at (item, path, &name);
+    res = fchownat (dir, name, uid, gid, 0);
+    release_at (dir);
 
     if (res == -1)
         return -errno;
@@ -1002,14 +1566,18 @@ int item_handler_chown (ItemHandler *item, uid_t uid, gid_t gid)
 int item_handler_readlink (ItemHandler *item, char *buf, size_t size)
 {
     int res;
+    int dir;
     const gchar *path;
+    const gchar *name;
 
     if (item == NULL)
         return -ENOENT;
 
     path = get_some_file_path (item);
+    dir = resolve_at (item, path, &name);
     memset (buf, 0, size);
-    res = readlink (path, buf, size);
+    res = readlinkat (dir, name, buf, size);
+    release_at (dir);
 
     if (res == -1)
         return -errno;
@@ -1030,18 +1598,32 @@ int item_handler_readlink (ItemHandler *item, char *buf, size_t size)
 int item_handler_truncate (ItemHandler *item, off_t size)
 {
     int res;
+    int fd;
+    int dir;
     const gchar *path;
+    const gchar *name;
 
     if (item == NULL)
         return -ENOENT;
 
     path = get_some_file_path (item);
-    res = truncate (path, size);
+    dir = resolve_at (item, path, &name);
 
-    if (res == -1)
+    /*
+        There is no truncateat(), the file is opened relative to the folder instead
+    */
+    fd = openat (dir, name, O_WRONLY | O_CLOEXEC);
+    release_at (dir);
+
+    if (fd == -1)
         return -errno;
-    else
-        return 0;
+
+    res = ftruncate (fd, size);
+    if (res == -1)
+        res = -errno;
+
+    close (fd);
+    return res;
 }
 
 /**
@@ -1058,13 +1640,21 @@ int item_handler_truncate (ItemHandler *item, off_t size)
 int item_handler_utimes (ItemHandler *item, struct timeval tv [2])
 {
     int res;
+    int dir;
     const gchar *path;
+    const gchar *name;
+    struct timespec ts [2];
 
     if (item == NULL)
         return -ENOENT;
 
     path = get_some_file_path (item);
-    res = utimes (path, tv);
+    dir = resolve_at (item, path, &name);
+
+    TIMEVAL_TO_TIMESPEC (&(tv [0]), &(ts [0]));
+    TIMEVAL_TO_TIMESPEC (&(tv [1]), &(ts [1]));
+    res = utimensat (dir, name, ts, 0);
+    release_at (dir);
 
     if (res == -1)
         return -errno;
@@ -1130,12 +1720,10 @@ ItemHandler* item_handler_attach_child (ItemHandler *item, NODE_TYPE type, const
  * @item: an #ItemHandler
  *
  * Saves permanently all metadata assigned to @item and not yet in Tracker. This is automatically
- * called on #ItemHandler destruction
+ * called on #ItemHandler destruction. Changes are applied asynchronously by the metadata
+ * journal: use metadata_journal_barrier() to wait for them
  **/
 void item_handler_flush (ItemHandler *item)
 {
-    if (item->priv->newly_allocated == TRUE)
-        flush_pending_metadata_to_save (item, item->priv->tosave, TRUE, item->priv->metadata, FALSE, NULL);
-    else
-        flush_pending_metadata_to_save (item, item->priv->tosave, TRUE, NULL);
+    flush_pending_metadata_to_save (item, G_OBJECT (item));
 }
@@ -21,6 +21,7 @@
 #define ITEM_HANDLER_H
 
 #include "common.h"
+#include "property.h"
 
 #define ITEM_HANDLER_TYPE             (item_handler_get_type ())
 #define ITEM_HANDLER(obj)             (G_TYPE_CHECK_INSTANCE_CAST ((obj),   \
@@ -71,9 +72,17 @@ typedef enum {
 
 #include "hierarchy-node.h"
 
+/*
+    contents-plugin.h already includes this header
+*/
+struct _ContentsPlugin;
+
 GType           item_handler_get_type           ();
 
+ItemHandler*    item_handler_new                (CONTENT_TYPE type, HierarchyNode *node, ItemHandler *parent,
+                                                 const gchar *subject, const gchar *exposed_name, const gchar *file_path);
 ItemHandler*    item_handler_new_alloc          (CONTENT_TYPE type, HierarchyNode *node, ItemHandler *parent);
+void            item_handler_set_contents_handler (ItemHandler *item, struct _ContentsPlugin *contents);
 
 CONTENT_TYPE    item_handler_get_format         (ItemHandler *item);
 ItemHandler*    item_handler_get_parent         (ItemHandler *item);
@@ -82,9 +91,11 @@ GList*          item_handler_get_children       (ItemHandler *item);
 gboolean        item_handler_get_hidden         (ItemHandler *item);
 
 const gchar*    item_handler_exposed_name       (ItemHandler *item);
+gchar*          item_handler_escape_name        (const gchar *str);
 int             item_handler_open               (ItemHandler *item, int flags);
 void            item_handler_close              (ItemHandler *item, int fd);
 int             item_handler_stat               (ItemHandler *item, struct stat *sbuf);
+void            item_handler_stat_batch         (GList *items, struct stat *sbufs, int *results);
 int             item_handler_access             (ItemHandler *item, int mask);
 int             item_handler_chmod              (ItemHandler *item, mode_t mode);
 int             item_handler_chown              (ItemHandler *item, uid_t uid, gid_t gid);
@@ -96,14 +107,20 @@ const gchar*    item_handler_real_path          (ItemHandler *item);
 
 ItemHandler*    item_handler_attach_child       (ItemHandler *item, NODE_TYPE type, const gchar *newname);
 int             item_handler_remove             (ItemHandler *item);
+void            item_handler_forget_metadata    (ItemHandler *item);
 
 const gchar*    item_handler_get_subject        (ItemHandler *item);
 gboolean        item_handler_type_has_metadata  (ItemHandler *item);
 gboolean        item_handler_contains_metadata  (ItemHandler *item, const gchar *name);
 const gchar*    item_handler_get_metadata       (ItemHandler *item, const gchar *name);
+gboolean        item_handler_get_decoded_metadata (ItemHandler *item, const gchar *name, PropertyValue *decoded);
 GList*          item_handler_get_all_metadata   (ItemHandler *item);
 void            item_handler_set_metadata       (ItemHandler *item, const gchar *name, const gchar *value);
 void            item_handler_load_metadata      (ItemHandler *item, const gchar *name, const gchar *value);
 void            item_handler_flush              (ItemHandler *item);
 
+void            item_handler_set_prefetched_children    (ItemHandler *item, HierarchyNode *node, GPtrArray *rows);
+gboolean        item_handler_has_prefetched_children    (ItemHandler *item, HierarchyNode *node);
+GPtrArray*      item_handler_steal_prefetched_children  (ItemHandler *item, HierarchyNode *node);
+
 #endif
@@ -0,0 +1,141 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "metadata-backend-memory.h"
+#include "triple-store.h"
+#include "utils.h"
+
+#define METADATA_BACKEND_MEMORY_GET_PRIVATE(obj)   (G_TYPE_INSTANCE_GET_PRIVATE ((obj), METADATA_BACKEND_MEMORY_TYPE, MetadataBackendMemoryPrivate))
+
+struct _MetadataBackendMemoryPrivate {
+    TripleStore         *store;
+    GMutex              lock;
+};
+
+G_DEFINE_TYPE (MetadataBackendMemory, metadata_backend_memory, METADATA_BACKEND_TYPE);
+
+static GVariant* memory_query (MetadataBackend *backend, const gchar *query, GError **error)
+{
+    GPtrArray *rows;
+    GVariant *ret;
+    MetadataBackendMemory *self;
+
+    self = METADATA_BACKEND_MEMORY (backend);
+
+    g_mutex_lock (&(self->priv->lock));
+    rows = triple_store_query (self->priv->store, query, error);
+    g_mutex_unlock (&(self->priv->lock));
+
+    if (rows == NULL)
+        return NULL;
+
+    ret = query_rows_to_variant (rows);
+    g_ptr_array_unref (rows);
+    return ret;
+}
+
+static GVariant* memory_update_blank (MetadataBackend *backend, const gchar *query, GError **error)
+{
+    GVariant *results;
+    MetadataBackendMemory *self;
+
+    self = METADATA_BACKEND_MEMORY (backend);
+
+    g_mutex_lock (&(self->priv->lock));
+    results = triple_store_update (self->priv->store, query, NULL, error);
+    g_mutex_unlock (&(self->priv->lock));
+
+    if (results == NULL)
+        return NULL;
+
+    return g_variant_ref_sink (g_variant_new ("(@aaa{ss})", results));
+}
+
+static gboolean memory_update (MetadataBackend *backend, const gchar *query, GError **error)
+{
+    GVariant *results;
+
+    results = memory_update_blank (backend, query, error);
+    if (results == NULL)
+        return FALSE;
+
+    g_variant_unref (results);
+    return TRUE;
+}
+
+static void metadata_backend_memory_finalize (GObject *obj)
+{
+    MetadataBackendMemory *backend;
+
+    backend = METADATA_BACKEND_MEMORY (obj);
+
+    if (backend->priv->store != NULL)
+        g_object_unref (backend->priv->store);
+
+    g_mutex_clear (&(backend->priv->lock));
+}
+
+static void metadata_backend_memory_class_init (MetadataBackendMemoryClass *klass)
+{
+    GObjectClass *gobject_class;
+    MetadataBackendClass *backend_class;
+
+    g_type_class_add_private (klass, sizeof (MetadataBackendMemoryPrivate));
+
+    gobject_class = G_OBJECT_CLASS (klass);
+    gobject_class->finalize = metadata_backend_memory_finalize;
+
+    backend_class = METADATA_BACKEND_CLASS (klass);
+    backend_class->query = memory_query;
+    backend_class->update = memory_update;
+    backend_class->update_blank = memory_update_blank;
+}
+
+static void metadata_backend_memory_init (MetadataBackendMemory *backend)
+{
+    backend->priv = METADATA_BACKEND_MEMORY_GET_PRIVATE (backend);
+    memset (backend->priv, 0, sizeof (MetadataBackendMemoryPrivate));
+    g_mutex_init (&(backend->priv->lock));
+}
+
+/**
+ * metadata_backend_memory_new:
+ * @path: path of a Turtle dump of the metadata
+ * @error: return location for a #GError
+ *
+ * Inits a backend holding all the metadata in memory, with no need for a
+ * running Tracker. Contents are loaded from @path, and modifications are
+ * kept only until the filesystem is unmounted
+ *
+ * Return value: a new #MetadataBackend, or NULL if the dump cannot be loaded
+ **/
+MetadataBackend* metadata_backend_memory_new (const gchar *path, GError **error)
+{
+    MetadataBackendMemory *ret;
+
+    ret = g_object_new (METADATA_BACKEND_MEMORY_TYPE, NULL);
+    ret->priv->store = triple_store_new ();
+
+    if (triple_store_load_file (ret->priv->store, path, error) == FALSE) {
+        g_object_unref (ret);
+        return NULL;
+    }
+
+    return METADATA_BACKEND (ret);
+}
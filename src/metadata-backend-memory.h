@@ -0,0 +1,57 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METADATA_BACKEND_MEMORY_H
+#define METADATA_BACKEND_MEMORY_H
+
+#include "metadata-backend.h"
+
+#define METADATA_BACKEND_MEMORY_TYPE             (metadata_backend_memory_get_type ())
+#define METADATA_BACKEND_MEMORY(obj)             (G_TYPE_CHECK_INSTANCE_CAST ((obj),    \
+                                                  METADATA_BACKEND_MEMORY_TYPE,         \
+                                                  MetadataBackendMemory))
+#define METADATA_BACKEND_MEMORY_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST ((klass),     \
+                                                  METADATA_BACKEND_MEMORY_TYPE,         \
+                                                  MetadataBackendMemoryClass))
+#define IS_METADATA_BACKEND_MEMORY(obj)          (G_TYPE_CHECK_INSTANCE_TYPE ((obj),    \
+                                                  METADATA_BACKEND_MEMORY_TYPE))
+#define IS_METADATA_BACKEND_MEMORY_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE ((klass),     \
+                                                  METADATA_BACKEND_MEMORY_TYPE))
+#define METADATA_BACKEND_MEMORY_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS ((obj),     \
+                                                  METADATA_BACKEND_MEMORY_TYPE,         \
+                                                  MetadataBackendMemoryClass))
+
+typedef struct _MetadataBackendMemory         MetadataBackendMemory;
+typedef struct _MetadataBackendMemoryClass    MetadataBackendMemoryClass;
+typedef struct _MetadataBackendMemoryPrivate  MetadataBackendMemoryPrivate;
+
+struct _MetadataBackendMemory {
+    MetadataBackend                 parent;
+    MetadataBackendMemoryPrivate    *priv;
+};
+
+struct _MetadataBackendMemoryClass {
+    MetadataBackendClass    parent_class;
+};
+
+GType               metadata_backend_memory_get_type     ();
+
+MetadataBackend*    metadata_backend_memory_new         (const gchar *path, GError **error);
+
+#endif
@@ -0,0 +1,763 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "metadata-backend-tracker.h"
+#include "triple-store.h"
+#include "operation.h"
+#include "utils.h"
+
+#define METADATA_BACKEND_TRACKER_GET_PRIVATE(obj)  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), METADATA_BACKEND_TRACKER_TYPE, MetadataBackendTrackerPrivate))
+
+#define RDF_TYPE            "http://www.w3.org/1999/02/22-rdf-syntax-ns#type"
+
+/*
+    Interval (in milliseconds) at which a pending query is checked against his deadline
+*/
+#define INTERRUPT_CHECK_INTERVAL    50
+
+/*
+    Max number of subjects reloaded with a single query after a GraphUpdated notification
+*/
+#define REFRESH_CHUNK_SIZE  100
+
+struct _MetadataBackendTrackerPrivate {
+    GDBusConnection     *connection;
+    guint               subscription;
+    GHashTable          *predicates;    // Tracker ID -> interned URI
+
+    gboolean            preload;
+    GMutex              lock;
+    TripleStore         *local;         // values of the preloaded predicates, NULL if none
+    GList               *loaded;        // interned URIs of the preloaded predicates
+    GHashTable          *subjects;      // Tracker ID -> URI of subjects in the local store
+};
+
+typedef struct {
+    gboolean            done;
+    GVariant            *result;
+    GError              *error;
+} PendingCall;
+
+G_DEFINE_TYPE (MetadataBackendTracker, metadata_backend_tracker, METADATA_BACKEND_TYPE);
+
+static GVariant* call_tracker (MetadataBackendTracker *backend, const gchar *method, const gchar *query,
+                               const GVariantType *reply, GError **error)
+{
+    return g_dbus_connection_call_sync (backend->priv->connection,
+                                        "org.freedesktop.Tracker1",
+                                        "/org/freedesktop/Tracker1/Resources",
+                                        "org.freedesktop.Tracker1.Resources",
+                                        method,
+                                        g_variant_new ("(s)", query),
+                                        reply,
+                                        G_DBUS_CALL_FLAGS_NONE,
+                                        -1,
+                                        NULL,
+                                        error);
+}
+
+static void bounded_call_done (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    PendingCall *call;
+
+    call = (PendingCall*) user_data;
+    call->result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), res, &(call->error));
+    call->done = TRUE;
+}
+
+static gboolean keep_ticking (gpointer user_data)
+{
+    return TRUE;
+}
+
+/*
+    Within a filesystem operation, queries are limited by his deadline and cancelled when the
+    kernel interrupts the request. The call is executed asynchronously in a private context,
+    which also reads interruptions from the FUSE channel (otherwise not polled until the
+    current request is completed) and is woken up periodically to check the deadline.
+    Updates are never bounded, as Tracker applies them anyway
+*/
+static GVariant* call_tracker_bounded (MetadataBackendTracker *backend, const gchar *method, const gchar *query,
+                                       const GVariantType *reply, GError **error)
+{
+    PendingCall call;
+    GSource *tick;
+    GSource *interrupts;
+    GMainContext *context;
+
+    if (operation_is_active () == FALSE)
+        return call_tracker (backend, method, query, reply, error);
+
+    if (operation_check (error) == FALSE)
+        return NULL;
+
+    memset (&call, 0, sizeof (PendingCall));
+    context = g_main_context_new ();
+    g_main_context_push_thread_default (context);
+
+    tick = g_timeout_source_new (INTERRUPT_CHECK_INTERVAL);
+    g_source_set_callback (tick, keep_ticking, NULL, NULL);
+    g_source_attach (tick, context);
+
+    interrupts = operation_watch_interrupts (context);
+
+    g_dbus_connection_call (backend->priv->connection,
+                            "org.freedesktop.Tracker1",
+                            "/org/freedesktop/Tracker1/Resources",
+                            "org.freedesktop.Tracker1.Resources",
+                            method,
+                            g_variant_new ("(s)", query),
+                            reply,
+                            G_DBUS_CALL_FLAGS_NONE,
+                            operation_remaining (),
+                            operation_get_cancellable (),
+                            bounded_call_done,
+                            &call);
+
+    while (call.done == FALSE) {
+        g_main_context_iteration (context, TRUE);
+        operation_check (NULL);
+    }
+
+    g_source_destroy (tick);
+    g_source_unref (tick);
+
+    if (interrupts != NULL) {
+        g_source_destroy (interrupts);
+        g_source_unref (interrupts);
+    }
+    g_main_context_pop_thread_default (context);
+    g_main_context_unref (context);
+
+    /*
+        The error reported by D-Bus is replaced with the one of the operation, so to inform
+        about the real cause of the failure
+    */
+    if (call.result == NULL) {
+        if (operation_check (error) == FALSE)
+            g_error_free (call.error);
+        else
+            g_propagate_error (error, call.error);
+    }
+
+    return call.result;
+}
+
+/*
+    Queries are first executed on the local store, if any: when they involve predicates
+    which have not been preloaded, or syntax the store does not handle, they are forwarded
+    to Tracker
+*/
+static GVariant* local_query (MetadataBackendTracker *backend, const gchar *query)
+{
+    GPtrArray *rows;
+    GVariant *ret;
+
+    rows = NULL;
+
+    g_mutex_lock (&(backend->priv->lock));
+    if (backend->priv->local != NULL)
+        rows = triple_store_query (backend->priv->local, query, NULL);
+    g_mutex_unlock (&(backend->priv->lock));
+
+    if (rows == NULL)
+        return NULL;
+
+    ret = query_rows_to_variant (rows);
+    g_ptr_array_unref (rows);
+    return ret;
+}
+
+static void drop_local (MetadataBackendTracker *backend, const gchar *reason)
+{
+    g_warning ("Local metadata store disabled: %s", reason);
+
+    if (backend->priv->local != NULL) {
+        g_object_unref (backend->priv->local);
+        backend->priv->local = NULL;
+    }
+}
+
+/*
+    Updates executed by FSter itself are replayed on the local store, reusing the URIs Tracker
+    assigned to blank nodes. The store ignores values for predicates it does not hold
+*/
+static void local_update (MetadataBackendTracker *backend, const gchar *query, GVariant *blanks)
+{
+    GVariant *results;
+    GError *error;
+
+    g_mutex_lock (&(backend->priv->lock));
+
+    if (backend->priv->local != NULL) {
+        error = NULL;
+        results = triple_store_update (backend->priv->local, query, blanks, &error);
+
+        if (results == NULL) {
+            drop_local (backend, error->message);
+            g_error_free (error);
+        }
+        else {
+            g_variant_unref (g_variant_ref_sink (results));
+        }
+    }
+
+    g_mutex_unlock (&(backend->priv->lock));
+}
+
+static GVariant* tracker_query (MetadataBackend *backend, const gchar *query, GError **error)
+{
+    GVariant *ret;
+    MetadataBackendTracker *self;
+
+    self = METADATA_BACKEND_TRACKER (backend);
+
+    if (self->priv->preload == TRUE) {
+        ret = local_query (self, query);
+        if (ret != NULL)
+            return ret;
+    }
+
+    return call_tracker_bounded (self, "SparqlQuery", query, G_VARIANT_TYPE ("(aas)"), error);
+}
+
+static gboolean tracker_update (MetadataBackend *backend, const gchar *query, GError **error)
+{
+    GVariant *ret;
+    MetadataBackendTracker *self;
+
+    self = METADATA_BACKEND_TRACKER (backend);
+
+    ret = call_tracker (self, "SparqlUpdate", query, NULL, error);
+    if (ret == NULL)
+        return FALSE;
+
+    g_variant_unref (ret);
+
+    if (self->priv->preload == TRUE)
+        local_update (self, query, NULL);
+
+    return TRUE;
+}
+
+static GVariant* tracker_update_blank (MetadataBackend *backend, const gchar *query, GError **error)
+{
+    GVariant *ret;
+    GVariant *blanks;
+    MetadataBackendTracker *self;
+
+    self = METADATA_BACKEND_TRACKER (backend);
+
+    ret = call_tracker (self, "SparqlUpdateBlank", query, G_VARIANT_TYPE ("(aaa{ss})"), error);
+
+    if (ret != NULL && self->priv->preload == TRUE) {
+        blanks = g_variant_get_child_value (ret, 0);
+        local_update (self, query, blanks);
+        g_variant_unref (blanks);
+    }
+
+    return ret;
+}
+
+static void load_namespaces (MetadataBackendTracker *backend, TripleStore *store)
+{
+    register int i;
+    gchar **row;
+    GPtrArray *rows;
+    GVariant *response;
+    GError *error;
+
+    error = NULL;
+    response = call_tracker (backend, "SparqlQuery", "SELECT ?u ?p WHERE { ?u a tracker:Namespace . ?u tracker:prefix ?p }",
+                             G_VARIANT_TYPE ("(aas)"), &error);
+
+    if (response == NULL) {
+        g_warning ("Unable to fetch namespaces: %s", error->message);
+        g_error_free (error);
+        return;
+    }
+
+    rows = query_rows_from_variant (response);
+    g_variant_unref (response);
+
+    for (i = 0; i < rows->len; i++) {
+        row = (gchar**) g_ptr_array_index (rows, i);
+        if (row [0] != NULL && row [1] != NULL)
+            triple_store_add_prefix (store, row [1], row [0]);
+    }
+
+    g_ptr_array_unref (rows);
+}
+
+static void preload_predicate (MetadataBackendTracker *backend, TripleStore *store, const gchar *predicate)
+{
+    register int i;
+    gchar *query;
+    gchar **row;
+    GPtrArray *rows;
+    GVariant *response;
+    GError *error;
+
+    error = NULL;
+    query = g_strdup_printf ("SELECT ?s tracker:id(?s) ?o WHERE { ?s <%s> ?o }", predicate);
+    response = call_tracker (backend, "SparqlQuery", query, G_VARIANT_TYPE ("(aas)"), &error);
+    g_free (query);
+
+    /*
+        A predicate not marked as complete is simply always queried on Tracker
+    */
+    if (response == NULL) {
+        g_warning ("Unable to preload values for %s: %s", predicate, error->message);
+        g_error_free (error);
+        return;
+    }
+
+    rows = query_rows_from_variant (response);
+    g_variant_unref (response);
+
+    for (i = 0; i < rows->len; i++) {
+        row = (gchar**) g_ptr_array_index (rows, i);
+        if (row [0] == NULL || row [1] == NULL || row [2] == NULL)
+            continue;
+
+        triple_store_insert (store, row [0], predicate, row [2]);
+
+        if (g_hash_table_lookup (backend->priv->subjects, GINT_TO_POINTER (strtol (row [1], NULL, 10))) == NULL)
+            g_hash_table_insert (backend->priv->subjects, GINT_TO_POINTER (strtol (row [1], NULL, 10)), g_strdup (row [0]));
+    }
+
+    g_ptr_array_unref (rows);
+
+    triple_store_mark_complete (store, predicate);
+    backend->priv->loaded = g_list_prepend (backend->priv->loaded, (gpointer) g_intern_string (predicate));
+}
+
+/*
+    Types are always preloaded, as they are required to match any resource and are involved in
+    most of the queries
+*/
+static void tracker_preload (MetadataBackend *backend, GList *predicates)
+{
+    GList *iter;
+    TripleStore *store;
+    MetadataBackendTracker *self;
+
+    self = METADATA_BACKEND_TRACKER (backend);
+    if (self->priv->preload == FALSE || self->priv->local != NULL)
+        return;
+
+    store = triple_store_new ();
+    load_namespaces (self, store);
+    preload_predicate (self, store, RDF_TYPE);
+
+    for (iter = predicates; iter; iter = g_list_next (iter))
+        if (g_list_find (self->priv->loaded, g_intern_string ((const gchar*) iter->data)) == NULL)
+            preload_predicate (self, store, (const gchar*) iter->data);
+
+    g_mutex_lock (&(self->priv->lock));
+    self->priv->local = store;
+    g_mutex_unlock (&(self->priv->lock));
+}
+
+static void collect_changed_predicates (MetadataBackendTracker *backend, GVariant *changes, GList **changed, gboolean *unknown)
+{
+    gint graph;
+    gint subject;
+    gint predicate;
+    gint object;
+    const gchar *uri;
+    GVariantIter iter;
+
+    g_variant_iter_init (&iter, changes);
+
+    while (g_variant_iter_next (&iter, "(iiii)", &graph, &subject, &predicate, &object)) {
+        uri = g_hash_table_lookup (backend->priv->predicates, GINT_TO_POINTER (predicate));
+
+        if (uri == NULL)
+            *unknown = TRUE;
+        else if (g_list_find (*changed, uri) == NULL)
+            *changed = g_list_prepend (*changed, (gpointer) uri);
+    }
+}
+
+static void collect_changed_subjects (MetadataBackendTracker *backend, GVariant *changes, GHashTable *subjects)
+{
+    gint graph;
+    gint subject;
+    gint predicate;
+    gint object;
+    const gchar *uri;
+    GVariantIter iter;
+
+    g_variant_iter_init (&iter, changes);
+
+    while (g_variant_iter_next (&iter, "(iiii)", &graph, &subject, &predicate, &object)) {
+        uri = g_hash_table_lookup (backend->priv->predicates, GINT_TO_POINTER (predicate));
+        if (uri == NULL || g_list_find (backend->priv->loaded, uri) != NULL)
+            g_hash_table_insert (subjects, GINT_TO_POINTER (subject), GINT_TO_POINTER (subject));
+    }
+}
+
+static gboolean resolve_subjects (MetadataBackendTracker *backend, GList *ids)
+{
+    register int i;
+    gchar *query;
+    gchar **row;
+    GList *iter;
+    GString *list;
+    GPtrArray *rows;
+    GVariant *response;
+    GError *error;
+
+    list = g_string_new ("");
+
+    for (iter = ids; iter; iter = g_list_next (iter))
+        if (g_hash_table_lookup (backend->priv->subjects, iter->data) == NULL)
+            g_string_append_printf (list, "%s%d", list->len != 0 ? ", " : "", GPOINTER_TO_INT (iter->data));
+
+    if (list->len == 0) {
+        g_string_free (list, TRUE);
+        return TRUE;
+    }
+
+    error = NULL;
+    query = g_strdup_printf ("SELECT ?s tracker:id(?s) WHERE { ?s a rdfs:Resource FILTER (tracker:id(?s) IN (%s)) }", list->str);
+    response = call_tracker (backend, "SparqlQuery", query, G_VARIANT_TYPE ("(aas)"), &error);
+    g_free (query);
+    g_string_free (list, TRUE);
+
+    if (response == NULL) {
+        g_warning ("Unable to resolve changed subjects: %s", error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+
+    rows = query_rows_from_variant (response);
+    g_variant_unref (response);
+
+    for (i = 0; i < rows->len; i++) {
+        row = (gchar**) g_ptr_array_index (rows, i);
+        if (row [0] != NULL && row [1] != NULL)
+            g_hash_table_insert (backend->priv->subjects, GINT_TO_POINTER (strtol (row [1], NULL, 10)), g_strdup (row [0]));
+    }
+
+    g_ptr_array_unref (rows);
+    return TRUE;
+}
+
+/*
+    Subjects are reloaded in a single query, fetching the values of all the preloaded predicates,
+    and their contents in the local store are replaced
+*/
+static gboolean refresh_subjects (MetadataBackendTracker *backend, GList *uris)
+{
+    register int i;
+    gchar *query;
+    gchar **row;
+    GList *iter;
+    GString *subjects;
+    GString *predicates;
+    GPtrArray *rows;
+    GVariant *response;
+    GError *error;
+
+    subjects = g_string_new ("");
+    predicates = g_string_new ("");
+
+    for (iter = uris; iter; iter = g_list_next (iter))
+        g_string_append_printf (subjects, " <%s>", (const gchar*) iter->data);
+    for (iter = backend->priv->loaded; iter; iter = g_list_next (iter))
+        g_string_append_printf (predicates, "%s<%s>", predicates->len != 0 ? ", " : "", (const gchar*) iter->data);
+
+    error = NULL;
+    query = g_strdup_printf ("SELECT ?s ?p ?o WHERE { ?s ?p ?o . VALUES ?s {%s } FILTER (?p IN (%s)) }", subjects->str, predicates->str);
+    response = call_tracker (backend, "SparqlQuery", query, G_VARIANT_TYPE ("(aas)"), &error);
+    g_free (query);
+    g_string_free (subjects, TRUE);
+    g_string_free (predicates, TRUE);
+
+    if (response == NULL) {
+        g_mutex_lock (&(backend->priv->lock));
+        drop_local (backend, error->message);
+        g_mutex_unlock (&(backend->priv->lock));
+        g_error_free (error);
+        return FALSE;
+    }
+
+    rows = query_rows_from_variant (response);
+    g_variant_unref (response);
+
+    g_mutex_lock (&(backend->priv->lock));
+
+    if (backend->priv->local != NULL) {
+        for (iter = uris; iter; iter = g_list_next (iter))
+            triple_store_remove_subject (backend->priv->local, (const gchar*) iter->data);
+
+        for (i = 0; i < rows->len; i++) {
+            row = (gchar**) g_ptr_array_index (rows, i);
+            if (row [0] != NULL && row [1] != NULL && row [2] != NULL)
+                triple_store_insert (backend->priv->local, row [0], row [1], row [2]);
+        }
+    }
+
+    g_mutex_unlock (&(backend->priv->lock));
+
+    g_ptr_array_unref (rows);
+    return TRUE;
+}
+
+static void refresh_local (MetadataBackendTracker *backend, GVariant *deletes, GVariant *inserts)
+{
+    int count;
+    gboolean done;
+    const gchar *uri;
+    GList *ids;
+    GList *iter;
+    GList *chunk;
+    GHashTable *changed;
+
+    changed = g_hash_table_new (g_direct_hash, g_direct_equal);
+    collect_changed_subjects (backend, deletes, changed);
+    collect_changed_subjects (backend, inserts, changed);
+    ids = g_hash_table_get_keys (changed);
+
+    /*
+        Subjects which cannot be resolved are no longer existing, and were never seen in the
+        local store
+    */
+    if (ids != NULL && resolve_subjects (backend, ids) == TRUE) {
+        chunk = NULL;
+        count = 0;
+
+        for (iter = ids; iter; iter = g_list_next (iter)) {
+            uri = g_hash_table_lookup (backend->priv->subjects, iter->data);
+            if (uri == NULL)
+                continue;
+
+            chunk = g_list_prepend (chunk, (gpointer) uri);
+            count++;
+
+            if (count == REFRESH_CHUNK_SIZE) {
+                done = refresh_subjects (backend, chunk);
+                g_list_free (chunk);
+                chunk = NULL;
+                count = 0;
+
+                if (done == FALSE)
+                    break;
+            }
+        }
+
+        if (chunk != NULL) {
+            refresh_subjects (backend, chunk);
+            g_list_free (chunk);
+        }
+    }
+
+    g_list_free (ids);
+    g_hash_table_destroy (changed);
+}
+
+static void collect_changed_resources (GVariant *changes, GHashTable *resources)
+{
+    gint graph;
+    gint subject;
+    gint predicate;
+    gint object;
+    GVariantIter iter;
+
+    g_variant_iter_init (&iter, changes);
+
+    /*
+        Literal objects have no identifier
+    */
+    while (g_variant_iter_next (&iter, "(iiii)", &graph, &subject, &predicate, &object)) {
+        g_hash_table_insert (resources, GINT_TO_POINTER (subject), GINT_TO_POINTER (subject));
+        if (object != 0)
+            g_hash_table_insert (resources, GINT_TO_POINTER (object), GINT_TO_POINTER (object));
+    }
+}
+
+static void graph_updated (GDBusConnection *connection, const gchar *sender, const gchar *path,
+                           const gchar *interface, const gchar *signal, GVariant *parameters, gpointer user_data)
+{
+    gboolean unknown;
+    const gchar *class_name;
+    GList *changed;
+    GList *ids;
+    GHashTable *resources;
+    GVariant *deletes;
+    GVariant *inserts;
+    MetadataBackendTracker *backend;
+
+    backend = (MetadataBackendTracker*) user_data;
+    class_name = NULL;
+    deletes = NULL;
+    inserts = NULL;
+
+    g_variant_get (parameters, "(&s@a(iiii)@a(iiii))", &class_name, &deletes, &inserts);
+
+    /*
+        The local store is refreshed before the notification is propagated, so that caches
+        invalidated by listeners are filled again with updated contents
+    */
+    if (backend->priv->local != NULL)
+        refresh_local (backend, deletes, inserts);
+
+    unknown = FALSE;
+    changed = g_list_prepend (NULL, (gpointer) g_intern_string (class_name));
+    collect_changed_predicates (backend, deletes, &changed, &unknown);
+    collect_changed_predicates (backend, inserts, &changed, &unknown);
+
+    metadata_backend_emit_changed (METADATA_BACKEND (backend), changed, unknown);
+
+    resources = g_hash_table_new (g_direct_hash, g_direct_equal);
+    collect_changed_resources (deletes, resources);
+    collect_changed_resources (inserts, resources);
+    ids = g_hash_table_get_keys (resources);
+
+    if (ids != NULL)
+        metadata_backend_emit_resources_changed (METADATA_BACKEND (backend), ids, changed, unknown);
+
+    g_list_free (ids);
+    g_hash_table_destroy (resources);
+    g_list_free (changed);
+    g_variant_unref (deletes);
+    g_variant_unref (inserts);
+}
+
+/*
+    GraphUpdated notifications carry the internal Tracker identifiers for predicates, here
+    mapped to their URIs
+*/
+static void load_predicates_ids (MetadataBackendTracker *backend)
+{
+    register int i;
+    gchar **row;
+    GPtrArray *rows;
+    GVariant *response;
+    GError *error;
+
+    error = NULL;
+    response = call_tracker (backend, "SparqlQuery", "SELECT ?p tracker:id(?p) WHERE { ?p a rdf:Property }", G_VARIANT_TYPE ("(aas)"), &error);
+
+    if (response == NULL) {
+        g_warning ("Unable to fetch predicates identifiers: %s", error->message);
+        g_error_free (error);
+        return;
+    }
+
+    rows = query_rows_from_variant (response);
+    g_variant_unref (response);
+
+    for (i = 0; i < rows->len; i++) {
+        row = (gchar**) g_ptr_array_index (rows, i);
+        if (row [0] != NULL && row [1] != NULL)
+            g_hash_table_insert (backend->priv->predicates, GINT_TO_POINTER (strtol (row [1], NULL, 10)),
+                                 (gpointer) g_intern_string (row [0]));
+    }
+
+    g_ptr_array_unref (rows);
+}
+
+static void metadata_backend_tracker_finalize (GObject *obj)
+{
+    MetadataBackendTracker *backend;
+
+    backend = METADATA_BACKEND_TRACKER (obj);
+
+    if (backend->priv->subscription != 0)
+        g_dbus_connection_signal_unsubscribe (backend->priv->connection, backend->priv->subscription);
+    if (backend->priv->connection != NULL)
+        g_object_unref (backend->priv->connection);
+
+    g_hash_table_destroy (backend->priv->predicates);
+    g_hash_table_destroy (backend->priv->subjects);
+    g_list_free (backend->priv->loaded);
+
+    if (backend->priv->local != NULL)
+        g_object_unref (backend->priv->local);
+
+    g_mutex_clear (&(backend->priv->lock));
+}
+
+static void metadata_backend_tracker_class_init (MetadataBackendTrackerClass *klass)
+{
+    GObjectClass *gobject_class;
+    MetadataBackendClass *backend_class;
+
+    g_type_class_add_private (klass, sizeof (MetadataBackendTrackerPrivate));
+
+    gobject_class = G_OBJECT_CLASS (klass);
+    gobject_class->finalize = metadata_backend_tracker_finalize;
+
+    backend_class = METADATA_BACKEND_CLASS (klass);
+    backend_class->query = tracker_query;
+    backend_class->update = tracker_update;
+    backend_class->update_blank = tracker_update_blank;
+    backend_class->preload = tracker_preload;
+}
+
+static void metadata_backend_tracker_init (MetadataBackendTracker *backend)
+{
+    backend->priv = METADATA_BACKEND_TRACKER_GET_PRIVATE (backend);
+    memset (backend->priv, 0, sizeof (MetadataBackendTrackerPrivate));
+    backend->priv->predicates = g_hash_table_new (g_direct_hash, g_direct_equal);
+    backend->priv->subjects = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+    g_mutex_init (&(backend->priv->lock));
+}
+
+/**
+ * metadata_backend_tracker_new:
+ * @preload: if TRUE, values of the predicates indicated with
+ * metadata_backend_preload() are kept in memory, and queries involving only
+ * them are executed locally
+ * @error: return location for a #GError
+ *
+ * Inits a backend executing queries on the Tracker daemon over the session
+ * bus, and emitting the "changed" signal for each GraphUpdated notification
+ *
+ * Return value: a new #MetadataBackend, or NULL if the session bus is not
+ * reachable
+ **/
+MetadataBackend* metadata_backend_tracker_new (gboolean preload, GError **error)
+{
+    GDBusConnection *connection;
+    MetadataBackendTracker *ret;
+
+    connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, error);
+    if (connection == NULL)
+        return NULL;
+
+    ret = g_object_new (METADATA_BACKEND_TRACKER_TYPE, NULL);
+    ret->priv->connection = connection;
+    ret->priv->preload = preload;
+
+    load_predicates_ids (ret);
+
+    ret->priv->subscription = g_dbus_connection_signal_subscribe (connection,
+                                                                  "org.freedesktop.Tracker1",
+                                                                  "org.freedesktop.Tracker1.Resources",
+                                                                  "GraphUpdated",
+                                                                  "/org/freedesktop/Tracker1/Resources",
+                                                                  NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+                                                                  graph_updated, ret, NULL);
+
+    return METADATA_BACKEND (ret);
+}
@@ -0,0 +1,57 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METADATA_BACKEND_TRACKER_H
+#define METADATA_BACKEND_TRACKER_H
+
+#include "metadata-backend.h"
+
+#define METADATA_BACKEND_TRACKER_TYPE            (metadata_backend_tracker_get_type ())
+#define METADATA_BACKEND_TRACKER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj),    \
+                                                  METADATA_BACKEND_TRACKER_TYPE,        \
+                                                  MetadataBackendTracker))
+#define METADATA_BACKEND_TRACKER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),     \
+                                                  METADATA_BACKEND_TRACKER_TYPE,        \
+                                                  MetadataBackendTrackerClass))
+#define IS_METADATA_BACKEND_TRACKER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj),    \
+                                                  METADATA_BACKEND_TRACKER_TYPE))
+#define IS_METADATA_BACKEND_TRACKER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),     \
+                                                  METADATA_BACKEND_TRACKER_TYPE))
+#define METADATA_BACKEND_TRACKER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),     \
+                                                  METADATA_BACKEND_TRACKER_TYPE,        \
+                                                  MetadataBackendTrackerClass))
+
+typedef struct _MetadataBackendTracker         MetadataBackendTracker;
+typedef struct _MetadataBackendTrackerClass    MetadataBackendTrackerClass;
+typedef struct _MetadataBackendTrackerPrivate  MetadataBackendTrackerPrivate;
+
+struct _MetadataBackendTracker {
+    MetadataBackend                 parent;
+    MetadataBackendTrackerPrivate   *priv;
+};
+
+struct _MetadataBackendTrackerClass {
+    MetadataBackendClass    parent_class;
+};
+
+GType               metadata_backend_tracker_get_type    ();
+
+MetadataBackend*    metadata_backend_tracker_new        (gboolean preload, GError **error);
+
+#endif
@@ -0,0 +1,174 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "metadata-backend.h"
+#include "metadata-backend-tracker.h"
+#include "metadata-backend-memory.h"
+
+enum {
+    CHANGED,
+    RESOURCES_CHANGED,
+    LAST_SIGNAL
+};
+
+static guint                Signals [LAST_SIGNAL]   = { 0 };
+static MetadataBackend      *DefaultBackend         = NULL;
+
+G_LOCK_DEFINE_STATIC (DefaultBackend);
+
+G_DEFINE_ABSTRACT_TYPE (MetadataBackend, metadata_backend, G_TYPE_OBJECT);
+
+static void metadata_backend_class_init (MetadataBackendClass *klass)
+{
+    /*
+        Emitted when contents in the store are modified by someone else than FSter. The list
+        of references holds the (interned) URIs of involved classes and predicates, and "all"
+        is TRUE when they are not known
+    */
+    Signals [CHANGED] = g_signal_new ("changed", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+                                      G_STRUCT_OFFSET (MetadataBackendClass, changed), NULL, NULL, NULL,
+                                      G_TYPE_NONE, 2, G_TYPE_POINTER, G_TYPE_BOOLEAN);
+
+    /*
+        Emitted after "changed", with the list of the resources (as Tracker IDs, packed with
+        GINT_TO_POINTER()) appearing as subjects or objects of the modified statements
+    */
+    Signals [RESOURCES_CHANGED] = g_signal_new ("resources-changed", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+                                                G_STRUCT_OFFSET (MetadataBackendClass, resources_changed), NULL, NULL, NULL,
+                                                G_TYPE_NONE, 3, G_TYPE_POINTER, G_TYPE_POINTER, G_TYPE_BOOLEAN);
+}
+
+static void metadata_backend_init (MetadataBackend *backend)
+{
+}
+
+/**
+ * metadata_backend_new:
+ * @spec: description of the backend to init, or NULL for the default one
+ * @error: return location for a #GError
+ *
+ * Inits the backend described by @spec: "tracker" for the Tracker daemon
+ * reached on the session bus, "tracker:preload" for the same keeping in
+ * memory the values of the predicates involved in the configuration, or
+ * "memory:" followed by the path of a Turtle dump to be loaded in an
+ * in-process store
+ *
+ * Return value: a new #MetadataBackend, or NULL if it cannot be inited
+ **/
+MetadataBackend* metadata_backend_new (const gchar *spec, GError **error)
+{
+    if (spec == NULL || strcmp (spec, "tracker") == 0)
+        return metadata_backend_tracker_new (FALSE, error);
+    else if (strcmp (spec, "tracker:preload") == 0)
+        return metadata_backend_tracker_new (TRUE, error);
+    else if (strncmp (spec, "memory:", 7) == 0)
+        return metadata_backend_memory_new (spec + 7, error);
+
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Unknown metadata backend '%s'", spec);
+    return NULL;
+}
+
+/**
+ * metadata_backend_set_default:
+ * @backend: the #MetadataBackend to be used for all metadata operations, or
+ * NULL to release the current one
+ **/
+void metadata_backend_set_default (MetadataBackend *backend)
+{
+    G_LOCK (DefaultBackend);
+
+    if (DefaultBackend != NULL)
+        g_object_unref (DefaultBackend);
+
+    DefaultBackend = backend != NULL ? g_object_ref (backend) : NULL;
+
+    G_UNLOCK (DefaultBackend);
+}
+
+/**
+ * metadata_backend_get_default:
+ *
+ * Retrieves the backend used for metadata operations. If none has been
+ * explicitely set, the Tracker one is inited
+ *
+ * Return value: the current #MetadataBackend. The reference is owned by the
+ * function
+ **/
+MetadataBackend* metadata_backend_get_default ()
+{
+    GError *error;
+    MetadataBackend *ret;
+
+    G_LOCK (DefaultBackend);
+
+    if (DefaultBackend == NULL) {
+        error = NULL;
+        DefaultBackend = metadata_backend_tracker_new (FALSE, &error);
+
+        if (DefaultBackend == NULL) {
+            g_warning ("Unable to init metadata backend: %s", error->message);
+            g_error_free (error);
+        }
+    }
+
+    ret = DefaultBackend;
+
+    G_UNLOCK (DefaultBackend);
+    return ret;
+}
+
+GVariant* metadata_backend_query (MetadataBackend *self, const gchar *query, GError **error)
+{
+    return METADATA_BACKEND_GET_CLASS (self)->query (self, query, error);
+}
+
+gboolean metadata_backend_update (MetadataBackend *self, const gchar *query, GError **error)
+{
+    return METADATA_BACKEND_GET_CLASS (self)->update (self, query, error);
+}
+
+GVariant* metadata_backend_update_blank (MetadataBackend *self, const gchar *query, GError **error)
+{
+    return METADATA_BACKEND_GET_CLASS (self)->update_blank (self, query, error);
+}
+
+/**
+ * metadata_backend_preload:
+ * @self: a #MetadataBackend
+ * @predicates: list of URIs of the predicates which will be involved in
+ * queries
+ *
+ * Permits to the backend to prepare itself for the queries to come. Backends
+ * not implementing it just ignore the hint
+ **/
+void metadata_backend_preload (MetadataBackend *self, GList *predicates)
+{
+    if (METADATA_BACKEND_GET_CLASS (self)->preload != NULL)
+        METADATA_BACKEND_GET_CLASS (self)->preload (self, predicates);
+}
+
+void metadata_backend_emit_changed (MetadataBackend *self, GList *references, gboolean all)
+{
+    g_signal_emit (self, Signals [CHANGED], 0, references, all);
+}
+
+void metadata_backend_emit_resources_changed (MetadataBackend *self, GList *resources, GList *references, gboolean all)
+{
+    g_signal_emit (self, Signals [RESOURCES_CHANGED], 0, resources, references, all);
+}
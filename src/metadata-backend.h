@@ -0,0 +1,77 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METADATA_BACKEND_H
+#define METADATA_BACKEND_H
+
+#include "common.h"
+
+#define METADATA_BACKEND_TYPE               (metadata_backend_get_type ())
+#define METADATA_BACKEND(obj)               (G_TYPE_CHECK_INSTANCE_CAST ((obj),     \
+                                             METADATA_BACKEND_TYPE, MetadataBackend))
+#define METADATA_BACKEND_CLASS(klass)       (G_TYPE_CHECK_CLASS_CAST ((klass),      \
+                                             METADATA_BACKEND_TYPE,                 \
+                                             MetadataBackendClass))
+#define IS_METADATA_BACKEND(obj)            (G_TYPE_CHECK_INSTANCE_TYPE ((obj),     \
+                                             METADATA_BACKEND_TYPE))
+#define IS_METADATA_BACKEND_CLASS(klass)    (G_TYPE_CHECK_CLASS_TYPE ((klass),      \
+                                             METADATA_BACKEND_TYPE))
+#define METADATA_BACKEND_GET_CLASS(obj)     (G_TYPE_INSTANCE_GET_CLASS ((obj),      \
+                                             METADATA_BACKEND_TYPE,                 \
+                                             MetadataBackendClass))
+
+typedef struct _MetadataBackend         MetadataBackend;
+typedef struct _MetadataBackendClass    MetadataBackendClass;
+
+struct _MetadataBackend {
+    GObject                 parent;
+};
+
+/*
+    Results are in the same format used by Tracker over D-Bus: (aas) for queries, (aaa{ss})
+    for updates with blank nodes
+*/
+struct _MetadataBackendClass {
+    GObjectClass    parent_class;
+
+    GVariant*       (*query)            (MetadataBackend *self, const gchar *query, GError **error);
+    gboolean        (*update)           (MetadataBackend *self, const gchar *query, GError **error);
+    GVariant*       (*update_blank)     (MetadataBackend *self, const gchar *query, GError **error);
+    void            (*preload)          (MetadataBackend *self, GList *predicates);
+
+    /* signals */
+    void            (*changed)          (MetadataBackend *self, GList *references, gboolean all);
+    void            (*resources_changed)    (MetadataBackend *self, GList *resources, GList *references, gboolean all);
+};
+
+GType               metadata_backend_get_type       ();
+
+MetadataBackend*    metadata_backend_new            (const gchar *spec, GError **error);
+void                metadata_backend_set_default    (MetadataBackend *backend);
+MetadataBackend*    metadata_backend_get_default    ();
+
+GVariant*           metadata_backend_query          (MetadataBackend *self, const gchar *query, GError **error);
+gboolean            metadata_backend_update         (MetadataBackend *self, const gchar *query, GError **error);
+GVariant*           metadata_backend_update_blank   (MetadataBackend *self, const gchar *query, GError **error);
+void                metadata_backend_preload        (MetadataBackend *self, GList *predicates);
+
+void                metadata_backend_emit_changed   (MetadataBackend *self, GList *references, gboolean all);
+void                metadata_backend_emit_resources_changed (MetadataBackend *self, GList *resources, GList *references, gboolean all);
+
+#endif
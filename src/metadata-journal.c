@@ -0,0 +1,677 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "metadata-journal.h"
+#include "utils.h"
+
+/*
+    Metadata changes are not saved synchronously on Tracker, but appended to a local log and
+    applied in batches by a background thread. Newly created resources are blank nodes, whose
+    subject is assigned by Tracker: it is delivered to the owner object (as the "subject"
+    property) in the main loop, and later changes on the same resource refer to the journal
+    entry creating it until the subject is known. Assigned subjects are saved in the log too,
+    so that those changes can be replayed after a crash.
+    If the creation fails, a NULL subject is delivered to the owner
+*/
+
+#define JOURNAL_BATCH_SIZE          200
+
+typedef enum {
+    JOURNAL_INSERT,
+    JOURNAL_UPDATE,
+    JOURNAL_DELETE,
+    JOURNAL_FORGET,
+} JOURNAL_OPERATION;
+
+typedef struct {
+    guint64             id;
+    JOURNAL_OPERATION   operation;
+    gchar               *subject;
+    guint64             depends;
+    gchar               *statements;
+    GWeakRef            *owner;
+} JournalEntry;
+
+typedef struct {
+    guint64             id;
+    gchar               *subject;       // NULL if the creation failed
+    GWeakRef            *owner;
+} JournalCompletion;
+
+static GThread      *worker         = NULL;
+static GMutex       lock;
+static GCond        wakeup;
+static GCond        drained;
+static GQueue       pending;
+static gboolean     busy            = FALSE;
+static gboolean     running         = FALSE;
+static guint64      next_id         = 1;
+static FILE         *logfile        = NULL;
+static gchar        *logpath        = NULL;
+static GList        *completions    = NULL;
+static guint        delivery        = 0;
+static GHashTable   *subjects       = NULL;     // used only by the worker: entry ID -> subject
+
+static void free_entry (JournalEntry *entry)
+{
+    g_free (entry->subject);
+    g_free (entry->statements);
+
+    if (entry->owner != NULL) {
+        g_weak_ref_clear (entry->owner);
+        g_free (entry->owner);
+    }
+
+    g_free (entry);
+}
+
+static void log_entry (JournalEntry *entry)
+{
+    gchar *escaped;
+
+    if (logfile == NULL || entry->operation == JOURNAL_FORGET)
+        return;
+
+    escaped = g_strescape (entry->statements != NULL ? entry->statements : "", NULL);
+    fprintf (logfile, "E\t%" G_GUINT64_FORMAT "\t%d\t%s\t%" G_GUINT64_FORMAT "\t%s\n",
+             entry->id, entry->operation, entry->subject != NULL ? entry->subject : "", entry->depends, escaped);
+    fflush (logfile);
+    g_free (escaped);
+}
+
+/*
+    To be called with the lock held
+*/
+static void log_subject (guint64 id, const gchar *subject)
+{
+    if (logfile == NULL)
+        return;
+
+    fprintf (logfile, "S\t%" G_GUINT64_FORMAT "\t%s\n", id, subject);
+    fflush (logfile);
+}
+
+static void relog_subject (guint64 *id, gchar *subject, gpointer useless)
+{
+    log_subject (*id, subject);
+}
+
+static void log_done (guint64 id)
+{
+    if (logfile == NULL)
+        return;
+
+    fprintf (logfile, "D\t%" G_GUINT64_FORMAT "\n", id);
+    fflush (logfile);
+}
+
+/*
+    To be called with the lock held
+*/
+static guint64 enqueue (JOURNAL_OPERATION operation, const gchar *subject, guint64 depends, const gchar *statements, GObject *owner)
+{
+    JournalEntry *entry;
+
+    entry = g_new0 (JournalEntry, 1);
+    entry->id = next_id++;
+    entry->operation = operation;
+    entry->subject = g_strdup (subject);
+    entry->depends = depends;
+    entry->statements = g_strdup (statements);
+
+    if (owner != NULL) {
+        entry->owner = g_new0 (GWeakRef, 1);
+        g_weak_ref_init (entry->owner, owner);
+    }
+
+    log_entry (entry);
+    g_queue_push_tail (&pending, entry);
+    g_cond_signal (&wakeup);
+    return entry->id;
+}
+
+static void deliver_completions_locked ()
+{
+    GList *list;
+    GList *iter;
+    GObject *owner;
+    JournalCompletion *completion;
+
+    list = g_list_reverse (completions);
+    completions = NULL;
+
+    for (iter = list; iter; iter = g_list_next (iter)) {
+        completion = (JournalCompletion*) iter->data;
+
+        if (completion->owner != NULL) {
+            owner = g_weak_ref_get (completion->owner);
+
+            if (owner != NULL) {
+                g_object_set (owner, "subject", completion->subject, NULL);
+                g_object_unref (owner);
+            }
+
+            g_weak_ref_clear (completion->owner);
+            g_free (completion->owner);
+        }
+
+        /*
+            From now on, changes on the resource will use the effective subject
+        */
+        if (completion->subject != NULL)
+            enqueue (JOURNAL_FORGET, NULL, completion->id, NULL, NULL);
+
+        g_free (completion->subject);
+        g_free (completion);
+    }
+
+    g_list_free (list);
+}
+
+static gboolean deliver_completions (gpointer useless)
+{
+    g_mutex_lock (&lock);
+    delivery = 0;
+    deliver_completions_locked ();
+    g_mutex_unlock (&lock);
+    return FALSE;
+}
+
+static gchar* entry_to_sparql (JournalEntry *entry)
+{
+    const gchar *subject;
+
+    subject = entry->subject;
+    if (entry->depends != 0)
+        subject = g_hash_table_lookup (subjects, &(entry->depends));
+
+    switch (entry->operation) {
+        case JOURNAL_INSERT:
+            return g_strdup_printf ("INSERT { _:item a nfo:FileDataObject ; a nie:InformationElement ; %s }", entry->statements);
+            break;
+
+        case JOURNAL_UPDATE:
+            if (subject != NULL)
+                return g_strdup_printf ("INSERT OR REPLACE { <%s> %s }", subject, entry->statements);
+            break;
+
+        case JOURNAL_DELETE:
+            if (subject != NULL)
+                return g_strdup_printf ("DELETE { <%s> ?predicate ?value } WHERE { <%s> ?predicate ?value }", subject, subject);
+            break;
+
+        default:
+            break;
+    }
+
+    return NULL;
+}
+
+/*
+    @subject is NULL if the creation of the resource failed
+*/
+static void complete_insert (JournalEntry *entry, const gchar *subject)
+{
+    JournalCompletion *completion;
+    guint64 *key;
+
+    if (subject != NULL) {
+        key = g_new (guint64, 1);
+        *key = entry->id;
+        g_hash_table_insert (subjects, key, g_strdup (subject));
+    }
+
+    completion = g_new0 (JournalCompletion, 1);
+    completion->id = entry->id;
+    completion->subject = g_strdup (subject);
+    completion->owner = entry->owner;
+    entry->owner = NULL;
+
+    g_mutex_lock (&lock);
+
+    if (subject != NULL)
+        log_subject (entry->id, subject);
+
+    completions = g_list_prepend (completions, completion);
+    if (delivery == 0)
+        delivery = g_idle_add (deliver_completions, NULL);
+
+    g_mutex_unlock (&lock);
+}
+
+/*
+    Runs the given entries in a single update, collecting subjects for the inserted resources.
+    If it fails and more entries are involved, they are retried one by one so to isolate the
+    broken one
+*/
+static void apply_batch (GList *batch)
+{
+    int index;
+    gchar *uri;
+    GList *iter;
+    GList *single;
+    GString *query;
+    GVariant *results;
+    GVariant *operations;
+    GVariant *solutions;
+    GVariant *solution;
+    GError *error;
+    JournalEntry *entry;
+
+    query = g_string_new ("");
+
+    for (iter = batch; iter; iter = g_list_next (iter)) {
+        uri = entry_to_sparql ((JournalEntry*) iter->data);
+
+        /*
+            Operations which cannot be expressed (e.g. referring a resource whose creation
+            failed) are replaced by an empty one, to not lose matching with results
+        */
+        g_string_append_printf (query, "%s ", uri != NULL ? uri : "INSERT { }");
+        g_free (uri);
+    }
+
+    error = NULL;
+    results = execute_update_blank (query->str, &error);
+    g_string_free (query, TRUE);
+
+    if (results == NULL) {
+        if (batch->next == NULL) {
+            g_warning ("Error while saving metadata: %s", error->message);
+
+            /*
+                The owner would wait forever for his subject
+            */
+            if (((JournalEntry*) batch->data)->operation == JOURNAL_INSERT)
+                complete_insert ((JournalEntry*) batch->data, NULL);
+        }
+        else {
+            for (iter = batch; iter; iter = g_list_next (iter)) {
+                single = g_list_prepend (NULL, iter->data);
+                apply_batch (single);
+                g_list_free (single);
+            }
+        }
+
+        g_error_free (error);
+        return;
+    }
+
+    /*
+        To know how to iter a SparqlUpdateBlank response, cfr.
+        http://mail.gnome.org/archives/commits-list/2011-February/msg05384.html
+    */
+    operations = g_variant_get_child_value (results, 0);
+
+    for (iter = batch, index = 0; iter; iter = g_list_next (iter), index++) {
+        entry = (JournalEntry*) iter->data;
+        if (entry->operation != JOURNAL_INSERT || index >= g_variant_n_children (operations))
+            continue;
+
+        solutions = g_variant_get_child_value (operations, index);
+
+        if (g_variant_n_children (solutions) != 0) {
+            solution = g_variant_get_child_value (solutions, 0);
+            uri = NULL;
+
+            if (g_variant_lookup (solution, "item", "s", &uri)) {
+                complete_insert (entry, uri);
+                g_free (uri);
+            }
+
+            g_variant_unref (solution);
+        }
+
+        g_variant_unref (solutions);
+    }
+
+    g_variant_unref (operations);
+    g_variant_unref (results);
+}
+
+static gpointer journal_worker (gpointer useless)
+{
+    int count;
+    gboolean stop;
+    guint64 last;
+    GList *iter;
+    GList *batch;
+    JournalEntry *entry;
+
+    g_mutex_lock (&lock);
+
+    while (TRUE) {
+        while (running == TRUE && g_queue_is_empty (&pending))
+            g_cond_wait (&wakeup, &lock);
+
+        if (running == FALSE && g_queue_is_empty (&pending))
+            break;
+
+        busy = TRUE;
+        batch = NULL;
+        last = 0;
+        count = 0;
+        stop = FALSE;
+
+        while (stop == FALSE && count < JOURNAL_BATCH_SIZE && (entry = g_queue_peek_head (&pending)) != NULL) {
+            if (entry->operation == JOURNAL_FORGET) {
+                g_queue_pop_head (&pending);
+                g_hash_table_remove (subjects, &(entry->depends));
+                free_entry (entry);
+                continue;
+            }
+
+            /*
+                Entries referring a resource created in the same batch have to wait the
+                subject assigned by Tracker
+            */
+            if (entry->depends != 0 && g_hash_table_lookup (subjects, &(entry->depends)) == NULL) {
+                for (iter = batch; iter; iter = g_list_next (iter)) {
+                    if (((JournalEntry*) iter->data)->id == entry->depends) {
+                        stop = TRUE;
+                        break;
+                    }
+                }
+
+                if (stop == TRUE)
+                    break;
+            }
+
+            g_queue_pop_head (&pending);
+            batch = g_list_prepend (batch, entry);
+            last = entry->id;
+            count++;
+        }
+
+        g_mutex_unlock (&lock);
+
+        if (batch != NULL) {
+            batch = g_list_reverse (batch);
+            apply_batch (batch);
+            g_list_foreach (batch, (GFunc) free_entry, NULL);
+            g_list_free (batch);
+        }
+
+        g_mutex_lock (&lock);
+
+        if (last != 0)
+            log_done (last);
+
+        busy = FALSE;
+
+        if (g_queue_is_empty (&pending)) {
+            /*
+                Everything has been saved, the log can be restarted. Subjects not yet
+                delivered are kept, as the following changes may still refer them
+            */
+            if (logfile != NULL && ftruncate (fileno (logfile), 0) == 0) {
+                rewind (logfile);
+                g_hash_table_foreach (subjects, (GHFunc) relog_subject, NULL);
+            }
+
+            g_cond_broadcast (&drained);
+        }
+    }
+
+    g_mutex_unlock (&lock);
+    return NULL;
+}
+
+static gboolean subject_unreferenced (guint64 *id, gchar *subject, gpointer useless)
+{
+    GList *iter;
+
+    for (iter = pending.head; iter; iter = g_list_next (iter))
+        if (((JournalEntry*) iter->data)->depends == *id)
+            return FALSE;
+
+    return TRUE;
+}
+
+/*
+    Entries found in the log and not marked as done are from a previous session, terminated
+    before they were saved: they are enqueued again. Subjects already assigned to resources
+    created in that session are reloaded, as pending entries may still refer them
+*/
+static void replay_log ()
+{
+    gchar *contents;
+    gchar **lines;
+    gchar **tokens;
+    guint64 done;
+    guint64 id;
+    guint64 *key;
+    register int i;
+    JournalEntry *entry;
+
+    if (g_file_get_contents (logpath, &contents, NULL, NULL) == FALSE)
+        return;
+
+    lines = g_strsplit (contents, "\n", -1);
+    g_free (contents);
+    done = 0;
+
+    for (i = 0; lines [i] != NULL; i++) {
+        if (lines [i][0] == 'D') {
+            id = g_ascii_strtoull (lines [i] + 2, NULL, 10);
+            if (id > done)
+                done = id;
+        }
+        else if (lines [i][0] == 'S') {
+            tokens = g_strsplit (lines [i], "\t", 3);
+
+            if (g_strv_length (tokens) == 3 && *(tokens [2]) != '\0') {
+                key = g_new (guint64, 1);
+                *key = g_ascii_strtoull (tokens [1], NULL, 10);
+                g_hash_table_insert (subjects, key, g_strdup (tokens [2]));
+            }
+
+            g_strfreev (tokens);
+        }
+    }
+
+    for (i = 0; lines [i] != NULL; i++) {
+        if (lines [i][0] != 'E')
+            continue;
+
+        tokens = g_strsplit (lines [i], "\t", 6);
+
+        if (g_strv_length (tokens) == 6) {
+            id = g_ascii_strtoull (tokens [1], NULL, 10);
+
+            /*
+                A creation with an assigned subject has already been saved, even if not
+                marked as done
+            */
+            if (id > done && (atoi (tokens [2]) != JOURNAL_INSERT || g_hash_table_lookup (subjects, &id) == NULL)) {
+                entry = g_new0 (JournalEntry, 1);
+                entry->id = id;
+                entry->operation = atoi (tokens [2]);
+                entry->subject = *(tokens [3]) != '\0' ? g_strdup (tokens [3]) : NULL;
+                entry->depends = g_ascii_strtoull (tokens [4], NULL, 10);
+                entry->statements = g_strcompress (tokens [5]);
+                g_queue_push_tail (&pending, entry);
+
+                if (id >= next_id)
+                    next_id = id + 1;
+            }
+        }
+
+        g_strfreev (tokens);
+    }
+
+    g_strfreev (lines);
+    g_hash_table_foreach_remove (subjects, (GHRFunc) subject_unreferenced, NULL);
+
+    if (g_queue_is_empty (&pending) == FALSE)
+        g_message ("Recovering %u metadata changes from previous session", g_queue_get_length (&pending));
+}
+
+void metadata_journal_init ()
+{
+    gchar *folder;
+    GList *iter;
+
+    if (worker != NULL) {
+        g_warning ("Metadata journal is already inited.");
+        return;
+    }
+
+    g_mutex_init (&lock);
+    g_cond_init (&wakeup);
+    g_cond_init (&drained);
+    g_queue_init (&pending);
+    subjects = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, g_free);
+
+    folder = g_build_filename (g_get_user_cache_dir (), "fster", NULL);
+    check_and_create_folder (folder);
+    logpath = g_build_filename (folder, "journal", NULL);
+    g_free (folder);
+
+    replay_log ();
+
+    logfile = fopen (logpath, "w");
+    if (logfile == NULL)
+        g_warning ("Unable to open metadata journal in %s, changes will not survive a crash", logpath);
+    else {
+        g_hash_table_foreach (subjects, (GHFunc) relog_subject, NULL);
+
+        for (iter = pending.head; iter; iter = g_list_next (iter))
+            log_entry ((JournalEntry*) iter->data);
+    }
+
+    running = TRUE;
+    worker = g_thread_new ("metadata-journal", journal_worker, NULL);
+}
+
+void metadata_journal_finish ()
+{
+    if (worker == NULL)
+        return;
+
+    metadata_journal_barrier ();
+
+    g_mutex_lock (&lock);
+    running = FALSE;
+    g_cond_signal (&wakeup);
+    g_mutex_unlock (&lock);
+
+    g_thread_join (worker);
+    worker = NULL;
+
+    if (delivery != 0) {
+        g_source_remove (delivery);
+        delivery = 0;
+    }
+
+    if (logfile != NULL) {
+        fclose (logfile);
+        logfile = NULL;
+    }
+
+    g_free (logpath);
+    logpath = NULL;
+    g_hash_table_destroy (subjects);
+    subjects = NULL;
+}
+
+/*
+    Enqueues the creation of a new resource with the given statements (in the form
+    "predicate value ; predicate value"). When the subject is assigned, it is set as the
+    "subject" property of @owner, if still alive. The returned ID may be used as @depends in
+    other operations on the same resource
+*/
+guint64 metadata_journal_insert (const gchar *statements, GObject *owner)
+{
+    guint64 ret;
+
+    g_mutex_lock (&lock);
+    ret = enqueue (JOURNAL_INSERT, NULL, 0, statements, owner);
+    g_mutex_unlock (&lock);
+    return ret;
+}
+
+/*
+    Enqueues the update of the given @subject, or of the resource created by the entry @depends
+    if the subject is not yet known
+*/
+guint64 metadata_journal_update (const gchar *subject, guint64 depends, const gchar *statements)
+{
+    guint64 ret;
+
+    g_mutex_lock (&lock);
+    ret = enqueue (JOURNAL_UPDATE, subject, depends, statements, NULL);
+    g_mutex_unlock (&lock);
+    return ret;
+}
+
+guint64 metadata_journal_delete (const gchar *subject, guint64 depends)
+{
+    guint64 ret;
+
+    g_mutex_lock (&lock);
+    ret = enqueue (JOURNAL_DELETE, subject, depends, NULL, NULL);
+    g_mutex_unlock (&lock);
+    return ret;
+}
+
+static void wait_drained_locked ()
+{
+    while (busy == TRUE || g_queue_is_empty (&pending) == FALSE)
+        g_cond_wait (&drained, &lock);
+}
+
+/*
+    Waits until all enqueued changes have been saved on Tracker, and assigns the obtained
+    subjects to their owners. Must be called from the main loop
+*/
+void metadata_journal_barrier ()
+{
+    if (worker == NULL)
+        return;
+
+    g_mutex_lock (&lock);
+    wait_drained_locked ();
+
+    if (logfile != NULL)
+        fdatasync (fileno (logfile));
+
+    deliver_completions_locked ();
+    g_mutex_unlock (&lock);
+}
+
+/*
+    To be called before reading from Tracker, so that queries see the changes already
+    enqueued: as metadata_journal_barrier(), but returns immediately when nothing is pending
+    and does not flush the log. Must be called from the main loop
+*/
+void metadata_journal_sync ()
+{
+    if (worker == NULL)
+        return;
+
+    g_mutex_lock (&lock);
+
+    if (busy == TRUE || g_queue_is_empty (&pending) == FALSE) {
+        wait_drained_locked ();
+        deliver_completions_locked ();
+    }
+
+    g_mutex_unlock (&lock);
+}
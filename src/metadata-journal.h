@@ -0,0 +1,34 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METADATA_JOURNAL_H
+#define METADATA_JOURNAL_H
+
+#include "common.h"
+
+void        metadata_journal_init           ();
+void        metadata_journal_finish         ();
+
+guint64     metadata_journal_insert         (const gchar *statements, GObject *owner);
+guint64     metadata_journal_update         (const gchar *subject, guint64 depends, const gchar *statements);
+guint64     metadata_journal_delete         (const gchar *subject, guint64 depends);
+void        metadata_journal_barrier        ();
+void        metadata_journal_sync           ();
+
+#endif
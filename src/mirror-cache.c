@@ -0,0 +1,600 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mirror-cache.h"
+#include <sys/inotify.h>
+
+#define WATCHED_EVENTS      (IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |       \
+                             IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+#define LISTING_EVENTS      (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+/*
+    Contents and attributes of the folders mirrored from the real filesystem. Each cached
+    folder is watched with inotify, and pending notifications are consumed before each
+    lookup: changes made outside FSter are so reflected as soon as the kernel reports them.
+    Attributes are cached only for files in watched folders, and so the O_PATH handles used
+    to access their contents, which are closed when the folder or one of his ancestors is
+    moved or deleted
+*/
+typedef struct {
+    int                 fd;
+    guint               users;
+    gboolean            detached;       // no more in the cache, closed by the last user
+} FolderHandle;
+
+typedef struct {
+    gchar               *path;
+    int                 wd;
+    GPtrArray           *listing;       // MirrorEntry, or NULL if not yet cached
+    gboolean            unchanged;      // FALSE if changed since the last lookup
+    GHashTable          *attributes;    // name -> struct stat
+    FolderHandle        *handle;        // NULL if not opened
+    GList               *handle_link;   // in HandlesLru
+} WatchedFolder;
+
+static int              Notifier        = -1;
+static GHashTable       *Folders        = NULL;     // path -> WatchedFolder
+static GHashTable       *Watches        = NULL;     // watch descriptor -> WatchedFolder, owned by Folders
+static GHashTable       *Descriptors    = NULL;     // fd -> FolderHandle
+static GQueue           HandlesLru      = G_QUEUE_INIT;     // WatchedFolder with an handle, most recent first
+G_LOCK_DEFINE_STATIC (Folders);
+
+static void free_folder_handle (FolderHandle *handle)
+{
+    g_hash_table_remove (Descriptors, GINT_TO_POINTER (handle->fd));
+    close (handle->fd);
+    g_free (handle);
+}
+
+/*
+    Handles still in use by some operation are closed only once released
+*/
+static void detach_handle (WatchedFolder *folder)
+{
+    if (folder->handle == NULL)
+        return;
+
+    g_queue_delete_link (&HandlesLru, folder->handle_link);
+    folder->handle_link = NULL;
+
+    folder->handle->detached = TRUE;
+    if (folder->handle->users == 0)
+        free_folder_handle (folder->handle);
+
+    folder->handle = NULL;
+}
+
+static void free_watched_folder (WatchedFolder *folder)
+{
+    detach_handle (folder);
+
+    if (folder->listing != NULL)
+        g_ptr_array_unref (folder->listing);
+
+    g_hash_table_destroy (folder->attributes);
+    g_free (folder->path);
+    g_free (folder);
+}
+
+/**
+ * mirror_entry_new:
+ * @name: name of the file
+ * @type: DT_DIR or DT_REG
+ *
+ * Allocates a new entry for a listing, to be freed with g_free()
+ *
+ * Return value: a newly allocated #MirrorEntry
+ **/
+MirrorEntry* mirror_entry_new (const gchar *name, unsigned char type)
+{
+    int len;
+    MirrorEntry *ret;
+
+    len = strlen (name);
+    ret = g_malloc (sizeof (MirrorEntry) + len + 1);
+    ret->type = type;
+    memcpy (ret->name, name, len + 1);
+    return ret;
+}
+
+/**
+ * mirror_cache_init:
+ *
+ * Inits the cache for mirrored folders. If inotify is not available,
+ * nothing is cached
+ **/
+void mirror_cache_init ()
+{
+    G_LOCK (Folders);
+
+    if (Folders == NULL) {
+        Notifier = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+        if (Notifier == -1)
+            g_warning ("Unable to init inotify, mirrored folders will not be cached: %s", strerror (errno));
+
+        Folders = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) free_watched_folder);
+        Watches = g_hash_table_new (g_direct_hash, g_direct_equal);
+        Descriptors = g_hash_table_new (g_direct_hash, g_direct_equal);
+    }
+
+    G_UNLOCK (Folders);
+}
+
+/**
+ * mirror_cache_finish:
+ *
+ * Drops all the cached contents and watches
+ **/
+void mirror_cache_finish ()
+{
+    G_LOCK (Folders);
+
+    if (Folders != NULL) {
+        g_hash_table_destroy (Watches);
+        g_hash_table_destroy (Folders);
+        g_hash_table_destroy (Descriptors);
+        Watches = NULL;
+        Folders = NULL;
+        Descriptors = NULL;
+    }
+
+    if (Notifier != -1) {
+        close (Notifier);
+        Notifier = -1;
+    }
+
+    G_UNLOCK (Folders);
+}
+
+static const gchar* name_in_folder (const gchar *path, const gchar *folder)
+{
+    return path + strlen (folder) + (strcmp (folder, "/") != 0 ? 1 : 0);
+}
+
+/*
+    Attributes of a folder change also when his contents change, but those events are
+    notified only to his own watch
+*/
+static void forget_attributes (const gchar *path)
+{
+    gchar *parent;
+    WatchedFolder *folder;
+
+    parent = g_path_get_dirname (path);
+    folder = g_hash_table_lookup (Folders, parent);
+
+    if (folder != NULL)
+        g_hash_table_remove (folder->attributes, name_in_folder (path, parent));
+
+    g_free (parent);
+}
+
+static void forget_folder (WatchedFolder *folder)
+{
+    forget_attributes (folder->path);
+    g_hash_table_remove (Watches, GINT_TO_POINTER (folder->wd));
+    g_hash_table_remove (Folders, folder->path);
+}
+
+static void remove_watch (gpointer wd, WatchedFolder *folder, gpointer useless)
+{
+    inotify_rm_watch (Notifier, folder->wd);
+}
+
+/*
+    Watches follow the inodes, while folders are indexed by path: when a folder is moved,
+    deleted or replaced, all the folders cached beneath his previous path are dropped,
+    together with their watches
+*/
+static void forget_subtree (const gchar *path)
+{
+    int len;
+    GList *iter;
+    GList *doomed;
+    GHashTableIter hiter;
+    WatchedFolder *folder;
+
+    len = strlen (path);
+    doomed = NULL;
+    g_hash_table_iter_init (&hiter, Folders);
+
+    while (g_hash_table_iter_next (&hiter, NULL, (gpointer*) &folder))
+        if (strncmp (folder->path, path, len) == 0 && folder->path [len] == '/')
+            doomed = g_list_prepend (doomed, folder);
+
+    for (iter = doomed; iter; iter = g_list_next (iter)) {
+        folder = (WatchedFolder*) iter->data;
+        inotify_rm_watch (Notifier, folder->wd);
+        forget_folder (folder);
+    }
+
+    g_list_free (doomed);
+}
+
+static void forget_child_folder (WatchedFolder *parent, const gchar *name)
+{
+    gchar *path;
+    WatchedFolder *folder;
+
+    path = g_build_filename (parent->path, name, NULL);
+
+    folder = g_hash_table_lookup (Folders, path);
+    if (folder != NULL) {
+        inotify_rm_watch (Notifier, folder->wd);
+        forget_folder (folder);
+    }
+
+    forget_subtree (path);
+    g_free (path);
+}
+
+static void apply_event (struct inotify_event *event)
+{
+    gchar *path;
+    WatchedFolder *folder;
+
+    folder = g_hash_table_lookup (Watches, GINT_TO_POINTER (event->wd));
+    if (folder == NULL)
+        return;
+
+    /*
+        The kernel removes the watch once the folder is deleted (IN_IGNORED follows), but
+        on a move the watch would follow the folder to his new path, so it is removed here
+    */
+    if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        if ((event->mask & IN_IGNORED) == 0)
+            inotify_rm_watch (Notifier, folder->wd);
+
+        path = g_strdup (folder->path);
+        forget_folder (folder);
+        forget_subtree (path);
+        g_free (path);
+        return;
+    }
+
+    if (event->len != 0) {
+        g_hash_table_remove (folder->attributes, event->name);
+
+        if ((event->mask & IN_ISDIR) && (event->mask & (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)))
+            forget_child_folder (folder, event->name);
+    }
+
+    if (event->mask & LISTING_EVENTS) {
+        folder->unchanged = FALSE;
+
+        if (folder->listing != NULL) {
+            g_ptr_array_unref (folder->listing);
+            folder->listing = NULL;
+        }
+
+        forget_attributes (folder->path);
+    }
+}
+
+/*
+    To be called with the lock held. If the kernel queue overflowed, nothing can be
+    trusted anymore and all the cache is dropped
+*/
+static void consume_events ()
+{
+    int len;
+    gchar *ptr;
+    gchar buffer [4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    struct inotify_event *event;
+
+    if (Notifier == -1)
+        return;
+
+    while ((len = read (Notifier, buffer, sizeof (buffer))) > 0) {
+        for (ptr = buffer; ptr < buffer + len; ptr += sizeof (struct inotify_event) + event->len) {
+            event = (struct inotify_event*) ptr;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                g_hash_table_foreach (Watches, (GHFunc) remove_watch, NULL);
+                g_hash_table_remove_all (Watches);
+                g_hash_table_remove_all (Folders);
+            }
+            else {
+                apply_event (event);
+            }
+        }
+    }
+}
+
+static WatchedFolder* get_folder (const gchar *path, gboolean create)
+{
+    int len;
+    int wd;
+    WatchedFolder *folder;
+
+    /*
+        Folders are indexed without trailing slash, as returned by g_path_get_dirname()
+    */
+    len = strlen (path);
+    if (len > 1 && path [len - 1] == '/')
+        path = strndupa (path, len - 1);
+
+    folder = g_hash_table_lookup (Folders, path);
+
+    if (folder == NULL && create == TRUE && Notifier != -1 && g_hash_table_size (Folders) < MIRROR_CACHE_MAX_WATCHES) {
+        wd = inotify_add_watch (Notifier, path, WATCHED_EVENTS | IN_ONLYDIR);
+
+        if (wd != -1) {
+            /*
+                The same folder may be reached with different paths (e.g. by symlinks), but
+                each watch has to refer only one of them
+            */
+            if (g_hash_table_lookup (Watches, GINT_TO_POINTER (wd)) != NULL)
+                return NULL;
+
+            folder = g_new0 (WatchedFolder, 1);
+            folder->path = g_strdup (path);
+            folder->wd = wd;
+            folder->attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+            g_hash_table_insert (Folders, folder->path, folder);
+            g_hash_table_insert (Watches, GINT_TO_POINTER (wd), folder);
+        }
+    }
+
+    return folder;
+}
+
+/**
+ * mirror_cache_get_listing:
+ * @folder: absolute path of a folder in the real filesystem
+ *
+ * Retrieves the files in @folder, if still valid in the cache
+ *
+ * Return value: array of #MirrorEntry, to be released with
+ * g_ptr_array_unref(), or NULL if not available
+ **/
+GPtrArray* mirror_cache_get_listing (const gchar *folder)
+{
+    GPtrArray *ret;
+    WatchedFolder *watched;
+
+    ret = NULL;
+    G_LOCK (Folders);
+
+    if (Folders != NULL) {
+        consume_events ();
+
+        /*
+            The folder is watched before being scanned, so that changes happening in the
+            meanwhile are not lost
+        */
+        watched = get_folder (folder, TRUE);
+
+        if (watched != NULL) {
+            if (watched->listing != NULL)
+                ret = g_ptr_array_ref (watched->listing);
+            else
+                watched->unchanged = TRUE;
+        }
+    }
+
+    G_UNLOCK (Folders);
+    return ret;
+}
+
+/**
+ * mirror_cache_set_listing:
+ * @folder: absolute path of a folder in the real filesystem
+ * @names: array of #MirrorEntry describing the files in @folder
+ *
+ * Saves the contents of @folder, as read after a failed
+ * mirror_cache_get_listing(). If @folder changed in the meanwhile, @names
+ * is discarded. A reference to @names is hold
+ **/
+void mirror_cache_set_listing (const gchar *folder, GPtrArray *names)
+{
+    WatchedFolder *watched;
+
+    G_LOCK (Folders);
+
+    if (Folders != NULL) {
+        consume_events ();
+        watched = get_folder (folder, FALSE);
+
+        if (watched != NULL && watched->unchanged == TRUE) {
+            if (watched->listing != NULL)
+                g_ptr_array_unref (watched->listing);
+            watched->listing = g_ptr_array_ref (names);
+        }
+    }
+
+    G_UNLOCK (Folders);
+}
+
+/**
+ * mirror_cache_get_stat:
+ * @path: absolute path of a file in the real filesystem
+ * @sbuf: stat struct to be filled
+ *
+ * Retrieves the lstat() attributes of @path, if still valid in the cache
+ *
+ * Return value: TRUE if @sbuf has been filled, FALSE otherwise
+ **/
+gboolean mirror_cache_get_stat (const gchar *path, struct stat *sbuf)
+{
+    gchar *folder;
+    gboolean ret;
+    struct stat *cached;
+    WatchedFolder *watched;
+
+    ret = FALSE;
+    folder = g_path_get_dirname (path);
+    G_LOCK (Folders);
+
+    if (Folders != NULL) {
+        consume_events ();
+        watched = get_folder (folder, FALSE);
+
+        if (watched != NULL) {
+            cached = g_hash_table_lookup (watched->attributes, name_in_folder (path, folder));
+
+            if (cached != NULL) {
+                *sbuf = *cached;
+                ret = TRUE;
+            }
+        }
+    }
+
+    G_UNLOCK (Folders);
+    g_free (folder);
+    return ret;
+}
+
+/**
+ * mirror_cache_set_stat:
+ * @path: absolute path of a file in the real filesystem
+ * @sbuf: lstat() attributes of @path
+ *
+ * Saves the attributes of @path. Those are kept only if the parent folder
+ * of @path is watched, i.e. it has been listed with
+ * mirror_cache_set_listing(), and (for folders) if also @path is watched
+ **/
+void mirror_cache_set_stat (const gchar *path, struct stat *sbuf)
+{
+    gchar *folder;
+    struct stat *cached;
+    WatchedFolder *watched;
+
+    folder = g_path_get_dirname (path);
+    G_LOCK (Folders);
+
+    if (Folders != NULL) {
+        consume_events ();
+        watched = get_folder (folder, FALSE);
+
+        if (watched != NULL && (S_ISDIR (sbuf->st_mode) == FALSE || get_folder (path, FALSE) != NULL)) {
+            cached = g_new (struct stat, 1);
+            *cached = *sbuf;
+            g_hash_table_replace (watched->attributes, g_strdup (name_in_folder (path, folder)), cached);
+        }
+    }
+
+    G_UNLOCK (Folders);
+    g_free (folder);
+}
+
+/**
+ * mirror_cache_acquire_handle:
+ * @folder: absolute path of a folder in the real filesystem
+ *
+ * Retrieves an O_PATH descriptor for @folder, to be used with the *at()
+ * syscalls. Descriptors are kept only for watched folders, so that they
+ * never refer a folder moved or replaced in the meanwhile, and at most
+ * MIRROR_CACHE_MAX_HANDLES are kept open at the same time
+ *
+ * Return value: a file descriptor to be released with
+ * mirror_cache_release_handle(), or -1 if not available
+ **/
+int mirror_cache_acquire_handle (const gchar *folder)
+{
+    int fd;
+    int ret;
+    gchar *parent;
+    WatchedFolder *watched;
+
+    ret = -1;
+    G_LOCK (Folders);
+
+    if (Folders != NULL) {
+        consume_events ();
+
+        /*
+            The folder is watched before being opened, so that a replacement happening in
+            the meanwhile is notified
+        */
+        watched = get_folder (folder, TRUE);
+
+        /*
+            A folder moved over the watched one is reported only to the parent, which
+            has to be watched too. Its events also drop the handles of all the folders
+            beneath the moved or deleted one
+        */
+        if (watched != NULL && watched->handle == NULL) {
+            parent = g_path_get_dirname (watched->path);
+            if (strcmp (parent, watched->path) != 0 && get_folder (parent, TRUE) == NULL)
+                watched = NULL;
+            g_free (parent);
+        }
+
+        if (watched != NULL) {
+            if (watched->handle == NULL) {
+                fd = open (watched->path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+                if (fd != -1) {
+                    if (g_queue_get_length (&HandlesLru) >= MIRROR_CACHE_MAX_HANDLES)
+                        detach_handle ((WatchedFolder*) g_queue_peek_tail (&HandlesLru));
+
+                    watched->handle = g_new0 (FolderHandle, 1);
+                    watched->handle->fd = fd;
+                    g_hash_table_insert (Descriptors, GINT_TO_POINTER (fd), watched->handle);
+
+                    g_queue_push_head (&HandlesLru, watched);
+                    watched->handle_link = HandlesLru.head;
+                }
+            }
+            else {
+                g_queue_unlink (&HandlesLru, watched->handle_link);
+                g_queue_push_head_link (&HandlesLru, watched->handle_link);
+            }
+
+            if (watched->handle != NULL) {
+                watched->handle->users++;
+                ret = watched->handle->fd;
+            }
+        }
+    }
+
+    G_UNLOCK (Folders);
+    return ret;
+}
+
+/**
+ * mirror_cache_release_handle:
+ * @fd: a descriptor obtained with mirror_cache_acquire_handle()
+ *
+ * Releases a descriptor once the operation using it is completed. errno is
+ * preserved, so this can be called right after the syscall using @fd
+ **/
+void mirror_cache_release_handle (int fd)
+{
+    int saved;
+    FolderHandle *handle;
+
+    saved = errno;
+    G_LOCK (Folders);
+
+    if (Descriptors != NULL) {
+        handle = g_hash_table_lookup (Descriptors, GINT_TO_POINTER (fd));
+
+        if (handle != NULL) {
+            handle->users--;
+            if (handle->users == 0 && handle->detached == TRUE)
+                free_folder_handle (handle);
+        }
+    }
+
+    G_UNLOCK (Folders);
+    errno = saved;
+}
@@ -0,0 +1,58 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIRROR_CACHE_H
+#define MIRROR_CACHE_H
+
+#include "common.h"
+
+/*
+    Max number of folders watched for changes: contents of other folders are not cached
+*/
+#define MIRROR_CACHE_MAX_WATCHES        4096
+
+/*
+    Max number of O_PATH handles kept open for watched folders, least recently used are
+    closed first
+*/
+#define MIRROR_CACHE_MAX_HANDLES        256
+
+/*
+    Entry of a cached listing, with the type (DT_DIR or DT_REG) used to expose it
+*/
+typedef struct {
+    unsigned char       type;
+    gchar               name [];
+} MirrorEntry;
+
+MirrorEntry*    mirror_entry_new                (const gchar *name, unsigned char type);
+
+void            mirror_cache_init               ();
+void            mirror_cache_finish             ();
+
+GPtrArray*      mirror_cache_get_listing        (const gchar *folder);
+void            mirror_cache_set_listing        (const gchar *folder, GPtrArray *names);
+
+gboolean        mirror_cache_get_stat           (const gchar *path, struct stat *sbuf);
+void            mirror_cache_set_stat           (const gchar *path, struct stat *sbuf);
+
+int             mirror_cache_acquire_handle     (const gchar *folder);
+void            mirror_cache_release_handle     (int fd);
+
+#endif
@@ -23,17 +23,24 @@
 
 struct _NodesCachePrivate {
     GHashTable          *bag;
+    GHashTable          *listings;  // folder path -> GList of ListingRows, for items listed but not yet built
     GRWLock             lock;
 };
 
 G_DEFINE_TYPE (NodesCache, nodes_cache, G_TYPE_OBJECT);
 
+static void free_listings (GList *listings)
+{
+    g_list_free_full (listings, (GDestroyNotify) hierarchy_node_listing_free);
+}
+
 static void nodes_cache_finalize (GObject *cache)
 {
     NodesCache *ret;
 
     ret = NODES_CACHE (cache);
     g_hash_table_destroy (ret->priv->bag);
+    g_hash_table_destroy (ret->priv->listings);
     g_rw_lock_clear (&(ret->priv->lock));
 }
 
@@ -52,6 +59,7 @@ static void nodes_cache_init (NodesCache *cache)
     cache->priv = NODES_CACHE_GET_PRIVATE (cache);
     memset (cache->priv, 0, sizeof (NodesCachePrivate));
     cache->priv->bag = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+    cache->priv->listings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) free_listings);
     g_rw_lock_init (&(cache->priv->lock));
 }
 
@@ -81,13 +89,49 @@ static ItemHandler* internal_get_by_path (NodesCache *cache, const gchar *path)
     return (ItemHandler*) g_hash_table_lookup (cache->priv->bag, path);
 }
 
+/*
+    Looks for @path in the listing of his folder, if any, and builds the item
+*/
+static ItemHandler* internal_get_from_listings (NodesCache *cache, const gchar *path)
+{
+    gchar *folder;
+    const gchar *name;
+    GList *iter;
+    ItemHandler *ret;
+
+    ret = NULL;
+    folder = g_path_get_dirname (path);
+    name = strrchr (path, '/');
+
+    if (name != NULL) {
+        name++;
+
+        for (iter = g_hash_table_lookup (cache->priv->listings, folder); ret == NULL && iter; iter = g_list_next (iter))
+            ret = hierarchy_node_listing_lookup ((ListingRows*) iter->data, name);
+    }
+
+    g_free (folder);
+    return ret;
+}
+
+static void internal_forget_listing (NodesCache *cache, const gchar *path)
+{
+    gchar *folder;
+
+    folder = g_path_get_dirname (path);
+    g_hash_table_remove (cache->priv->listings, folder);
+    g_hash_table_remove (cache->priv->listings, path);
+    g_free (folder);
+}
+
 /**
  * nodes_cache_get_by_path:
  * @cache: instance of #NodesCache to query
  * @path: path to look for
  *
  * Given an absolute path relative to the filesystem, looks for the related
- * #ItemHandler
+ * #ItemHandler. If @path has been only listed, the item is built from the
+ * listing of his folder
  *
  * Return value: the #ItemHandler found at @path, or NULL if nothing has been
  * cached yet
@@ -99,6 +143,21 @@ ItemHandler* nodes_cache_get_by_path (NodesCache *cache, const gchar *path)
     g_rw_lock_reader_lock (&(cache->priv->lock));
     ret = internal_get_by_path (cache, path);
     g_rw_lock_reader_unlock (&(cache->priv->lock));
+
+    if (ret != NULL)
+        return ret;
+
+    g_rw_lock_writer_lock (&(cache->priv->lock));
+
+    ret = internal_get_by_path (cache, path);
+
+    if (ret == NULL) {
+        ret = internal_get_from_listings (cache, path);
+        if (ret != NULL)
+            g_hash_table_insert (cache->priv->bag, g_strdup (path), ret);
+    }
+
+    g_rw_lock_writer_unlock (&(cache->priv->lock));
     return ret;
 }
 
@@ -124,6 +183,24 @@ void nodes_cache_set_by_path (NodesCache *cache, ItemHandler *item, const gchar
     g_rw_lock_writer_unlock (&(cache->priv->lock));
 }
 
+/**
+ * nodes_cache_set_listings_by_path:
+ * @cache: instance of #NodesCache to populate
+ * @listings: list of #ListingRows obtained listing the folder at @path
+ * @path: absolute path of the listed folder. Must be constant and never
+ * freed
+ *
+ * Saves the rows of a listing, from which the items found in the folder at
+ * @path are built when required with nodes_cache_get_by_path(). Listings
+ * already saved for @path are replaced
+ **/
+void nodes_cache_set_listings_by_path (NodesCache *cache, GList *listings, gchar *path)
+{
+    g_rw_lock_writer_lock (&(cache->priv->lock));
+    g_hash_table_replace (cache->priv->listings, path, listings);
+    g_rw_lock_writer_unlock (&(cache->priv->lock));
+}
+
 /**
  * nodes_cache_remove_by_path:
  * @cache: instance of #NodesCache to manipulate
@@ -133,5 +210,8 @@ void nodes_cache_set_by_path (NodesCache *cache, ItemHandler *item, const gchar
  **/
 void nodes_cache_remove_by_path (NodesCache *cache, const gchar *path)
 {
+    g_rw_lock_writer_lock (&(cache->priv->lock));
+    internal_forget_listing (cache, path);
     g_hash_table_remove (cache->priv->bag, path);
+    g_rw_lock_writer_unlock (&(cache->priv->lock));
 }
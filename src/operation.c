@@ -0,0 +1,249 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "operation.h"
+#include "gfuse-loop.h"
+#include "core.h"
+
+/*
+    State of the filesystem operation executed by the current thread. Once the operation has
+    been interrupted or has run out of time, all the following queries fail immediately and
+    the proper error is returned to the kernel
+*/
+typedef struct {
+    gboolean            active;
+    gint64              start;
+    gint64              deadline;
+    gboolean            timed;
+    int                 aborted;
+    GCancellable        *cancellable;
+} Operation;
+
+static void free_operation (Operation *op)
+{
+    if (op->cancellable != NULL)
+        g_object_unref (op->cancellable);
+
+    g_free (op);
+}
+
+static GPrivate CurrentOperation = G_PRIVATE_INIT ((GDestroyNotify) free_operation);
+
+static Operation* current_operation ()
+{
+    Operation *op;
+
+    op = g_private_get (&CurrentOperation);
+
+    if (op == NULL) {
+        op = g_new0 (Operation, 1);
+        op->cancellable = g_cancellable_new ();
+        g_private_set (&CurrentOperation, op);
+    }
+
+    return op;
+}
+
+/**
+ * operation_begin:
+ *
+ * Marks the start of a filesystem operation in the current thread, with
+ * the default deadline
+ **/
+void operation_begin ()
+{
+    Operation *op;
+
+    op = current_operation ();
+    op->active = TRUE;
+    op->start = g_get_monotonic_time ();
+    op->deadline = op->start + (OPERATION_DEFAULT_TIMEOUT * 1000);
+    op->timed = FALSE;
+    op->aborted = 0;
+
+    if (g_cancellable_is_cancelled (op->cancellable))
+        g_cancellable_reset (op->cancellable);
+}
+
+/**
+ * operation_set_timeout:
+ * @timeout: time, in milliseconds from the start of the operation, after
+ * which the operation fails
+ *
+ * Changes the deadline of the operation running in the current thread, if
+ * any. The first call replaces the default deadline, the following ones can
+ * only postpone it: an operation traversing many nodes gets the longest
+ * timeout among them
+ **/
+void operation_set_timeout (guint timeout)
+{
+    gint64 deadline;
+    Operation *op;
+
+    op = g_private_get (&CurrentOperation);
+    if (op != NULL && op->active == TRUE) {
+        deadline = op->start + ((gint64) timeout * 1000);
+        if (op->timed == FALSE || deadline > op->deadline)
+            op->deadline = deadline;
+        op->timed = TRUE;
+    }
+}
+
+/**
+ * operation_end:
+ * @result: value to return to the kernel, as computed by the operation
+ *
+ * Marks the end of the operation running in the current thread. Successful
+ * results are always preserved, as resources (e.g. file descriptors) may
+ * have been already allocated for them
+ *
+ * Return value: @result, or -EINTR or -ETIMEDOUT if the operation failed
+ * after having been interrupted or having exceeded his deadline
+ **/
+int operation_end (int result)
+{
+    Operation *op;
+
+    op = g_private_get (&CurrentOperation);
+    if (op == NULL || op->active == FALSE)
+        return result;
+
+    op->active = FALSE;
+
+    if (result < 0 && op->aborted != 0)
+        return op->aborted;
+
+    return result;
+}
+
+/**
+ * operation_is_active:
+ *
+ * Return value: TRUE if the current thread is executing a filesystem
+ * operation
+ **/
+gboolean operation_is_active ()
+{
+    Operation *op;
+
+    op = g_private_get (&CurrentOperation);
+    return (op != NULL && op->active == TRUE);
+}
+
+/**
+ * operation_remaining:
+ *
+ * Return value: milliseconds left until the deadline of the current
+ * operation, or -1 if no operation is running
+ **/
+gint operation_remaining ()
+{
+    gint64 left;
+    Operation *op;
+
+    op = g_private_get (&CurrentOperation);
+    if (op == NULL || op->active == FALSE)
+        return -1;
+
+    left = (op->deadline - g_get_monotonic_time ()) / 1000;
+    return (gint) MAX (left, 1);
+}
+
+/**
+ * operation_get_cancellable:
+ *
+ * Return value: a #GCancellable triggered when the current operation is
+ * interrupted or exceeds his deadline, or NULL if no operation is running.
+ * The reference is owned by the function
+ **/
+GCancellable* operation_get_cancellable ()
+{
+    Operation *op;
+
+    op = g_private_get (&CurrentOperation);
+    if (op == NULL || op->active == FALSE)
+        return NULL;
+
+    return op->cancellable;
+}
+
+/**
+ * operation_watch_interrupts:
+ * @context: the #GMainContext in which the current thread is waiting
+ *
+ * The loop serving FUSE requests is blocked while an operation waits for
+ * something else: this attaches to @context a source reading interruptions
+ * from the kernel, so that operation_check() is able to detect them
+ *
+ * Return value: the attached #GSource, to be destroyed and released when
+ * the wait is over, or NULL if no operation is running
+ **/
+GSource* operation_watch_interrupts (GMainContext *context)
+{
+    GSource *ret;
+    GFuseLoop *loop;
+
+    if (operation_is_active () == FALSE)
+        return NULL;
+
+    loop = gfuse_loop_get_current ();
+    if (loop == NULL)
+        return NULL;
+
+    ret = gfuse_loop_interrupts_source (loop);
+    g_source_attach (ret, context);
+    return ret;
+}
+
+/**
+ * operation_check:
+ * @error: return location for a #GError
+ *
+ * Verifies if the current operation has been interrupted by the kernel
+ * (FUSE_INTERRUPT) or has exceeded his deadline. In both cases the
+ * #GCancellable of the operation is triggered, so to abort pending calls
+ *
+ * Return value: FALSE if the operation has to be stopped, TRUE otherwise
+ **/
+gboolean operation_check (GError **error)
+{
+    Operation *op;
+
+    op = g_private_get (&CurrentOperation);
+    if (op == NULL || op->active == FALSE)
+        return TRUE;
+
+    if (op->aborted == 0) {
+        if (fuse_interrupted () != 0)
+            op->aborted = -EINTR;
+        else if (g_get_monotonic_time () >= op->deadline)
+            op->aborted = -ETIMEDOUT;
+        else
+            return TRUE;
+
+        g_cancellable_cancel (op->cancellable);
+    }
+
+    if (op->aborted == -EINTR)
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Operation interrupted");
+    else
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT, "Operation timed out");
+
+    return FALSE;
+}
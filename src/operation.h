@@ -0,0 +1,40 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPERATION_H
+#define OPERATION_H
+
+#include "common.h"
+
+/*
+    Time (in milliseconds) granted to a filesystem operation until the involved node is known
+*/
+#define OPERATION_DEFAULT_TIMEOUT       10000
+
+void            operation_begin                 ();
+void            operation_set_timeout           (guint timeout);
+int             operation_end                   (int result);
+
+gboolean        operation_is_active             ();
+gint            operation_remaining             ();
+GCancellable*   operation_get_cancellable       ();
+GSource*        operation_watch_interrupts      (GMainContext *context);
+gboolean        operation_check                 (GError **error);
+
+#endif
@@ -30,60 +30,38 @@
 #define XSD_STRING      XSD_PREFIX "string"
 #define XSD_CLASS       "http://www.w3.org/2000/01/rdf-schema#Class"
 
-static GHashTable   *namespaces     = NULL;
-static GHashTable   *properties     = NULL;
+#define ONTOLOGY_CACHE_FILE     "ontology"
 
-void properties_pool_init ()
-{
-    gchar *query;
-    gchar *uri;
-    gchar *prefix;
-    GVariant *response;
-    GVariantIter *iter;
-    GVariantIter *subiter;
-    GError *error;
-
-    if (namespaces != NULL) {
-        g_warning ("Properties pool is already inited.");
-        return;
-    }
-
-    namespaces = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
-    properties = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+static GHashTable   *namespaces     = NULL;     // prefix -> namespace
+static GHashTable   *prefixes       = NULL;     // namespace -> prefix
+static GHashTable   *properties     = NULL;     // uri -> Property
+static GHashTable   *names          = NULL;     // prefixed name -> Property
+static GPtrArray    *registry       = NULL;     // id -> Property
+static gboolean     cardinalities   = FALSE;    // TRUE if the ontology describes them
 
-    query = g_strdup_printf ("SELECT ?s ?prefix WHERE { ?s a tracker:Namespace . ?s tracker:prefix ?prefix }");
-    error = NULL;
-    response = execute_query (query, &error);
-    g_free (query);
-
-    if (response == NULL) {
-        g_warning ("Unable to fetch namespaces: %s", error->message);
-        g_error_free (error);
-        return;
-    }
+/*
+    Properties not found at init are added while the filesystem runs
+*/
+G_LOCK_DEFINE_STATIC (Pool);
 
-    iter = NULL;
-    subiter = NULL;
-    g_variant_get (response, "(aas)", &iter);
-
-    while (g_variant_iter_loop (iter, "as", &subiter)) {
-        prefix = NULL;
-        uri = NULL;
-
-        if (g_variant_iter_loop (subiter, "s", &uri) && g_variant_iter_loop (subiter, "s", &prefix)) {
-            printf ("%s - %s\n", prefix, uri);
-            g_hash_table_insert (namespaces, g_strdup (prefix), g_strdup (uri));
-        }
-    }
-
-    g_variant_unref (response);
-}
-
-void properties_pool_finish ()
+static PROPERTY_DATATYPE range_to_datatype (const gchar *type)
 {
-    g_hash_table_destroy (namespaces);
-    g_hash_table_destroy (properties);
-    namespaces = NULL;
+    if (strcmp (type, XSD_STRING) == 0)
+        return PROPERTY_TYPE_STRING;
+    else if (strcmp (type, XSD_BOOLEAN) == 0)
+        return PROPERTY_TYPE_BOOLEAN;
+    else if (strcmp (type, XSD_INTEGER) == 0)
+        return PROPERTY_TYPE_INTEGER;
+    else if (strcmp (type, XSD_DOUBLE) == 0)
+        return PROPERTY_TYPE_DOUBLE;
+    else if (strcmp (type, XSD_DATE) == 0)
+        return PROPERTY_TYPE_DATE;
+    else if (strcmp (type, XSD_DATETIME) == 0)
+        return PROPERTY_TYPE_DATETIME;
+    else if (strcmp (type, XSD_CLASS) == 0)
+        return PROPERTY_TYPE_CLASS;
+    else
+        return PROPERTY_TYPE_RESOURCE;
 }
 
 static gchar* name_to_uri (gchar *name)
@@ -113,33 +91,424 @@ static gchar* name_to_uri (gchar *name)
     }
 }
 
-static gchar* uri_to_name (gchar *uri)
+/*
+    Namespaces terminate with a separator ('#' or '/', sometimes ':'), so the candidates for
+    the given @uri are looked up in the index from the longest one
+*/
+static gchar* uri_to_name (const gchar *uri)
 {
-    gchar *name;
-    gchar *namespace;
-    GList *prefixes;
-    GList *iter;
-
-    prefixes = g_hash_table_get_keys (namespaces);
-    name = NULL;
-
-    for (iter = prefixes; iter; iter = g_list_next (iter)) {
-        namespace = g_hash_table_lookup (namespaces, iter->data);
-        if (g_str_has_prefix (uri, namespace)) {
-            name = iter->data;
-            break;
-        }
+    register int i;
+    gchar *candidate;
+    const gchar *prefix;
+
+    candidate = strdupa (uri);
+
+    for (i = strlen (candidate) - 2; i >= 0; i--) {
+        if (candidate [i] != '#' && candidate [i] != '/' && candidate [i] != ':')
+            continue;
+
+        candidate [i + 1] = '\0';
+        prefix = g_hash_table_lookup (prefixes, candidate);
+
+        if (prefix != NULL)
+            return g_strdup_printf ("%s:%s", prefix, uri + i + 1);
     }
 
-    g_list_free (prefixes);
+    g_warning ("Unable to retrieve uri in ontology: '%s'", uri);
+    return NULL;
+}
+
+static void register_namespace (const gchar *prefix, const gchar *uri)
+{
+    g_hash_table_insert (namespaces, g_strdup (prefix), g_strdup (uri));
+    g_hash_table_insert (prefixes, g_strdup (uri), g_strdup (prefix));
+}
+
+static Property* register_property (const gchar *uri, PROPERTY_DATATYPE type)
+{
+    gchar *name;
+    Property *prop;
+
+    prop = property_new ();
+
+    name = uri_to_name (uri);
+    property_set_name (prop, name);
+    g_free (name);
 
-    if (name != NULL) {
-        return g_strdup_printf ("%s:%s", name, uri + strlen (namespace));
+    property_set_uri (prop, (gchar*) uri);
+    property_set_datatype (prop, type);
+
+    /*
+        Ids are small and dense, so that items may use them to index their metadata
+    */
+    property_set_id (prop, registry->len);
+    g_ptr_array_add (registry, prop);
+
+    g_hash_table_insert (properties, g_strdup (uri), prop);
+    if (property_get_name (prop) != NULL)
+        g_hash_table_insert (names, (gpointer) property_get_name (prop), prop);
+
+    return prop;
+}
+
+static void reset_properties ()
+{
+    g_hash_table_remove_all (names);
+    g_ptr_array_set_size (registry, 0);
+    g_hash_table_remove_all (properties);
+}
+
+/*
+    The ontology is identified by the modification dates of all his components, as Tracker
+    updates them when the ontology is changed. Returns NULL if the backend provides no such
+    information, so that the ontology is not cached
+*/
+static gchar* ontology_version ()
+{
+    register int i;
+    gchar **row;
+    gchar *ret;
+    GChecksum *checksum;
+    GPtrArray *rows;
+    GError *error;
+
+    error = NULL;
+    rows = execute_query_rows ("SELECT ?o ?modified WHERE { ?o a tracker:Ontology . ?o nao:lastModified ?modified } ORDER BY ?o", &error);
+
+    if (rows == NULL) {
+        g_error_free (error);
+        return NULL;
     }
-    else {
-        g_warning ("Unable to retrieve uri in ontology: '%s'", uri);
+
+    if (rows->len == 0) {
+        g_ptr_array_unref (rows);
         return NULL;
     }
+
+    checksum = g_checksum_new (G_CHECKSUM_SHA1);
+
+    for (i = 0; i < rows->len; i++) {
+        row = (gchar**) g_ptr_array_index (rows, i);
+        if (row [0] == NULL || row [1] == NULL)
+            continue;
+
+        g_checksum_update (checksum, (guchar*) row [0], -1);
+        g_checksum_update (checksum, (guchar*) row [1], -1);
+    }
+
+    ret = g_strdup (g_checksum_get_string (checksum));
+    g_checksum_free (checksum);
+    g_ptr_array_unref (rows);
+    return ret;
+}
+
+static gchar* ontology_cache_path ()
+{
+    gchar *folder;
+    gchar *ret;
+
+    folder = g_build_filename (g_get_user_cache_dir (), "fster", NULL);
+    check_and_create_folder (folder);
+    ret = g_build_filename (folder, ONTOLOGY_CACHE_FILE, NULL);
+    g_free (folder);
+    return ret;
+}
+
+/*
+    The cache holds parallel lists of namespaces with their prefixes, and of properties with
+    their datatypes. Lists are used instead of keys, as URIs may contain characters not
+    permitted in GKeyFile keys
+*/
+static gboolean load_ontology_cache (const gchar *version)
+{
+    register int i;
+    gboolean ret;
+    gchar *path;
+    gchar *cached_version;
+    gchar **names;
+    gchar **uris;
+    gint *types;
+    gboolean *multiple;
+    gsize names_len;
+    gsize uris_len;
+    gsize types_len;
+    gsize multiple_len;
+    GKeyFile *cache;
+    Property *prop;
+
+    ret = FALSE;
+    names = NULL;
+    uris = NULL;
+    types = NULL;
+    multiple = NULL;
+    cached_version = NULL;
+
+    path = ontology_cache_path ();
+    cache = g_key_file_new ();
+
+    if (g_key_file_load_from_file (cache, path, G_KEY_FILE_NONE, NULL) == FALSE)
+        goto end;
+
+    cached_version = g_key_file_get_string (cache, "ontology", "version", NULL);
+    if (cached_version == NULL || strcmp (cached_version, version) != 0)
+        goto end;
+
+    names = g_key_file_get_string_list (cache, "namespaces", "prefixes", &names_len, NULL);
+    uris = g_key_file_get_string_list (cache, "namespaces", "uris", &uris_len, NULL);
+    if (names == NULL || uris == NULL || names_len != uris_len)
+        goto end;
+
+    for (i = 0; i < names_len; i++)
+        register_namespace (names [i], uris [i]);
+
+    g_strfreev (uris);
+    uris = g_key_file_get_string_list (cache, "properties", "uris", &uris_len, NULL);
+    types = g_key_file_get_integer_list (cache, "properties", "types", &types_len, NULL);
+    multiple = g_key_file_get_boolean_list (cache, "properties", "multiple", &multiple_len, NULL);
+    if (uris == NULL || types == NULL || multiple == NULL || uris_len != types_len || uris_len != multiple_len)
+        goto end;
+
+    for (i = 0; i < uris_len; i++) {
+        prop = register_property (uris [i], (PROPERTY_DATATYPE) types [i]);
+        property_set_multiple (prop, multiple [i]);
+    }
+
+    cardinalities = g_key_file_get_boolean (cache, "ontology", "cardinalities", NULL);
+    ret = TRUE;
+
+end:
+    if (ret == FALSE) {
+        g_hash_table_remove_all (namespaces);
+        g_hash_table_remove_all (prefixes);
+        reset_properties ();
+    }
+
+    g_strfreev (names);
+    g_strfreev (uris);
+    g_free (types);
+    g_free (multiple);
+    g_free (cached_version);
+    g_key_file_free (cache);
+    g_free (path);
+    return ret;
+}
+
+static void save_ontology_cache (const gchar *version)
+{
+    register int i;
+    gchar *path;
+    gchar *contents;
+    const gchar **names;
+    const gchar **uris;
+    gint *types;
+    gboolean *multiple;
+    guint len;
+    gsize size;
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    GKeyFile *cache;
+    GError *error;
+
+    cache = g_key_file_new ();
+    g_key_file_set_string (cache, "ontology", "version", version);
+    g_key_file_set_boolean (cache, "ontology", "cardinalities", cardinalities);
+
+    len = g_hash_table_size (namespaces);
+    names = g_new0 (const gchar*, len + 1);
+    uris = g_new0 (const gchar*, len + 1);
+    g_hash_table_iter_init (&iter, namespaces);
+
+    for (i = 0; g_hash_table_iter_next (&iter, &key, &value); i++) {
+        names [i] = key;
+        uris [i] = value;
+    }
+
+    g_key_file_set_string_list (cache, "namespaces", "prefixes", names, len);
+    g_key_file_set_string_list (cache, "namespaces", "uris", uris, len);
+    g_free (names);
+    g_free (uris);
+
+    len = g_hash_table_size (properties);
+    uris = g_new0 (const gchar*, len + 1);
+    types = g_new0 (gint, len + 1);
+    multiple = g_new0 (gboolean, len + 1);
+    g_hash_table_iter_init (&iter, properties);
+
+    for (i = 0; g_hash_table_iter_next (&iter, &key, &value); i++) {
+        uris [i] = key;
+        types [i] = property_get_datatype ((Property*) value);
+        multiple [i] = property_is_multiple ((Property*) value);
+    }
+
+    g_key_file_set_string_list (cache, "properties", "uris", uris, len);
+    g_key_file_set_integer_list (cache, "properties", "types", types, len);
+    g_key_file_set_boolean_list (cache, "properties", "multiple", multiple, len);
+    g_free (uris);
+    g_free (types);
+    g_free (multiple);
+
+    error = NULL;
+    path = ontology_cache_path ();
+    contents = g_key_file_to_data (cache, &size, NULL);
+
+    if (g_file_set_contents (path, contents, size, &error) == FALSE) {
+        g_warning ("Unable to save ontology cache in %s: %s", path, error->message);
+        g_error_free (error);
+    }
+
+    g_free (contents);
+    g_free (path);
+    g_key_file_free (cache);
+}
+
+static gboolean fetch_namespaces ()
+{
+    register int i;
+    gchar **row;
+    GPtrArray *rows;
+    GError *error;
+
+    error = NULL;
+    rows = execute_query_rows ("SELECT ?s ?prefix WHERE { ?s a tracker:Namespace . ?s tracker:prefix ?prefix }", &error);
+
+    if (rows == NULL) {
+        g_warning ("Unable to fetch namespaces: %s", error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+
+    for (i = 0; i < rows->len; i++) {
+        row = (gchar**) g_ptr_array_index (rows, i);
+        if (row [0] != NULL && row [1] != NULL)
+            register_namespace (row [1], row [0]);
+    }
+
+    g_ptr_array_unref (rows);
+    return TRUE;
+}
+
+static void set_all_multiple (gchar *uri, Property *prop, gpointer useless)
+{
+    property_set_multiple (prop, TRUE);
+}
+
+/*
+    In the Tracker ontology single valued properties have nrl:maxCardinality 1, and all the
+    others permit many values. If no property has a cardinality (the ontology is not fully
+    described in the backend) all are assumed single valued
+*/
+static gboolean fetch_cardinalities ()
+{
+    register int i;
+    gchar **row;
+    GPtrArray *rows;
+    GError *error;
+    Property *prop;
+
+    error = NULL;
+    rows = execute_query_rows ("SELECT ?p ?max WHERE { ?p a rdf:Property . ?p nrl:maxCardinality ?max }", &error);
+
+    if (rows == NULL) {
+        g_warning ("Unable to fetch properties cardinality: %s", error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+
+    cardinalities = (rows->len != 0);
+
+    if (cardinalities == TRUE)
+        g_hash_table_foreach (properties, (GHFunc) set_all_multiple, NULL);
+
+    for (i = 0; i < rows->len; i++) {
+        row = (gchar**) g_ptr_array_index (rows, i);
+        if (row [0] == NULL || row [1] == NULL || strcmp (row [1], "1") != 0)
+            continue;
+
+        prop = g_hash_table_lookup (properties, row [0]);
+        if (prop != NULL)
+            property_set_multiple (prop, FALSE);
+    }
+
+    g_ptr_array_unref (rows);
+    return TRUE;
+}
+
+/*
+    All the properties in the ontology are loaded at once, instead of issuing a query for
+    each property found in the configuration or in metadata to save
+*/
+static gboolean fetch_properties ()
+{
+    register int i;
+    gchar **row;
+    GPtrArray *rows;
+    GError *error;
+
+    error = NULL;
+    rows = execute_query_rows ("SELECT ?p ?range WHERE { ?p a rdf:Property . ?p rdfs:range ?range }", &error);
+
+    if (rows == NULL) {
+        g_warning ("Unable to fetch properties: %s", error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+
+    for (i = 0; i < rows->len; i++) {
+        row = (gchar**) g_ptr_array_index (rows, i);
+        if (row [0] != NULL && row [1] != NULL && g_hash_table_lookup (properties, row [0]) == NULL)
+            register_property (row [0], range_to_datatype (row [1]));
+    }
+
+    g_ptr_array_unref (rows);
+    return fetch_cardinalities ();
+}
+
+void properties_pool_init ()
+{
+    gchar *version;
+
+    if (namespaces != NULL) {
+        g_warning ("Properties pool is already inited.");
+        return;
+    }
+
+    namespaces = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    prefixes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    properties = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+    names = g_hash_table_new (g_str_hash, g_str_equal);
+    registry = g_ptr_array_new ();
+
+    version = ontology_version ();
+
+    if (version == NULL || load_ontology_cache (version) == FALSE)
+        if (fetch_namespaces () == TRUE && fetch_properties () == TRUE && version != NULL)
+            save_ontology_cache (version);
+
+    g_free (version);
+}
+
+void properties_pool_finish ()
+{
+    g_hash_table_destroy (namespaces);
+    g_hash_table_destroy (prefixes);
+    g_hash_table_destroy (names);
+    g_ptr_array_free (registry, TRUE);
+    g_hash_table_destroy (properties);
+    namespaces = NULL;
+    prefixes = NULL;
+    names = NULL;
+    registry = NULL;
+    properties = NULL;
+}
+
+/*
+    Expands a prefixed name (e.g. "nie:url") to the full URI, or returns NULL if the prefix is
+    unknown
+*/
+gchar* properties_pool_expand_name (gchar *name)
+{
+    return name_to_uri (name);
 }
 
 Property* properties_pool_get_by_name (gchar *name)
@@ -147,6 +516,13 @@ Property* properties_pool_get_by_name (gchar *name)
     gchar *uri;
     Property *ret;
 
+    G_LOCK (Pool);
+    ret = g_hash_table_lookup (names, name);
+    G_UNLOCK (Pool);
+
+    if (ret != NULL)
+        return ret;
+
     uri = name_to_uri (name);
     if (uri == NULL)
         return NULL;
@@ -156,70 +532,44 @@ Property* properties_pool_get_by_name (gchar *name)
     return ret;
 }
 
+/*
+    Fallback for properties not found when the pool has been inited
+*/
 static Property* fetch_property (gchar *uri)
 {
     gchar *query;
-    gchar *name;
-    gchar *type;
-    GVariant *response;
-    GVariantIter *iter;
-    GVariantIter *subiter;
+    gchar **row;
+    GPtrArray *rows;
     GError *error;
     Property *prop;
-    PROPERTY_DATATYPE data_type;
 
     error = NULL;
     query = g_strdup_printf ("SELECT ?range WHERE { <%s> rdfs:range ?range }", uri);
-    response = execute_query (query, &error);
+    rows = execute_query_rows (query, &error);
     g_free (query);
 
-    if (response == NULL) {
+    if (rows == NULL) {
         g_warning ("Unable to retrieve property %s: %s", uri, error->message);
         g_error_free (error);
         return NULL;
     }
 
-    prop = property_new ();
+    row = rows->len != 0 ? (gchar**) g_ptr_array_index (rows, 0) : NULL;
+    prop = register_property (uri, row != NULL && row [0] != NULL ? range_to_datatype (row [0]) : PROPERTY_TYPE_UNKNOWN);
+    g_ptr_array_unref (rows);
 
-    name = uri_to_name (uri);
-    property_set_name (prop, name);
-    g_free (name);
-
-    property_set_uri (prop, uri);
+    if (cardinalities == TRUE) {
+        query = g_strdup_printf ("SELECT ?max WHERE { <%s> nrl:maxCardinality ?max }", uri);
+        rows = execute_query_rows (query, NULL);
+        g_free (query);
 
-    iter = NULL;
-    subiter = NULL;
-    g_variant_get (response, "(aas)", &iter);
-
-    if (g_variant_iter_loop (iter, "as", &subiter) && g_variant_iter_loop (subiter, "s", &type)) {
-        if (strcmp (type, XSD_STRING) == 0)
-            data_type = PROPERTY_TYPE_STRING;
-        else if (strcmp (type, XSD_BOOLEAN) == 0)
-            data_type = PROPERTY_TYPE_BOOLEAN;
-        else if (strcmp (type, XSD_INTEGER) == 0)
-            data_type = PROPERTY_TYPE_INTEGER;
-        else if (strcmp (type, XSD_DOUBLE) == 0)
-            data_type = PROPERTY_TYPE_DOUBLE;
-        else if (strcmp (type, XSD_DATE) == 0)
-            data_type = PROPERTY_TYPE_DATE;
-        else if (strcmp (type, XSD_DATETIME) == 0)
-            data_type = PROPERTY_TYPE_DATETIME;
-        else if (strcmp (type, XSD_CLASS) == 0)
-            data_type = PROPERTY_TYPE_CLASS;
-        else
-            data_type = PROPERTY_TYPE_RESOURCE;
-
-        property_set_datatype (prop, data_type);
+        if (rows != NULL) {
+            row = rows->len != 0 ? (gchar**) g_ptr_array_index (rows, 0) : NULL;
+            property_set_multiple (prop, row == NULL || row [0] == NULL || strcmp (row [0], "1") != 0);
+            g_ptr_array_unref (rows);
+        }
     }
 
-    if (iter != NULL)
-        g_variant_iter_free (iter);
-    if (subiter != NULL)
-        g_variant_iter_free (subiter);
-
-    g_variant_unref (response);
-
-    g_hash_table_insert (properties, g_strdup (uri), prop);
     return prop;
 }
 
@@ -227,9 +577,26 @@ Property* properties_pool_get_by_uri (gchar *uri)
 {
     Property *prop;
 
+    G_LOCK (Pool);
+
     prop = g_hash_table_lookup (properties, uri);
     if (prop == NULL)
         prop = fetch_property (uri);
 
+    G_UNLOCK (Pool);
+    return prop;
+}
+
+Property* properties_pool_get_by_id (guint id)
+{
+    Property *prop;
+
+    prop = NULL;
+    G_LOCK (Pool);
+
+    if (id < registry->len)
+        prop = g_ptr_array_index (registry, id);
+
+    G_UNLOCK (Pool);
     return prop;
 }
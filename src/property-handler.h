@@ -28,5 +28,7 @@ void        properties_pool_finish          ();
 
 Property*   properties_pool_get_by_name     (gchar *name);
 Property*   properties_pool_get_by_uri      (gchar *uri);
+Property*   properties_pool_get_by_id       (guint id);
+gchar*      properties_pool_expand_name     (gchar *name);
 
 #endif
@@ -24,7 +24,9 @@
 struct _PropertyPrivate {
     gchar               *name;
     gchar               *uri;
+    guint               id;
     PROPERTY_DATATYPE   type;
+    gboolean            multiple;       // TRUE if the ontology permits many values per resource
 };
 
 G_DEFINE_TYPE (Property, property, G_TYPE_OBJECT);
@@ -86,6 +88,16 @@ const gchar* property_get_uri (Property *property)
     return (const gchar*) property->priv->uri;
 }
 
+void property_set_id (Property *property, guint id)
+{
+    property->priv->id = id;
+}
+
+guint property_get_id (Property *property)
+{
+    return property->priv->id;
+}
+
 void property_set_datatype (Property *property, PROPERTY_DATATYPE type)
 {
     property->priv->type = type;
@@ -96,13 +108,137 @@ PROPERTY_DATATYPE property_get_datatype (Property *property)
     return property->priv->type;
 }
 
-gchar* property_format_value (Property *property, const gchar *value)
+void property_set_multiple (Property *property, gboolean multiple)
 {
-    gchar *ret;
+    property->priv->multiple = multiple;
+}
+
+/*
+    Properties are assumed to be single valued unless the ontology states otherwise
+*/
+gboolean property_is_multiple (Property *property)
+{
+    return property->priv->multiple;
+}
+
+/*
+    Values already expressed as xsd:dateTime are used as they are. The expression is compiled
+    once and shared by all properties
+*/
+static GRegex* datetime_format ()
+{
+    static gsize inited = 0;
+    static GRegex *regex = NULL;
+
+    if (g_once_init_enter (&inited)) {
+        regex = g_regex_new ("[1-9][0-9]{3}-.+T[^.]+(Z|[+-].+)", G_REGEX_OPTIMIZE, 0, NULL);
+        g_once_init_leave (&inited, 1);
+    }
+
+    return regex;
+}
+
+static gchar* format_timestamp (gint64 timestamp)
+{
+    time_t t;
+    struct tm tm;
+
+    t = (time_t) timestamp;
+    gmtime_r (&t, &tm);
+
+    return g_strdup_printf ("\"%04d-%02d-%02dT%02d:%02d:%02dZ\"",
+                            tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                            tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+/*
+    Datetimes without an explicit timezone are intended as UTC, as Tracker does
+*/
+static gboolean parse_timestamp (const gchar *value, gint64 *timestamp)
+{
+    gboolean ret;
     GDate *d;
+    GDateTime *dt;
+    GTimeZone *utc;
     struct tm tm;
-    GRegex *subject_format;
-    gboolean subject_already_formatted;
+
+    utc = g_time_zone_new_utc ();
+    dt = g_date_time_new_from_iso8601 (value, utc);
+    g_time_zone_unref (utc);
+
+    if (dt != NULL) {
+        *timestamp = g_date_time_to_unix (dt);
+        g_date_time_unref (dt);
+        return TRUE;
+    }
+
+    d = g_date_new ();
+    g_date_set_parse (d, value);
+    ret = g_date_valid (d);
+
+    if (ret == TRUE) {
+        g_date_to_struct_tm (d, &tm);
+        *timestamp = timegm (&tm);
+    }
+
+    g_date_free (d);
+    return ret;
+}
+
+/*
+    Values are decoded once when retrieved, so that they have not to be parsed again each time
+    they are used. Strings and resources are not decoded
+*/
+gboolean property_decode_value (Property *property, const gchar *value, PropertyValue *decoded)
+{
+    gchar *end;
+
+    decoded->type = property_get_datatype (property);
+    decoded->valid = FALSE;
+
+    if (value == NULL)
+        return FALSE;
+
+    switch (decoded->type) {
+        case PROPERTY_TYPE_BOOLEAN:
+            if (strcmp (value, "true") == 0 || strcmp (value, "1") == 0) {
+                decoded->v.boolean = TRUE;
+                decoded->valid = TRUE;
+            }
+            else if (strcmp (value, "false") == 0 || strcmp (value, "0") == 0) {
+                decoded->v.boolean = FALSE;
+                decoded->valid = TRUE;
+            }
+
+            break;
+
+        case PROPERTY_TYPE_INTEGER:
+            decoded->v.integer = g_ascii_strtoll (value, &end, 10);
+            decoded->valid = (end != value && *end == '\0');
+            break;
+
+        case PROPERTY_TYPE_DOUBLE:
+            decoded->v.number = g_ascii_strtod (value, &end);
+            decoded->valid = (end != value && *end == '\0');
+            break;
+
+        case PROPERTY_TYPE_DATE:
+        case PROPERTY_TYPE_DATETIME:
+            decoded->valid = parse_timestamp (value, &(decoded->v.timestamp));
+            break;
+
+        default:
+            break;
+    }
+
+    return decoded->valid;
+}
+
+gchar* property_format_value (Property *property, const gchar *value)
+{
+    gchar *ret;
+    const gchar *open;
+    PropertyValue decoded;
 
     ret = NULL;
 
@@ -112,42 +248,23 @@ gchar* property_format_value (Property *property, const gchar *value)
             break;
 
         case PROPERTY_TYPE_DATETIME:
-            subject_format = g_regex_new ("[1-9][0-9]{3}-.+T[^.]+(Z|[+-].+)", 0, 0, NULL);
-            subject_already_formatted = g_regex_match (subject_format, value, 0, NULL);
-
-            if (subject_already_formatted == FALSE) {
-                d = g_date_new ();
-                g_date_set_parse (d, value);
-
-                if (g_date_valid (d) == TRUE) {
-                    g_date_to_struct_tm (d, &tm);
-                    ret = g_strdup_printf ("\"%04d-%02d-%02dT%02d:%02d:%02dZ\"",
-                                           tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
-                                           tm.tm_hour, tm.tm_min, tm.tm_sec);
-                }
-                else {
-                    g_warning ("Unrecognized date format: %s", value);
-                }
-
-                g_date_free (d);
-            }
-            else {
+            if (g_regex_match (datetime_format (), value, 0, NULL) == TRUE)
                 ret = g_strdup_printf ("\"%s\"", value);
-            }
+            else if (property_decode_value (property, value, &decoded) == TRUE)
+                ret = format_timestamp (decoded.v.timestamp);
+            else
+                g_warning ("Unrecognized date format: %s", value);
 
-            g_regex_unref (subject_format);
             break;
 
         case PROPERTY_TYPE_RESOURCE:
-            subject_format = g_regex_new ("<.*>", 0, 0, NULL);
-            subject_already_formatted = g_regex_match (subject_format, value, 0, NULL);
+            open = strchr (value, '<');
 
-            if (!subject_already_formatted)
+            if (open == NULL || strchr (open, '>') == NULL)
                 ret = g_strdup_printf ("<%s>", value);
             else
                 ret = g_strdup (value);
 
-            g_regex_unref (subject_format);
             break;
 
         case PROPERTY_TYPE_BOOLEAN:
@@ -160,3 +277,31 @@ gchar* property_format_value (Property *property, const gchar *value)
 
     return ret;
 }
+
+/*
+    As property_format_value(), but the literal is built from the already decoded value when
+    it is valid for the property. Datetimes are always formatted from the original value, as
+    the decoded one has lost fractions of second and timezone: it is meant only to compare
+    values
+*/
+gchar* property_format_decoded (Property *property, const gchar *value, PropertyValue *decoded)
+{
+    gchar buffer [G_ASCII_DTOSTR_BUF_SIZE];
+
+    if (decoded == NULL || decoded->valid == FALSE || decoded->type != property_get_datatype (property))
+        return property_format_value (property, value);
+
+    switch (decoded->type) {
+        case PROPERTY_TYPE_BOOLEAN:
+            return g_strdup (decoded->v.boolean == TRUE ? "true" : "false");
+
+        case PROPERTY_TYPE_INTEGER:
+            return g_strdup_printf ("%" G_GINT64_FORMAT, decoded->v.integer);
+
+        case PROPERTY_TYPE_DOUBLE:
+            return g_strdup (g_ascii_dtostr (buffer, sizeof (buffer), decoded->v.number));
+
+        default:
+            return property_format_value (property, value);
+    }
+}
@@ -48,6 +48,22 @@ typedef enum {
     PROPERTY_TYPE_CLASS,
 } PROPERTY_DATATYPE;
 
+/*
+    Value of a property decoded in his native type. Strings and resources are not decoded,
+    and are always handled in their textual form
+*/
+typedef struct {
+    PROPERTY_DATATYPE   type;
+    gboolean            valid;
+
+    union {
+        gboolean        boolean;
+        gint64          integer;
+        gdouble         number;
+        gint64          timestamp;      // seconds since epoch, for dates and datetimes
+    } v;
+} PropertyValue;
+
 typedef struct _Property         Property;
 typedef struct _PropertyClass    PropertyClass;
 typedef struct _PropertyPrivate  PropertyPrivate;
@@ -67,9 +83,15 @@ void                property_set_name       (Property *property, gchar *name);
 const gchar*        property_get_name       (Property *property);
 void                property_set_uri        (Property *property, gchar *uri);
 const gchar*        property_get_uri        (Property *property);
+void                property_set_id         (Property *property, guint id);
+guint               property_get_id         (Property *property);
 void                property_set_datatype   (Property *property, PROPERTY_DATATYPE type);
 PROPERTY_DATATYPE   property_get_datatype   (Property *property);
+void                property_set_multiple   (Property *property, gboolean multiple);
+gboolean            property_is_multiple    (Property *property);
 
+gboolean            property_decode_value   (Property *property, const gchar *value, PropertyValue *decoded);
 gchar*              property_format_value   (Property *property, const gchar *value);
+gchar*              property_format_decoded (Property *property, const gchar *value, PropertyValue *decoded);
 
 #endif
@@ -0,0 +1,423 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "query-cache.h"
+#include "metadata-backend.h"
+#include "property-handler.h"
+#include "utils.h"
+
+#define QUERY_CACHE_GET_PRIVATE(obj)       (G_TYPE_INSTANCE_GET_PRIVATE ((obj), QUERY_CACHE_TYPE, QueryCachePrivate))
+
+typedef struct {
+    gchar               *query;
+    GPtrArray           *rows;
+    gsize               size;
+    gboolean            unresolved;     // some reference was not expanded: invalidate on any change
+    GList               *references;    // list of interned URIs
+    GList               *link;          // position in the LRU queue
+} CachedQuery;
+
+struct _QueryCachePrivate {
+    GHashTable          *entries;       // normalized query -> CachedQuery
+    GQueue              lru;
+    gsize               size;
+    gsize               max_size;
+    guint               generation;     // increased at each complete invalidation
+
+    MetadataBackend     *backend;
+    gulong              changed_handler;
+    GMutex              lock;
+};
+
+G_DEFINE_TYPE (QueryCache, query_cache, G_TYPE_OBJECT);
+
+static void free_cached_query (CachedQuery *entry)
+{
+    g_free (entry->query);
+    g_ptr_array_unref (entry->rows);
+    g_list_free (entry->references);
+    g_free (entry);
+}
+
+static void query_cache_finalize (GObject *obj)
+{
+    QueryCache *cache;
+
+    cache = QUERY_CACHE (obj);
+
+    if (cache->priv->backend != NULL) {
+        g_signal_handler_disconnect (cache->priv->backend, cache->priv->changed_handler);
+        g_object_unref (cache->priv->backend);
+    }
+
+    g_queue_clear (&(cache->priv->lru));
+    g_hash_table_destroy (cache->priv->entries);
+    g_mutex_clear (&(cache->priv->lock));
+}
+
+static void query_cache_class_init (QueryCacheClass *klass)
+{
+    GObjectClass *gobject_class;
+
+    g_type_class_add_private (klass, sizeof (QueryCachePrivate));
+
+    gobject_class = G_OBJECT_CLASS (klass);
+    gobject_class->finalize = query_cache_finalize;
+}
+
+static void query_cache_init (QueryCache *cache)
+{
+    cache->priv = QUERY_CACHE_GET_PRIVATE (cache);
+    memset (cache->priv, 0, sizeof (QueryCachePrivate));
+    cache->priv->entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) free_cached_query);
+    g_queue_init (&(cache->priv->lru));
+    g_mutex_init (&(cache->priv->lock));
+}
+
+/*
+    Literals and IRIs are copied as they are, as whitespaces within them are meaningful
+*/
+static const gchar* copy_quoted (GString *ret, const gchar *iter)
+{
+    gchar close;
+
+    close = (*iter == '<' ? '>' : *iter);
+    g_string_append_c (ret, *iter);
+
+    for (iter++; *iter != '\0' && *iter != close; iter++) {
+        if (*iter == '\\' && close != '>' && *(iter + 1) != '\0') {
+            g_string_append_c (ret, *iter);
+            iter++;
+        }
+
+        g_string_append_c (ret, *iter);
+    }
+
+    if (*iter != '\0') {
+        g_string_append_c (ret, *iter);
+        iter++;
+    }
+
+    return iter;
+}
+
+/*
+    Collapses sequences of whitespaces between tokens, so that queries differing only in
+    formatting are considered the same
+*/
+static gchar* normalize_query (const gchar *query)
+{
+    gboolean space;
+    const gchar *iter;
+    GString *ret;
+
+    ret = g_string_sized_new (strlen (query));
+    space = FALSE;
+    iter = query;
+
+    while (*iter != '\0') {
+        if (g_ascii_isspace (*iter)) {
+            space = TRUE;
+            iter++;
+            continue;
+        }
+
+        if (space == TRUE && ret->len != 0)
+            g_string_append_c (ret, ' ');
+        space = FALSE;
+
+        if (*iter == '"' || *iter == '\'' || (*iter == '<' && *(iter + 1) != ' ' && *(iter + 1) != '='))
+            iter = copy_quoted (ret, iter);
+        else
+            g_string_append_c (ret, *iter++);
+    }
+
+    return g_string_free (ret, FALSE);
+}
+
+static void add_reference (CachedQuery *entry, const gchar *uri)
+{
+    const gchar *interned;
+
+    interned = g_intern_string (uri);
+    if (g_list_find (entry->references, interned) == NULL)
+        entry->references = g_list_prepend (entry->references, (gpointer) interned);
+}
+
+/*
+    Collects prefixed names (classes and predicates) found in the query, skipping literals,
+    IRIs and variables. The "a" keyword is a reference to rdf:type
+*/
+static void collect_references (CachedQuery *entry)
+{
+    gchar *token;
+    gchar *uri;
+    const gchar *iter;
+    const gchar *start;
+
+    iter = entry->query;
+
+    while (*iter != '\0') {
+        if (*iter == '"') {
+            for (iter++; *iter != '\0' && *iter != '"'; iter++)
+                if (*iter == '\\' && *(iter + 1) != '\0')
+                    iter++;
+
+            if (*iter != '\0')
+                iter++;
+        }
+        else if (*iter == '<' && *(iter + 1) != ' ' && *(iter + 1) != '=') {
+            for (iter++; *iter != '\0' && *iter != '>'; iter++);
+
+            if (*iter != '\0')
+                iter++;
+        }
+        else if (*iter == '?' || *iter == '$') {
+            for (iter++; g_ascii_isalnum (*iter) || *iter == '_'; iter++);
+        }
+        else if (g_ascii_isalpha (*iter)) {
+            start = iter;
+            for (; g_ascii_isalnum (*iter) || *iter == '_' || *iter == '-' || *iter == ':'; iter++);
+
+            token = g_strndup (start, iter - start);
+
+            if (strcmp (token, "a") == 0) {
+                add_reference (entry, "http://www.w3.org/1999/02/22-rdf-syntax-ns#type");
+            }
+            else if (strchr (token, ':') != NULL) {
+                uri = properties_pool_expand_name (token);
+
+                if (uri != NULL) {
+                    add_reference (entry, uri);
+                    g_free (uri);
+                }
+                else {
+                    entry->unresolved = TRUE;
+                }
+            }
+
+            g_free (token);
+        }
+        else {
+            iter++;
+        }
+    }
+}
+
+static gsize rows_size (GPtrArray *rows)
+{
+    register int i;
+    gsize ret;
+    gchar **row;
+    gchar **col;
+
+    ret = sizeof (GPtrArray) + rows->len * sizeof (gpointer);
+
+    for (i = 0; i < rows->len; i++) {
+        row = (gchar**) g_ptr_array_index (rows, i);
+
+        for (col = row; *col != NULL; col++)
+            ret += sizeof (gchar*) + strlen (*col) + 1;
+
+        ret += sizeof (gchar*);
+    }
+
+    return ret;
+}
+
+static void remove_entry (QueryCache *cache, CachedQuery *entry)
+{
+    g_queue_delete_link (&(cache->priv->lru), entry->link);
+    cache->priv->size -= entry->size;
+    g_hash_table_remove (cache->priv->entries, entry->query);
+}
+
+static void invalidate_references (QueryCache *cache, GList *changed, gboolean all)
+{
+    GList *iter;
+    GList *next;
+    GList *ref;
+    CachedQuery *entry;
+
+    for (iter = cache->priv->lru.head; iter; iter = next) {
+        next = iter->next;
+        entry = (CachedQuery*) iter->data;
+
+        if (all == TRUE || entry->unresolved == TRUE) {
+            remove_entry (cache, entry);
+            continue;
+        }
+
+        for (ref = entry->references; ref; ref = g_list_next (ref)) {
+            if (g_list_find (changed, ref->data) != NULL) {
+                remove_entry (cache, entry);
+                break;
+            }
+        }
+    }
+}
+
+static void backend_changed (MetadataBackend *backend, GList *references, gboolean all, QueryCache *cache)
+{
+    g_mutex_lock (&(cache->priv->lock));
+    invalidate_references (cache, references, all);
+    g_mutex_unlock (&(cache->priv->lock));
+}
+
+/**
+ * query_cache_new:
+ * @max_size: maximum amount of memory, in bytes, to be used by cached
+ * results
+ *
+ * Allocates a new cache for results of SPARQL queries. Entries are
+ * automatically invalidated when the metadata backend notifies changes on
+ * the classes or the predicates referenced by the query, and least recently
+ * used entries are discarded when @max_size is exceeded
+ *
+ * Return value: a new #QueryCache
+ **/
+QueryCache* query_cache_new (gsize max_size)
+{
+    QueryCache *ret;
+
+    ret = g_object_new (QUERY_CACHE_TYPE, NULL);
+    ret->priv->max_size = max_size;
+
+    ret->priv->backend = metadata_backend_get_default ();
+    if (ret->priv->backend != NULL) {
+        g_object_ref (ret->priv->backend);
+        ret->priv->changed_handler = g_signal_connect (ret->priv->backend, "changed",
+                                                       G_CALLBACK (backend_changed), ret);
+    }
+
+    return ret;
+}
+
+/**
+ * query_cache_lookup:
+ * @cache: a #QueryCache
+ * @query: the SPARQL query to look for
+ *
+ * Retrieves the rows obtained by a previous execution of @query, if still
+ * valid
+ *
+ * Return value: an array of rows, to be freed with g_ptr_array_unref(), or
+ * NULL if @query is not in @cache
+ **/
+GPtrArray* query_cache_lookup (QueryCache *cache, const gchar *query)
+{
+    gchar *key;
+    GPtrArray *ret;
+    CachedQuery *entry;
+
+    ret = NULL;
+    key = normalize_query (query);
+
+    g_mutex_lock (&(cache->priv->lock));
+
+    entry = g_hash_table_lookup (cache->priv->entries, key);
+    if (entry != NULL) {
+        g_queue_unlink (&(cache->priv->lru), entry->link);
+        g_queue_push_head_link (&(cache->priv->lru), entry->link);
+        ret = g_ptr_array_ref (entry->rows);
+    }
+
+    g_mutex_unlock (&(cache->priv->lock));
+
+    g_free (key);
+    return ret;
+}
+
+/**
+ * query_cache_store:
+ * @cache: a #QueryCache
+ * @query: the executed SPARQL query
+ * @rows: rows obtained by @query, as returned by query_rows_from_variant().
+ * They are referenced by @cache
+ *
+ * Saves the results of @query into @cache
+ **/
+void query_cache_store (QueryCache *cache, const gchar *query, GPtrArray *rows)
+{
+    CachedQuery *entry;
+    CachedQuery *old;
+
+    entry = g_new0 (CachedQuery, 1);
+    entry->query = normalize_query (query);
+    entry->rows = g_ptr_array_ref (rows);
+    entry->size = rows_size (rows) + strlen (entry->query);
+
+    if (entry->size > cache->priv->max_size / 4) {
+        free_cached_query (entry);
+        return;
+    }
+
+    collect_references (entry);
+
+    g_mutex_lock (&(cache->priv->lock));
+
+    old = g_hash_table_lookup (cache->priv->entries, entry->query);
+    if (old != NULL)
+        remove_entry (cache, old);
+
+    while (cache->priv->lru.tail != NULL && cache->priv->size + entry->size > cache->priv->max_size)
+        remove_entry (cache, (CachedQuery*) cache->priv->lru.tail->data);
+
+    g_queue_push_head (&(cache->priv->lru), entry);
+    entry->link = cache->priv->lru.head;
+    cache->priv->size += entry->size;
+    g_hash_table_insert (cache->priv->entries, entry->query, entry);
+
+    g_mutex_unlock (&(cache->priv->lock));
+}
+
+/**
+ * query_cache_invalidate_all:
+ * @cache: a #QueryCache
+ *
+ * Drops all entries in @cache. To be used when the contents of the storage
+ * are changed by FSter itself, and notifications have still to come
+ **/
+void query_cache_invalidate_all (QueryCache *cache)
+{
+    g_mutex_lock (&(cache->priv->lock));
+    invalidate_references (cache, NULL, TRUE);
+    cache->priv->generation++;
+    g_mutex_unlock (&(cache->priv->lock));
+}
+
+/**
+ * query_cache_get_generation:
+ * @cache: a #QueryCache
+ *
+ * Permits to other caches to know when query_cache_invalidate_all() has been
+ * called, so to invalidate themselves too
+ *
+ * Return value: a counter increased at each complete invalidation
+ **/
+guint query_cache_get_generation (QueryCache *cache)
+{
+    guint ret;
+
+    g_mutex_lock (&(cache->priv->lock));
+    ret = cache->priv->generation;
+    g_mutex_unlock (&(cache->priv->lock));
+
+    return ret;
+}
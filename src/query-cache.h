@@ -0,0 +1,61 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+#include "common.h"
+
+#define QUERY_CACHE_TYPE                (query_cache_get_type ())
+#define QUERY_CACHE(obj)                (G_TYPE_CHECK_INSTANCE_CAST ((obj),     \
+                                         QUERY_CACHE_TYPE, QueryCache))
+#define QUERY_CACHE_CLASS(klass)        (G_TYPE_CHECK_CLASS_CAST ((klass),      \
+                                         QUERY_CACHE_TYPE,                      \
+                                         QueryCacheClass))
+#define IS_QUERY_CACHE(obj)             (G_TYPE_CHECK_INSTANCE_TYPE ((obj),     \
+                                         QUERY_CACHE_TYPE))
+#define IS_QUERY_CACHE_CLASS(klass)     (G_TYPE_CHECK_CLASS_TYPE ((klass),      \
+                                         QUERY_CACHE_TYPE))
+#define QUERY_CACHE_GET_CLASS(obj)      (G_TYPE_INSTANCE_GET_CLASS ((obj),      \
+                                         QUERY_CACHE_TYPE,                      \
+                                         QueryCacheClass))
+
+typedef struct _QueryCache         QueryCache;
+typedef struct _QueryCacheClass    QueryCacheClass;
+typedef struct _QueryCachePrivate  QueryCachePrivate;
+
+struct _QueryCache {
+    GObject                 parent;
+    QueryCachePrivate       *priv;
+};
+
+struct _QueryCacheClass {
+    GObjectClass    parent_class;
+};
+
+GType           query_cache_get_type            ();
+
+QueryCache*     query_cache_new                 (gsize max_size);
+
+GPtrArray*      query_cache_lookup              (QueryCache *cache, const gchar *query);
+void            query_cache_store               (QueryCache *cache, const gchar *query, GPtrArray *rows);
+void            query_cache_invalidate_all      (QueryCache *cache);
+guint           query_cache_get_generation      (QueryCache *cache);
+
+#endif
@@ -0,0 +1,289 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "query-stats.h"
+
+#define NO_ORIGIN       "(none)"
+
+/*
+    Counters for all the queries issued on behalf of the same origin, usually a HierarchyNode.
+    Latencies are in microseconds
+*/
+typedef struct {
+    gchar               *origin;
+    guint               queries;
+    guint               cached;
+    guint               failed;
+    guint64             rows;
+    guint64             bytes;
+    gint64              total_time;
+    gint64              max_time;
+    guint               histogram [QUERY_STATS_BUCKETS];
+} OriginStats;
+
+static GHashTable       *Stats          = NULL;
+static guint            SlowThreshold   = 0;
+static GPrivate         CurrentOrigin;
+G_LOCK_DEFINE_STATIC (Stats);
+
+static void free_origin_stats (OriginStats *stats)
+{
+    g_free (stats->origin);
+    g_free (stats);
+}
+
+/**
+ * query_stats_init:
+ *
+ * Inits the collection of statistics about queries
+ **/
+void query_stats_init ()
+{
+    G_LOCK (Stats);
+
+    if (Stats == NULL)
+        Stats = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) free_origin_stats);
+
+    G_UNLOCK (Stats);
+}
+
+/**
+ * query_stats_finish:
+ *
+ * Drops all the statistics collected so far
+ **/
+void query_stats_finish ()
+{
+    G_LOCK (Stats);
+
+    if (Stats != NULL) {
+        g_hash_table_destroy (Stats);
+        Stats = NULL;
+    }
+
+    G_UNLOCK (Stats);
+}
+
+/**
+ * query_stats_set_slow_threshold:
+ * @threshold: time in milliseconds, or 0
+ *
+ * Queries taking more than @threshold milliseconds are logged, with their
+ * origin and full text. If 0, the log is disabled
+ **/
+void query_stats_set_slow_threshold (guint threshold)
+{
+    SlowThreshold = threshold;
+}
+
+/**
+ * query_stats_set_origin:
+ * @origin: identifier of the component issuing the following queries in
+ * the current thread, or NULL
+ *
+ * Assigns to all the queries issued in the current thread, until the next
+ * call, the given @origin. The string is not copied, and must be valid
+ * until replaced
+ *
+ * Return value: the previous origin, to be restored with another call to
+ * query_stats_set_origin() when @origin is no longer involved
+ **/
+const gchar* query_stats_set_origin (const gchar *origin)
+{
+    const gchar *previous;
+
+    previous = g_private_get (&CurrentOrigin);
+    g_private_set (&CurrentOrigin, (gpointer) origin);
+    return previous;
+}
+
+static int latency_bucket (gint64 elapsed)
+{
+    register int i;
+    gint64 limit;
+
+    limit = 1000;
+
+    for (i = 0; i < QUERY_STATS_BUCKETS - 1; i++) {
+        if (elapsed < limit)
+            return i;
+        limit *= 2;
+    }
+
+    return QUERY_STATS_BUCKETS - 1;
+}
+
+/**
+ * query_stats_record:
+ * @query: the SPARQL query
+ * @elapsed: time taken by the query, in microseconds
+ * @rows: number of rows in the response
+ * @bytes: size of the serialized response
+ * @cached: TRUE if the response has been found in the local cache
+ * @failed: TRUE if the query has not been executed successfully
+ *
+ * Accounts a query to the origin currently set in the calling thread
+ **/
+void query_stats_record (const gchar *query, gint64 elapsed, guint rows, gsize bytes, gboolean cached, gboolean failed)
+{
+    const gchar *origin;
+    OriginStats *stats;
+
+    origin = g_private_get (&CurrentOrigin);
+    if (origin == NULL)
+        origin = NO_ORIGIN;
+
+    G_LOCK (Stats);
+
+    if (Stats == NULL) {
+        G_UNLOCK (Stats);
+        return;
+    }
+
+    stats = g_hash_table_lookup (Stats, origin);
+    if (stats == NULL) {
+        stats = g_new0 (OriginStats, 1);
+        stats->origin = g_strdup (origin);
+        g_hash_table_insert (Stats, stats->origin, stats);
+    }
+
+    stats->queries++;
+
+    if (failed == TRUE) {
+        stats->failed++;
+    }
+    else if (cached == TRUE) {
+        /*
+            Hits in the cache are not accounted in latencies, which would be flattened
+        */
+        stats->cached++;
+        stats->rows += rows;
+    }
+    else {
+        stats->rows += rows;
+        stats->bytes += bytes;
+        stats->total_time += elapsed;
+        stats->max_time = MAX (stats->max_time, elapsed);
+        stats->histogram [latency_bucket (elapsed)]++;
+    }
+
+    G_UNLOCK (Stats);
+
+    if (cached == FALSE && SlowThreshold != 0 && elapsed >= (gint64) SlowThreshold * 1000)
+        g_message ("Slow query from %s: %" G_GINT64_FORMAT " ms, %u rows, %" G_GSIZE_FORMAT " bytes%s\n%s",
+                   origin, elapsed / 1000, rows, bytes, failed ? " (failed)" : "", query);
+}
+
+/**
+ * query_stats_count:
+ *
+ * Return value: total number of queries effectively sent to the backend so
+ * far, excluding the ones served by the local cache
+ **/
+guint query_stats_count ()
+{
+    guint ret;
+    GHashTableIter iter;
+    OriginStats *stats;
+
+    ret = 0;
+    G_LOCK (Stats);
+
+    if (Stats != NULL) {
+        g_hash_table_iter_init (&iter, Stats);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &stats))
+            ret += stats->queries - stats->cached;
+    }
+
+    G_UNLOCK (Stats);
+    return ret;
+}
+
+static gint sort_by_time (gconstpointer a, gconstpointer b)
+{
+    const OriginStats *first;
+    const OriginStats *second;
+
+    first = a;
+    second = b;
+
+    if (first->total_time > second->total_time)
+        return -1;
+    else if (first->total_time < second->total_time)
+        return 1;
+    else
+        return strcmp (first->origin, second->origin);
+}
+
+/**
+ * query_stats_dump:
+ * @output: stream on which write the report
+ *
+ * Writes a report of the collected statistics, one block per origin,
+ * ordered by the time spent waiting for the queries
+ **/
+void query_stats_dump (FILE *output)
+{
+    register int i;
+    guint executed;
+    gint64 limit;
+    GList *origins;
+    GList *iter;
+    OriginStats *stats;
+
+    G_LOCK (Stats);
+
+    if (Stats == NULL) {
+        G_UNLOCK (Stats);
+        return;
+    }
+
+    origins = g_list_sort (g_hash_table_get_values (Stats), sort_by_time);
+
+    for (iter = origins; iter; iter = g_list_next (iter)) {
+        stats = (OriginStats*) iter->data;
+        executed = stats->queries - stats->cached - stats->failed;
+
+        fprintf (output, "%s\n", stats->origin);
+        fprintf (output, "    queries: %u (cached %u, failed %u)\n", stats->queries, stats->cached, stats->failed);
+        fprintf (output, "    rows: %" G_GUINT64_FORMAT ", bytes: %" G_GUINT64_FORMAT "\n", stats->rows, stats->bytes);
+
+        if (executed != 0)
+            fprintf (output, "    time: total %" G_GINT64_FORMAT " ms, average %" G_GINT64_FORMAT " ms, max %" G_GINT64_FORMAT " ms\n",
+                     stats->total_time / 1000, stats->total_time / executed / 1000, stats->max_time / 1000);
+
+        limit = 1;
+
+        for (i = 0; i < QUERY_STATS_BUCKETS; i++) {
+            if (stats->histogram [i] != 0) {
+                if (i == QUERY_STATS_BUCKETS - 1)
+                    fprintf (output, "    >= %5" G_GINT64_FORMAT " ms: %u\n", limit / 2, stats->histogram [i]);
+                else
+                    fprintf (output, "    <  %5" G_GINT64_FORMAT " ms: %u\n", limit, stats->histogram [i]);
+            }
+
+            limit *= 2;
+        }
+    }
+
+    g_list_free (origins);
+    G_UNLOCK (Stats);
+
+    fflush (output);
+}
@@ -0,0 +1,41 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUERY_STATS_H
+#define QUERY_STATS_H
+
+#include "common.h"
+
+/*
+    Latencies are collected in exponential buckets: the first counts queries completed in less
+    than 1 millisecond, the second in less than 2, then 4, 8... The last one counts all the
+    slower queries
+*/
+#define QUERY_STATS_BUCKETS             12
+
+void            query_stats_init                ();
+void            query_stats_finish              ();
+void            query_stats_set_slow_threshold  (guint threshold);
+
+const gchar*    query_stats_set_origin          (const gchar *origin);
+void            query_stats_record              (const gchar *query, gint64 elapsed, guint rows, gsize bytes, gboolean cached, gboolean failed);
+guint           query_stats_count               ();
+void            query_stats_dump                (FILE *output);
+
+#endif
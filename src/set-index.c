@@ -0,0 +1,463 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "set-index.h"
+#include "metadata-backend.h"
+#include "property-handler.h"
+#include "utils.h"
+
+#define SET_INDEX_GET_PRIVATE(obj)          (G_TYPE_INSTANCE_GET_PRIVATE ((obj), SET_INDEX_TYPE, SetIndexPrivate))
+
+/*
+    Max number of items reloaded with a single query after a change notification
+*/
+#define REFRESH_CHUNK_SIZE                  100
+
+typedef struct {
+    gchar               *value;
+    int                 count;
+} IndexedValue;
+
+struct _SetIndexPrivate {
+    gchar               *statements;    // matching each ?item with his values in ?a
+    GList               *predicates;    // interned URIs of the involved predicates
+    GList               *classes;       // interned URIs of the classes required to items
+    gboolean            built;
+    guint               generation;
+    GHashTable          *items;         // Tracker ID -> list of IndexedValue, owned by "values"
+    GHashTable          *values;        // value -> IndexedValue
+
+    MetadataBackend     *backend;
+    gulong              changed_handler;
+    GMutex              lock;
+};
+
+/*
+    Backends known to not handle the queries used to build indexes: those are not tried
+    again, and values are collected with plain queries
+*/
+static GHashTable       *Unsupported    = NULL;     // MetadataBackend -> MetadataBackend
+G_LOCK_DEFINE_STATIC (Unsupported);
+
+G_DEFINE_TYPE (SetIndex, set_index, G_TYPE_OBJECT);
+
+static void free_indexed_value (IndexedValue *value)
+{
+    g_free (value->value);
+    g_free (value);
+}
+
+static void set_index_finalize (GObject *obj)
+{
+    SetIndex *index;
+
+    index = SET_INDEX (obj);
+
+    if (index->priv->backend != NULL) {
+        g_signal_handler_disconnect (index->priv->backend, index->priv->changed_handler);
+        g_object_unref (index->priv->backend);
+    }
+
+    g_hash_table_destroy (index->priv->items);
+    g_hash_table_destroy (index->priv->values);
+    g_list_free (index->priv->predicates);
+    g_list_free (index->priv->classes);
+    g_free (index->priv->statements);
+    g_mutex_clear (&(index->priv->lock));
+}
+
+static void set_index_class_init (SetIndexClass *klass)
+{
+    GObjectClass *gobject_class;
+
+    g_type_class_add_private (klass, sizeof (SetIndexPrivate));
+
+    gobject_class = G_OBJECT_CLASS (klass);
+    gobject_class->finalize = set_index_finalize;
+}
+
+static void set_index_init (SetIndex *index)
+{
+    index->priv = SET_INDEX_GET_PRIVATE (index);
+    memset (index->priv, 0, sizeof (SetIndexPrivate));
+    index->priv->items = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) g_list_free);
+    index->priv->values = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) free_indexed_value);
+    g_mutex_init (&(index->priv->lock));
+}
+
+static void add_value (SetIndex *index, gpointer id, const gchar *value)
+{
+    GList *values;
+    IndexedValue *indexed;
+
+    indexed = g_hash_table_lookup (index->priv->values, value);
+    if (indexed == NULL) {
+        indexed = g_new0 (IndexedValue, 1);
+        indexed->value = g_strdup (value);
+        g_hash_table_insert (index->priv->values, indexed->value, indexed);
+    }
+
+    indexed->count++;
+
+    /*
+        The list is stolen, as replacing the value would free it
+    */
+    values = g_hash_table_lookup (index->priv->items, id);
+    if (values != NULL)
+        g_hash_table_steal (index->priv->items, id);
+
+    g_hash_table_insert (index->priv->items, id, g_list_prepend (values, indexed));
+}
+
+/*
+    Values no longer held by any item are dropped
+*/
+static void remove_item (SetIndex *index, gpointer id)
+{
+    GList *iter;
+    IndexedValue *indexed;
+
+    for (iter = g_hash_table_lookup (index->priv->items, id); iter; iter = g_list_next (iter)) {
+        indexed = (IndexedValue*) iter->data;
+        indexed->count--;
+
+        if (indexed->count <= 0)
+            g_hash_table_remove (index->priv->values, indexed->value);
+    }
+
+    g_hash_table_remove (index->priv->items, id);
+}
+
+static void load_rows (SetIndex *index, GPtrArray *rows)
+{
+    register int i;
+    gchar **row;
+
+    for (i = 0; i < rows->len; i++) {
+        row = (gchar**) g_ptr_array_index (rows, i);
+        if (row [0] != NULL && row [1] != NULL)
+            add_value (index, GINT_TO_POINTER (strtol (row [0], NULL, 10)), row [1]);
+    }
+}
+
+static GPtrArray* fetch_rows (gchar *query, GError **error)
+{
+    GPtrArray *rows;
+    GVariant *response;
+
+    /*
+        The query cache is skipped: those rows are consumed just once
+    */
+    response = execute_query (query, error);
+    if (response == NULL)
+        return NULL;
+
+    rows = query_rows_from_variant (response);
+    g_variant_unref (response);
+    return rows;
+}
+
+static gboolean build_index (SetIndex *index, GError **error)
+{
+    gchar *query;
+    GPtrArray *rows;
+
+    query = g_strdup_printf ("SELECT tracker:id(?item) ?a WHERE { %s }", index->priv->statements);
+    rows = fetch_rows (query, error);
+    g_free (query);
+
+    if (rows == NULL)
+        return FALSE;
+
+    g_hash_table_remove_all (index->priv->items);
+    g_hash_table_remove_all (index->priv->values);
+    load_rows (index, rows);
+    index->priv->built = TRUE;
+
+    g_ptr_array_unref (rows);
+    return TRUE;
+}
+
+static void refresh_items (SetIndex *index, GList *ids)
+{
+    gchar *query;
+    GList *iter;
+    GString *list;
+    GPtrArray *rows;
+    GError *error;
+
+    list = g_string_new ("");
+
+    for (iter = ids; iter; iter = g_list_next (iter))
+        g_string_append_printf (list, "%s%d", list->len != 0 ? ", " : "", GPOINTER_TO_INT (iter->data));
+
+    error = NULL;
+    query = g_strdup_printf ("SELECT tracker:id(?item) ?a WHERE { %s . FILTER (tracker:id(?item) IN (%s)) }",
+                             index->priv->statements, list->str);
+    rows = fetch_rows (query, &error);
+    g_free (query);
+    g_string_free (list, TRUE);
+
+    g_mutex_lock (&(index->priv->lock));
+
+    /*
+        If the index cannot be updated it is just rebuilt at the next request
+    */
+    if (rows == NULL) {
+        g_warning ("Unable to refresh values index: %s", error->message);
+        g_error_free (error);
+        index->priv->built = FALSE;
+    }
+    else if (index->priv->built == TRUE) {
+        for (iter = ids; iter; iter = g_list_next (iter))
+            remove_item (index, iter->data);
+
+        load_rows (index, rows);
+    }
+
+    g_mutex_unlock (&(index->priv->lock));
+
+    if (rows != NULL)
+        g_ptr_array_unref (rows);
+}
+
+static gboolean involves_references (GList *involved, GList *references)
+{
+    GList *iter;
+
+    for (iter = references; iter; iter = g_list_next (iter))
+        if (g_list_find (involved, iter->data) != NULL)
+            return TRUE;
+
+    return FALSE;
+}
+
+/*
+    Notifications always carry the class of the modified resources, even when predicates
+    are not known: indexes restricted to other classes are not affected
+*/
+static gboolean affected_by_change (SetIndex *index, GList *references, gboolean all)
+{
+    if (index->priv->classes != NULL && involves_references (index->priv->classes, references) == FALSE)
+        return FALSE;
+
+    return (all == TRUE || involves_references (index->priv->predicates, references) == TRUE);
+}
+
+/*
+    Collects the classes found in "?item a class" statements
+*/
+static void collect_classes (SetIndex *index)
+{
+    register int i;
+    gchar *uri;
+    gchar *name;
+    gchar **tokens;
+
+    tokens = g_strsplit_set (index->priv->statements, " \t\n", -1);
+
+    for (i = 0; tokens [i] != NULL && tokens [i + 1] != NULL && tokens [i + 2] != NULL; i++) {
+        if (strcmp (tokens [i], "?item") != 0 || strcmp (tokens [i + 1], "a") != 0)
+            continue;
+
+        name = g_strdup (tokens [i + 2]);
+        g_strchomp (g_strdelimit (name, ".;})", ' '));
+
+        uri = properties_pool_expand_name (name);
+        if (uri != NULL) {
+            index->priv->classes = g_list_prepend (index->priv->classes, (gpointer) g_intern_string (uri));
+            g_free (uri);
+        }
+
+        g_free (name);
+    }
+
+    g_strfreev (tokens);
+}
+
+static void forget_backend (gpointer useless, GObject *backend)
+{
+    G_LOCK (Unsupported);
+    g_hash_table_remove (Unsupported, backend);
+    G_UNLOCK (Unsupported);
+}
+
+static gboolean backend_supported (MetadataBackend *backend)
+{
+    gboolean ret;
+
+    G_LOCK (Unsupported);
+    ret = (Unsupported == NULL || g_hash_table_lookup (Unsupported, backend) == NULL);
+    G_UNLOCK (Unsupported);
+
+    return ret;
+}
+
+/*
+    A query rejected by the backend (not parsed by the local store, or refused by Tracker)
+    will always fail, so the index is not built again. Only interruptions and timeouts of
+    the current operation are temporary
+*/
+static void check_backend_support (MetadataBackend *backend, GError *error)
+{
+    if (backend == NULL || error == NULL ||
+            g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED) || g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT))
+        return;
+
+    G_LOCK (Unsupported);
+
+    if (Unsupported == NULL)
+        Unsupported = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    if (g_hash_table_lookup (Unsupported, backend) == NULL) {
+        g_hash_table_insert (Unsupported, backend, backend);
+        g_object_weak_ref (G_OBJECT (backend), forget_backend, NULL);
+    }
+
+    G_UNLOCK (Unsupported);
+}
+
+/*
+    Changed resources are both subjects and objects of modified statements: conditions
+    may match the item as object of a predicate of his parent
+*/
+static void backend_resources_changed (MetadataBackend *backend, GList *resources, GList *references, gboolean all, SetIndex *index)
+{
+    int count;
+    gboolean built;
+    GList *iter;
+    GList *chunk;
+
+    g_mutex_lock (&(index->priv->lock));
+    built = index->priv->built;
+    g_mutex_unlock (&(index->priv->lock));
+
+    if (built == FALSE || affected_by_change (index, references, all) == FALSE)
+        return;
+
+    chunk = NULL;
+    count = 0;
+
+    for (iter = resources; iter; iter = g_list_next (iter)) {
+        chunk = g_list_prepend (chunk, iter->data);
+        count++;
+
+        if (count == REFRESH_CHUNK_SIZE) {
+            refresh_items (index, chunk);
+            g_list_free (chunk);
+            chunk = NULL;
+            count = 0;
+        }
+    }
+
+    if (chunk != NULL) {
+        refresh_items (index, chunk);
+        g_list_free (chunk);
+    }
+}
+
+/**
+ * set_index_new:
+ * @statements: SPARQL statements matching each ?item with his values, in
+ * the ?a variable
+ * @predicates: list of URIs of the predicates involved in @statements
+ *
+ * Allocates a new index of the distinct values matched by @statements, with
+ * the number of items having each of them. The index is filled at the first
+ * request, and then kept up to date with the change notifications of the
+ * metadata backend
+ *
+ * Return value: a new #SetIndex
+ **/
+SetIndex* set_index_new (const gchar *statements, GList *predicates)
+{
+    GList *iter;
+    SetIndex *ret;
+
+    ret = g_object_new (SET_INDEX_TYPE, NULL);
+    ret->priv->statements = g_strdup (statements);
+
+    for (iter = predicates; iter; iter = g_list_next (iter))
+        ret->priv->predicates = g_list_prepend (ret->priv->predicates, (gpointer) g_intern_string (iter->data));
+
+    collect_classes (ret);
+
+    ret->priv->backend = metadata_backend_get_default ();
+    if (ret->priv->backend != NULL) {
+        g_object_ref (ret->priv->backend);
+        ret->priv->changed_handler = g_signal_connect (ret->priv->backend, "resources-changed",
+                                                       G_CALLBACK (backend_resources_changed), ret);
+    }
+
+    return ret;
+}
+
+/**
+ * set_index_get_values:
+ * @index: a #SetIndex
+ * @generation: current generation of the query cache, as returned by
+ * query_cache_get_generation(). When it differs from the one of the last
+ * request the index is rebuilt, as contents of the storage may have changed
+ * without notifications
+ * @error: return location for a #GError
+ *
+ * Retrieves the values held by at least one item. If the metadata backend
+ * proves to not support indexes, following requests fail immediately with
+ * %G_IO_ERROR_NOT_SUPPORTED
+ *
+ * Return value: a list of strings, sorted alphabetically, to be freed with
+ * easy_list_free(), or NULL if the index cannot be built
+ **/
+GList* set_index_get_values (SetIndex *index, guint generation, GError **error)
+{
+    GList *ret;
+    GList *iter;
+    GError *build_error;
+
+    ret = NULL;
+
+    if (backend_supported (index->priv->backend) == FALSE) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Values indexes not supported by the metadata backend");
+        return NULL;
+    }
+
+    g_mutex_lock (&(index->priv->lock));
+
+    if (index->priv->built == FALSE || index->priv->generation != generation) {
+        index->priv->built = FALSE;
+        index->priv->generation = generation;
+        build_error = NULL;
+
+        if (build_index (index, &build_error) == FALSE) {
+            g_mutex_unlock (&(index->priv->lock));
+            check_backend_support (index->priv->backend, build_error);
+            g_propagate_error (error, build_error);
+            return NULL;
+        }
+    }
+
+    ret = g_hash_table_get_keys (index->priv->values);
+
+    for (iter = ret; iter; iter = g_list_next (iter))
+        iter->data = g_strdup (iter->data);
+
+    g_mutex_unlock (&(index->priv->lock));
+
+    return g_list_sort (ret, (GCompareFunc) strcmp);
+}
@@ -0,0 +1,58 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SET_INDEX_H
+#define SET_INDEX_H
+
+#include "common.h"
+
+#define SET_INDEX_TYPE                  (set_index_get_type ())
+#define SET_INDEX(obj)                  (G_TYPE_CHECK_INSTANCE_CAST ((obj),     \
+                                         SET_INDEX_TYPE, SetIndex))
+#define SET_INDEX_CLASS(klass)          (G_TYPE_CHECK_CLASS_CAST ((klass),      \
+                                         SET_INDEX_TYPE,                        \
+                                         SetIndexClass))
+#define IS_SET_INDEX(obj)               (G_TYPE_CHECK_INSTANCE_TYPE ((obj),     \
+                                         SET_INDEX_TYPE))
+#define IS_SET_INDEX_CLASS(klass)       (G_TYPE_CHECK_CLASS_TYPE ((klass),      \
+                                         SET_INDEX_TYPE))
+#define SET_INDEX_GET_CLASS(obj)        (G_TYPE_INSTANCE_GET_CLASS ((obj),      \
+                                         SET_INDEX_TYPE,                        \
+                                         SetIndexClass))
+
+typedef struct _SetIndex         SetIndex;
+typedef struct _SetIndexClass    SetIndexClass;
+typedef struct _SetIndexPrivate  SetIndexPrivate;
+
+struct _SetIndex {
+    GObject                 parent;
+    SetIndexPrivate         *priv;
+};
+
+struct _SetIndexClass {
+    GObjectClass    parent_class;
+};
+
+GType           set_index_get_type              ();
+
+SetIndex*       set_index_new                   (const gchar *statements, GList *predicates);
+
+GList*          set_index_get_values            (SetIndex *index, guint generation, GError **error);
+
+#endif
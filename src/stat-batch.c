@@ -0,0 +1,132 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stat-batch.h"
+
+/*
+    Requests of a batch are pushed one by one to a shared pool, so that the latencies of the
+    involved storages overlap. The calling thread waits until all of them have been executed
+*/
+typedef struct {
+    guint               pending;
+    GMutex              lock;
+    GCond               done;
+} StatBatch;
+
+typedef struct {
+    StatRequest         *request;
+    StatBatch           *batch;
+} StatJob;
+
+static void execute_request (StatRequest *request)
+{
+    int res;
+
+    if (request->follow_links)
+        res = stat (request->path, &(request->sbuf));
+    else
+        res = lstat (request->path, &(request->sbuf));
+
+    request->result = (res == -1 ? -errno : 0);
+}
+
+static void execute_job (StatJob *job, gpointer useless)
+{
+    StatBatch *batch;
+
+    batch = job->batch;
+    execute_request (job->request);
+
+    g_mutex_lock (&(batch->lock));
+    batch->pending--;
+    if (batch->pending == 0)
+        g_cond_signal (&(batch->done));
+    g_mutex_unlock (&(batch->lock));
+}
+
+static GThreadPool* get_pool ()
+{
+    static gsize pool = 0;
+    GThreadPool *tmp;
+    GError *error;
+
+    if (g_once_init_enter (&pool)) {
+        error = NULL;
+        tmp = g_thread_pool_new ((GFunc) execute_job, NULL, STAT_BATCH_THREADS, FALSE, &error);
+
+        if (tmp == NULL) {
+            g_warning ("Unable to init stat() thread pool: %s", error->message);
+            g_error_free (error);
+        }
+
+        g_once_init_leave (&pool, (gsize) tmp);
+    }
+
+    return (GThreadPool*) pool;
+}
+
+/**
+ * stat_batch_run:
+ * @requests: array of requests to execute
+ * @n: length of @requests
+ *
+ * Executes the stat() (or lstat(), if follow_links is FALSE) of all the
+ * @requests in parallel, filling their sbuf and result. Returns when all
+ * of them have been executed
+ **/
+void stat_batch_run (StatRequest *requests, guint n)
+{
+    register int i;
+    StatJob *jobs;
+    StatBatch batch;
+    GThreadPool *pool;
+
+    if (n == 0)
+        return;
+
+    pool = NULL;
+    if (n >= STAT_BATCH_MIN_SIZE)
+        pool = get_pool ();
+
+    if (pool == NULL) {
+        for (i = 0; i < n; i++)
+            execute_request (&(requests [i]));
+        return;
+    }
+
+    jobs = g_new (StatJob, n);
+    batch.pending = n;
+    g_mutex_init (&(batch.lock));
+    g_cond_init (&(batch.done));
+
+    for (i = 0; i < n; i++) {
+        jobs [i].request = &(requests [i]);
+        jobs [i].batch = &batch;
+        g_thread_pool_push (pool, &(jobs [i]), NULL);
+    }
+
+    g_mutex_lock (&(batch.lock));
+    while (batch.pending != 0)
+        g_cond_wait (&(batch.done), &(batch.lock));
+    g_mutex_unlock (&(batch.lock));
+
+    g_mutex_clear (&(batch.lock));
+    g_cond_clear (&(batch.done));
+    g_free (jobs);
+}
@@ -0,0 +1,44 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STAT_BATCH_H
+#define STAT_BATCH_H
+
+#include "common.h"
+
+/*
+    Max number of stat() calls executed in parallel
+*/
+#define STAT_BATCH_THREADS              8
+
+/*
+    Batches smaller than this are executed directly by the calling thread
+*/
+#define STAT_BATCH_MIN_SIZE             4
+
+typedef struct {
+    const gchar         *path;
+    gboolean            follow_links;
+    struct stat         sbuf;
+    int                 result;         // 0 or the negative errno
+} StatRequest;
+
+void            stat_batch_run                  (StatRequest *requests, guint n);
+
+#endif
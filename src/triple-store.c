@@ -0,0 +1,2444 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "triple-store.h"
+
+#define TRIPLE_STORE_GET_PRIVATE(obj)      (G_TYPE_INSTANCE_GET_PRIVATE ((obj), TRIPLE_STORE_TYPE, TripleStorePrivate))
+
+#define RDF_TYPE            "http://www.w3.org/1999/02/22-rdf-syntax-ns#type"
+#define RDFS_RANGE          "http://www.w3.org/2000/01/rdf-schema#range"
+#define RDFS_RESOURCE       "http://www.w3.org/2000/01/rdf-schema#Resource"
+#define TRACKER_NAMESPACE   "http://www.tracker-project.org/ontologies/tracker#Namespace"
+#define TRACKER_PREFIX      "http://www.tracker-project.org/ontologies/tracker#prefix"
+#define XSD_PREFIX          "http://www.w3.org/2001/XMLSchema#"
+#define XSD_BOOLEAN         XSD_PREFIX "boolean"
+#define XSD_DOUBLE          XSD_PREFIX "double"
+#define XSD_INTEGER         XSD_PREFIX "integer"
+#define XSD_STRING          XSD_PREFIX "string"
+
+typedef enum {
+    SLOT_ALL,
+    SLOT_SUBJECT,
+    SLOT_PREDICATE,
+    SLOT_OBJECT,
+    SLOT_COUNT
+} SLOT_TYPE;
+
+typedef struct {
+    const gchar         *subject;
+    const gchar         *predicate;
+    const gchar         *object;
+    guint               positions [SLOT_COUNT];     // offset in each list holding the triple
+} Triple;
+
+struct _TripleStorePrivate {
+    GHashTable          *strings;       // every string used in a triple, owned here
+    GHashTable          *prefixes;
+    GPtrArray           *triples;
+    GHashTable          *by_subject;    // stored string -> GPtrArray of Triple
+    GHashTable          *by_predicate;
+    GHashTable          *by_object;
+    GHashTable          *complete;      // predicates fully loaded, NULL if all of them are
+};
+
+/*
+    Namespaces known by Tracker without explicit declaration, so that the same queries may be
+    executed against the store
+*/
+static const gchar *DefaultPrefixes [] = {
+    "rdf",      "http://www.w3.org/1999/02/22-rdf-syntax-ns#",
+    "rdfs",     "http://www.w3.org/2000/01/rdf-schema#",
+    "xsd",      XSD_PREFIX,
+    "tracker",  "http://www.tracker-project.org/ontologies/tracker#",
+    "dc",       "http://purl.org/dc/elements/1.1/",
+    "nrl",      "http://www.semanticdesktop.org/ontologies/2007/08/15/nrl#",
+    "nao",      "http://www.semanticdesktop.org/ontologies/2007/08/15/nao#",
+    "nie",      "http://www.semanticdesktop.org/ontologies/2007/01/19/nie#",
+    "nco",      "http://www.semanticdesktop.org/ontologies/2007/03/22/nco#",
+    "nfo",      "http://www.semanticdesktop.org/ontologies/2007/03/22/nfo#",
+    "nmo",      "http://www.semanticdesktop.org/ontologies/2007/03/22/nmo#",
+    "ncal",     "http://www.semanticdesktop.org/ontologies/2007/04/02/ncal#",
+    "nid3",     "http://www.semanticdesktop.org/ontologies/2007/05/10/nid3#",
+    "nmm",      "http://www.tracker-project.org/temp/nmm#",
+    "mlo",      "http://www.tracker-project.org/temp/mlo#",
+    "mfo",      "http://www.tracker-project.org/temp/mfo#",
+    "scal",     "http://www.tracker-project.org/temp/scal#",
+    "slo",      "http://www.tracker-project.org/ontologies/slo#",
+    "osinfo",   "http://www.tracker-project.org/ontologies/osinfo#",
+    NULL
+};
+
+/*
+    Parsing structures, shared by the Turtle loader and by the SPARQL evaluator
+*/
+
+typedef enum {
+    TOKEN_END,
+    TOKEN_IRI,
+    TOKEN_PNAME,
+    TOKEN_BLANK,
+    TOKEN_VARIABLE,
+    TOKEN_STRING,
+    TOKEN_NUMBER,
+    TOKEN_WORD,
+    TOKEN_DIRECTIVE,
+    TOKEN_PUNCT
+} TOKEN_TYPE;
+
+typedef struct {
+    TripleStore         *store;
+    const gchar         *text;
+    const gchar         *pos;
+    const gchar         *token_start;
+    TOKEN_TYPE          type;
+    gchar               *value;
+    gboolean            in_pattern;     // blank nodes are handled as variables
+    GHashTable          *variables;     // name -> index + 1
+    GPtrArray           *variable_names;
+    GError              *error;
+} Parser;
+
+typedef enum {
+    TERM_VARIABLE,
+    TERM_RESOURCE,
+    TERM_LITERAL,
+    TERM_BLANK
+} TERM_TYPE;
+
+typedef struct {
+    TERM_TYPE           type;
+    gchar               *value;
+    const gchar         *stored;        // the same string held by the store, NULL if unknown
+    const gchar         *datatype;
+    int                 variable;
+} Term;
+
+typedef struct {
+    Term                subject;
+    Term                predicate;
+    Term                object;
+    gboolean            any_resource;   // "?x a rdfs:Resource", true for every subject
+} Pattern;
+
+typedef enum {
+    EXPRESSION_TERM,
+    EXPRESSION_STR,
+    EXPRESSION_BOUND,
+    EXPRESSION_NOT,
+    EXPRESSION_AND,
+    EXPRESSION_OR,
+    EXPRESSION_EQUAL,
+    EXPRESSION_NOT_EQUAL,
+    EXPRESSION_LESS,
+    EXPRESSION_GREATER,
+    EXPRESSION_LESS_EQUAL,
+    EXPRESSION_GREATER_EQUAL
+} EXPRESSION_TYPE;
+
+typedef struct _Expression Expression;
+
+struct _Expression {
+    EXPRESSION_TYPE     type;
+    Term                term;
+    Expression          *left;
+    Expression          *right;
+};
+
+typedef struct {
+    int                 variable;
+    GArray              *terms;
+} ValuesBlock;
+
+typedef struct _Group Group;
+
+struct _Group {
+    GArray              *patterns;
+    GList               *values;
+    GList               *optionals;
+    GList               *filters;
+};
+
+typedef struct {
+    gboolean            distinct;
+    gboolean            all;
+    GArray              *projection;
+    Group               *where;
+    int                 order_variable;
+    gboolean            order_descending;
+    int                 limit;
+    int                 offset;
+} Query;
+
+typedef enum {
+    UPDATE_INSERT,
+    UPDATE_REPLACE,
+    UPDATE_DELETE
+} UPDATE_TYPE;
+
+G_DEFINE_TYPE (TripleStore, triple_store, G_TYPE_OBJECT);
+
+GQuark triple_store_error_quark ()
+{
+    return g_quark_from_static_string ("triple-store-error-quark");
+}
+
+static void triple_store_finalize (GObject *obj)
+{
+    TripleStore *store;
+
+    store = TRIPLE_STORE (obj);
+
+    g_hash_table_destroy (store->priv->by_subject);
+    g_hash_table_destroy (store->priv->by_predicate);
+    g_hash_table_destroy (store->priv->by_object);
+    g_ptr_array_unref (store->priv->triples);
+    g_hash_table_destroy (store->priv->prefixes);
+    g_hash_table_destroy (store->priv->strings);
+
+    if (store->priv->complete != NULL)
+        g_hash_table_destroy (store->priv->complete);
+}
+
+static void triple_store_class_init (TripleStoreClass *klass)
+{
+    GObjectClass *gobject_class;
+
+    g_type_class_add_private (klass, sizeof (TripleStorePrivate));
+
+    gobject_class = G_OBJECT_CLASS (klass);
+    gobject_class->finalize = triple_store_finalize;
+}
+
+static void triple_store_init (TripleStore *store)
+{
+    store->priv = TRIPLE_STORE_GET_PRIVATE (store);
+    memset (store->priv, 0, sizeof (TripleStorePrivate));
+
+    store->priv->strings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    store->priv->prefixes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    store->priv->triples = g_ptr_array_new_with_free_func (g_free);
+    store->priv->by_subject = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) g_ptr_array_unref);
+    store->priv->by_predicate = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) g_ptr_array_unref);
+    store->priv->by_object = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) g_ptr_array_unref);
+}
+
+/*
+    Strings are stored once, and all the triples refer to the same copy: this permits to
+    compare terms just by pointer
+*/
+static const gchar* store_string (TripleStore *store, const gchar *str)
+{
+    gchar *ret;
+
+    ret = g_hash_table_lookup (store->priv->strings, str);
+    if (ret == NULL) {
+        ret = g_strdup (str);
+        g_hash_table_insert (store->priv->strings, ret, ret);
+    }
+
+    return ret;
+}
+
+static const gchar* lookup_string (TripleStore *store, const gchar *str)
+{
+    return g_hash_table_lookup (store->priv->strings, str);
+}
+
+/*
+    Each triple keeps his position in the lists holding it, so that it can be removed
+    without scanning them
+*/
+static void list_add (GPtrArray *list, Triple *triple, SLOT_TYPE slot)
+{
+    triple->positions [slot] = list->len;
+    g_ptr_array_add (list, triple);
+}
+
+static void list_remove (GPtrArray *list, Triple *triple, SLOT_TYPE slot)
+{
+    guint position;
+
+    position = triple->positions [slot];
+    g_ptr_array_remove_index_fast (list, position);
+
+    if (position < list->len)
+        ((Triple*) g_ptr_array_index (list, position))->positions [slot] = position;
+}
+
+static void index_add (GHashTable *index, const gchar *key, Triple *triple, SLOT_TYPE slot)
+{
+    GPtrArray *list;
+
+    list = g_hash_table_lookup (index, key);
+    if (list == NULL) {
+        list = g_ptr_array_new ();
+        g_hash_table_insert (index, (gpointer) key, list);
+    }
+
+    list_add (list, triple, slot);
+}
+
+static void index_remove (GHashTable *index, const gchar *key, Triple *triple, SLOT_TYPE slot)
+{
+    GPtrArray *list;
+
+    list = g_hash_table_lookup (index, key);
+    if (list == NULL)
+        return;
+
+    list_remove (list, triple, slot);
+    if (list->len == 0)
+        g_hash_table_remove (index, key);
+}
+
+static Triple* find_triple (TripleStore *store, const gchar *subject, const gchar *predicate, const gchar *object)
+{
+    register int i;
+    GPtrArray *list;
+    Triple *triple;
+
+    list = g_hash_table_lookup (store->priv->by_subject, subject);
+    if (list == NULL)
+        return NULL;
+
+    for (i = 0; i < list->len; i++) {
+        triple = (Triple*) g_ptr_array_index (list, i);
+        if (triple->predicate == predicate && triple->object == object)
+            return triple;
+    }
+
+    return NULL;
+}
+
+/*
+    All the strings have to be already in the store, as returned by store_string()
+*/
+static void add_triple (TripleStore *store, const gchar *subject, const gchar *predicate, const gchar *object)
+{
+    Triple *triple;
+
+    if (find_triple (store, subject, predicate, object) != NULL)
+        return;
+
+    triple = g_new0 (Triple, 1);
+    triple->subject = subject;
+    triple->predicate = predicate;
+    triple->object = object;
+
+    list_add (store->priv->triples, triple, SLOT_ALL);
+    index_add (store->priv->by_subject, subject, triple, SLOT_SUBJECT);
+    index_add (store->priv->by_predicate, predicate, triple, SLOT_PREDICATE);
+    index_add (store->priv->by_object, object, triple, SLOT_OBJECT);
+}
+
+static void remove_triple (TripleStore *store, Triple *triple)
+{
+    index_remove (store->priv->by_subject, triple->subject, triple, SLOT_SUBJECT);
+    index_remove (store->priv->by_predicate, triple->predicate, triple, SLOT_PREDICATE);
+    index_remove (store->priv->by_object, triple->object, triple, SLOT_OBJECT);
+
+    /*
+        The main list owns the triple, so it is removed at last
+    */
+    list_remove (store->priv->triples, triple, SLOT_ALL);
+}
+
+static void remove_values (TripleStore *store, const gchar *subject, const gchar *predicate)
+{
+    register int i;
+    GPtrArray *list;
+    GPtrArray *found;
+    Triple *triple;
+
+    list = g_hash_table_lookup (store->priv->by_subject, subject);
+    if (list == NULL)
+        return;
+
+    found = g_ptr_array_new ();
+
+    for (i = 0; i < list->len; i++) {
+        triple = (Triple*) g_ptr_array_index (list, i);
+        if (triple->predicate == predicate)
+            g_ptr_array_add (found, triple);
+    }
+
+    for (i = 0; i < found->len; i++)
+        remove_triple (store, (Triple*) g_ptr_array_index (found, i));
+
+    g_ptr_array_free (found, TRUE);
+}
+
+static gchar* expand_name (TripleStore *store, const gchar *name)
+{
+    gchar *prefix;
+    const gchar *colon;
+    const gchar *uri;
+
+    colon = strchr (name, ':');
+    if (colon == NULL)
+        return NULL;
+
+    prefix = g_strndup (name, colon - name);
+    uri = g_hash_table_lookup (store->priv->prefixes, prefix);
+    g_free (prefix);
+
+    if (uri == NULL)
+        return NULL;
+
+    return g_strconcat (uri, colon + 1, NULL);
+}
+
+static gchar* generate_blank_uri ()
+{
+    return g_strdup_printf ("urn:uuid:%08x-%04x-%04x-%04x-%04x%08x",
+                            g_random_int (), g_random_int_range (0, 0x10000),
+                            0x4000 | g_random_int_range (0, 0x1000), 0x8000 | g_random_int_range (0, 0x4000),
+                            g_random_int_range (0, 0x10000), g_random_int ());
+}
+
+/*
+    Tokenizer
+*/
+
+static void parser_fail (Parser *p, const gchar *message)
+{
+    int line;
+    const gchar *iter;
+
+    if (p->error != NULL)
+        return;
+
+    line = 1;
+    for (iter = p->text; iter < p->token_start; iter++)
+        if (*iter == '\n')
+            line++;
+
+    p->error = g_error_new (TRIPLE_STORE_ERROR, TRIPLE_STORE_ERROR_PARSE, "%s at line %d, near '%.20s'", message, line, p->token_start);
+}
+
+static inline gboolean is_name_char (gchar c)
+{
+    return (g_ascii_isalnum (c) || c == '_' || c == '-');
+}
+
+static const gchar* scan_string (Parser *p, const gchar *start, GString *str)
+{
+    int len;
+    int digits;
+    gchar quote;
+    gchar *hex;
+    gboolean long_string;
+    const gchar *iter;
+
+    quote = *start;
+    long_string = (start [1] == quote && start [2] == quote);
+    iter = start + (long_string ? 3 : 1);
+
+    while (TRUE) {
+        if (*iter == '\0') {
+            parser_fail (p, "Unterminated string");
+            return iter;
+        }
+
+        if (long_string == TRUE) {
+            if (iter [0] == quote && iter [1] == quote && iter [2] == quote)
+                return iter + 3;
+        }
+        else if (*iter == quote) {
+            return iter + 1;
+        }
+
+        if (*iter == '\\' && iter [1] != '\0') {
+            iter++;
+
+            switch (*iter) {
+                case 'n':
+                    g_string_append_c (str, '\n');
+                    break;
+                case 't':
+                    g_string_append_c (str, '\t');
+                    break;
+                case 'r':
+                    g_string_append_c (str, '\r');
+                    break;
+                case 'b':
+                    g_string_append_c (str, '\b');
+                    break;
+                case 'f':
+                    g_string_append_c (str, '\f');
+                    break;
+                case 'u':
+                case 'U':
+                    len = (*iter == 'u') ? 4 : 8;
+                    for (digits = 0; digits < len && g_ascii_isxdigit (iter [digits + 1]); digits++);
+
+                    hex = g_strndup (iter + 1, digits);
+                    g_string_append_unichar (str, (gunichar) strtoul (hex, NULL, 16));
+                    g_free (hex);
+                    iter += digits;
+                    break;
+                default:
+                    g_string_append_c (str, *iter);
+                    break;
+            }
+
+            iter++;
+        }
+        else {
+            g_string_append_c (str, *iter);
+            iter++;
+        }
+    }
+}
+
+static void next_token (Parser *p)
+{
+    const gchar *start;
+    const gchar *iter;
+    GString *str;
+
+    g_free (p->value);
+    p->value = NULL;
+
+    while (TRUE) {
+        while (g_ascii_isspace (*(p->pos)))
+            p->pos++;
+
+        if (*(p->pos) != '#')
+            break;
+
+        while (*(p->pos) != '\0' && *(p->pos) != '\n')
+            p->pos++;
+    }
+
+    start = p->pos;
+    p->token_start = start;
+    p->type = TOKEN_PUNCT;
+
+    if (*start == '\0') {
+        p->type = TOKEN_END;
+        return;
+    }
+
+    /*
+        '<' is both the opening of an IRI and an operator: IRIs never contain whitespaces
+    */
+    if (*start == '<') {
+        for (iter = start + 1; *iter != '\0' && *iter != '>' && *iter != '<' && *iter != '"' &&
+                               *iter != '{' && *iter != '}' && g_ascii_isspace (*iter) == FALSE; iter++);
+
+        if (*iter == '>' && iter != start + 1) {
+            p->type = TOKEN_IRI;
+            p->value = g_strndup (start + 1, iter - start - 1);
+            p->pos = iter + 1;
+            return;
+        }
+    }
+
+    if (*start == '"' || *start == '\'') {
+        str = g_string_new ("");
+        p->pos = scan_string (p, start, str);
+        p->type = TOKEN_STRING;
+        p->value = g_string_free (str, FALSE);
+        return;
+    }
+
+    if ((*start == '?' || *start == '$') && is_name_char (start [1])) {
+        for (iter = start + 1; is_name_char (*iter); iter++);
+        p->type = TOKEN_VARIABLE;
+        p->value = g_strndup (start + 1, iter - start - 1);
+        p->pos = iter;
+        return;
+    }
+
+    if (start [0] == '_' && start [1] == ':') {
+        for (iter = start + 2; is_name_char (*iter) || *iter == '.'; iter++);
+        while (iter > start + 2 && *(iter - 1) == '.')
+            iter--;
+
+        p->type = TOKEN_BLANK;
+        p->value = g_strndup (start, iter - start);
+        p->pos = iter;
+        return;
+    }
+
+    if (*start == '@' && g_ascii_isalpha (start [1])) {
+        for (iter = start + 1; is_name_char (*iter); iter++);
+        p->type = TOKEN_DIRECTIVE;
+        p->value = g_strndup (start + 1, iter - start - 1);
+        p->pos = iter;
+        return;
+    }
+
+    if (g_ascii_isdigit (*start) || ((*start == '-' || *start == '+') && g_ascii_isdigit (start [1]))) {
+        for (iter = start + 1; g_ascii_isdigit (*iter); iter++);
+
+        if (*iter == '.' && g_ascii_isdigit (iter [1]))
+            for (iter++; g_ascii_isdigit (*iter); iter++);
+
+        if ((*iter == 'e' || *iter == 'E') &&
+                (g_ascii_isdigit (iter [1]) || ((iter [1] == '-' || iter [1] == '+') && g_ascii_isdigit (iter [2]))))
+            for (iter += 2; g_ascii_isdigit (*iter); iter++);
+
+        p->type = TOKEN_NUMBER;
+        p->value = g_strndup (start, iter - start);
+        p->pos = iter;
+        return;
+    }
+
+    if (g_ascii_isalpha (*start) || *start == ':') {
+        for (iter = start; is_name_char (*iter); iter++);
+
+        if (*iter == ':') {
+            for (iter++; is_name_char (*iter) || *iter == '.' || *iter == '%'; iter++);
+            while (*(iter - 1) == '.')
+                iter--;
+
+            p->type = TOKEN_PNAME;
+        }
+        else {
+            p->type = TOKEN_WORD;
+        }
+
+        p->value = g_strndup (start, iter - start);
+        p->pos = iter;
+        return;
+    }
+
+    if (strncmp (start, "!=", 2) == 0 || strncmp (start, "<=", 2) == 0 || strncmp (start, ">=", 2) == 0 ||
+            strncmp (start, "&&", 2) == 0 || strncmp (start, "||", 2) == 0 || strncmp (start, "^^", 2) == 0) {
+        p->value = g_strndup (start, 2);
+        p->pos = start + 2;
+    }
+    else {
+        p->value = g_strndup (start, 1);
+        p->pos = start + 1;
+    }
+}
+
+static void parser_init (Parser *p, TripleStore *store, const gchar *text)
+{
+    memset (p, 0, sizeof (Parser));
+    p->store = store;
+    p->text = text;
+    p->pos = text;
+    p->variables = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    p->variable_names = g_ptr_array_new ();
+    next_token (p);
+}
+
+static void parser_reset_variables (Parser *p)
+{
+    g_ptr_array_set_size (p->variable_names, 0);
+    g_hash_table_remove_all (p->variables);
+}
+
+static void parser_clear (Parser *p)
+{
+    g_free (p->value);
+    g_ptr_array_free (p->variable_names, TRUE);
+    g_hash_table_destroy (p->variables);
+
+    if (p->error != NULL)
+        g_error_free (p->error);
+}
+
+static int parser_variable (Parser *p, const gchar *name)
+{
+    gchar *key;
+    gpointer index;
+
+    index = g_hash_table_lookup (p->variables, name);
+    if (index != NULL)
+        return GPOINTER_TO_INT (index) - 1;
+
+    key = g_strdup (name);
+    g_ptr_array_add (p->variable_names, key);
+    g_hash_table_insert (p->variables, key, GINT_TO_POINTER (p->variable_names->len));
+    return p->variable_names->len - 1;
+}
+
+static inline int parser_variables_count (Parser *p)
+{
+    return MAX (p->variable_names->len, 1);
+}
+
+static inline gboolean is_punct (Parser *p, const gchar *punct)
+{
+    return (p->type == TOKEN_PUNCT && strcmp (p->value, punct) == 0);
+}
+
+static inline gboolean is_word (Parser *p, const gchar *word)
+{
+    return (p->type == TOKEN_WORD && g_ascii_strcasecmp (p->value, word) == 0);
+}
+
+static gboolean expect (Parser *p, const gchar *punct)
+{
+    gchar *message;
+
+    if (is_punct (p, punct) == FALSE) {
+        message = g_strdup_printf ("Expected '%s'", punct);
+        parser_fail (p, message);
+        g_free (message);
+        return FALSE;
+    }
+
+    next_token (p);
+    return TRUE;
+}
+
+/*
+    Terms and patterns
+*/
+
+static void term_clear (Term *term)
+{
+    g_free (term->value);
+    term->value = NULL;
+}
+
+static Term term_copy (Term *term)
+{
+    Term ret;
+
+    ret = *term;
+    ret.value = g_strdup (term->value);
+    return ret;
+}
+
+static gboolean parse_term (Parser *p, Term *term)
+{
+    gchar *datatype;
+
+    memset (term, 0, sizeof (Term));
+    term->variable = -1;
+
+    switch (p->type) {
+        case TOKEN_VARIABLE:
+            term->type = TERM_VARIABLE;
+            term->value = g_strdup (p->value);
+            term->variable = parser_variable (p, p->value);
+            break;
+
+        case TOKEN_IRI:
+            term->type = TERM_RESOURCE;
+            term->value = g_strdup (p->value);
+            break;
+
+        case TOKEN_PNAME:
+            term->type = TERM_RESOURCE;
+            term->value = expand_name (p->store, p->value);
+
+            if (term->value == NULL) {
+                parser_fail (p, "Unknown prefix");
+                return FALSE;
+            }
+
+            break;
+
+        case TOKEN_BLANK:
+            term->value = g_strdup (p->value);
+
+            if (p->in_pattern == TRUE) {
+                term->type = TERM_VARIABLE;
+                term->variable = parser_variable (p, p->value);
+            }
+            else {
+                term->type = TERM_BLANK;
+            }
+
+            break;
+
+        case TOKEN_STRING:
+            term->type = TERM_LITERAL;
+            term->value = g_strdup (p->value);
+            term->datatype = XSD_STRING;
+            next_token (p);
+
+            if (p->type == TOKEN_DIRECTIVE) {
+                next_token (p);
+            }
+            else if (is_punct (p, "^^")) {
+                next_token (p);
+
+                if (p->type == TOKEN_IRI)
+                    datatype = g_strdup (p->value);
+                else if (p->type == TOKEN_PNAME)
+                    datatype = expand_name (p->store, p->value);
+                else
+                    datatype = NULL;
+
+                if (datatype == NULL) {
+                    parser_fail (p, "Invalid datatype");
+                    term_clear (term);
+                    return FALSE;
+                }
+
+                term->datatype = store_string (p->store, datatype);
+                g_free (datatype);
+                next_token (p);
+            }
+
+            term->stored = lookup_string (p->store, term->value);
+            return TRUE;
+
+        case TOKEN_NUMBER:
+            term->type = TERM_LITERAL;
+            term->value = g_strdup (p->value);
+            term->datatype = strpbrk (p->value, ".eE") != NULL ? XSD_DOUBLE : XSD_INTEGER;
+            break;
+
+        case TOKEN_WORD:
+            if (strcmp (p->value, "a") == 0) {
+                term->type = TERM_RESOURCE;
+                term->value = g_strdup (RDF_TYPE);
+            }
+            else if (strcmp (p->value, "true") == 0 || strcmp (p->value, "false") == 0) {
+                term->type = TERM_LITERAL;
+                term->value = g_strdup (p->value);
+                term->datatype = XSD_BOOLEAN;
+            }
+            else {
+                parser_fail (p, "Unexpected word");
+                return FALSE;
+            }
+
+            break;
+
+        default:
+            parser_fail (p, "Unexpected token");
+            return FALSE;
+    }
+
+    if (term->type != TERM_VARIABLE)
+        term->stored = lookup_string (p->store, term->value);
+
+    next_token (p);
+    return TRUE;
+}
+
+static void pattern_clear (Pattern *pattern)
+{
+    term_clear (&(pattern->subject));
+    term_clear (&(pattern->predicate));
+    term_clear (&(pattern->object));
+}
+
+static GArray* new_patterns ()
+{
+    GArray *ret;
+
+    ret = g_array_new (FALSE, TRUE, sizeof (Pattern));
+    g_array_set_clear_func (ret, (GDestroyNotify) pattern_clear);
+    return ret;
+}
+
+/*
+    Parses a subject followed by any number of predicates and objects, separated by ';' and ','
+*/
+static gboolean parse_triples (Parser *p, GArray *patterns)
+{
+    Term subject;
+    Term predicate;
+    Pattern pattern;
+
+    if (parse_term (p, &subject) == FALSE)
+        return FALSE;
+
+    while (TRUE) {
+        if (parse_term (p, &predicate) == FALSE) {
+            term_clear (&subject);
+            return FALSE;
+        }
+
+        while (TRUE) {
+            if (parse_term (p, &(pattern.object)) == FALSE) {
+                term_clear (&subject);
+                term_clear (&predicate);
+                return FALSE;
+            }
+
+            pattern.subject = term_copy (&subject);
+            pattern.predicate = term_copy (&predicate);
+            pattern.any_resource = (pattern.predicate.type == TERM_RESOURCE && strcmp (pattern.predicate.value, RDF_TYPE) == 0 &&
+                                    pattern.object.type == TERM_RESOURCE && strcmp (pattern.object.value, RDFS_RESOURCE) == 0);
+            g_array_append_val (patterns, pattern);
+
+            if (is_punct (p, ",") == FALSE)
+                break;
+
+            next_token (p);
+        }
+
+        term_clear (&predicate);
+
+        if (is_punct (p, ";") == FALSE)
+            break;
+
+        next_token (p);
+
+        if (is_punct (p, ".") || is_punct (p, "}") || p->type == TOKEN_END)
+            break;
+    }
+
+    term_clear (&subject);
+    return TRUE;
+}
+
+/*
+    Expressions
+*/
+
+static void free_expression (Expression *expression)
+{
+    if (expression == NULL)
+        return;
+
+    term_clear (&(expression->term));
+    free_expression (expression->left);
+    free_expression (expression->right);
+    g_free (expression);
+}
+
+static Expression* new_expression (EXPRESSION_TYPE type, Expression *left, Expression *right)
+{
+    Expression *ret;
+
+    ret = g_new0 (Expression, 1);
+    ret->type = type;
+    ret->left = left;
+    ret->right = right;
+    return ret;
+}
+
+static Expression* parse_expression (Parser *p);
+
+static Expression* parse_primary (Parser *p)
+{
+    EXPRESSION_TYPE type;
+    Expression *ret;
+
+    if (is_punct (p, "(")) {
+        next_token (p);
+        ret = parse_expression (p);
+
+        if (ret != NULL && expect (p, ")") == FALSE) {
+            free_expression (ret);
+            ret = NULL;
+        }
+
+        return ret;
+    }
+
+    if (is_punct (p, "!")) {
+        next_token (p);
+        ret = parse_primary (p);
+        return ret != NULL ? new_expression (EXPRESSION_NOT, ret, NULL) : NULL;
+    }
+
+    if (is_word (p, "str") || is_word (p, "bound")) {
+        type = is_word (p, "str") ? EXPRESSION_STR : EXPRESSION_BOUND;
+        next_token (p);
+
+        if (is_punct (p, "(") == FALSE) {
+            parser_fail (p, "Expected '('");
+            return NULL;
+        }
+
+        ret = parse_primary (p);
+        return ret != NULL ? new_expression (type, ret, NULL) : NULL;
+    }
+
+    ret = new_expression (EXPRESSION_TERM, NULL, NULL);
+
+    if (parse_term (p, &(ret->term)) == FALSE) {
+        free_expression (ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+static Expression* parse_relational (Parser *p)
+{
+    register int i;
+    Expression *left;
+    Expression *right;
+    static const struct {
+        const gchar     *op;
+        EXPRESSION_TYPE type;
+    } operators [] = {
+        { "=",  EXPRESSION_EQUAL },
+        { "!=", EXPRESSION_NOT_EQUAL },
+        { "<",  EXPRESSION_LESS },
+        { ">",  EXPRESSION_GREATER },
+        { "<=", EXPRESSION_LESS_EQUAL },
+        { ">=", EXPRESSION_GREATER_EQUAL },
+        { NULL, 0 }
+    };
+
+    left = parse_primary (p);
+    if (left == NULL)
+        return NULL;
+
+    for (i = 0; operators [i].op != NULL; i++) {
+        if (is_punct (p, operators [i].op)) {
+            next_token (p);
+            right = parse_primary (p);
+
+            if (right == NULL) {
+                free_expression (left);
+                return NULL;
+            }
+
+            return new_expression (operators [i].type, left, right);
+        }
+    }
+
+    return left;
+}
+
+static Expression* parse_conjunction (Parser *p)
+{
+    Expression *left;
+    Expression *right;
+
+    left = parse_relational (p);
+
+    while (left != NULL && is_punct (p, "&&")) {
+        next_token (p);
+        right = parse_relational (p);
+
+        if (right == NULL) {
+            free_expression (left);
+            return NULL;
+        }
+
+        left = new_expression (EXPRESSION_AND, left, right);
+    }
+
+    return left;
+}
+
+static Expression* parse_expression (Parser *p)
+{
+    Expression *left;
+    Expression *right;
+
+    left = parse_conjunction (p);
+
+    while (left != NULL && is_punct (p, "||")) {
+        next_token (p);
+        right = parse_conjunction (p);
+
+        if (right == NULL) {
+            free_expression (left);
+            return NULL;
+        }
+
+        left = new_expression (EXPRESSION_OR, left, right);
+    }
+
+    return left;
+}
+
+/*
+    Groups
+*/
+
+static void free_values_block (ValuesBlock *block)
+{
+    g_array_free (block->terms, TRUE);
+    g_free (block);
+}
+
+static void free_group (Group *group)
+{
+    if (group == NULL)
+        return;
+
+    g_array_free (group->patterns, TRUE);
+    g_list_free_full (group->values, (GDestroyNotify) free_values_block);
+    g_list_free_full (group->optionals, (GDestroyNotify) free_group);
+    g_list_free_full (group->filters, (GDestroyNotify) free_expression);
+    g_free (group);
+}
+
+static ValuesBlock* parse_values (Parser *p)
+{
+    Term term;
+    ValuesBlock *ret;
+
+    next_token (p);
+
+    if (p->type != TOKEN_VARIABLE) {
+        parser_fail (p, "Only VALUES on a single variable are supported");
+        return NULL;
+    }
+
+    ret = g_new0 (ValuesBlock, 1);
+    ret->variable = parser_variable (p, p->value);
+    ret->terms = g_array_new (FALSE, TRUE, sizeof (Term));
+    g_array_set_clear_func (ret->terms, (GDestroyNotify) term_clear);
+    next_token (p);
+
+    if (expect (p, "{") == TRUE) {
+        while (p->error == NULL && is_punct (p, "}") == FALSE) {
+            if (parse_term (p, &term) == TRUE)
+                g_array_append_val (ret->terms, term);
+        }
+
+        next_token (p);
+    }
+
+    if (p->error != NULL) {
+        free_values_block (ret);
+        ret = NULL;
+    }
+
+    return ret;
+}
+
+static Group* parse_group (Parser *p)
+{
+    Group *ret;
+    Group *optional;
+    Expression *filter;
+    ValuesBlock *values;
+
+    if (expect (p, "{") == FALSE)
+        return NULL;
+
+    ret = g_new0 (Group, 1);
+    ret->patterns = new_patterns ();
+
+    while (p->error == NULL && is_punct (p, "}") == FALSE) {
+        if (p->type == TOKEN_END) {
+            parser_fail (p, "Unterminated group");
+        }
+        else if (is_punct (p, ".")) {
+            next_token (p);
+        }
+        else if (is_word (p, "FILTER")) {
+            next_token (p);
+            filter = parse_primary (p);
+            if (filter != NULL)
+                ret->filters = g_list_append (ret->filters, filter);
+        }
+        else if (is_word (p, "OPTIONAL")) {
+            next_token (p);
+            optional = parse_group (p);
+            if (optional != NULL)
+                ret->optionals = g_list_append (ret->optionals, optional);
+        }
+        else if (is_word (p, "VALUES")) {
+            values = parse_values (p);
+            if (values != NULL)
+                ret->values = g_list_append (ret->values, values);
+        }
+        else {
+            parse_triples (p, ret->patterns);
+        }
+    }
+
+    if (p->error != NULL) {
+        free_group (ret);
+        return NULL;
+    }
+
+    next_token (p);
+    return ret;
+}
+
+static void free_query (Query *query)
+{
+    g_array_free (query->projection, TRUE);
+    free_group (query->where);
+    g_free (query);
+}
+
+static Query* parse_query (Parser *p)
+{
+    int var;
+    Query *ret;
+
+    if (is_word (p, "SELECT") == FALSE) {
+        parser_fail (p, "Only SELECT queries are supported");
+        return NULL;
+    }
+
+    ret = g_new0 (Query, 1);
+    ret->projection = g_array_new (FALSE, FALSE, sizeof (int));
+    ret->order_variable = -1;
+    ret->limit = -1;
+    next_token (p);
+
+    if (is_word (p, "DISTINCT")) {
+        ret->distinct = TRUE;
+        next_token (p);
+    }
+
+    while (p->error == NULL) {
+        if (is_punct (p, "*")) {
+            ret->all = TRUE;
+            next_token (p);
+        }
+        else if (p->type == TOKEN_VARIABLE) {
+            var = parser_variable (p, p->value);
+            g_array_append_val (ret->projection, var);
+            next_token (p);
+        }
+        else if (is_punct (p, "(")) {
+            next_token (p);
+
+            if (p->type != TOKEN_VARIABLE) {
+                parser_fail (p, "Only variables are supported in projection");
+                break;
+            }
+
+            var = parser_variable (p, p->value);
+            g_array_append_val (ret->projection, var);
+            next_token (p);
+            expect (p, ")");
+        }
+        else {
+            break;
+        }
+    }
+
+    if (p->error == NULL && ret->all == FALSE && ret->projection->len == 0)
+        parser_fail (p, "Empty projection");
+
+    if (p->error == NULL) {
+        if (is_word (p, "WHERE"))
+            next_token (p);
+
+        p->in_pattern = TRUE;
+        ret->where = parse_group (p);
+        p->in_pattern = FALSE;
+    }
+
+    while (p->error == NULL && p->type != TOKEN_END) {
+        if (is_word (p, "ORDER")) {
+            next_token (p);
+            if (is_word (p, "BY"))
+                next_token (p);
+
+            if (is_word (p, "ASC") || is_word (p, "DESC")) {
+                ret->order_descending = is_word (p, "DESC");
+                next_token (p);
+                expect (p, "(");
+            }
+
+            if (p->type != TOKEN_VARIABLE) {
+                parser_fail (p, "Only ordering by a variable is supported");
+                break;
+            }
+
+            ret->order_variable = parser_variable (p, p->value);
+            next_token (p);
+
+            if (is_punct (p, ")"))
+                next_token (p);
+        }
+        else if (is_word (p, "LIMIT") || is_word (p, "OFFSET")) {
+            var = is_word (p, "LIMIT");
+            next_token (p);
+
+            if (p->type != TOKEN_NUMBER) {
+                parser_fail (p, "Expected a number");
+                break;
+            }
+
+            if (var)
+                ret->limit = atoi (p->value);
+            else
+                ret->offset = atoi (p->value);
+
+            next_token (p);
+        }
+        else {
+            parser_fail (p, "Unexpected token after query");
+        }
+    }
+
+    if (p->error != NULL) {
+        free_query (ret);
+        return NULL;
+    }
+
+    /*
+        Blank nodes in patterns are registered as variables, but are not part of the results
+    */
+    if (ret->all == TRUE)
+        for (var = 0; var < p->variable_names->len; var++)
+            if (strncmp ((gchar*) g_ptr_array_index (p->variable_names, var), "_:", 2) != 0)
+                g_array_append_val (ret->projection, var);
+
+    return ret;
+}
+
+/*
+    Evaluation. A solution is an array of values, one for each variable of the query, with NULL
+    for unbound ones. Values got from the store are compared by pointer
+*/
+
+static const gchar** new_solution (int vars)
+{
+    return g_new0 (const gchar*, vars);
+}
+
+static const gchar** copy_solution (const gchar **solution, int vars)
+{
+    const gchar **ret;
+
+    ret = g_new (const gchar*, vars);
+    memcpy (ret, solution, sizeof (const gchar*) * vars);
+    return ret;
+}
+
+static GPtrArray* initial_solutions (int vars)
+{
+    GPtrArray *ret;
+
+    ret = g_ptr_array_new_with_free_func (g_free);
+    g_ptr_array_add (ret, new_solution (vars));
+    return ret;
+}
+
+static inline const gchar* term_binding (Term *term, const gchar **solution)
+{
+    if (term->type == TERM_VARIABLE)
+        return solution [term->variable];
+    else
+        return term->stored;
+}
+
+static inline gboolean bind_term (Term *term, const gchar *value, const gchar **solution)
+{
+    if (term->type != TERM_VARIABLE)
+        return (term->stored == value);
+
+    if (solution [term->variable] == NULL) {
+        solution [term->variable] = value;
+        return TRUE;
+    }
+
+    return (solution [term->variable] == value);
+}
+
+static void save_bindings (Pattern *pattern, const gchar **solution, const gchar **saved)
+{
+    saved [0] = pattern->subject.type == TERM_VARIABLE ? solution [pattern->subject.variable] : NULL;
+    saved [1] = pattern->predicate.type == TERM_VARIABLE ? solution [pattern->predicate.variable] : NULL;
+    saved [2] = pattern->object.type == TERM_VARIABLE ? solution [pattern->object.variable] : NULL;
+}
+
+static void restore_bindings (Pattern *pattern, const gchar **solution, const gchar **saved)
+{
+    if (pattern->object.type == TERM_VARIABLE)
+        solution [pattern->object.variable] = saved [2];
+    if (pattern->predicate.type == TERM_VARIABLE)
+        solution [pattern->predicate.variable] = saved [1];
+    if (pattern->subject.type == TERM_VARIABLE)
+        solution [pattern->subject.variable] = saved [0];
+}
+
+static int bound_positions (Pattern *pattern, const gchar **solution)
+{
+    int ret;
+
+    ret = 0;
+
+    if (term_binding (&(pattern->subject), solution) != NULL)
+        ret++;
+    if (term_binding (&(pattern->predicate), solution) != NULL)
+        ret++;
+    if (term_binding (&(pattern->object), solution) != NULL)
+        ret++;
+
+    return ret;
+}
+
+static gboolean pattern_is_unmatchable (Pattern *pattern)
+{
+    if (pattern->subject.type != TERM_VARIABLE && pattern->subject.stored == NULL)
+        return TRUE;
+
+    if (pattern->any_resource == TRUE)
+        return FALSE;
+
+    return ((pattern->predicate.type != TERM_VARIABLE && pattern->predicate.stored == NULL) ||
+            (pattern->object.type != TERM_VARIABLE && pattern->object.stored == NULL));
+}
+
+/*
+    Returns the shortest list of triples which may match the pattern, given the terms
+    already bound
+*/
+static GPtrArray* pattern_candidates (TripleStore *store, Pattern *pattern, const gchar **solution)
+{
+    const gchar *value;
+    GPtrArray *list;
+    GPtrArray *ret;
+
+    ret = store->priv->triples;
+
+    value = term_binding (&(pattern->subject), solution);
+    if (value != NULL) {
+        list = g_hash_table_lookup (store->priv->by_subject, value);
+        if (list == NULL)
+            return NULL;
+        if (list->len < ret->len)
+            ret = list;
+    }
+
+    value = term_binding (&(pattern->predicate), solution);
+    if (value != NULL) {
+        list = g_hash_table_lookup (store->priv->by_predicate, value);
+        if (list == NULL)
+            return NULL;
+        if (list->len < ret->len)
+            ret = list;
+    }
+
+    value = term_binding (&(pattern->object), solution);
+    if (value != NULL) {
+        list = g_hash_table_lookup (store->priv->by_object, value);
+        if (list == NULL)
+            return NULL;
+        if (list->len < ret->len)
+            ret = list;
+    }
+
+    return ret;
+}
+
+/*
+    Patterns are joined by nested loops, each time picking the one with the largest number of
+    already bound terms so that the most selective index is used
+*/
+static void match_patterns (TripleStore *store, GArray *patterns, gboolean *done, guint remaining,
+                            const gchar **solution, int vars, GPtrArray *matched)
+{
+    register int i;
+    int best;
+    int best_bound;
+    int bound;
+    const gchar *key;
+    const gchar *saved [3];
+    Pattern *pattern;
+    Triple *triple;
+    GPtrArray *candidates;
+    GHashTableIter iter;
+
+    if (remaining == 0) {
+        g_ptr_array_add (matched, copy_solution (solution, vars));
+        return;
+    }
+
+    best = -1;
+    best_bound = -1;
+
+    for (i = 0; i < patterns->len; i++) {
+        if (done [i] == TRUE)
+            continue;
+
+        bound = bound_positions (&g_array_index (patterns, Pattern, i), solution);
+        if (bound > best_bound) {
+            best = i;
+            best_bound = bound;
+        }
+    }
+
+    pattern = &g_array_index (patterns, Pattern, best);
+    if (pattern_is_unmatchable (pattern) == TRUE)
+        return;
+
+    done [best] = TRUE;
+    save_bindings (pattern, solution, saved);
+
+    if (pattern->any_resource == TRUE) {
+        key = term_binding (&(pattern->subject), solution);
+
+        if (key != NULL) {
+            if (g_hash_table_lookup (store->priv->by_subject, key) != NULL)
+                match_patterns (store, patterns, done, remaining - 1, solution, vars, matched);
+        }
+        else {
+            g_hash_table_iter_init (&iter, store->priv->by_subject);
+
+            while (g_hash_table_iter_next (&iter, (gpointer*) &key, NULL)) {
+                bind_term (&(pattern->subject), key, solution);
+                match_patterns (store, patterns, done, remaining - 1, solution, vars, matched);
+                restore_bindings (pattern, solution, saved);
+            }
+        }
+    }
+    else {
+        candidates = pattern_candidates (store, pattern, solution);
+
+        if (candidates != NULL) {
+            for (i = 0; i < candidates->len; i++) {
+                triple = (Triple*) g_ptr_array_index (candidates, i);
+
+                if (bind_term (&(pattern->subject), triple->subject, solution) &&
+                        bind_term (&(pattern->predicate), triple->predicate, solution) &&
+                        bind_term (&(pattern->object), triple->object, solution))
+                    match_patterns (store, patterns, done, remaining - 1, solution, vars, matched);
+
+                restore_bindings (pattern, solution, saved);
+            }
+        }
+    }
+
+    done [best] = FALSE;
+}
+
+static const gchar* expression_value (Expression *expression, const gchar **solution)
+{
+    switch (expression->type) {
+        case EXPRESSION_TERM:
+            if (expression->term.type == TERM_VARIABLE)
+                return solution [expression->term.variable];
+            else
+                return expression->term.value;
+
+        case EXPRESSION_STR:
+            return expression_value (expression->left, solution);
+
+        default:
+            return NULL;
+    }
+}
+
+/*
+    Values are compared as numbers when both are numeric, as strings otherwise (which is fine
+    also for ISO 8601 dates)
+*/
+static int compare_values (const gchar *first, const gchar *second)
+{
+    gdouble a;
+    gdouble b;
+    gchar *end_first;
+    gchar *end_second;
+
+    a = g_ascii_strtod (first, &end_first);
+    b = g_ascii_strtod (second, &end_second);
+
+    if (end_first != first && *end_first == '\0' && end_second != second && *end_second == '\0')
+        return (a < b) ? -1 : (a > b ? 1 : 0);
+
+    return strcmp (first, second);
+}
+
+static gboolean evaluate_filter (Expression *expression, const gchar **solution)
+{
+    int cmp;
+    const gchar *first;
+    const gchar *second;
+
+    switch (expression->type) {
+        case EXPRESSION_AND:
+            return (evaluate_filter (expression->left, solution) && evaluate_filter (expression->right, solution));
+
+        case EXPRESSION_OR:
+            return (evaluate_filter (expression->left, solution) || evaluate_filter (expression->right, solution));
+
+        case EXPRESSION_NOT:
+            return !evaluate_filter (expression->left, solution);
+
+        case EXPRESSION_BOUND:
+            return (expression_value (expression->left, solution) != NULL);
+
+        case EXPRESSION_TERM:
+        case EXPRESSION_STR:
+            first = expression_value (expression, solution);
+            return (first != NULL && *first != '\0' && strcmp (first, "false") != 0 && strcmp (first, "0") != 0);
+
+        default:
+            break;
+    }
+
+    first = expression_value (expression->left, solution);
+    second = expression_value (expression->right, solution);
+    if (first == NULL || second == NULL)
+        return FALSE;
+
+    cmp = compare_values (first, second);
+
+    switch (expression->type) {
+        case EXPRESSION_EQUAL:
+            return (cmp == 0);
+        case EXPRESSION_NOT_EQUAL:
+            return (cmp != 0);
+        case EXPRESSION_LESS:
+            return (cmp < 0);
+        case EXPRESSION_GREATER:
+            return (cmp > 0);
+        case EXPRESSION_LESS_EQUAL:
+            return (cmp <= 0);
+        case EXPRESSION_GREATER_EQUAL:
+            return (cmp >= 0);
+        default:
+            return FALSE;
+    }
+}
+
+static GPtrArray* join_values (ValuesBlock *block, int vars, GPtrArray *solutions)
+{
+    register int i;
+    register int j;
+    const gchar *value;
+    const gchar **solution;
+    const gchar **copy;
+    GPtrArray *ret;
+    Term *term;
+
+    ret = g_ptr_array_new_with_free_func (g_free);
+
+    for (i = 0; i < solutions->len; i++) {
+        solution = (const gchar**) g_ptr_array_index (solutions, i);
+
+        for (j = 0; j < block->terms->len; j++) {
+            term = &g_array_index (block->terms, Term, j);
+            value = term->stored != NULL ? term->stored : term->value;
+
+            if (solution [block->variable] != NULL && solution [block->variable] != value)
+                continue;
+
+            copy = copy_solution (solution, vars);
+            copy [block->variable] = value;
+            g_ptr_array_add (ret, copy);
+        }
+    }
+
+    g_ptr_array_unref (solutions);
+    return ret;
+}
+
+static GPtrArray* filter_solutions (GList *filters, GPtrArray *solutions)
+{
+    register int i;
+    gboolean keep;
+    const gchar **solution;
+    GList *iter;
+    GPtrArray *ret;
+
+    ret = g_ptr_array_new_with_free_func (g_free);
+    g_ptr_array_set_free_func (solutions, NULL);
+
+    for (i = 0; i < solutions->len; i++) {
+        solution = (const gchar**) g_ptr_array_index (solutions, i);
+        keep = TRUE;
+
+        for (iter = filters; keep == TRUE && iter; iter = g_list_next (iter))
+            keep = evaluate_filter ((Expression*) iter->data, solution);
+
+        if (keep == TRUE)
+            g_ptr_array_add (ret, solution);
+        else
+            g_free (solution);
+    }
+
+    g_ptr_array_unref (solutions);
+    return ret;
+}
+
+static GPtrArray* evaluate_group (TripleStore *store, Group *group, int vars, GPtrArray *solutions);
+
+static GPtrArray* left_join (TripleStore *store, Group *optional, int vars, GPtrArray *solutions)
+{
+    register int i;
+    register int j;
+    const gchar **solution;
+    GPtrArray *ret;
+    GPtrArray *extended;
+
+    ret = g_ptr_array_new_with_free_func (g_free);
+
+    for (i = 0; i < solutions->len; i++) {
+        solution = (const gchar**) g_ptr_array_index (solutions, i);
+
+        extended = g_ptr_array_new_with_free_func (g_free);
+        g_ptr_array_add (extended, copy_solution (solution, vars));
+        extended = evaluate_group (store, optional, vars, extended);
+
+        if (extended->len == 0) {
+            g_ptr_array_add (ret, copy_solution (solution, vars));
+        }
+        else {
+            for (j = 0; j < extended->len; j++)
+                g_ptr_array_add (ret, g_ptr_array_index (extended, j));
+            g_ptr_array_set_free_func (extended, NULL);
+        }
+
+        g_ptr_array_unref (extended);
+    }
+
+    g_ptr_array_unref (solutions);
+    return ret;
+}
+
+/*
+    Takes ownership of @solutions, and returns the ones extended with the bindings required by
+    @group
+*/
+static GPtrArray* evaluate_group (TripleStore *store, Group *group, int vars, GPtrArray *solutions)
+{
+    register int i;
+    gboolean *done;
+    GList *iter;
+    GPtrArray *matched;
+
+    for (iter = group->values; iter; iter = g_list_next (iter))
+        solutions = join_values ((ValuesBlock*) iter->data, vars, solutions);
+
+    if (group->patterns->len != 0) {
+        matched = g_ptr_array_new_with_free_func (g_free);
+        done = g_new0 (gboolean, group->patterns->len);
+
+        for (i = 0; i < solutions->len; i++)
+            match_patterns (store, group->patterns, done, group->patterns->len,
+                            (const gchar**) g_ptr_array_index (solutions, i), vars, matched);
+
+        g_free (done);
+        g_ptr_array_unref (solutions);
+        solutions = matched;
+    }
+
+    for (iter = group->optionals; iter; iter = g_list_next (iter))
+        solutions = left_join (store, (Group*) iter->data, vars, solutions);
+
+    if (group->filters != NULL)
+        solutions = filter_solutions (group->filters, solutions);
+
+    return solutions;
+}
+
+static gint sort_solutions (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    int cmp;
+    const gchar *first;
+    const gchar *second;
+    Query *query;
+
+    query = (Query*) user_data;
+    first = (*(const gchar***) a) [query->order_variable];
+    second = (*(const gchar***) b) [query->order_variable];
+
+    if (first == NULL || second == NULL)
+        cmp = (first == NULL) - (second == NULL);
+    else
+        cmp = compare_values (first, second);
+
+    return query->order_descending ? -cmp : cmp;
+}
+
+static GPtrArray* project_solutions (Query *query, GPtrArray *solutions)
+{
+    register int i;
+    register int j;
+    int skipped;
+    gchar *key;
+    gchar **row;
+    const gchar *value;
+    const gchar **solution;
+    GPtrArray *ret;
+    GHashTable *seen;
+
+    ret = g_ptr_array_new_with_free_func ((GDestroyNotify) g_strfreev);
+    seen = query->distinct ? g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL) : NULL;
+    skipped = 0;
+
+    for (i = 0; i < solutions->len; i++) {
+        if (query->limit >= 0 && ret->len >= query->limit)
+            break;
+
+        solution = (const gchar**) g_ptr_array_index (solutions, i);
+        row = g_new0 (gchar*, query->projection->len + 1);
+
+        for (j = 0; j < query->projection->len; j++) {
+            value = solution [g_array_index (query->projection, int, j)];
+            row [j] = g_strdup (value != NULL ? value : "");
+        }
+
+        if (seen != NULL) {
+            key = g_strjoinv ("\x1f", row);
+
+            if (g_hash_table_lookup (seen, key) != NULL) {
+                g_free (key);
+                g_strfreev (row);
+                continue;
+            }
+
+            g_hash_table_insert (seen, key, GINT_TO_POINTER (1));
+        }
+
+        if (skipped < query->offset) {
+            skipped++;
+            g_strfreev (row);
+            continue;
+        }
+
+        g_ptr_array_add (ret, row);
+    }
+
+    if (seen != NULL)
+        g_hash_table_destroy (seen);
+
+    return ret;
+}
+
+/*
+    In a partial store, a query is executed only if all the values it may match are
+    available
+*/
+static gboolean group_is_complete (TripleStore *store, Group *group)
+{
+    register int i;
+    Pattern *pattern;
+    GList *iter;
+
+    if (store->priv->complete == NULL)
+        return TRUE;
+
+    for (i = 0; i < group->patterns->len; i++) {
+        pattern = &g_array_index (group->patterns, Pattern, i);
+
+        if (pattern->any_resource == TRUE)
+            continue;
+
+        if (pattern->predicate.type == TERM_VARIABLE || pattern->predicate.stored == NULL ||
+                g_hash_table_lookup (store->priv->complete, pattern->predicate.stored) == NULL)
+            return FALSE;
+    }
+
+    for (iter = group->optionals; iter; iter = g_list_next (iter))
+        if (group_is_complete (store, (Group*) iter->data) == FALSE)
+            return FALSE;
+
+    return TRUE;
+}
+
+/*
+    Updates
+*/
+
+static const gchar* instantiate_term (TripleStore *store, Term *term, const gchar **solution, GHashTable *blanks, gboolean create)
+{
+    gchar *uri;
+    const gchar *value;
+
+    switch (term->type) {
+        case TERM_VARIABLE:
+            value = solution [term->variable];
+            if (value == NULL)
+                return NULL;
+            return create ? store_string (store, value) : lookup_string (store, value);
+
+        case TERM_BLANK:
+            value = g_hash_table_lookup (blanks, term->value);
+
+            if (value == NULL && create == TRUE) {
+                uri = generate_blank_uri ();
+                value = store_string (store, uri);
+                g_free (uri);
+                g_hash_table_insert (blanks, g_strdup (term->value), (gpointer) value);
+            }
+
+            return value;
+
+        default:
+            return create ? store_string (store, term->value) : lookup_string (store, term->value);
+    }
+}
+
+/*
+    When the same update has already been executed elsewhere, the URIs assigned there to
+    blank nodes are reused for the same solution
+*/
+static void assign_blanks (TripleStore *store, GHashTable *blanks, GVariant *assigned, int solution)
+{
+    gchar *label;
+    gchar *uri;
+    GVariant *dict;
+    GVariantIter iter;
+
+    if (assigned == NULL || solution >= g_variant_n_children (assigned))
+        return;
+
+    dict = g_variant_get_child_value (assigned, solution);
+    g_variant_iter_init (&iter, dict);
+
+    while (g_variant_iter_next (&iter, "{ss}", &label, &uri)) {
+        g_hash_table_insert (blanks, g_strdup_printf ("_:%s", label), (gpointer) store_string (store, uri));
+        g_free (label);
+        g_free (uri);
+    }
+
+    g_variant_unref (dict);
+}
+
+static gboolean predicate_is_complete (TripleStore *store, const gchar *predicate)
+{
+    return (store->priv->complete == NULL || g_hash_table_lookup (store->priv->complete, predicate) != NULL);
+}
+
+/*
+    Each operation produces an array of solutions, with the URIs assigned to blank nodes,
+    as SparqlUpdateBlank does in Tracker
+*/
+static void execute_operation (TripleStore *store, UPDATE_TYPE type, GArray *template, Group *where, int vars,
+                               GVariant *assigned, GVariantBuilder *results)
+{
+    register int i;
+    register int j;
+    gboolean create;
+    const gchar *label;
+    const gchar *uri;
+    const gchar **solution;
+    const gchar *type_predicate;
+    GArray *triples;
+    GPtrArray *solutions;
+    GHashTable *blanks;
+    GHashTableIter iter;
+    Pattern *pattern;
+    Triple triple;
+    Triple *existing;
+
+    solutions = initial_solutions (vars);
+    if (where != NULL)
+        solutions = evaluate_group (store, where, vars, solutions);
+
+    create = (type != UPDATE_DELETE);
+    type_predicate = lookup_string (store, RDF_TYPE);
+    triples = g_array_new (FALSE, FALSE, sizeof (Triple));
+
+    g_variant_builder_open (results, G_VARIANT_TYPE ("aa{ss}"));
+
+    for (i = 0; i < solutions->len; i++) {
+        solution = (const gchar**) g_ptr_array_index (solutions, i);
+        blanks = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        assign_blanks (store, blanks, assigned, i);
+        g_array_set_size (triples, 0);
+
+        for (j = 0; j < template->len; j++) {
+            pattern = &g_array_index (template, Pattern, j);
+            triple.subject = instantiate_term (store, &(pattern->subject), solution, blanks, create);
+            triple.predicate = instantiate_term (store, &(pattern->predicate), solution, blanks, create);
+            triple.object = instantiate_term (store, &(pattern->object), solution, blanks, create);
+
+            /*
+                In a partial store only values of complete predicates are kept, the
+                others would be anyway never queried
+            */
+            if (triple.subject != NULL && triple.predicate != NULL && triple.object != NULL &&
+                    predicate_is_complete (store, triple.predicate))
+                g_array_append_val (triples, triple);
+        }
+
+        if (type == UPDATE_DELETE) {
+            for (j = 0; j < triples->len; j++) {
+                triple = g_array_index (triples, Triple, j);
+                existing = find_triple (store, triple.subject, triple.predicate, triple.object);
+                if (existing != NULL)
+                    remove_triple (store, existing);
+            }
+        }
+        else {
+            /*
+                Types are never replaced, as they are always multi-valued
+            */
+            if (type == UPDATE_REPLACE) {
+                type_predicate = lookup_string (store, RDF_TYPE);
+
+                for (j = 0; j < triples->len; j++) {
+                    triple = g_array_index (triples, Triple, j);
+                    if (triple.predicate != type_predicate)
+                        remove_values (store, triple.subject, triple.predicate);
+                }
+            }
+
+            for (j = 0; j < triples->len; j++) {
+                triple = g_array_index (triples, Triple, j);
+                add_triple (store, triple.subject, triple.predicate, triple.object);
+            }
+        }
+
+        if (g_hash_table_size (blanks) != 0) {
+            g_variant_builder_open (results, G_VARIANT_TYPE ("a{ss}"));
+            g_hash_table_iter_init (&iter, blanks);
+
+            while (g_hash_table_iter_next (&iter, (gpointer*) &label, (gpointer*) &uri))
+                g_variant_builder_add (results, "{ss}", label + 2, uri);
+
+            g_variant_builder_close (results);
+        }
+
+        g_hash_table_destroy (blanks);
+    }
+
+    g_variant_builder_close (results);
+    g_array_free (triples, TRUE);
+    g_ptr_array_unref (solutions);
+}
+
+static gboolean parse_template (Parser *p, GArray *patterns)
+{
+    if (expect (p, "{") == FALSE)
+        return FALSE;
+
+    while (p->error == NULL && is_punct (p, "}") == FALSE) {
+        if (p->type == TOKEN_END)
+            parser_fail (p, "Unterminated template");
+        else if (is_punct (p, "."))
+            next_token (p);
+        else
+            parse_triples (p, patterns);
+    }
+
+    if (p->error != NULL)
+        return FALSE;
+
+    next_token (p);
+    return TRUE;
+}
+
+/**
+ * triple_store_new:
+ *
+ * Allocates a new empty store, already aware of the namespaces Tracker
+ * provides by default
+ *
+ * Return value: a new #TripleStore
+ **/
+TripleStore* triple_store_new ()
+{
+    register int i;
+    TripleStore *ret;
+
+    ret = g_object_new (TRIPLE_STORE_TYPE, NULL);
+
+    for (i = 0; DefaultPrefixes [i] != NULL; i += 2)
+        triple_store_add_prefix (ret, DefaultPrefixes [i], DefaultPrefixes [i + 1]);
+
+    return ret;
+}
+
+/**
+ * triple_store_add_prefix:
+ * @store: a #TripleStore
+ * @prefix: short name of the namespace
+ * @uri: URI of the namespace
+ *
+ * Registers a namespace to be used in prefixed names. The namespace is also
+ * described within the store as a tracker:Namespace, so that it is found by
+ * the same query used against Tracker
+ **/
+void triple_store_add_prefix (TripleStore *store, const gchar *prefix, const gchar *uri)
+{
+    g_hash_table_insert (store->priv->prefixes, g_strdup (prefix), g_strdup (uri));
+
+    add_triple (store, store_string (store, uri), store_string (store, RDF_TYPE), store_string (store, TRACKER_NAMESPACE));
+    add_triple (store, store_string (store, uri), store_string (store, TRACKER_PREFIX), store_string (store, prefix));
+}
+
+/*
+    Dumps rarely include the ontology: ranges of predicates are guessed from the type of the
+    values found, so that properties are formatted properly in queries
+*/
+static void infer_ranges (TripleStore *store, GHashTable *datatypes)
+{
+    register int i;
+    gboolean found;
+    const gchar *predicate;
+    const gchar *datatype;
+    const gchar *range;
+    GPtrArray *list;
+    GHashTableIter iter;
+
+    range = store_string (store, RDFS_RANGE);
+    g_hash_table_iter_init (&iter, datatypes);
+
+    while (g_hash_table_iter_next (&iter, (gpointer*) &predicate, (gpointer*) &datatype)) {
+        found = FALSE;
+        list = g_hash_table_lookup (store->priv->by_subject, predicate);
+
+        if (list != NULL) {
+            for (i = 0; i < list->len; i++) {
+                if (((Triple*) g_ptr_array_index (list, i))->predicate == range) {
+                    found = TRUE;
+                    break;
+                }
+            }
+        }
+
+        if (found == FALSE)
+            add_triple (store, predicate, range, store_string (store, datatype));
+    }
+}
+
+static gboolean load_directive (Parser *p)
+{
+    gboolean turtle;
+    gchar *prefix;
+
+    turtle = (p->type == TOKEN_DIRECTIVE);
+
+    if (turtle ? strcmp (p->value, "base") == 0 : is_word (p, "BASE")) {
+        next_token (p);
+        if (p->type == TOKEN_IRI)
+            next_token (p);
+    }
+    else {
+        next_token (p);
+
+        if (p->type != TOKEN_PNAME) {
+            parser_fail (p, "Expected a prefix");
+            return FALSE;
+        }
+
+        prefix = g_strndup (p->value, strchr (p->value, ':') - p->value);
+        next_token (p);
+
+        if (p->type != TOKEN_IRI) {
+            parser_fail (p, "Expected a namespace");
+            g_free (prefix);
+            return FALSE;
+        }
+
+        triple_store_add_prefix (p->store, prefix, p->value);
+        g_free (prefix);
+        next_token (p);
+    }
+
+    if (turtle == TRUE)
+        return expect (p, ".");
+    else
+        return TRUE;
+}
+
+/**
+ * triple_store_load_file:
+ * @store: a #TripleStore
+ * @path: path of the file to load
+ * @error: return location for a #GError
+ *
+ * Loads triples from a file in Turtle format, as produced by Tracker's
+ * export tools. Only the subset of the syntax used by dumps is handled:
+ * prefixes, IRIs, prefixed names, labelled blank nodes, literals with
+ * language or datatype, and predicate/object lists
+ *
+ * Return value: TRUE if the whole file has been loaded, FALSE otherwise
+ **/
+gboolean triple_store_load_file (TripleStore *store, const gchar *path, GError **error)
+{
+    register int i;
+    gboolean ret;
+    gchar *contents;
+    const gchar *subject;
+    const gchar *predicate;
+    const gchar *object;
+    GArray *patterns;
+    GHashTable *datatypes;
+    Parser p;
+    Pattern *pattern;
+
+    if (g_file_get_contents (path, &contents, NULL, error) == FALSE)
+        return FALSE;
+
+    parser_init (&p, store, contents);
+    patterns = new_patterns ();
+    datatypes = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    while (p.error == NULL && p.type != TOKEN_END) {
+        if ((p.type == TOKEN_DIRECTIVE && (strcmp (p.value, "prefix") == 0 || strcmp (p.value, "base") == 0)) ||
+                is_word (&p, "PREFIX") || is_word (&p, "BASE")) {
+            load_directive (&p);
+            continue;
+        }
+
+        if (parse_triples (&p, patterns) == FALSE)
+            break;
+
+        for (i = 0; i < patterns->len; i++) {
+            pattern = &g_array_index (patterns, Pattern, i);
+
+            if (pattern->subject.type == TERM_VARIABLE || pattern->predicate.type == TERM_VARIABLE ||
+                    pattern->object.type == TERM_VARIABLE) {
+                parser_fail (&p, "Variables are not allowed in data");
+                break;
+            }
+
+            subject = store_string (store, pattern->subject.value);
+            predicate = store_string (store, pattern->predicate.value);
+            object = store_string (store, pattern->object.value);
+            add_triple (store, subject, predicate, object);
+
+            if (g_hash_table_lookup (datatypes, predicate) == NULL)
+                g_hash_table_insert (datatypes, (gpointer) predicate,
+                                     (gpointer) (pattern->object.type == TERM_LITERAL ? pattern->object.datatype : RDFS_RESOURCE));
+        }
+
+        g_array_set_size (patterns, 0);
+
+        if (p.error == NULL)
+            expect (&p, ".");
+    }
+
+    ret = (p.error == NULL);
+
+    if (ret == TRUE)
+        infer_ranges (store, datatypes);
+    else
+        g_propagate_prefixed_error (error, g_error_copy (p.error), "%s: ", path);
+
+    g_hash_table_destroy (datatypes);
+    g_array_free (patterns, TRUE);
+    parser_clear (&p);
+    g_free (contents);
+    return ret;
+}
+
+/**
+ * triple_store_insert:
+ * @store: a #TripleStore
+ * @subject: URI of the subject
+ * @predicate: URI of the predicate
+ * @object: URI or literal value of the object
+ *
+ * Adds a single triple to the store, if not already existing
+ **/
+void triple_store_insert (TripleStore *store, const gchar *subject, const gchar *predicate, const gchar *object)
+{
+    add_triple (store, store_string (store, subject), store_string (store, predicate), store_string (store, object));
+}
+
+/**
+ * triple_store_size:
+ * @store: a #TripleStore
+ *
+ * Return value: number of triples in @store
+ **/
+guint triple_store_size (TripleStore *store)
+{
+    return store->priv->triples->len;
+}
+
+/**
+ * triple_store_mark_complete:
+ * @store: a #TripleStore
+ * @predicate: URI of a predicate
+ *
+ * Declares all the values for @predicate have been loaded in the store. Once
+ * a predicate has been marked, the store is considered partial: queries
+ * involving other predicates fail with %TRIPLE_STORE_ERROR_INCOMPLETE, and
+ * updates ignore their values
+ **/
+void triple_store_mark_complete (TripleStore *store, const gchar *predicate)
+{
+    const gchar *stored;
+
+    if (store->priv->complete == NULL)
+        store->priv->complete = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    stored = store_string (store, predicate);
+    g_hash_table_insert (store->priv->complete, (gpointer) stored, (gpointer) stored);
+}
+
+/**
+ * triple_store_remove_subject:
+ * @store: a #TripleStore
+ * @subject: URI of the subject
+ *
+ * Removes all the triples having @subject as subject
+ **/
+void triple_store_remove_subject (TripleStore *store, const gchar *subject)
+{
+    const gchar *stored;
+    GPtrArray *list;
+
+    stored = lookup_string (store, subject);
+    if (stored == NULL)
+        return;
+
+    /*
+        The list itself is destroyed when the last triple is removed
+    */
+    while ((list = g_hash_table_lookup (store->priv->by_subject, stored)) != NULL)
+        remove_triple (store, (Triple*) g_ptr_array_index (list, list->len - 1));
+}
+
+/**
+ * triple_store_query:
+ * @store: a #TripleStore
+ * @query: a SPARQL SELECT query
+ * @error: return location for a #GError
+ *
+ * Executes the query against the contents of the store. Supported are basic
+ * graph patterns, FILTER with comparisons, str() and bound(), OPTIONAL,
+ * single variable VALUES, DISTINCT, ORDER BY, LIMIT and OFFSET. As in Tracker
+ * results, unbound values are returned as empty strings
+ *
+ * Return value: an array of NULL-terminated strings vectors, one for each
+ * row, or NULL if the query cannot be executed
+ **/
+GPtrArray* triple_store_query (TripleStore *store, const gchar *query, GError **error)
+{
+    int vars;
+    Parser p;
+    Query *parsed;
+    GPtrArray *solutions;
+    GPtrArray *rows;
+
+    parser_init (&p, store, query);
+    parsed = parse_query (&p);
+
+    if (parsed == NULL) {
+        g_propagate_error (error, p.error);
+        p.error = NULL;
+        parser_clear (&p);
+        return NULL;
+    }
+
+    if (group_is_complete (store, parsed->where) == FALSE) {
+        g_set_error (error, TRIPLE_STORE_ERROR, TRIPLE_STORE_ERROR_INCOMPLETE, "Query involves predicates not loaded in the store");
+        free_query (parsed);
+        parser_clear (&p);
+        return NULL;
+    }
+
+    vars = parser_variables_count (&p);
+    solutions = evaluate_group (store, parsed->where, vars, initial_solutions (vars));
+
+    if (parsed->order_variable >= 0)
+        g_ptr_array_sort_with_data (solutions, sort_solutions, parsed);
+
+    rows = project_solutions (parsed, solutions);
+
+    g_ptr_array_unref (solutions);
+    free_query (parsed);
+    parser_clear (&p);
+    return rows;
+}
+
+/**
+ * triple_store_update:
+ * @store: a #TripleStore
+ * @update: a sequence of SPARQL update operations
+ * @blanks: URIs to assign to blank nodes, as returned by a previous execution
+ * of the same @update, or NULL
+ * @error: return location for a #GError
+ *
+ * Executes INSERT, INSERT OR REPLACE and DELETE operations, optionally with a
+ * WHERE clause, in the order they are found. Operations preceding a failing
+ * one are not reverted
+ *
+ * Return value: a floating #GVariant of type aaa{ss}, with the URIs assigned
+ * to blank nodes by each operation, or NULL on error
+ **/
+GVariant* triple_store_update (TripleStore *store, const gchar *update, GVariant *blanks, GError **error)
+{
+    int operation;
+    UPDATE_TYPE type;
+    GVariant *assigned;
+    GArray *template;
+    Group *where;
+    Parser p;
+    GVariantBuilder results;
+
+    parser_init (&p, store, update);
+    g_variant_builder_init (&results, G_VARIANT_TYPE ("aaa{ss}"));
+    operation = 0;
+
+    while (p.error == NULL && p.type != TOKEN_END) {
+        if (is_punct (&p, ";")) {
+            next_token (&p);
+            continue;
+        }
+
+        if (is_word (&p, "INSERT")) {
+            type = UPDATE_INSERT;
+            next_token (&p);
+
+            if (is_word (&p, "OR")) {
+                next_token (&p);
+
+                if (is_word (&p, "REPLACE") == FALSE) {
+                    parser_fail (&p, "Expected REPLACE");
+                    break;
+                }
+
+                type = UPDATE_REPLACE;
+                next_token (&p);
+            }
+        }
+        else if (is_word (&p, "DELETE")) {
+            type = UPDATE_DELETE;
+            next_token (&p);
+        }
+        else {
+            parser_fail (&p, "Unsupported update operation");
+            break;
+        }
+
+        if (is_word (&p, "DATA"))
+            next_token (&p);
+
+        parser_reset_variables (&p);
+        template = new_patterns ();
+        where = NULL;
+
+        if (parse_template (&p, template) == TRUE && is_word (&p, "WHERE")) {
+            next_token (&p);
+            p.in_pattern = TRUE;
+            where = parse_group (&p);
+            p.in_pattern = FALSE;
+        }
+
+        if (p.error == NULL) {
+            assigned = NULL;
+            if (blanks != NULL && operation < g_variant_n_children (blanks))
+                assigned = g_variant_get_child_value (blanks, operation);
+
+            execute_operation (store, type, template, where, parser_variables_count (&p), assigned, &results);
+
+            if (assigned != NULL)
+                g_variant_unref (assigned);
+        }
+
+        operation++;
+
+        free_group (where);
+        g_array_free (template, TRUE);
+    }
+
+    if (p.error != NULL) {
+        g_variant_builder_clear (&results);
+        g_propagate_error (error, p.error);
+        p.error = NULL;
+        parser_clear (&p);
+        return NULL;
+    }
+
+    parser_clear (&p);
+    return g_variant_builder_end (&results);
+}
@@ -0,0 +1,74 @@
+/*  Copyright (C) 2009 Itsme S.r.L.
+ *  Copyright (C) 2012 Roberto Guido <roberto.guido@linux.it>
+ *
+ *  This file is part of FSter
+ *
+ *  FSter is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRIPLE_STORE_H
+#define TRIPLE_STORE_H
+
+#include "common.h"
+
+#define TRIPLE_STORE_TYPE               (triple_store_get_type ())
+#define TRIPLE_STORE(obj)               (G_TYPE_CHECK_INSTANCE_CAST ((obj),     \
+                                         TRIPLE_STORE_TYPE, TripleStore))
+#define TRIPLE_STORE_CLASS(klass)       (G_TYPE_CHECK_CLASS_CAST ((klass),      \
+                                         TRIPLE_STORE_TYPE,                     \
+                                         TripleStoreClass))
+#define IS_TRIPLE_STORE(obj)            (G_TYPE_CHECK_INSTANCE_TYPE ((obj),     \
+                                         TRIPLE_STORE_TYPE))
+#define IS_TRIPLE_STORE_CLASS(klass)    (G_TYPE_CHECK_CLASS_TYPE ((klass),      \
+                                         TRIPLE_STORE_TYPE))
+#define TRIPLE_STORE_GET_CLASS(obj)     (G_TYPE_INSTANCE_GET_CLASS ((obj),      \
+                                         TRIPLE_STORE_TYPE,                     \
+                                         TripleStoreClass))
+
+#define TRIPLE_STORE_ERROR              (triple_store_error_quark ())
+
+typedef enum {
+    TRIPLE_STORE_ERROR_PARSE,
+    TRIPLE_STORE_ERROR_INCOMPLETE
+} TripleStoreError;
+
+typedef struct _TripleStore         TripleStore;
+typedef struct _TripleStoreClass    TripleStoreClass;
+typedef struct _TripleStorePrivate  TripleStorePrivate;
+
+struct _TripleStore {
+    GObject                 parent;
+    TripleStorePrivate      *priv;
+};
+
+struct _TripleStoreClass {
+    GObjectClass    parent_class;
+};
+
+GType           triple_store_get_type           ();
+GQuark          triple_store_error_quark        ();
+
+TripleStore*    triple_store_new                ();
+
+void            triple_store_add_prefix         (TripleStore *store, const gchar *prefix, const gchar *uri);
+gboolean        triple_store_load_file          (TripleStore *store, const gchar *path, GError **error);
+void            triple_store_insert             (TripleStore *store, const gchar *subject, const gchar *predicate, const gchar *object);
+void            triple_store_remove_subject     (TripleStore *store, const gchar *subject);
+guint           triple_store_size               (TripleStore *store);
+void            triple_store_mark_complete      (TripleStore *store, const gchar *predicate);
+
+GPtrArray*      triple_store_query              (TripleStore *store, const gchar *query, GError **error);
+GVariant*       triple_store_update             (TripleStore *store, const gchar *update, GVariant *blanks, GError **error);
+
+#endif
@@ -18,6 +18,11 @@
  */
 
 #include "utils.h"
+#include "hierarchy.h"
+#include "metadata-backend.h"
+#include "metadata-journal.h"
+#include "operation.h"
+#include "query-stats.h"
 
 void easy_list_free (GList *list)
 {
@@ -57,6 +62,41 @@ gchar* from_glist_to_string (GList *strings, const gchar *separator, gboolean fr
     return g_strdup (ret);
 }
 
+/*
+    Formats a string owned by @arena: all the strings of the same arena are released at once
+    with g_string_chunk_free(), instead of one by one
+*/
+gchar* arena_printf (GStringChunk *arena, const gchar *format, ...)
+{
+    int res;
+    gsize len;
+    gchar buffer [512];
+    gchar *large;
+    gchar *ret;
+    va_list params;
+
+    va_start (params, format);
+    res = vsnprintf (buffer, sizeof (buffer), format, params);
+    va_end (params);
+
+    if (res < 0) {
+        g_warning ("Unable to format string: %s", strerror (errno));
+        return g_string_chunk_insert_len (arena, "", 0);
+    }
+
+    len = res;
+    if (len < sizeof (buffer))
+        return g_string_chunk_insert_len (arena, buffer, len);
+
+    va_start (params, format);
+    large = g_strdup_vprintf (format, params);
+    va_end (params);
+
+    ret = g_string_chunk_insert_len (arena, large, len);
+    g_free (large);
+    return ret;
+}
+
 void check_and_create_folder (gchar *path)
 {
     gboolean ret;
@@ -90,63 +130,191 @@ void create_file (gchar *path)
         g_warning ("Unable to touch new file in %s\n", path);
 }
 
+static MetadataBackend* current_backend (GError **error)
+{
+    MetadataBackend *ret;
+
+    ret = metadata_backend_get_default ();
+    if (ret == NULL)
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED, "No metadata backend available");
+
+    return ret;
+}
+
+static guint response_rows (GVariant *response)
+{
+    guint ret;
+    GVariant *table;
+
+    if (response == NULL || g_variant_n_children (response) == 0)
+        return 0;
+
+    table = g_variant_get_child_value (response, 0);
+    ret = g_variant_n_children (table);
+    g_variant_unref (table);
+    return ret;
+}
+
 GVariant* execute_query (gchar *query, GError **error)
 {
+    gint64 start;
     GVariant *ret;
+    MetadataBackend *backend;
+
+    if (operation_check (error) == FALSE)
+        return NULL;
 
-    ret = g_dbus_connection_call_sync (
-            g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL),
-            "org.freedesktop.Tracker1",
-            "/org/freedesktop/Tracker1/Resources",
-            "org.freedesktop.Tracker1.Resources",
-            "SparqlQuery",
-            g_variant_new ("(s)", query),
-            G_VARIANT_TYPE ("(aas)"),
-            G_DBUS_CALL_FLAGS_NONE,
-            -1,
-            NULL,
-            error);
+    /*
+        Changes still in the journal have to be visible to the following query
+    */
+    metadata_journal_sync ();
+
+    backend = current_backend (error);
+    if (backend == NULL)
+        return NULL;
+
+    start = g_get_monotonic_time ();
+    ret = metadata_backend_query (backend, query, error);
+
+    query_stats_record (query, g_get_monotonic_time () - start, response_rows (ret),
+                        ret != NULL ? g_variant_get_size (ret) : 0, FALSE, ret == NULL);
 
     return ret;
 }
 
 void execute_update (gchar *query, GError **error)
 {
-    GVariant *ret;
+    gint64 start;
+    gboolean done;
+    MetadataBackend *backend;
+
+    backend = current_backend (error);
+    if (backend == NULL)
+        return;
+
+    start = g_get_monotonic_time ();
+    done = metadata_backend_update (backend, query, error);
+    query_stats_record (query, g_get_monotonic_time () - start, 0, 0, FALSE, done == FALSE);
 
-    ret = g_dbus_connection_call_sync (
-            g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL),
-            "org.freedesktop.Tracker1",
-            "/org/freedesktop/Tracker1/Resources",
-            "org.freedesktop.Tracker1.Resources",
-            "SparqlUpdate",
-            g_variant_new ("(s)", query),
-            NULL,
-            G_DBUS_CALL_FLAGS_NONE,
-            -1,
-            NULL,
-            error);
-
-    g_object_unref (ret);
+    if (get_query_cache_reference () != NULL)
+        query_cache_invalidate_all (get_query_cache_reference ());
 }
 
 GVariant* execute_update_blank (gchar *query, GError **error)
 {
+    gint64 start;
     GVariant *ret;
+    MetadataBackend *backend;
 
-    ret = g_dbus_connection_call_sync (
-            g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL),
-            "org.freedesktop.Tracker1",
-            "/org/freedesktop/Tracker1/Resources",
-            "org.freedesktop.Tracker1.Resources",
-            "SparqlUpdateBlank",
-            g_variant_new ("(s)", query),
-            G_VARIANT_TYPE ("(aaa{ss})"),
-            G_DBUS_CALL_FLAGS_NONE,
-            -1,
-            NULL,
-            error);
+    backend = current_backend (error);
+    if (backend == NULL)
+        return NULL;
+
+    start = g_get_monotonic_time ();
+    ret = metadata_backend_update_blank (backend, query, error);
+    query_stats_record (query, g_get_monotonic_time () - start, 0, 0, FALSE, ret == NULL);
+
+    if (get_query_cache_reference () != NULL)
+        query_cache_invalidate_all (get_query_cache_reference ());
 
     return ret;
 }
 
+/*
+    Rows decoded from a reply do not copy the strings, but point into the buffer of the reply
+    itself: each row holds a reference to his own portion of it just before the first column,
+    released with the row
+*/
+static void free_borrowed_row (gchar **row)
+{
+    gpointer *block;
+
+    block = ((gpointer*) row) - 1;
+    g_variant_unref ((GVariant*) block [0]);
+    g_free (block);
+}
+
+GPtrArray* query_rows_from_variant (GVariant *response)
+{
+    gsize len;
+    const gchar **strv;
+    gpointer *block;
+    GPtrArray *rows;
+    GVariant *table;
+    GVariant *row;
+    GVariantIter iter;
+
+    table = g_variant_get_child_value (response, 0);
+    rows = g_ptr_array_sized_new (g_variant_n_children (table));
+    g_ptr_array_set_free_func (rows, (GDestroyNotify) free_borrowed_row);
+    g_variant_iter_init (&iter, table);
+
+    while ((row = g_variant_iter_next_value (&iter)) != NULL) {
+        strv = g_variant_get_strv (row, &len);
+
+        block = g_new (gpointer, len + 2);
+        block [0] = row;
+        memcpy (block + 1, strv, (len + 1) * sizeof (gpointer));
+        g_free (strv);
+
+        g_ptr_array_add (rows, block + 1);
+    }
+
+    g_variant_unref (table);
+    return rows;
+}
+
+/*
+    The opposite of query_rows_from_variant(), to present rows obtained elsewhere as if they
+    were the response to a SparqlQuery call
+*/
+GVariant* query_rows_to_variant (GPtrArray *rows)
+{
+    register int i;
+    GVariantBuilder table;
+
+    g_variant_builder_init (&table, G_VARIANT_TYPE ("aas"));
+
+    for (i = 0; i < rows->len; i++)
+        g_variant_builder_add (&table, "^as", g_ptr_array_index (rows, i));
+
+    return g_variant_ref_sink (g_variant_new ("(@aas)", g_variant_builder_end (&table)));
+}
+
+/*
+    Executes the query and returns the decoded rows, as query_rows_from_variant() does, looking
+    first for the same query in the results cache
+*/
+GPtrArray* execute_query_rows (gchar *query, GError **error)
+{
+    GPtrArray *rows;
+    GVariant *response;
+    QueryCache *cache;
+
+    cache = get_query_cache_reference ();
+
+    if (cache != NULL) {
+        /*
+            Results cached before the pending changes are invalidated once they are applied
+        */
+        metadata_journal_sync ();
+
+        rows = query_cache_lookup (cache, query);
+        if (rows != NULL) {
+            query_stats_record (query, 0, rows->len, 0, TRUE, FALSE);
+            return rows;
+        }
+    }
+
+    response = execute_query (query, error);
+    if (response == NULL)
+        return NULL;
+
+    rows = query_rows_from_variant (response);
+    g_variant_unref (response);
+
+    if (cache != NULL)
+        query_cache_store (cache, query, rows);
+
+    return rows;
+}
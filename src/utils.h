@@ -19,11 +19,20 @@
 
 #include "common.h"
 
+/*
+    Size of the blocks allocated by arenas used to compose queries
+*/
+#define ARENA_CHUNK_SIZE                                    4096
+
 void                easy_list_free                          (GList *list);
 gchar*              from_glist_to_string                    (GList *strings, const gchar *separator, gboolean free_list);
+gchar*              arena_printf                            (GStringChunk *arena, const gchar *format, ...);
 void                check_and_create_folder                 (gchar *path);
 void                create_file                             (gchar *path);
 GVariant*           execute_query                           (gchar *query, GError **error);
 void                execute_update                          (gchar *query, GError **error);
 GVariant*           execute_update_blank                    (gchar *query, GError **error);
 
+GPtrArray*          query_rows_from_variant                 (GVariant *response);
+GVariant*           query_rows_to_variant                   (GPtrArray *rows);
+GPtrArray*          execute_query_rows                      (gchar *query, GError **error);